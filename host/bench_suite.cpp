@@ -0,0 +1,318 @@
+/***
+ * Microbenchmarks of the firmware hot paths, built for the host from the same headers and sources:
+ * Average<T>, the filter bank, the heater model lookups (calc_temperature / calc_voltage), my_pid::next,
+ * CRC-32, the outbound frame encoder (frame_codec.h) and the firmware's inbound parser (receiver::parse_input, on the
+ * ESP-IDF subset in idf/), parameterized by window, payload size and escape density. frame_decode_host measures the
+ * host's decoder (protocol.h) on the same frames, for comparison.
+ * Usage: bench_suite [-j] [-t ms per case] [name filter]
+ * Prints CSV (or JSON lines with -j), one row per case: name, parameter, iterations, ns per operation, MB/s.
+ * New cases go into register_cases(), one add() per parameter set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+#include "average.h"
+#include "filter_bank.h"
+#include "heater_model.h"
+#include "frame_codec.h"
+#include "my_pid.h"
+#include "my_uart.h"
+#include "my_params.h"
+#include "esp_log.h"
+
+// Defined in my_uart.cpp, not exported by my_uart.h: the parser task's loop body
+namespace receiver
+{
+    void parse_input(const uint8_t* data, size_t sz);
+}
+
+struct bench_case
+{
+    std::string name;
+    std::string param;
+    size_t bytes; // per operation, 0 for non-throughput cases
+    std::function<void(size_t)> run; // n operations
+};
+
+static std::vector<bench_case> cases;
+static volatile float sink_f;
+static volatile uint32_t sink_u;
+
+static void add(const std::string& name, const std::string& param, size_t bytes, std::function<void(size_t)> run)
+{
+    cases.push_back({ name, param, bytes, run });
+}
+
+// Deterministic payload where roughly `density` of the bytes need escaping
+static std::vector<uint8_t> payload(size_t size, float density)
+{
+    std::vector<uint8_t> p(size);
+    uint32_t x = 12345;
+    const uint8_t markers[] = { preamble, postamble, escape };
+    for (size_t i = 0; i < size; i++)
+    {
+        x = x * 1664525u + 1013904223u;
+        if ((x >> 8) % 10000 < density * 10000) p[i] = markers[(x >> 4) % 3];
+        else
+        {
+            uint8_t b = static_cast<uint8_t>(x >> 24);
+            p[i] = (b == preamble || b == postamble || b == escape) ? b + 1 : b;
+        }
+    }
+    return p;
+}
+
+// The parser checks each frame's counter against the previous one: frames[k] carries counter k, fed in turn
+static uint8_t parser_wdt = 1;
+
+// CMD_PROFILE_CHUNK frames at offset 0 of the upload register_cases() begins, one per counter value
+static std::shared_ptr<std::vector<std::vector<uint8_t>>> chunk_frames(const std::vector<uint8_t>& data)
+{
+    auto frames = std::make_shared<std::vector<std::vector<uint8_t>>>(256);
+    profile_chunk_header h = { 0, static_cast<uint16_t>(data.size()), ~protocol::crc32_le(~0u, data.data(), data.size()) };
+    std::vector<uint8_t> args(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+    args.insert(args.end(), data.begin(), data.end());
+    for (size_t k = 0; k < frames->size(); k++) protocol::encode_frame((*frames)[k], CMD_PROFILE_CHUNK, args.data(), args.size(), k);
+    return frames;
+}
+
+static uint32_t adc_sample(size_t i)
+{
+    return static_cast<uint32_t>(1000 + (i * 2654435761u >> 22)); // mV-like
+}
+
+static void register_cases()
+{
+    for (uint32_t window : { 8u, 64u, 256u })
+    {
+        std::string w = std::to_string(window);
+        add("average_rolling", w, 0, [window](size_t n) {
+            Average<uint32_t> a(window);
+            float s = 0;
+            for (size_t i = 0; i < n; i++) s += a.rolling(adc_sample(i));
+            sink_f = s;
+        });
+        add("average_stddev", w, 0, [window](size_t n) {
+            Average<uint32_t> a(window);
+            for (uint32_t i = 0; i < window; i++) a.push(adc_sample(i));
+            float s = 0;
+            for (size_t i = 0; i < n; i++) s += a.stddev();
+            sink_f = s;
+        });
+    }
+
+    for (size_t outputs = 1; outputs <= FILTER_MAX_BOXCARS; outputs++)
+    {
+        add("filter_bank_push", std::to_string(outputs) + "_outputs", 0, [outputs](size_t n) {
+            static const uint32_t lengths[FILTER_MAX_BOXCARS] = { 4, 50, 200, 256 };
+            std::vector<uint32_t> store(256);
+            filter_bank<uint32_t> bank(store.data(), 256, outputs);
+            for (size_t k = 0; k < outputs; k++) bank.set_length(k, lengths[k]);
+            float s = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                bank.push(adc_sample(i));
+                s += bank.mean(0);
+            }
+            sink_f = s;
+        });
+    }
+    for (uint32_t window : { 8u, 64u, 256u })
+    {
+        //A runtime window change (CMD_SET_AVERAGING): the new window's sum is taken from the history
+        add("filter_bank_set_length", std::to_string(window), 0, [window](size_t n) {
+            std::vector<uint32_t> store(256);
+            filter_bank<uint32_t> bank(store.data(), 256, 1);
+            for (uint32_t i = 0; i < 256; i++) bank.push(adc_sample(i));
+            for (size_t i = 0; i < n; i++) bank.set_length(0, (i & 1) ? window : window / 2);
+            sink_f = bank.mean(0);
+        });
+    }
+
+    const float rt_temp = 273, rt_res = 10;
+    struct model_case { const char* name; uint8_t kind; float tempco, beta; };
+    for (const model_case& mc : { model_case{ "linear", heater_linear, 0.0025f, 0 },
+        model_case{ "quadratic", heater_quadratic, 3.9083e-3f, -5.775e-7f }, model_case{ "table", heater_table, 0, 0 } })
+    {
+        heater_model_t m = {};
+        m.kind = mc.kind;
+        m.beta = mc.beta;
+        m.temp_max = 1100;
+        m.points = 4;
+        const float temps[] = { 273, 473, 773, 1073 }, ratios[] = { 1, 1.76f, 2.85f, 3.9f };
+        for (size_t i = 0; i < 4; i++)
+        {
+            m.temp[i] = temps[i];
+            m.ratio[i] = ratios[i];
+        }
+        auto lut = std::make_shared<heater_lut_t>();
+        heater_model::prepare(lut.get(), &m, mc.tempco, rt_res, rt_temp);
+        add("heater_temperature", mc.name, 0, [lut](size_t n) {
+            float s = 0;
+            for (size_t i = 0; i < n; i++) s += lut->temperature((0.5f + (i & 1023) * 0.01f) / 0.05f); // V / I
+            sink_f = s;
+        });
+        add("heater_voltage", mc.name, 0, [lut](size_t n) {
+            float s = 0;
+            for (size_t i = 0; i < n; i++) s += sqrtf(0.1f * lut->resistance(300 + (i & 511))); // P * R(setpoint)
+            sink_f = s;
+        });
+        add("heater_prepare", mc.name, 0, [m, mc, rt_res, rt_temp](size_t n) {
+            heater_lut_t l;
+            for (size_t i = 0; i < n; i++) heater_model::prepare(&l, &m, mc.tempco, rt_res, rt_temp);
+            sink_f = l.temp[1];
+        });
+    }
+    // The closed forms the tables replace: linear inverse, quadratic inverse (root of the Callendar-Van Dusen equation)
+    add("heater_temperature", "closed_linear", 0, [](size_t n) {
+        float s = 0;
+        for (size_t i = 0; i < n; i++) s += 273 + ((0.5f + (i & 1023) * 0.01f) / 0.05f - 10) * (1 / (0.0025f * 10));
+        sink_f = s;
+    });
+    add("heater_temperature", "closed_quadratic", 0, [](size_t n) {
+        const float a = 3.9083e-3f, b = -5.775e-7f;
+        float s = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            float ratio = ((0.5f + (i & 1023) * 0.01f) / 0.05f) / 10;
+            s += 273 + (-a + sqrtf(a * a - 4 * b * (1 - ratio))) / (2 * b);
+        }
+        sink_f = s;
+    });
+
+    add("pid_next", "", 0, [](size_t n) {
+        my_pid_params_t p = { 0.01f, 1, 0.1f, 0.001f, 1, 0.001f, 298 };
+        static my_pid pid(NULL); // Static storage like my_sensors::sensors: the state starts zeroed
+        pid.set_params(&p);
+        pid.track(273);
+        pid.set(600);
+        float s = 0;
+        for (size_t i = 0; i < n; i++) s += pid.next(580 + (i & 31));
+        sink_f = s;
+    });
+
+    for (size_t size : { 16u, 256u, 2048u })
+    {
+        auto data = std::make_shared<std::vector<uint8_t>>(payload(size, 0));
+        add("crc32_block", std::to_string(size), size, [data](size_t n) {
+            uint32_t c = 0;
+            for (size_t i = 0; i < n; i++) c ^= protocol::crc32_le(~0u, data->data(), data->size());
+            sink_u = c;
+        });
+        // One call per byte, as the firmware parser feeds the ROM routine
+        add("crc32_bytewise", std::to_string(size), size, [data](size_t n) {
+            uint32_t c = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                uint32_t crc = ~0u;
+                for (uint8_t b : *data) crc = protocol::crc32_le(crc, &b, 1);
+                c ^= crc;
+            }
+            sink_u = c;
+        });
+    }
+
+    //parse_input's chunks need an upload in progress. No USB host is connected, so the responses are discarded
+    uint16_t points = CYCLE_LENGTH;
+    std::vector<uint8_t> begin;
+    protocol::encode_frame(begin, CMD_PROFILE_BEGIN, &points, sizeof(points), parser_wdt++);
+    receiver::parse_input(begin.data(), begin.size());
+    for (size_t size : { 16u, 256u, 512u, 2048u })
+    {
+        for (float density : { 0.0f, 0.01f, 0.1f, 1.0f })
+        {
+            char param[32];
+            snprintf(param, sizeof(param), "%zu_%g", size, density);
+            auto data = std::make_shared<std::vector<uint8_t>>(payload(size, density));
+            add("frame_encode", param, size, [data](size_t n) {
+                std::vector<uint8_t> out(FRAME_ENCODED_MAX(data->size()));
+                size_t len = 0;
+                for (size_t i = 0; i < n; i++) len += frame_encode(out.data(), CMD_GET_DATA, data->data(), data->size(), i, 0x12345678);
+                sink_u = len;
+            });
+            if (size <= PROFILE_CHUNK_MAX)
+            {
+                //Received, CRC-checked, copied into the upload buffer and answered, as from the USB RX stream
+                auto frames = chunk_frames(*data);
+                add("parse_input", param, size, [frames](size_t n) {
+                    for (size_t i = 0; i < n; i++)
+                    {
+                        const std::vector<uint8_t>& f = (*frames)[parser_wdt++];
+                        receiver::parse_input(f.data(), f.size());
+                    }
+                });
+            }
+            add("frame_decode_host", param, size, [data](size_t n) {
+                std::vector<uint8_t> stream;
+                protocol::encode_frame(stream, CMD_GET_DATA, data->data(), data->size(), 1);
+                protocol::frame_decoder decoder;
+                protocol::frame_t f;
+                size_t frames = 0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    for (uint8_t b : stream) frames += decoder.feed(b, f);
+                }
+                sink_u = frames;
+            });
+        }
+    }
+}
+
+// Doubles the iteration count until a run takes at least min_ms, reports that run
+static void run_case(const bench_case& c, double min_ms, bool json)
+{
+    size_t n = 1;
+    double ns = 0;
+    while (true)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        c.run(n);
+        ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        if (ns >= min_ms * 1e6 || n >= (size_t(1) << 40)) break;
+        n *= 2;
+    }
+    double per_op = ns / n;
+    double mb_s = c.bytes ? c.bytes / per_op * 1e3 : 0;
+    if (json)
+    {
+        printf("{\"name\":\"%s\",\"param\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.3f,\"mb_per_s\":%.1f}\n",
+            c.name.c_str(), c.param.c_str(), n, per_op, mb_s);
+    }
+    else
+    {
+        printf("%s,%s,%zu,%.3f,%.1f\n", c.name.c_str(), c.param.c_str(), n, per_op, mb_s);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    double min_ms = 100;
+    const char* filter = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j")) json = true;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) min_ms = atof(argv[++i]);
+        else filter = argv[i];
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+    if (my_params::init() != ESP_OK) return 1;
+    my_uart::init();
+    register_cases();
+    if (!json) printf("name,param,iterations,ns_per_op,mb_per_s\n");
+    for (const bench_case& c : cases)
+    {
+        if (filter != NULL && (c.name + "/" + c.param).find(filter) == std::string::npos) continue;
+        run_case(c, min_ms, json);
+    }
+    return 0;
+}
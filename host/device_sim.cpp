@@ -0,0 +1,743 @@
+#include "device_sim.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "my_uart.h"
+#include "my_pid.h"
+#include "my_dac.h"
+#include "heater_guard.h"
+
+#define SIM_RING_DEPTH 4 //Same as CYCLE_RING_DEPTH
+#define SIM_FEATURE_RING_DEPTH 16 //Same as FEATURE_RING_DEPTH
+#define SIM_AVERAGE_RING_DEPTH 2 //Same as AVERAGE_RING_DEPTH
+#define SIM_AVERAGE_MAX 256 //Same as ADC_AVERAGE_MAX
+#define SIM_CLOCK_RATE 1000 //Hz, the firmware's RTOS tick
+#define SIM_RT_TEMP 273 //K, my_params::rt_temp
+#define SIM_HEATER_RES 10.0f //Ohm at SIM_RT_TEMP
+#define SIM_HEATER_TEMPCO 0.003f //1/K
+#define SIM_HEATER_CURRENT 0.1f //A, constant: the heater voltage follows its resistance
+#define READ_CHUNK_SIZE 4096
+#define POLL_PERIOD_MS 5
+
+static float heater_resistance(float temp)
+{
+    return SIM_HEATER_RES * (1 + SIM_HEATER_TEMPCO * (temp - SIM_RT_TEMP));
+}
+
+namespace protocol
+{
+    device_sim::device_sim()
+    {
+    }
+
+    device_sim::~device_sim()
+    {
+        stop();
+    }
+
+    void device_sim::set_cycle(size_t points, std::chrono::milliseconds period)
+    {
+        cycle_points = points > CYCLE_LENGTH ? CYCLE_LENGTH : points;
+        cycle_period = period;
+    }
+
+    void device_sim::set_sensors(size_t n)
+    {
+        sensors.resize(n > 0 ? n : 1);
+    }
+
+    void device_sim::set_rx_faults(float drop, float corrupt, uint32_t seed)
+    {
+        rx_drop = drop;
+        rx_corrupt = corrupt;
+        rx_faults.seed(seed);
+    }
+
+    std::vector<float> device_sim::get_profile(size_t sensor) const
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        return sensors[sensor].profile;
+    }
+
+    bool device_sim::start()
+    {
+        if (running) return false;
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0) return false;
+        if (grantpt(master) != 0 || unlockpt(master) != 0)
+        {
+            ::close(master);
+            master = -1;
+            return false;
+        }
+        struct termios t;
+        tcgetattr(master, &t);
+        cfmakeraw(&t);
+        tcsetattr(master, TCSANOW, &t);
+        path = ptsname(master);
+        running = true;
+        worker = std::thread(&device_sim::task, this);
+        return true;
+    }
+
+    void device_sim::stop()
+    {
+        if (!running) return;
+        running = false;
+        if (worker.joinable()) worker.join();
+        ::close(master);
+        master = -1;
+    }
+
+    void device_sim::send(uint8_t cmd, const void* payload, size_t len)
+    {
+        tx_buffer.clear();
+        encode_frame(tx_buffer, cmd, payload, len, tx_wdt++);
+        const uint8_t* p = tx_buffer.data();
+        size_t left = tx_buffer.size();
+        while (left > 0 && running)
+        {
+            ssize_t n = ::write(master, p, left);
+            if (n <= 0)
+            {
+                struct pollfd pf = { master, POLLOUT, 0 };
+                poll(&pf, 1, POLL_PERIOD_MS);
+                continue;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+
+    //Synthetic cycle: a triangle temperature profile and a resistance following it, offset per sensor, drifting slowly.
+    //Points are produced in real time, one per cycle_period / cycle_points, so that events go out as they would
+    void device_sim::generate(size_t index)
+    {
+        sensor_t& s = sensors[index];
+        auto now = std::chrono::steady_clock::now();
+        if (!s.operate) return;
+        auto point_period = std::chrono::duration_cast<std::chrono::microseconds>(cycle_period) / cycle_points;
+        while (now >= s.next_point)
+        {
+            s.next_point += point_period;
+            if (s.point == 0)
+            {
+                s.cycle.assign(sizeof(uint32_t) + cycle_points * FLOATS_PER_POINT * sizeof(float), 0);
+                memcpy(s.cycle.data(), &s.seq, sizeof(s.seq));
+                s.features.begin(&s.feature_config);
+            }
+            size_t i = s.point;
+            float* points = reinterpret_cast<float*>(s.cycle.data() + sizeof(uint32_t));
+            float x = static_cast<float>(i) / cycle_points;
+            float temp = 300 + 10 * index + 200 * (x < 0.5f ? 2 * x : 2 - 2 * x);
+            //The firmware's trip path on the heater sample of this point: off on the sample that crosses a limit
+            heater_guard_limits_t limits;
+            heater_guard::prepare(&limits, &s.trip_limits, heater_resistance(s.trip_limits.max_temp));
+            s.heater->guard.check(SIM_HEATER_CURRENT * heater_resistance(temp), SIM_HEATER_CURRENT, &limits);
+            if (s.heater->guard.get_trip() != trip_none)
+            {
+                s.point = 0; //The partial cycle is dropped, the next one starts after CMD_CLEAR_TRIP
+                continue;
+            }
+            if (temp > s.heater->peak_temp) s.heater->peak_temp = temp;
+            points[i * FLOATS_PER_POINT] = temp;
+            float res = gas.load() * (1 + 0.001f * s.seq) * 1000 * expf(-(temp - 300) / 150) + 0.5f * sinf(s.seq + i);
+            float ratio = s.baseline.update(i, res);
+            points[i * FLOATS_PER_POINT + 1] = (s.baseline.get_mode() == baseline_normalize) ? ratio : res;
+            uint32_t now_us = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+            memcpy(points + i * FLOATS_PER_POINT + 2, &now_us, sizeof(now_us));
+            s.features.push(temp, points[i * FLOATS_PER_POINT + 1]);
+            s.average.push(i, temp, points[i * FLOATS_PER_POINT + 1]);
+            //The firmware filters every conversion, the stand-in only has the points
+            float alpha = (s.filter_config.trend_ms == 0) ? 0 :
+                std::chrono::duration<float, std::milli>(point_period).count() / s.filter_config.trend_ms;
+            if (alpha > 1) alpha = 1;
+            if (alpha == 0 || isnan(s.trend.temp))
+            {
+                s.trend.temp = (alpha == 0) ? NAN : temp;
+                s.trend.res = (alpha == 0) ? NAN : res;
+            }
+            else
+            {
+                s.trend.temp += alpha * (temp - s.trend.temp);
+                s.trend.res += alpha * (res - s.trend.res);
+            }
+            s.trend.timestamp_us = now_us;
+            event_frame_t e;
+            if (s.events.push(now_us, i, ratio, &e))
+            {
+                e.sensor = static_cast<uint8_t>(index);
+                send(CMD_EVENT, &e, sizeof(e)); //Right away, like the firmware's event task
+            }
+            if (++s.point == cycle_points)
+            {
+                s.point = 0;
+                cycle_end(index);
+            }
+        }
+    }
+
+    void device_sim::cycle_end(size_t index)
+    {
+        sensor_t& s = sensors[index];
+        std::vector<uint8_t> report(FEATURE_REPORT_MAX_SIZE);
+        report.resize(s.features.finish(s.feature_seq, report.data()));
+        s.seq++;
+        if (!report.empty())
+        {
+            s.feature_seq++;
+            if (s.feature_ring.size() >= SIM_FEATURE_RING_DEPTH)
+            {
+                s.feature_ring.pop_front();
+                error_codes |= my_error_codes::data_overrun;
+            }
+            s.feature_ring.push_back(std::move(report));
+        }
+        bool averaging = s.average.enabled();
+        if (s.average.cycle_end())
+        {
+            std::vector<uint8_t> a(AVERAGE_REPORT_SIZE(CYCLE_LENGTH));
+            a.resize(s.average.finish(s.average_seq++, a.data()));
+            if (s.average_ring.size() >= SIM_AVERAGE_RING_DEPTH)
+            {
+                s.average_ring.pop_front();
+                error_codes |= my_error_codes::data_overrun;
+            }
+            s.average_ring.push_back(std::move(a));
+        }
+        s.average.configure(&s.average_config); //Takes effect with the next cycle
+        s.baseline.configure(&s.baseline_config);
+        s.events.cycle_end();
+        s.events.configure(&s.event_config);
+        if (s.features.get_mode() == features_only || averaging) return; //Points aren't kept
+        if (s.ring.size() >= SIM_RING_DEPTH)
+        {
+            s.ring.pop_front();
+            error_codes |= my_error_codes::data_overrun;
+        }
+        s.ring.push_back(std::move(s.cycle));
+    }
+
+    //Same set and sizes as the firmware, my_adc_cal_t is two floats
+    static bool setting_size(uint8_t cmd, size_t& size)
+    {
+        switch (cmd)
+        {
+        case CMD_SET_HEATER_PARAMS: size = sizeof(heater_params); return true;
+        case CMD_SET_MEASURE_PARAMS: size = sizeof(measure_params); return true;
+        case CMD_SET_PID_PARAMS: size = sizeof(my_pid_params_t); return true;
+        case CMD_SET_ADC_CAL: size = 1 + 2 * sizeof(float); return true;
+        case CMD_SET_DAC_CAL: size = sizeof(my_dac_cal_t); return true;
+        case CMD_SET_PID_TRACE_PERIOD: size = sizeof(uint16_t); return true;
+        case CMD_SET_SESSION: size = sizeof(uint8_t); return true;
+        case CMD_SET_TRIP_LIMITS: size = sizeof(heater_limits_t); return true;
+        case CMD_SELECT_SENSOR: size = sizeof(uint8_t); return true;
+        case CMD_SET_FEATURES: size = sizeof(feature_config_t); return true;
+        case CMD_SET_AVERAGING: size = sizeof(average_config_t); return true;
+        case CMD_SET_BASELINE: size = sizeof(baseline_config_t); return true;
+        case CMD_SET_EVENTS: size = sizeof(event_config_t); return true;
+        case CMD_SET_TIMINGS: size = sizeof(my_timings_t); return true;
+        case CMD_SET_FILTERS: size = sizeof(filter_config_t); return true;
+        case CMD_SET_HEATER_MODEL: size = sizeof(heater_model_t); return true;
+        case CMD_SAVE_NVS: size = 0; return true;
+        default: return false;
+        }
+    }
+
+    //Ranges only: the stand-in has no ADC windows and accepts loop rate changes while running
+    static bool valid_timings(const my_timings_t& t)
+    {
+        return t.averaging_len >= 1 && t.averaging_len <= SIM_AVERAGE_MAX && t.oversampling_rate >= 1 &&
+            t.oversampling_rate <= SIM_CLOCK_RATE && t.sampling_rate >= 1 && t.sampling_rate <= t.oversampling_rate;
+    }
+
+    void device_sim::handle_batch(const frame_t& f)
+    {
+        batch_header h;
+        if (f.payload.size() < sizeof(h))
+        {
+            error_codes |= my_error_codes::incorrect_command_format;
+            return;
+        }
+        memcpy(&h, f.payload.data(), sizeof(h));
+        const batch_entry_header* entries[BATCH_MAX_COMMANDS];
+        int count = (h.size == f.payload.size() - sizeof(h) && h.size <= BATCH_MAX_SIZE) ?
+            batch_split(f.payload.data() + sizeof(h), h.size, entries, BATCH_MAX_COMMANDS) : -1;
+        std::vector<uint8_t> reply(sizeof(batch_response_header) + (count > 0 ? count : 0));
+        batch_response_header r = { h.request_id, RSP_OK, static_cast<uint8_t>(count > 0 ? count : 0) };
+        if (count < 0) r.result = RSP_SET_FAILED;
+        for (int i = 0; i < count; i++)
+        {
+            size_t size;
+            bool ok = setting_size(entries[i]->cmd, size) && entries[i]->length == size &&
+                (entries[i]->cmd != CMD_SELECT_SENSOR || batch_args(entries[i])[0] < sensors.size());
+            if (ok && entries[i]->cmd == CMD_SET_FEATURES)
+            {
+                feature_config_t c;
+                memcpy(&c, batch_args(entries[i]), sizeof(c));
+                ok = cycle_features::validate(&c);
+            }
+            if (ok && entries[i]->cmd == CMD_SET_AVERAGING)
+            {
+                average_config_t c;
+                memcpy(&c, batch_args(entries[i]), sizeof(c));
+                ok = cycle_average<CYCLE_LENGTH>::validate(&c);
+            }
+            if (ok && entries[i]->cmd == CMD_SET_BASELINE)
+            {
+                baseline_config_t c;
+                memcpy(&c, batch_args(entries[i]), sizeof(c));
+                ok = baseline_tracker<CYCLE_LENGTH>::validate(&c);
+            }
+            if (ok && entries[i]->cmd == CMD_SET_TIMINGS)
+            {
+                my_timings_t t;
+                memcpy(&t, batch_args(entries[i]), sizeof(t));
+                ok = valid_timings(t);
+            }
+            if (ok && entries[i]->cmd == CMD_SET_FILTERS)
+            {
+                filter_config_t c;
+                memcpy(&c, batch_args(entries[i]), sizeof(c));
+                ok = c.telemetry_len <= SIM_AVERAGE_MAX;
+            }
+            if (ok && entries[i]->cmd == CMD_SET_HEATER_MODEL)
+            {
+                heater_model_t m;
+                memcpy(&m, batch_args(entries[i]), sizeof(m));
+                ok = heater_model::validate(&m, SIM_RT_TEMP); //Heater params aren't kept, so no tempco check
+            }
+            if (ok && entries[i]->cmd == CMD_SET_EVENTS)
+            {
+                event_config_t c;
+                memcpy(&c, batch_args(entries[i]), sizeof(c));
+                ok = event_detector::validate(&c);
+            }
+            reply[sizeof(r) + i] = ok ? NO_STD_RSP : RSP_SET_FAILED;
+            if (!ok) r.result = RSP_SET_FAILED;
+        }
+        if (r.result == RSP_OK)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                if (entries[i]->cmd == CMD_SELECT_SENSOR) selected = batch_args(entries[i])[0];
+                if (entries[i]->cmd == CMD_SET_FEATURES)
+                {
+                    memcpy(&sensors[selected].feature_config, batch_args(entries[i]), sizeof(feature_config_t));
+                }
+                if (entries[i]->cmd == CMD_SET_AVERAGING)
+                {
+                    memcpy(&sensors[selected].average_config, batch_args(entries[i]), sizeof(average_config_t));
+                }
+                if (entries[i]->cmd == CMD_SET_BASELINE)
+                {
+                    memcpy(&sensors[selected].baseline_config, batch_args(entries[i]), sizeof(baseline_config_t));
+                }
+                if (entries[i]->cmd == CMD_SET_EVENTS)
+                {
+                    memcpy(&sensors[selected].event_config, batch_args(entries[i]), sizeof(event_config_t));
+                }
+                if (entries[i]->cmd == CMD_SET_FILTERS)
+                {
+                    memcpy(&sensors[selected].filter_config, batch_args(entries[i]), sizeof(filter_config_t));
+                }
+                if (entries[i]->cmd == CMD_SET_TRIP_LIMITS)
+                {
+                    memcpy(&sensors[selected].trip_limits, batch_args(entries[i]), sizeof(heater_limits_t));
+                }
+                reply[sizeof(r) + i] = RSP_OK;
+            }
+        }
+        memcpy(reply.data(), &r, sizeof(r));
+        send(CMD_BATCH, reply.data(), reply.size());
+    }
+
+    void device_sim::handle(const frame_t& f)
+    {
+        frames_received++;
+        if (f.wdt != static_cast<uint8_t>(rx_wdt + 1)) error_codes |= my_error_codes::missed_packet;
+        rx_wdt = f.wdt;
+        sensor_t& s = sensors[selected];
+        auto& ring = s.ring;
+        switch (f.cmd)
+        {
+        case CMD_SELECT_SENSOR:
+            if (f.payload.size() != sizeof(uint8_t) || f.payload[0] >= sensors.size())
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            selected = f.payload[0];
+            respond(f.cmd, RSP_OK);
+            break;
+        case CMD_START:
+            if (s.operate)
+            {
+                respond(f.cmd, RSP_ALREADY_IN_REQUESTED_STATE);
+                break;
+            }
+            s.operate = true;
+            s.next_point = std::chrono::steady_clock::now();
+            s.point = 0;
+            respond(f.cmd, RSP_OK);
+            break;
+        case CMD_STOP:
+            respond(f.cmd, s.operate ? RSP_OK : RSP_ALREADY_IN_REQUESTED_STATE);
+            s.operate = false;
+            break;
+        case CMD_GET_HAVE_DATA:
+            respond(f.cmd, ring.empty() ? RSP_NO_DATA : RSP_OK);
+            break;
+        case CMD_GET_DATA:
+            if (ring.empty())
+            {
+                respond(f.cmd, RSP_NO_DATA);
+                break;
+            }
+            send(CMD_GET_DATA, ring.front().data(), ring.front().size());
+            ring.pop_front();
+            break;
+        case CMD_GET_DATA_SEQ:
+        {
+            uint32_t seq;
+            bool found = false;
+            if (f.payload.size() != sizeof(seq))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&seq, f.payload.data(), sizeof(seq));
+            for (auto it = ring.begin(); it != ring.end(); ++it)
+            {
+                uint32_t cs;
+                memcpy(&cs, it->data(), sizeof(cs));
+                if (cs != seq) continue;
+                send(CMD_GET_DATA, it->data(), it->size());
+                ring.erase(it);
+                found = true;
+                break;
+            }
+            if (!found) respond(f.cmd, RSP_NO_DATA);
+            break;
+        }
+        case CMD_GET_ERROR:
+            send(f.cmd, &error_codes, sizeof(error_codes));
+            error_codes = 0;
+            break;
+        case CMD_PROFILE_BEGIN:
+        {
+            uint16_t length;
+            if (f.payload.size() != sizeof(length)) break;
+            memcpy(&length, f.payload.data(), sizeof(length));
+            if (length == 0 || length > CYCLE_LENGTH)
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.upload_length = length;
+            s.upload.assign(length, 0);
+            s.upload_received.assign(length, false);
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_PROFILE_CHUNK:
+        {
+            profile_chunk_header h;
+            if (f.payload.size() < sizeof(h)) break;
+            memcpy(&h, f.payload.data(), sizeof(h));
+            if ((h.offset % sizeof(float)) || (h.length % sizeof(float)) || h.length == 0 || h.length > PROFILE_CHUNK_MAX ||
+                f.payload.size() != sizeof(h) + h.length || h.offset + h.length > s.upload_length * sizeof(float))
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            const uint8_t* data = f.payload.data() + sizeof(h);
+            if (~crc32_le(~0u, data, h.length) != h.crc)
+            {
+                respond(f.cmd, RSP_BAD_CRC);
+                break;
+            }
+            memcpy(reinterpret_cast<uint8_t*>(s.upload.data()) + h.offset, data, h.length);
+            for (size_t i = h.offset / sizeof(float); i < (h.offset + h.length) / sizeof(float); i++) s.upload_received[i] = true;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_PROFILE_STATUS:
+        {
+            profile_upload_status st = {};
+            st.length = s.upload_length;
+            while (st.first_missing < st.length && s.upload_received[st.first_missing]) st.first_missing++;
+            send(f.cmd, &st, sizeof(st));
+            break;
+        }
+        case CMD_PROFILE_COMMIT:
+        {
+            uint32_t crc;
+            if (f.payload.size() != sizeof(crc)) break;
+            memcpy(&crc, f.payload.data(), sizeof(crc));
+            bool complete = s.upload_length > 0 &&
+                std::find(s.upload_received.begin(), s.upload_received.end(), false) == s.upload_received.end();
+            if (!complete)
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            if (~crc32_le(~0u, reinterpret_cast<const uint8_t*>(s.upload.data()), s.upload_length * sizeof(float)) != crc)
+            {
+                respond(f.cmd, RSP_BAD_CRC);
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(profile_mutex);
+                s.profile = s.upload;
+            }
+            s.upload_length = 0;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_BATCH:
+            handle_batch(f);
+            break;
+        case CMD_SET_FEATURES:
+        {
+            feature_config_t c;
+            if (f.payload.size() != sizeof(c))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&c, f.payload.data(), sizeof(c));
+            if (!cycle_features::validate(&c))
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.feature_config = c;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_GET_FEATURES:
+            if (s.feature_ring.empty())
+            {
+                respond(f.cmd, RSP_NO_DATA);
+                break;
+            }
+            send(f.cmd, s.feature_ring.front().data(), s.feature_ring.front().size());
+            s.feature_ring.pop_front();
+            break;
+        case CMD_SET_AVERAGING:
+        {
+            average_config_t c;
+            if (f.payload.size() != sizeof(c))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&c, f.payload.data(), sizeof(c));
+            if (!cycle_average<CYCLE_LENGTH>::validate(&c))
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.average_config = c;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_GET_AVERAGE:
+            if (s.average_ring.empty())
+            {
+                respond(f.cmd, RSP_NO_DATA);
+                break;
+            }
+            send(f.cmd, s.average_ring.front().data(), s.average_ring.front().size());
+            s.average_ring.pop_front();
+            break;
+        case CMD_SET_BASELINE:
+        {
+            baseline_config_t c;
+            if (f.payload.size() != sizeof(c))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&c, f.payload.data(), sizeof(c));
+            if (!baseline_tracker<CYCLE_LENGTH>::validate(&c))
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.baseline_config = c;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_SET_TIMINGS:
+        {
+            my_timings_t t;
+            if (f.payload.size() != sizeof(t))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&t, f.payload.data(), sizeof(t));
+            respond(f.cmd, valid_timings(t) ? RSP_OK : RSP_SET_FAILED); //Not applied, the stand-in runs on its own clock
+            break;
+        }
+        case CMD_SET_EVENTS:
+        {
+            event_config_t c;
+            if (f.payload.size() != sizeof(c))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&c, f.payload.data(), sizeof(c));
+            if (!event_detector::validate(&c))
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.event_config = c;
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_SET_FILTERS:
+        {
+            filter_config_t c;
+            if (f.payload.size() != sizeof(c))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&c, f.payload.data(), sizeof(c));
+            if (c.telemetry_len > SIM_AVERAGE_MAX)
+            {
+                respond(f.cmd, RSP_SET_FAILED);
+                break;
+            }
+            s.filter_config = c; //Right away, the stand-in has no telemetry window to resize
+            respond(f.cmd, RSP_OK);
+            break;
+        }
+        case CMD_SET_HEATER_MODEL:
+        {
+            heater_model_t m;
+            if (f.payload.size() != sizeof(m))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&m, f.payload.data(), sizeof(m));
+            respond(f.cmd, heater_model::validate(&m, SIM_RT_TEMP) ? RSP_OK : RSP_SET_FAILED); //The stand-in has no heater
+            break;
+        }
+        case CMD_SET_TRIP_LIMITS:
+            if (f.payload.size() != sizeof(s.trip_limits))
+            {
+                error_codes |= my_error_codes::incorrect_command_format;
+                break;
+            }
+            memcpy(&s.trip_limits, f.payload.data(), sizeof(s.trip_limits)); //From the next point
+            respond(f.cmd, RSP_OK);
+            break;
+        case CMD_GET_TREND:
+            send(f.cmd, &s.trend, sizeof(s.trend));
+            break;
+        case CMD_GET_BASELINE:
+            send(f.cmd, s.baseline.get_state(), sizeof(*s.baseline.get_state())); //Not saved, the stand-in has no NVS
+            break;
+        case CMD_CLEAR_TRIP:
+            respond(f.cmd, s.heater->guard.clear() ? RSP_OK : RSP_ALREADY_IN_REQUESTED_STATE);
+            break;
+        case CMD_GET_RATES:
+        {
+            rates_t r; //A loop at the point rate on a 1 MHz clock, as the stand-in produces points
+            uint32_t point_rate = static_cast<uint32_t>(cycle_points * 1000 / cycle_period.count());
+            effective_rates(1000000, point_rate, point_rate, &r);
+            r.measured_loop_rate = point_rate;
+            send(f.cmd, &r, sizeof(r));
+            break;
+        }
+        case CMD_GET_TRIP:
+            respond(f.cmd, s.heater->guard.get_trip());
+            break;
+        case CMD_GET_BOOT:
+        {
+            boot_report_t r = {}; //The stand-in has no boot phases
+            r.rails_settled = 1;
+            send(f.cmd, &r, sizeof(r));
+            break;
+        }
+        case CMD_GET_POWER:
+        {
+            power_report_t r = {}; //No frequency scaling, residency isn't kept
+            r.state = power_idle;
+            for (const auto& sensor : sensors)
+            {
+                if (sensor.operate) r.state = power_active;
+            }
+            send(f.cmd, &r, sizeof(r));
+            break;
+        }
+        case CMD_SET_HEATER_PARAMS:
+        case CMD_SET_MEASURE_PARAMS:
+        case CMD_SET_TEMP_CYCLE:
+        case CMD_SET_SEGMENTS:
+        case CMD_SET_PID_PARAMS:
+        case CMD_SET_ADC_CAL:
+        case CMD_SET_DAC_CAL:
+        case CMD_SET_PID_TRACE_PERIOD:
+        case CMD_SET_SESSION:
+        case CMD_SAVE_NVS:
+        case CMD_STORE_ACTIVATE:
+        case CMD_STORE_SAVE:
+            respond(f.cmd, RSP_OK); //Arguments aren't interpreted
+            break;
+        default:
+            error_codes |= my_error_codes::unknown_cmd; //No response, like the firmware
+            break;
+        }
+    }
+
+    void device_sim::task()
+    {
+        std::vector<uint8_t> buf(READ_CHUNK_SIZE);
+        frame_decoder decoder;
+        frame_t f;
+        while (running)
+        {
+            struct pollfd p = { master, POLLIN, 0 };
+            int r = poll(&p, 1, POLL_PERIOD_MS);
+            if (r > 0 && (p.revents & POLLIN))
+            {
+                ssize_t n = ::read(master, buf.data(), buf.size());
+                for (ssize_t i = 0; i < n; i++)
+                {
+                    if (!decoder.feed(buf[i], f)) continue;
+                    std::uniform_real_distribution<float> u(0, 1);
+                    if (rx_drop > 0 && u(rx_faults) < rx_drop) continue;
+                    if (rx_corrupt > 0 && u(rx_faults) < rx_corrupt)
+                    {
+                        frames_received++;
+                        rx_wdt = f.wdt;
+                        respond(f.cmd, RSP_BAD_CRC);
+                        continue;
+                    }
+                    handle(f);
+                }
+            }
+            else if (r > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD_MS)); //No slave opened yet
+            }
+            for (size_t i = 0; i < sensors.size(); i++) generate(i);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocol.h"
+#include "cycle_features.h"
+#include "cycle_average.h"
+#include "baseline_tracker.h"
+#include "event_detector.h"
+#include "rate_scheduler.h"
+#include "filter_bank.h"
+#include "heater_model.h"
+#include "heater_guard.h"
+
+/***
+ * Firmware stand-in on a pseudo-terminal, for running host code without hardware.
+ * Implements the framing, the WDT counter check, sensor selection, one cycle ring per sensor (CMD_GET_DATA,
+ * CMD_GET_DATA_SEQ), per-cycle features (CMD_SET_FEATURES, CMD_GET_FEATURES), coherent averaging
+ * (CMD_SET_AVERAGING, CMD_GET_AVERAGE), the drift baseline (CMD_SET_BASELINE, CMD_GET_BASELINE), event frames
+ * (CMD_SET_EVENTS, CMD_EVENT), timestamped points, CMD_GET_RATES, CMD_SET_TIMINGS validation, a point-rate trend
+ * (CMD_SET_FILTERS, CMD_GET_TREND), CMD_SET_HEATER_MODEL validation, heater trips (CMD_SET_TRIP_LIMITS, CMD_GET_TRIP,
+ * CMD_CLEAR_TRIP) through the firmware's heater_guard, the CMD_GET_POWER state, an empty CMD_GET_BOOT report, batch validation, the chunked
+ * profile upload (CMD_PROFILE_*, applied at once) and acknowledges the other parameter and profile commands.
+ * Frames from the host can be dropped or corrupted on purpose, see set_rx_faults().
+ * Each sensor synthesizes cycles point by point at a configurable period.
+ */
+
+namespace protocol
+{
+    class device_sim
+    {
+    public:
+        device_sim();
+        ~device_sim();
+
+        bool start(); // Creates the pty and starts serving it
+        void stop();
+        const char* get_path() const { return path.c_str(); } // Slave side, for sensor_client::open()
+
+        void set_cycle(size_t points, std::chrono::milliseconds period); // Call before start()
+        void set_sensors(size_t n); // Call before start(), 1 by default
+        size_t get_frames_received() const { return frames_received; }
+        void set_gas(float factor) { gas = factor; } // Multiplies every sensor's resistance from the next point, any thread
+        // Call before start(): frames from the host are lost with probability `drop`, or fail their CRC with probability
+        // `corrupt` (answered with RSP_BAD_CRC, as the firmware does). Seeded, so that a run can be repeated
+        void set_rx_faults(float drop, float corrupt, uint32_t seed = 1);
+        std::vector<float> get_profile(size_t sensor) const; // Last committed upload, empty if none. Any thread
+        float get_peak_temp(size_t sensor) const { return sensors[sensor].heater->peak_temp; } // Heater driven at, K. Any thread
+
+    private:
+        int master = -1;
+        std::string path;
+        std::thread worker;
+        std::atomic<bool> running{false};
+        std::atomic<size_t> frames_received{0};
+        std::atomic<float> gas{1};
+        float rx_drop = 0;
+        float rx_corrupt = 0;
+        std::minstd_rand rx_faults;
+        mutable std::mutex profile_mutex; // Committed profiles
+
+        struct heater_t // Not movable, so sensor_t holds it by pointer
+        {
+            heater_guard guard;
+            std::atomic<float> peak_temp{0};
+        };
+
+        struct sensor_t
+        {
+            bool operate = false;
+            uint32_t seq = 0;
+            std::chrono::steady_clock::time_point next_point;
+            size_t point = 0; // In the current cycle
+            std::vector<uint8_t> cycle; // Being filled
+            std::deque<std::vector<uint8_t>> ring; // Ready cycles, oldest first
+            uint16_t upload_length = 0;
+            std::vector<float> upload;
+            std::vector<bool> upload_received; // Per point
+            std::vector<float> profile; // Committed
+            feature_config_t feature_config = {}; // Off
+            cycle_features features;
+            std::deque<std::vector<uint8_t>> feature_ring;
+            uint32_t feature_seq = 0; // Report counters, like the firmware's ring sequence numbers
+            uint32_t average_seq = 0;
+            average_config_t average_config = {}; // Off
+            cycle_average<CYCLE_LENGTH> average;
+            std::deque<std::vector<uint8_t>> average_ring;
+            baseline_config_t baseline_config = {}; // Off
+            baseline_tracker<CYCLE_LENGTH> baseline;
+            event_config_t event_config = {}; // Off
+            event_detector events;
+            filter_config_t filter_config = { 0, 0, 60000 }; // Firmware defaults
+            trend_report_t trend = { 0, NAN, NAN, { NAN, NAN, NAN, NAN } }; // No ADC voltages
+            std::unique_ptr<heater_t> heater{new heater_t()};
+            heater_limits_t trip_limits = { 1000, 0.7f, 0.5f, 0.002f, 1, 0.05f }; // Firmware defaults
+        };
+
+        size_t cycle_points = CYCLE_LENGTH;
+        std::chrono::milliseconds cycle_period{1000};
+        std::vector<sensor_t> sensors{1};
+        size_t selected = 0; // CMD_SELECT_SENSOR
+
+        uint8_t rx_wdt = 0;
+        uint8_t tx_wdt = 0;
+        uint32_t error_codes = 0;
+        std::vector<uint8_t> tx_buffer;
+
+        void task();
+        void handle(const frame_t& f);
+        void handle_batch(const frame_t& f);
+        void generate(size_t index);
+        void cycle_end(size_t index);
+        void send(uint8_t cmd, const void* payload, size_t len);
+        void respond(uint8_t cmd, uint8_t rsp) { send(cmd, &rsp, sizeof(rsp)); }
+    };
+}
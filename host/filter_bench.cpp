@@ -0,0 +1,84 @@
+/***
+ * Cost per ADC sample of the per-channel filter bank (filter_bank.h) against one Average per output,
+ * for 1..FILTER_MAX_BOXCARS boxcar outputs, with and without the trend output. As in the firmware, the first
+ * (control) output is read every sample and the others once per telemetry point.
+ * Usage: filter_bench [samples] [samples per point]   (10^7 and 50 by default)
+ * Host timings only show the scaling, the ESP32-S3 has no cache misses on the 1 KiB windows but a slower FPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "filter_bank.h"
+#include "average.h"
+
+#define BENCH_CAPACITY 256 //ADC_AVERAGE_MAX
+static const uint32_t lengths[FILTER_MAX_BOXCARS] = { 4, 50, 200, 255 }; //Control, telemetry, longer windows
+
+static volatile float sink;
+
+template <class F> static double ns_per_sample(size_t n, F step)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) step(static_cast<uint32_t>(1000 + (i * 2654435761u >> 22))); //ADC-like mV
+    std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - begin;
+    return d.count() / n;
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+    size_t decimation = (argc > 2) ? strtoul(argv[2], NULL, 10) : 50;
+    if (decimation == 0) decimation = 1;
+    printf("outputs,bank_ns,bank_trend_ns,separate_ns,bank_bytes,separate_bytes\n");
+    for (size_t outputs = 1; outputs <= FILTER_MAX_BOXCARS; outputs++)
+    {
+        std::vector<uint32_t> store(BENCH_CAPACITY);
+        filter_bank<uint32_t> bank(store.data(), BENCH_CAPACITY, outputs);
+        for (size_t k = 0; k < outputs; k++) bank.set_length(k, lengths[k]);
+        size_t left = decimation;
+        double plain = ns_per_sample(n, [&](uint32_t x) {
+            bank.push(x);
+            float s = bank.mean(0);
+            if (--left == 0)
+            {
+                left = decimation;
+                for (size_t k = 1; k < outputs; k++) s += bank.mean(k);
+            }
+            sink = s;
+        });
+        bank.set_trend(0.001f);
+        double trend = ns_per_sample(n, [&](uint32_t x) {
+            bank.push(x);
+            float s = bank.mean(0);
+            if (--left == 0)
+            {
+                left = decimation;
+                s += bank.trend();
+                for (size_t k = 1; k < outputs; k++) s += bank.mean(k);
+            }
+            sink = s;
+        });
+
+        std::vector<Average<uint32_t>*> separate;
+        for (size_t k = 0; k < outputs; k++) separate.push_back(new Average<uint32_t>(lengths[k]));
+        double sep = ns_per_sample(n, [&](uint32_t x) {
+            float s = separate[0]->rolling(x);
+            for (size_t k = 1; k < outputs; k++) separate[k]->push(x);
+            if (--left == 0)
+            {
+                left = decimation;
+                for (size_t k = 1; k < outputs; k++) s += separate[k]->mean();
+            }
+            sink = s;
+        });
+        size_t separate_bytes = 0; //Fixed windows: resizable ones (CMD_SET_FILTERS) would each need BENCH_CAPACITY
+        for (size_t k = 0; k < outputs; k++) separate_bytes += sizeof(Average<uint32_t>) + lengths[k] * sizeof(uint32_t);
+        for (auto a : separate) delete a;
+        printf("%zu,%.2f,%.2f,%.2f,%zu,%zu\n", outputs, plain, trend, sep,
+            sizeof(bank) + BENCH_CAPACITY * sizeof(uint32_t), separate_bytes);
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+// Types only: my_adc_channel.h is included through my_params.h, the ADC itself isn't built for the host
+#include "esp_err.h"
+
+typedef enum { ADC1_CHANNEL_0, ADC1_CHANNEL_1, ADC1_CHANNEL_2, ADC1_CHANNEL_3, ADC1_CHANNEL_4, ADC1_CHANNEL_5,
+    ADC1_CHANNEL_6, ADC1_CHANNEL_7, ADC1_CHANNEL_8, ADC1_CHANNEL_9, ADC1_CHANNEL_MAX } adc1_channel_t;
+typedef enum { ADC_ATTEN_DB_0, ADC_ATTEN_DB_2_5, ADC_ATTEN_DB_6, ADC_ATTEN_DB_11, ADC_ATTEN_MAX } adc_atten_t;
+typedef enum { ADC_WIDTH_BIT_12 = 3, ADC_WIDTH_MAX } adc_bits_width_t;
+#define ADC_WIDTH_BIT_DEFAULT (ADC_WIDTH_MAX - 1)
+typedef enum { ADC_UNIT_1 = 1, ADC_UNIT_2 = 2 } adc_unit_t;
@@ -0,0 +1,16 @@
+#pragma once
+// Types only, see driver/adc.h
+#include "driver/adc.h"
+
+typedef struct
+{
+    adc_unit_t adc_num;
+    adc_atten_t atten;
+    adc_bits_width_t bit_width;
+    uint32_t coeff_a;
+    uint32_t coeff_b;
+    uint32_t vref;
+    const uint32_t* low_curve;
+    const uint32_t* high_curve;
+    uint8_t version;
+} esp_adc_cal_characteristics_t;
@@ -0,0 +1,14 @@
+#pragma once
+#include "esp_err.h"
+
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level); // Any tag: one level for all, ESP_LOG_INFO by default
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...);
+
+#define ESP_LOGE(tag, format, ...) esp_log_write(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+// Compiled out, as with the default CONFIG_LOG_MAXIMUM_LEVEL
+#define ESP_LOGD(tag, format, ...) do { } while (0)
+#define ESP_LOGV(tag, format, ...) do { } while (0)
@@ -0,0 +1,19 @@
+#pragma once
+// FreeRTOS on host threads, see idf_host.cpp: a tick is a millisecond of the steady clock, priorities and core
+// affinities are ignored. Only what the host-built firmware sources call
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
@@ -0,0 +1,8 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_semaphore* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(); // Not recursive, no priority inheritance
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
@@ -0,0 +1,8 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_stream_buffer* StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger_level);
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void* data, size_t length, TickType_t ticks_to_wait);
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void* data, size_t length, TickType_t ticks_to_wait);
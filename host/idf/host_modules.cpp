@@ -0,0 +1,109 @@
+// Stand-ins for the firmware modules that drive hardware or their own tasks, so that my_uart.cpp links on the host:
+// nothing is measured, recorded or tripped. The control tasks aren't run, a test plays that part through my_uart::tick()
+#include "my_uart.h"
+#include "my_sensor.h"
+#include "my_session.h"
+#include "my_pid_trace.h"
+#include "my_boot.h"
+#include "my_trip.h"
+#include "my_power.h"
+#include "my_events.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace my_sensors
+{
+    bool idle()
+    {
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+        {
+            if (my_uart::get_operate(i)) return false;
+        }
+        return true;
+    }
+
+    void wake()
+    {
+    }
+
+    const trend_report_t* read_trend(size_t sensor)
+    {
+        (void)sensor;
+        static const trend_report_t off = { 0, NAN, NAN, { NAN, NAN, NAN, NAN } };
+        return &off;
+    }
+}
+
+namespace my_session
+{
+    void init()
+    {
+    }
+
+    void set_sensors(uint8_t mask)
+    {
+        (void)mask;
+    }
+
+    void push_command(size_t sensor, const session_command_t* c)
+    {
+        (void)sensor;
+        (void)c;
+    }
+}
+
+namespace my_pid_trace
+{
+    void init()
+    {
+    }
+
+    void set_period(uint32_t ms)
+    {
+        (void)ms;
+    }
+}
+
+namespace my_boot
+{
+    void get_report(boot_report_t* r)
+    {
+        memset(r, 0, sizeof(*r));
+    }
+}
+
+namespace my_trip
+{
+    uint8_t get_trip(size_t sensor)
+    {
+        (void)sensor;
+        return 0;
+    }
+
+    bool clear(size_t sensor)
+    {
+        (void)sensor;
+        return false;
+    }
+}
+
+namespace my_power
+{
+    void get_report(power_report_t* r)
+    {
+        memset(r, 0, sizeof(*r));
+    }
+}
+
+namespace my_events
+{
+    void init()
+    {
+    }
+
+    void push(const event_frame_t* f)
+    {
+        (void)f;
+    }
+}
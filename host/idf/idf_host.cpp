@@ -0,0 +1,591 @@
+#include "idf_host.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "nvs_flash.h"
+#include "rom/crc.h"
+#include "tinyusb.h"
+#include "tusb_cdc_acm.h"
+#include "protocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define USB_PACKET_SIZE 64 //bytes, full-speed bulk endpoint
+#define USB_BYTES_PER_MS (19 * USB_PACKET_SIZE) //Full-speed bulk throughput of an otherwise idle bus
+
+/***
+ * Everything below lives in objects that are never destroyed: the firmware's tasks still run while the process exits
+ */
+
+static std::chrono::steady_clock::time_point boot_time()
+{
+    static const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    return t;
+}
+
+static std::chrono::steady_clock::time_point tick_time(TickType_t ticks)
+{
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks * portTICK_PERIOD_MS);
+}
+
+/***
+ * esp_err, esp_log, esp_timer, ROM
+ */
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+static std::atomic<int> log_level(ESP_LOG_INFO);
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    (void)tag;
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    if (level > log_level.load()) return;
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    fprintf(stderr, "%c (%lld) %s: %s\n", letters[level], static_cast<long long>(esp_timer_get_time() / 1000), tag, line);
+}
+
+int64_t esp_timer_get_time()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time()).count();
+}
+
+uint32_t crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len)
+{
+    return protocol::crc32_le(crc, buf, len);
+}
+
+/***
+ * FreeRTOS
+ */
+
+struct host_task
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+};
+
+static thread_local host_task* current_task = NULL;
+
+static host_task* this_task()
+{
+    if (current_task == NULL) current_task = new host_task(); //Threads the firmware didn't create, main() included
+    return current_task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char* name, uint32_t stack_depth, void* param,
+    UBaseType_t priority, TaskHandle_t* created, BaseType_t core)
+{
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core;
+    host_task* task = new host_task();
+    if (created) *created = task;
+    std::thread([task, code, param]() {
+        current_task = task;
+        code(param);
+    }).detach();
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return static_cast<TickType_t>(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->notifications++;
+    task->cv.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_task* task = this_task();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto ready = [task]() { return task->notifications > 0; };
+    if (ticks_to_wait == portMAX_DELAY) task->cv.wait(lock, ready);
+    else task->cv.wait_until(lock, tick_time(ticks_to_wait), ready);
+    uint32_t value = task->notifications;
+    if (value > 0) task->notifications = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+struct host_semaphore
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool taken = false;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new host_semaphore();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    auto free = [semaphore]() { return !semaphore->taken; };
+    if (ticks_to_wait == portMAX_DELAY) semaphore->cv.wait(lock, free);
+    else if (!semaphore->cv.wait_until(lock, tick_time(ticks_to_wait), free)) return pdFALSE;
+    semaphore->taken = true;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (!semaphore->taken) return pdFALSE;
+    semaphore->taken = false;
+    semaphore->cv.notify_one();
+    return pdTRUE;
+}
+
+struct host_stream_buffer
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<uint8_t> data;
+    size_t size;
+    size_t trigger_level;
+};
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger_level)
+{
+    host_stream_buffer* buffer = new host_stream_buffer();
+    buffer->size = size;
+    buffer->trigger_level = (trigger_level == 0) ? 1 : trigger_level;
+    return buffer;
+}
+
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void* data, size_t length, TickType_t ticks_to_wait)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    std::unique_lock<std::mutex> lock(buffer->mutex);
+    auto space = [buffer]() { return buffer->data.size() < buffer->size; };
+    if (ticks_to_wait == portMAX_DELAY) buffer->cv.wait(lock, space);
+    else if (ticks_to_wait > 0) buffer->cv.wait_until(lock, tick_time(ticks_to_wait), space);
+    size_t n = std::min(length, buffer->size - buffer->data.size());
+    buffer->data.insert(buffer->data.end(), p, p + n);
+    if (n > 0) buffer->cv.notify_all();
+    return n;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void* data, size_t length, TickType_t ticks_to_wait)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    std::unique_lock<std::mutex> lock(buffer->mutex);
+    auto triggered = [buffer]() { return buffer->data.size() >= buffer->trigger_level; };
+    if (ticks_to_wait == portMAX_DELAY) buffer->cv.wait(lock, triggered);
+    else if (ticks_to_wait > 0) buffer->cv.wait_until(lock, tick_time(ticks_to_wait), triggered);
+    size_t n = std::min(length, buffer->data.size());
+    std::copy(buffer->data.begin(), buffer->data.begin() + n, p);
+    buffer->data.erase(buffer->data.begin(), buffer->data.begin() + n);
+    if (n > 0) buffer->cv.notify_all();
+    return n;
+}
+
+/***
+ * NVS and partitions
+ */
+
+struct flash_t
+{
+    std::mutex mutex;
+    bool nvs_ready = false;
+    std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs; // namespace, key, blob
+    std::map<nvs_handle_t, std::string> handles; // Open handles, to their namespace
+    nvs_handle_t next_handle = 1;
+    std::vector<uint8_t> profiles;
+};
+
+static const esp_partition_t partitions[] = {
+    { ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(0x40), 0x110000, 128 * 1024, "profiles", false },
+};
+
+static flash_t& flash()
+{
+    static flash_t* f = []() {
+        flash_t* f = new flash_t();
+        f->profiles.assign(partitions[0].size, 0xff);
+        return f;
+    }();
+    return *f;
+}
+
+esp_err_t nvs_flash_init()
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    flash().nvs_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    flash().nvs.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    flash_t& f = flash();
+    std::lock_guard<std::mutex> lock(f.mutex);
+    if (!f.nvs_ready) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (open_mode == NVS_READONLY && f.nvs.count(name) == 0) return ESP_ERR_NVS_NOT_FOUND;
+    f.nvs[name];
+    *out_handle = f.next_handle++;
+    f.handles[*out_handle] = name;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    flash().handles.erase(handle);
+}
+
+static std::map<std::string, std::vector<uint8_t>>* nvs_namespace(nvs_handle_t handle)
+{
+    auto h = flash().handles.find(handle);
+    return (h == flash().handles.end()) ? NULL : &flash().nvs[h->second];
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    auto* ns = nvs_namespace(handle);
+    if (ns == NULL) return ESP_ERR_NVS_INVALID_HANDLE;
+    const uint8_t* p = static_cast<const uint8_t*>(value);
+    (*ns)[key].assign(p, p + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    auto* ns = nvs_namespace(handle);
+    if (ns == NULL) return ESP_ERR_NVS_INVALID_HANDLE;
+    auto blob = ns->find(key);
+    if (blob == ns->end()) return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value == NULL)
+    {
+        *length = blob->second.size();
+        return ESP_OK;
+    }
+    if (*length < blob->second.size())
+    {
+        *length = blob->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, blob->second.data(), blob->second.size());
+    *length = blob->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    auto* ns = nvs_namespace(handle);
+    if (ns == NULL) return ESP_ERR_NVS_INVALID_HANDLE;
+    return ns->erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    return nvs_namespace(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    for (const esp_partition_t& p : partitions)
+    {
+        if (p.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || p.subtype == subtype) &&
+            (label == NULL || strcmp(label, p.label) == 0)) return &p;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+    esp_partition_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
+{
+    (void)memory;
+    if (partition != &partitions[0] || offset + size > partition->size) return ESP_ERR_INVALID_ARG;
+    *out_ptr = flash().profiles.data() + offset;
+    *out_handle = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if (partition != &partitions[0] || dst_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    const uint8_t* p = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) flash().profiles[dst_offset + i] &= p[i];
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if (partition != &partitions[0] || offset + size > partition->size || (offset % 4096) || (size % 4096))
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(flash().mutex);
+    memset(flash().profiles.data() + offset, 0xff, size);
+    return ESP_OK;
+}
+
+/***
+ * TinyUSB CDC
+ */
+
+struct usb_t
+{
+    std::mutex mutex; // RX FIFO and TX queue
+    tusb_cdcacm_callback_t callback_rx = NULL;
+    std::deque<uint8_t> rx_fifo;
+    std::vector<uint8_t> tx_queue;
+    std::atomic<int> fd{-1}; // Firmware end of the socket pair
+    std::mutex write_mutex; // Flushes
+    float drop = 0;
+    float corrupt = 0;
+    std::minstd_rand faults;
+    std::atomic<size_t> frames_received{0};
+};
+
+static usb_t& usb()
+{
+    static usb_t* u = new usb_t();
+    return *u;
+}
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t* config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+esp_err_t tusb_cdc_acm_init(const tinyusb_config_cdcacm_t* cfg)
+{
+    std::lock_guard<std::mutex> lock(usb().mutex);
+    usb().callback_rx = cfg->callback_rx;
+    return ESP_OK;
+}
+
+esp_err_t tinyusb_cdcacm_read(tinyusb_cdcacm_itf_t itf, uint8_t* out_buf, size_t out_buf_sz, size_t* rx_data_size)
+{
+    (void)itf;
+    usb_t& u = usb();
+    std::lock_guard<std::mutex> lock(u.mutex);
+    size_t n = std::min(out_buf_sz, u.rx_fifo.size());
+    std::copy(u.rx_fifo.begin(), u.rx_fifo.begin() + n, out_buf);
+    u.rx_fifo.erase(u.rx_fifo.begin(), u.rx_fifo.begin() + n);
+    *rx_data_size = n;
+    return ESP_OK;
+}
+
+size_t tinyusb_cdcacm_write_queue(tinyusb_cdcacm_itf_t itf, const uint8_t* in_buf, size_t in_size)
+{
+    (void)itf;
+    usb_t& u = usb();
+    std::lock_guard<std::mutex> lock(u.mutex);
+    size_t n = std::min(in_size, static_cast<size_t>(CONFIG_TINYUSB_CDC_TX_BUFSIZE) - u.tx_queue.size());
+    u.tx_queue.insert(u.tx_queue.end(), in_buf, in_buf + n);
+    return n;
+}
+
+esp_err_t tinyusb_cdcacm_write_flush(tinyusb_cdcacm_itf_t itf, uint32_t timeout_ticks)
+{
+    (void)itf;
+    (void)timeout_ticks;
+    usb_t& u = usb();
+    std::lock_guard<std::mutex> write_lock(u.write_mutex);
+    std::vector<uint8_t> out;
+    {
+        std::lock_guard<std::mutex> lock(u.mutex);
+        out.swap(u.tx_queue);
+    }
+    int fd = u.fd;
+    for (size_t sent = 0; fd >= 0 && sent < out.size();) // Without a host the bytes are lost, as on a closed port
+    {
+        ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+    return ESP_OK;
+}
+
+// TinyUSB task: packets from the host into the RX FIFO, the callback after each one, paced like the bus
+static void usb_deliver(usb_t& u, const uint8_t* data, size_t size, std::chrono::steady_clock::time_point& slot, size_t& budget)
+{
+    for (size_t offset = 0; offset < size; offset += USB_PACKET_SIZE)
+    {
+        if (budget < USB_PACKET_SIZE)
+        {
+            slot += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(slot);
+            budget = USB_BYTES_PER_MS;
+        }
+        size_t n = std::min(static_cast<size_t>(USB_PACKET_SIZE), size - offset);
+        budget -= USB_PACKET_SIZE;
+        tusb_cdcacm_callback_t callback;
+        {
+            std::lock_guard<std::mutex> lock(u.mutex);
+            u.rx_fifo.insert(u.rx_fifo.end(), data + offset, data + offset + n);
+            callback = u.callback_rx;
+        }
+        cdcacm_event_t event = { CDC_EVENT_RX };
+        if (callback) callback(TINYUSB_CDC_ACM_0, &event);
+    }
+}
+
+// Splits the byte stream at unescaped postambles, so that the faults hit whole frames
+static void usb_task(int fd)
+{
+    usb_t& u = usb();
+    std::uniform_real_distribution<float> uniform(0, 1);
+    std::vector<uint8_t> frame;
+    bool escape_state = false;
+    uint8_t buf[1024];
+    auto slot = std::chrono::steady_clock::now();
+    size_t budget = USB_BYTES_PER_MS;
+    while (true)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        if (std::chrono::steady_clock::now() > slot + std::chrono::milliseconds(1))
+        {
+            slot = std::chrono::steady_clock::now(); //Idle bus
+            budget = USB_BYTES_PER_MS;
+        }
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t b = buf[i];
+            frame.push_back(b);
+            if (escape_state)
+            {
+                escape_state = false;
+                continue;
+            }
+            if (b == escape) escape_state = true;
+            if (b != postamble) continue;
+            u.frames_received++;
+            if (u.drop > 0 && uniform(u.faults) < u.drop)
+            {
+                frame.clear();
+                continue;
+            }
+            if (u.corrupt > 0 && uniform(u.faults) < u.corrupt && frame.size() >= 2)
+            {
+                uint8_t& last = frame[frame.size() - 2]; //Last CRC byte: the frame keeps its shape
+                for (uint8_t mask = 1; mask; mask <<= 1)
+                {
+                    uint8_t v = last ^ mask;
+                    if (v != preamble && v != postamble && v != escape)
+                    {
+                        last = v;
+                        break;
+                    }
+                }
+            }
+            usb_deliver(u, frame.data(), frame.size(), slot, budget);
+            frame.clear();
+        }
+    }
+    int current = fd;
+    u.fd.compare_exchange_strong(current, -1); //Unless usb_connect() has moved on to a new pair already
+    close(fd);
+}
+
+namespace idf_host
+{
+    int usb_connect()
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+        usb().fd = fds[0];
+        std::thread(usb_task, fds[0]).detach();
+        return fds[1];
+    }
+
+    void set_usb_rx_faults(float drop, float corrupt, uint32_t seed)
+    {
+        usb().drop = drop;
+        usb().corrupt = corrupt;
+        usb().faults.seed(seed);
+    }
+
+    size_t get_usb_frames_received()
+    {
+        return usb().frames_received;
+    }
+
+    void flash_erase()
+    {
+        std::lock_guard<std::mutex> lock(flash().mutex);
+        flash().nvs.clear();
+        std::fill(flash().profiles.begin(), flash().profiles.end(), 0xff);
+    }
+}
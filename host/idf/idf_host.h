@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/***
+ * The ESP-IDF subset under host/idf, on host threads and memory: enough to link firmware sources (my_uart.cpp,
+ * my_params.cpp, my_profile_store.cpp) into host tests and benchmarks, with the stand-ins of host_modules.cpp for the
+ * hardware-facing modules. One boot per process: the firmware's init() functions run once.
+ */
+
+namespace idf_host
+{
+    // Connects the CDC port to one end of a socket pair and returns the other end, for sensor_client::attach().
+    // Bytes from the host reach the TinyUSB RX callback in 64-byte packets at the full-speed bulk rate. Can be
+    // called again once the previous client has closed its end, like replugging the cable
+    int usb_connect();
+    // Frames from the host are lost with probability `drop`, or fail their CRC with probability `corrupt`, like
+    // device_sim::set_rx_faults(). Seeded, so that a run can be repeated. Call before usb_connect()
+    void set_usb_rx_faults(float drop, float corrupt, uint32_t seed = 1);
+    size_t get_usb_frames_received(); // Complete frames from the host, dropped ones included
+    void flash_erase(); // NVS and the data partitions back to erased, before the firmware's init()
+}
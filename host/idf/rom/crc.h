@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len); // Inverts on entry and exit, like the ROM routine
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+// The options of ../../sdkconfig the host-built firmware sources read
+#define CONFIG_IDF_TARGET "esp32s3"
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ 160
+#define CONFIG_TINYUSB_CDC_RX_BUFSIZE 1000
+#define CONFIG_TINYUSB_CDC_TX_BUFSIZE 10000
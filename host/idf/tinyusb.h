@@ -0,0 +1,11 @@
+#pragma once
+#include "esp_err.h"
+
+typedef struct
+{
+    const void* descriptor;
+    const char** string_descriptor;
+    bool external_phy;
+} tinyusb_config_t;
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t* config);
@@ -0,0 +1,67 @@
+/***
+ * Decodes a raw capture of the USB CDC stream (e.g. `cat /dev/ttyACM0 > trace.bin`)
+ * and prints the PID trace records as CSV. Other frames are skipped.
+ * Usage: pid_trace_decode [capture] > trace.csv   (reads stdin without arguments)
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "pid_trace_format.h"
+
+int main(int argc, char** argv)
+{
+    FILE* in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (in == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    protocol::frame_decoder decoder;
+    protocol::frame_t frame;
+    uint64_t time_offset = 0; // unwraps the 32-bit device timestamp
+    uint32_t last_ts = 0;
+    uint32_t last_seq = 0;
+    uint32_t last_dropped = 0;
+    bool first = true;
+    size_t packets = 0, records = 0, seq_gaps = 0;
+
+    printf("time_us,sensor,setpoint,temp,p_term,i_term,ff_term,voltage,dac_code\n");
+    int c;
+    while ((c = fgetc(in)) != EOF)
+    {
+        if (!decoder.feed(static_cast<uint8_t>(c), frame) || frame.cmd != CMD_PID_TRACE) continue;
+        if (frame.payload.size() < sizeof(pid_trace_header_t)) continue;
+        pid_trace_header_t h;
+        memcpy(&h, frame.payload.data(), sizeof(h));
+        if (h.record_size != sizeof(pid_trace_record_t) ||
+            frame.payload.size() != sizeof(h) + h.count * sizeof(pid_trace_record_t))
+        {
+            fprintf(stderr, "Packet #%u: unexpected layout\n", h.seq);
+            continue;
+        }
+        if (!first && h.seq != last_seq + 1) seq_gaps++;
+        if (!first && h.dropped != last_dropped) fprintf(stderr, "Packet #%u: %u records dropped on device\n", h.seq, h.dropped - last_dropped);
+        last_seq = h.seq;
+        last_dropped = h.dropped;
+        packets++;
+        for (size_t i = 0; i < h.count; i++)
+        {
+            pid_trace_record_t r;
+            memcpy(&r, frame.payload.data() + sizeof(h) + i * sizeof(r), sizeof(r));
+            //Sensors on different cores may queue slightly out of order, only a large step back is a wrap
+            if (!first && r.timestamp_us < last_ts && last_ts - r.timestamp_us > (1u << 31)) time_offset += 1ull << 32;
+            first = false;
+            last_ts = r.timestamp_us;
+            printf("%llu,%u,%.3f,%.3f,%.6f,%.6f,%.6f,%.4f,%u\n", static_cast<unsigned long long>(time_offset + r.timestamp_us),
+                r.sensor, r.setpoint, r.temp, r.p_term, r.i_term, r.ff_term, r.voltage, r.dac_code);
+            records++;
+        }
+    }
+    fprintf(stderr, "%zu packets, %zu records, %zu sequence gaps, %zu CRC errors\n",
+        packets, records, seq_gaps, decoder.get_crc_errors());
+    if (in != stdin) fclose(in);
+    return 0;
+}
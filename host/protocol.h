@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "my_protocol.h"
+
+/***
+ * Host side of the USB CDC framing implemented in main/my_uart.cpp:
+ * preamble, escaped (cmd, payload, wdt counter, CRC32), postamble.
+ */
+
+namespace protocol
+{
+    // Same semantics as the ESP32 ROM routine (inverts on entry and exit)
+    inline uint32_t crc32_le(uint32_t crc, const uint8_t* buf, size_t len)
+    {
+        crc = ~crc;
+        while (len--)
+        {
+            crc ^= *buf++;
+            for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+        }
+        return ~crc;
+    }
+
+    inline uint32_t frame_crc(uint8_t cmd, const uint8_t* payload, size_t len, uint8_t wdt)
+    {
+        uint32_t crc = crc32_le(~0u, &cmd, 1);
+        crc = crc32_le(crc, payload, len);
+        return ~crc32_le(crc, &wdt, 1);
+    }
+
+    struct frame_t
+    {
+        uint8_t cmd;
+        uint8_t wdt;
+        std::vector<uint8_t> payload;
+    };
+
+    inline void escape_byte(std::vector<uint8_t>& out, uint8_t b)
+    {
+        if (b == preamble || b == postamble || b == escape) out.push_back(escape);
+        out.push_back(b);
+    }
+
+    // Appends a complete escaped frame to out
+    inline void encode_frame(std::vector<uint8_t>& out, uint8_t cmd, const void* payload, size_t len, uint8_t wdt)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(payload);
+        uint32_t crc = frame_crc(cmd, p, len, wdt);
+        out.push_back(preamble);
+        escape_byte(out, cmd);
+        for (size_t i = 0; i < len; i++) escape_byte(out, p[i]);
+        escape_byte(out, wdt);
+        for (size_t i = 0; i < sizeof(crc); i++) escape_byte(out, static_cast<uint8_t>(crc >> (8 * i)));
+        out.push_back(postamble);
+    }
+
+    class frame_decoder
+    {
+    private:
+        std::vector<uint8_t> body; // unescaped payload, wdt, crc. Handed over to the frame without copying
+        uint8_t cmd = 0;
+        bool have_cmd = false;
+        bool in_frame = false;
+        bool escape_state = false;
+        size_t crc_errors = 0;
+        size_t format_errors = 0;
+
+    public:
+        // Returns true when a complete frame with a valid CRC has been decoded into f
+        bool feed(uint8_t b, frame_t& f)
+        {
+            if (escape_state)
+            {
+                escape_state = false;
+                if (in_frame) push(b);
+                return false;
+            }
+            switch (b)
+            {
+            case escape:
+                escape_state = true;
+                return false;
+            case preamble:
+                if (in_frame) format_errors++;
+                in_frame = true;
+                have_cmd = false;
+                body.clear();
+                return false;
+            case postamble:
+                if (!in_frame) return false;
+                in_frame = false;
+                return finish(f);
+            default:
+                if (in_frame) push(b);
+                return false;
+            }
+        }
+
+        size_t get_crc_errors() const { return crc_errors; }
+        size_t get_format_errors() const { return format_errors; }
+
+    private:
+        void push(uint8_t b)
+        {
+            if (have_cmd)
+            {
+                body.push_back(b);
+            }
+            else
+            {
+                cmd = b;
+                have_cmd = true;
+            }
+        }
+
+        bool finish(frame_t& f)
+        {
+            if (!have_cmd || body.size() < 5) // wdt + crc
+            {
+                format_errors++;
+                return false;
+            }
+            size_t payload_len = body.size() - 5;
+            uint32_t crc = 0;
+            for (size_t i = 0; i < 4; i++) crc |= static_cast<uint32_t>(body[payload_len + 1 + i]) << (8 * i);
+            uint8_t wdt = body[payload_len];
+            if (frame_crc(cmd, body.data(), payload_len, wdt) != crc)
+            {
+                crc_errors++;
+                return false;
+            }
+            f.cmd = cmd;
+            f.wdt = wdt;
+            body.resize(payload_len);
+            f.payload.swap(body); // The payload starts at offset 0 of its own allocation, so it stays aligned
+            return true;
+        }
+    };
+}
@@ -0,0 +1,480 @@
+/***
+ * Starts the sensors and dumps the cycles as CSV (sensor,seq,index,temp,res,timestamp_us).
+ * Usage: sensor_acquire [-d device | -s] [-m sensors] [-n cycles] [-w window] [-F segments | -A cycles | -B alpha | -E step] [-b requests] [-r rounds]
+ *   -d  serial device (default /dev/ttyACM0)
+ *   -s  use the built-in pty device stand-in instead of hardware
+ *   -m  sensors to acquire from, round robin (default 1). Also the stand-in's sensor count
+ *   -n  cycles to acquire per sensor (default 10)
+ *   -w  requests in flight (default 8, 1 = strict request/response)
+ *   -F  acquire per-cycle features instead of points (CSV sensor,seq,segment,points,mean,min,max,slope,r,area),
+ *       the cycle split into this many equal segments, with probes at 350, 400 and 450 K
+ *   -A  acquire coherent averages of this many cycles instead of single cycles (CSV sensor,seq,index,temp,res,var),
+ *       -n counts averages
+ *   -B  baseline-normalize the points (R / R_baseline) with this weight per cycle, e.g. 0.05
+ *   -E  log event frames (CSV sensor,seq,timestamp_us,index,active,raised,cleared,suppressed,response,rate,cusum)
+ *       over -n cycles of baseline learning, -n cycles of exposure and -n cycles of recovery. The stand-in
+ *       multiplies R by this factor during the exposure and the detection and transport latencies are printed
+ *   -b  don't acquire, time this many CMD_GET_HAVE_DATA round trips instead
+ *   -r  don't acquire, time a full reconfiguration (heater, measure, PID, 4 ADC, DAC, NVS save)
+ *       sent as separate commands vs as one CMD_BATCH, this many times. Writes NVS on real hardware!
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "sensor_client.h"
+#include "device_sim.h"
+
+using namespace protocol;
+using std::chrono::steady_clock;
+
+static double seconds_since(steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(steady_clock::now() - t).count();
+}
+
+static int bench(sensor_client& client, size_t requests, size_t window)
+{
+    std::deque<std::future<reply_t>> in_flight;
+    size_t failed = 0;
+    auto t = steady_clock::now();
+    for (size_t i = 0; i < requests; i++)
+    {
+        if (in_flight.size() >= window)
+        {
+            if (sensor_client::status(in_flight.front().get()) < 0) failed++;
+            in_flight.pop_front();
+        }
+        in_flight.push_back(client.submit(CMD_GET_HAVE_DATA));
+    }
+    for (auto& f : in_flight)
+    {
+        if (sensor_client::status(f.get()) < 0) failed++;
+    }
+    double s = seconds_since(t);
+    fprintf(stderr, "%zu requests, window %zu: %.3f s, %.0f req/s, %zu failed\n", requests, window, s, requests / s, failed);
+    return failed ? 1 : 0;
+}
+
+static void reconfigure(batch_builder& b)
+{
+    heater_params heater = { 0.0039f, 10, 293 };
+    measure_params measure = { 1000 };
+    my_pid_params_t pid = {};
+    my_dac_cal_t dac = { 1, 0 };
+    b.set_heater_params(heater);
+    b.set_measure_params(measure);
+    b.set_pid_params(pid);
+    for (uint8_t i = 0; i < 4; i++) b.set_adc_cal(i, 1, 0);
+    b.set_dac_cal(dac);
+    b.save_nvs();
+}
+
+static int bench_reconfigure(sensor_client& client, size_t rounds)
+{
+    batch_builder b;
+    reconfigure(b);
+    const batch_entry_header* entries[BATCH_MAX_COMMANDS];
+    int count = batch_split(b.get_body().data(), b.get_body().size(), entries, BATCH_MAX_COMMANDS);
+    size_t failed = 0;
+
+    client.set_window(1); //Each setting waits for its acknowledgement, as a plain client would
+    auto t = steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (client.command(entries[i]->cmd, batch_args(entries[i]), entries[i]->length) != RSP_OK) failed++;
+        }
+    }
+    double separate = seconds_since(t);
+
+    t = steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        batch_view v(client.submit_batch(b).get());
+        if (!v.valid() || v.result() != RSP_OK) failed++;
+    }
+    double batched = seconds_since(t);
+    fprintf(stderr, "%zu reconfigurations: %d round trips each %.3f ms, 1 batch %.3f ms; %zu failed\n",
+        rounds, count, separate * 1000 / rounds, batched * 1000 / rounds, failed);
+    return failed ? 1 : 0;
+}
+
+static int acquire(sensor_client& client, size_t sensors, size_t cycles, size_t window, float baseline_alpha)
+{
+    baseline_config_t baseline = { baseline_normalize, 0, 0, baseline_alpha, 0.05f };
+    for (size_t s = 0; s < sensors; s++)
+    {
+        int rsp = sensor_client::status(client.select_sensor(s).get());
+        if (rsp == RSP_OK && baseline_alpha > 0) rsp = client.set_baseline(baseline);
+        if (rsp == RSP_OK) rsp = client.start();
+        if (rsp != RSP_OK && rsp != RSP_ALREADY_IN_REQUESTED_STATE)
+        {
+            fprintf(stderr, "Sensor %zu START failed: %d\n", s, rsp);
+            return 1;
+        }
+    }
+    rates_t rates;
+    if (client.get_rates(rates))
+    {
+        fprintf(stderr, "Control loop %u Hz (%u..%u ticks of %u Hz, measured %.2f Hz), telemetry %u Hz\n", rates.loop_rate,
+            rates.loop_period_min, rates.loop_period_max, rates.clock_rate, rates.measured_loop_rate, rates.point_rate);
+    }
+    printf("sensor,seq,index,temp,res,timestamp_us\n");
+    struct request_t
+    {
+        size_t sensor;
+        std::future<reply_t> selected;
+        std::future<reply_t> data;
+    };
+    std::deque<request_t> in_flight;
+    std::vector<size_t> received(sensors, 0);
+    size_t total = 0, points = 0, next = 0;
+    auto t = steady_clock::now();
+    while (total < sensors * cycles)
+    {
+        while (in_flight.size() < window)
+        {
+            auto selected = client.select_sensor(next);
+            in_flight.push_back({ next, std::move(selected), client.get_data() });
+            next = (next + 1) % sensors;
+        }
+        request_t r = std::move(in_flight.front());
+        in_flight.pop_front();
+        if (sensor_client::status(r.selected.get()) != RSP_OK)
+        {
+            fprintf(stderr, "Sensor %zu can't be selected\n", r.sensor);
+            return 1;
+        }
+        reply_t f = r.data.get();
+        cycle_view c(f);
+        if (!c.valid())
+        {
+            if (!f) fprintf(stderr, "GET_DATA timed out\n");
+            usleep(10000 / sensors); //Nothing ready yet
+            continue;
+        }
+        if (received[r.sensor] >= cycles) continue; //This sensor is done, the others aren't
+        for (size_t i = 0; i < c.size(); i++)
+        {
+            printf("%zu,%u,%zu,%.3f,%.3f,%u\n", r.sensor, c.seq(), i, c.temp(i), c.res(i), c.timestamp_us(i));
+        }
+        received[r.sensor]++;
+        total++;
+        points += c.size();
+    }
+    for (auto& r : in_flight) r.data.wait(); //Cycles fetched by these are discarded
+    double s = seconds_since(t);
+    for (size_t i = 0; i < sensors; i++)
+    {
+        client.select_sensor(i).wait();
+        if (baseline_alpha > 0)
+        {
+            baseline.mode = baseline_off;
+            client.set_baseline(baseline);
+        }
+        client.stop();
+    }
+    client_stats_t st = client.get_stats();
+    fprintf(stderr, "%zu sensors: %zu cycles, %zu points in %.3f s, %.0f points/s; %zu frames sent, %zu received, %zu timeouts, %zu missed, %zu CRC errors\n",
+        sensors, total, points, s, points / s, st.sent, st.received, st.timeouts, st.missed, st.crc_errors);
+    return 0;
+}
+
+static int acquire_features(sensor_client& client, size_t sensors, size_t cycles, size_t segments)
+{
+    feature_config_t config = {};
+    config.mode = features_only;
+    config.segment_count = segments;
+    for (size_t i = 0; i < segments; i++) config.segment_starts[i] = i * CYCLE_LENGTH / segments;
+    const float probes[] = { 350, 400, 450 };
+    config.probe_count = sizeof(probes) / sizeof(probes[0]);
+    memcpy(config.probe_temps, probes, sizeof(probes));
+    for (size_t s = 0; s < sensors; s++)
+    {
+        int rsp = sensor_client::status(client.select_sensor(s).get());
+        if (rsp == RSP_OK) rsp = client.set_features(config);
+        if (rsp == RSP_OK) rsp = client.start();
+        if (rsp != RSP_OK && rsp != RSP_ALREADY_IN_REQUESTED_STATE)
+        {
+            fprintf(stderr, "Sensor %zu feature setup failed: %d\n", s, rsp);
+            return 1;
+        }
+    }
+    printf("sensor,seq,segment,points,mean,min,max,slope,r,area\n");
+    std::vector<size_t> received(sensors, 0);
+    size_t total = 0, bytes = 0, next = 0;
+    auto t = steady_clock::now();
+    while (total < sensors * cycles)
+    {
+        size_t s = next;
+        next = (next + 1) % sensors;
+        if (received[s] >= cycles) continue;
+        client.select_sensor(s).wait();
+        reply_t f = client.get_features().get();
+        feature_view v(f);
+        if (!v.valid())
+        {
+            if (!f) fprintf(stderr, "GET_FEATURES timed out\n");
+            usleep(10000 / sensors); //Nothing ready yet
+            continue;
+        }
+        for (size_t i = 0; i < v.segments(); i++)
+        {
+            feature_segment_t g = v.segment(i);
+            printf("%zu,%u,%zu,%u,%.5f,%.5f,%.5f,%.6g,%.5f,%.1f\n", s, v.seq(), i, g.points, g.log_res_mean,
+                g.log_res_min, g.log_res_max, g.slope, g.r, g.area);
+        }
+        received[s]++;
+        total++;
+        bytes += f->payload.size();
+    }
+    double secs = seconds_since(t);
+    for (size_t i = 0; i < sensors; i++)
+    {
+        client.select_sensor(i).wait();
+        config.mode = features_off;
+        client.set_features(config);
+        client.stop();
+    }
+    size_t point_bytes = sizeof(uint32_t) + CYCLE_LENGTH * FLOATS_PER_POINT * sizeof(float);
+    fprintf(stderr, "%zu sensors: %zu reports in %.3f s, %zu bytes per report (%zu per cycle as points)\n",
+        sensors, total, secs, bytes / (total ? total : 1), point_bytes);
+    return 0;
+}
+
+static int acquire_averages(sensor_client& client, size_t sensors, size_t averages, uint16_t cycles)
+{
+    average_config_t config = { cycles, 0, 0 };
+    for (size_t s = 0; s < sensors; s++)
+    {
+        int rsp = sensor_client::status(client.select_sensor(s).get());
+        if (rsp == RSP_OK) rsp = client.set_averaging(config);
+        if (rsp == RSP_OK) rsp = client.start();
+        if (rsp != RSP_OK && rsp != RSP_ALREADY_IN_REQUESTED_STATE)
+        {
+            fprintf(stderr, "Sensor %zu averaging setup failed: %d\n", s, rsp);
+            return 1;
+        }
+    }
+    printf("sensor,seq,index,temp,res,var\n");
+    std::vector<size_t> received(sensors, 0);
+    size_t total = 0, bytes = 0, next = 0;
+    auto t = steady_clock::now();
+    while (total < sensors * averages)
+    {
+        size_t s = next;
+        next = (next + 1) % sensors;
+        if (received[s] >= averages) continue;
+        client.select_sensor(s).wait();
+        reply_t f = client.get_average().get();
+        average_view v(f);
+        if (!v.valid())
+        {
+            if (!f) fprintf(stderr, "GET_AVERAGE timed out\n");
+            usleep(10000 / sensors); //Nothing ready yet
+            continue;
+        }
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            printf("%zu,%u,%zu,%.3f,%.3f,%.5f\n", s, v.seq(), i, v.temp(i), v.res(i), v.res_variance(i));
+        }
+        received[s]++;
+        total++;
+        bytes += f->payload.size();
+    }
+    double secs = seconds_since(t);
+    for (size_t i = 0; i < sensors; i++)
+    {
+        client.select_sensor(i).wait();
+        config.cycles = 0;
+        client.set_averaging(config);
+        client.stop();
+    }
+    size_t point_bytes = sizeof(uint32_t) + CYCLE_LENGTH * FLOATS_PER_POINT * sizeof(float);
+    fprintf(stderr, "%zu sensors: %zu averages of %u cycles in %.3f s, %zu bytes each (%zu for the cycles as points)\n",
+        sensors, total, cycles, secs, bytes / (total ? total : 1), point_bytes * cycles);
+    return 0;
+}
+
+//Drains the cycle rings until every sensor has produced this many more cycles
+static bool wait_cycles(sensor_client& client, size_t sensors, size_t cycles)
+{
+    std::vector<size_t> received(sensors, 0);
+    size_t total = 0, next = 0;
+    while (total < sensors * cycles)
+    {
+        size_t s = next;
+        next = (next + 1) % sensors;
+        if (received[s] >= cycles) continue;
+        client.select_sensor(s).wait();
+        reply_t f = client.get_data().get();
+        if (!cycle_view(f).valid())
+        {
+            if (!f) return false;
+            usleep(10000 / sensors);
+            continue;
+        }
+        received[s]++;
+        total++;
+    }
+    return true;
+}
+
+static uint32_t steady_us()
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now().time_since_epoch()).count());
+}
+
+//The stand-in stamps its frames with the host's steady clock, so latencies are only printed against it
+static int acquire_events(sensor_client& client, size_t sensors, size_t cycles, float step, device_sim* sim)
+{
+    struct received_t
+    {
+        event_frame_t frame;
+        uint32_t host_us;
+    };
+    std::mutex mutex;
+    std::vector<received_t> events;
+    client.set_unsolicited_handler([&](const frame_t& f) {
+        if (f.cmd != CMD_EVENT || f.payload.size() != sizeof(event_frame_t)) return;
+        received_t r;
+        memcpy(&r.frame, f.payload.data(), sizeof(r.frame));
+        r.host_us = steady_us();
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(r);
+    });
+    baseline_config_t baseline = { baseline_normalize, 0, 0, 0.05f, 0.05f };
+    event_config_t config = { event_level | event_rate | event_cusum, 0, 200, 0.2f, 0.1f, 0.1f, 0.02f, 0.02f, 0.5f, 0.1f };
+    for (size_t s = 0; s < sensors; s++)
+    {
+        batch_builder b;
+        b.select_sensor(s);
+        b.set_baseline(baseline);
+        b.set_events(config);
+        batch_view v(client.submit_batch(b).get());
+        int rsp = v.valid() ? v.result() : -1;
+        if (rsp == RSP_OK) rsp = client.start();
+        if (rsp != RSP_OK && rsp != RSP_ALREADY_IN_REQUESTED_STATE)
+        {
+            fprintf(stderr, "Sensor %zu event setup failed: %d\n", s, rsp);
+            return 1;
+        }
+    }
+    bool ok = wait_cycles(client, sensors, cycles);
+    uint32_t exposed_us = steady_us();
+    if (sim) sim->set_gas(step);
+    ok = ok && wait_cycles(client, sensors, cycles);
+    if (sim) sim->set_gas(1);
+    ok = ok && wait_cycles(client, sensors, cycles);
+    for (size_t i = 0; i < sensors; i++)
+    {
+        client.select_sensor(i).wait();
+        config.detectors = 0;
+        client.set_events(config);
+        baseline.mode = baseline_off;
+        client.set_baseline(baseline);
+        client.stop();
+    }
+    client.set_unsolicited_handler(nullptr);
+    if (!ok) fprintf(stderr, "GET_DATA timed out\n");
+
+    printf("sensor,seq,timestamp_us,index,active,raised,cleared,suppressed,response,rate,cusum\n");
+    std::vector<double> detection(sensors, -1);
+    double transport_sum = 0, transport_max = 0;
+    for (auto& r : events)
+    {
+        const event_frame_t& e = r.frame;
+        printf("%u,%u,%u,%u,%u,%u,%u,%u,%.4f,%.4f,%.4f\n", e.sensor, e.seq, e.timestamp_us, e.index, e.active,
+            e.raised, e.cleared, e.suppressed, e.response, e.rate, e.cusum);
+        double transport = static_cast<uint32_t>(r.host_us - e.timestamp_us) / 1000.0;
+        transport_sum += transport;
+        if (transport > transport_max) transport_max = transport;
+        if (e.sensor < sensors && e.raised && detection[e.sensor] < 0 && e.timestamp_us - exposed_us < INT32_MAX)
+        {
+            detection[e.sensor] = (e.timestamp_us - exposed_us) / 1000.0;
+        }
+    }
+    fprintf(stderr, "%zu event frames from %zu sensors\n", events.size(), sensors);
+    if (sim && !events.empty())
+    {
+        for (size_t i = 0; i < sensors; i++) fprintf(stderr, "Sensor %zu: raised %.2f ms after the exposure\n", i, detection[i]);
+        fprintf(stderr, "Frame to host: %.2f ms mean, %.2f ms max\n", transport_sum / events.size(), transport_max);
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = "/dev/ttyACM0";
+    bool sim = false;
+    size_t sensors = 1, cycles = 10, window = 8, bench_requests = 0, bench_rounds = 0, segments = 0, average_cycles = 0;
+    float baseline_alpha = 0, event_step = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:sm:n:w:F:A:B:E:b:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': device = optarg; break;
+        case 's': sim = true; break;
+        case 'm': sensors = strtoul(optarg, NULL, 0); break;
+        case 'n': cycles = strtoul(optarg, NULL, 0); break;
+        case 'w': window = strtoul(optarg, NULL, 0); break;
+        case 'F': segments = strtoul(optarg, NULL, 0); break;
+        case 'A': average_cycles = strtoul(optarg, NULL, 0); break;
+        case 'B': baseline_alpha = strtof(optarg, NULL); break;
+        case 'E': event_step = strtof(optarg, NULL); break;
+        case 'b': bench_requests = strtoul(optarg, NULL, 0); break;
+        case 'r': bench_rounds = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device | -s] [-m sensors] [-n cycles] [-w window] [-F segments | -A cycles | -B alpha | -E step] [-b requests] [-r rounds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    device_sim stand_in;
+    if (sim)
+    {
+        stand_in.set_cycle(CYCLE_LENGTH, std::chrono::milliseconds(100));
+        stand_in.set_sensors(sensors);
+        if (!stand_in.start())
+        {
+            perror("pty");
+            return 1;
+        }
+        device = stand_in.get_path();
+    }
+    sensor_client client;
+    if (!client.open(device))
+    {
+        perror(device);
+        return 1;
+    }
+    client.set_window(window);
+    if (bench_rounds) return bench_reconfigure(client, bench_rounds);
+    if (sensors == 0 || sensors > UINT8_MAX)
+    {
+        fprintf(stderr, "Bad sensor count\n");
+        return 2;
+    }
+    if (segments > FEATURE_MAX_SEGMENTS)
+    {
+        fprintf(stderr, "Bad segment count\n");
+        return 2;
+    }
+    if (segments) return acquire_features(client, sensors, cycles, segments);
+    if (average_cycles > UINT16_MAX)
+    {
+        fprintf(stderr, "Bad averaging cycle count\n");
+        return 2;
+    }
+    if (average_cycles) return acquire_averages(client, sensors, cycles, average_cycles);
+    if (event_step > 0) return acquire_events(client, sensors, cycles, event_step, sim ? &stand_in : NULL);
+    return bench_requests ? bench(client, bench_requests, window) : acquire(client, sensors, cycles, window, baseline_alpha);
+}
@@ -0,0 +1,385 @@
+#include "sensor_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define READ_CHUNK_SIZE 4096
+#define POLL_PERIOD_MS 20 //Timeout resolution
+#define UPLOAD_ROUNDS 16 //Chunk passes of upload_profile(), and attempts of its BEGIN and COMMIT
+
+namespace protocol
+{
+    sensor_client::sensor_client()
+    {
+    }
+
+    sensor_client::~sensor_client()
+    {
+        close();
+    }
+
+    bool sensor_client::open(const char* path)
+    {
+        int d = ::open(path, O_RDWR | O_NOCTTY);
+        if (d < 0) return false;
+        struct termios t;
+        if (tcgetattr(d, &t) != 0)
+        {
+            ::close(d);
+            return false;
+        }
+        cfmakeraw(&t);
+        t.c_cc[VMIN] = 0;
+        t.c_cc[VTIME] = 0;
+        if (tcsetattr(d, TCSANOW, &t) != 0)
+        {
+            ::close(d);
+            return false;
+        }
+        tcflush(d, TCIOFLUSH);
+        return attach(d);
+    }
+
+    bool sensor_client::attach(int d)
+    {
+        if (d < 0 || is_open()) return false;
+        fd = d;
+        wdt = 0;
+        device_wdt_valid = false;
+        running = true;
+        reader = std::thread(&sensor_client::reader_task, this);
+        return true;
+    }
+
+    void sensor_client::close()
+    {
+        if (!is_open()) return;
+        running = false;
+        if (reader.joinable()) reader.join();
+        ::close(fd);
+        fd = -1;
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        for (auto& p : pending) p.promise.set_value(reply_t());
+        pending.clear();
+        window_cv.notify_all();
+    }
+
+    void sensor_client::set_window(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        window = std::max<size_t>(n, 1);
+        window_cv.notify_all();
+    }
+
+    void sensor_client::set_timeout(std::chrono::milliseconds t)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        timeout = t;
+    }
+
+    void sensor_client::set_unsolicited_handler(unsolicited_handler_t h)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        unsolicited = h;
+    }
+
+    client_stats_t sensor_client::get_stats() const
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        return stats;
+    }
+
+    bool batch_builder::add(uint8_t cmd, const void* args, size_t len)
+    {
+        if (count >= BATCH_MAX_COMMANDS || len > UINT8_MAX ||
+            body.size() + sizeof(batch_entry_header) + len > BATCH_MAX_SIZE) return false;
+        batch_entry_header e = { cmd, static_cast<uint8_t>(len) };
+        body.insert(body.end(), reinterpret_cast<const uint8_t*>(&e), reinterpret_cast<const uint8_t*>(&e) + sizeof(e));
+        body.insert(body.end(), static_cast<const uint8_t*>(args), static_cast<const uint8_t*>(args) + len);
+        count++;
+        return true;
+    }
+
+    bool batch_builder::set_adc_cal(uint8_t channel, float gain, float offset)
+    {
+        uint8_t args[sizeof(channel) + 2 * sizeof(float)]; // index, my_adc_cal_t
+        args[0] = channel;
+        memcpy(args + 1, &gain, sizeof(gain));
+        memcpy(args + 1 + sizeof(gain), &offset, sizeof(offset));
+        return add(CMD_SET_ADC_CAL, args, sizeof(args));
+    }
+
+    void batch_builder::clear()
+    {
+        body.clear();
+        count = 0;
+    }
+
+    std::future<reply_t> sensor_client::submit(uint8_t cmd, const void* args, size_t len)
+    {
+        return submit(cmd, args, len, -1);
+    }
+
+    std::future<reply_t> sensor_client::submit_batch(const batch_builder& b)
+    {
+        std::vector<uint8_t> args(sizeof(batch_header));
+        batch_header h;
+        h.request_id = request_id++;
+        h.size = b.get_body().size();
+        memcpy(args.data(), &h, sizeof(h));
+        args.insert(args.end(), b.get_body().begin(), b.get_body().end());
+        return submit(CMD_BATCH, args.data(), args.size(), h.request_id);
+    }
+
+    std::future<reply_t> sensor_client::submit(uint8_t cmd, const void* args, size_t len, int32_t id)
+    {
+        pending_t p;
+        p.cmd = cmd;
+        p.request_id = id;
+        std::future<reply_t> ret = p.promise.get_future();
+        if (!is_open())
+        {
+            p.promise.set_value(reply_t());
+            return ret;
+        }
+        //The frame has to hit the wire in the same order the request is queued
+        std::lock_guard<std::mutex> write_lock(write_mutex);
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            window_cv.wait(lock, [this] { return pending.size() < window || !running; });
+            if (!running)
+            {
+                p.promise.set_value(reply_t());
+                return ret;
+            }
+            p.deadline = std::chrono::steady_clock::now() + timeout;
+            pending.push_back(std::move(p));
+            stats.sent++;
+        }
+        tx_buffer.clear();
+        encode_frame(tx_buffer, cmd, args, len, ++wdt); //The firmware expects the counter to increment by one per frame
+        //On failure the request just expires: a partial frame is discarded by the device parser on the next preamble
+        write_all(tx_buffer.data(), tx_buffer.size());
+        return ret;
+    }
+
+    int sensor_client::status(const reply_t& r)
+    {
+        if (!r || r->payload.size() != 1) return -1;
+        return r->payload[0];
+    }
+
+    int sensor_client::command(uint8_t cmd, const void* args, size_t len)
+    {
+        return status(submit(cmd, args, len).get());
+    }
+
+    bool sensor_client::get_baseline(baseline_state_t<CYCLE_LENGTH>& out)
+    {
+        reply_t r = submit(CMD_GET_BASELINE).get();
+        if (!r || r->cmd != CMD_GET_BASELINE || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    bool sensor_client::get_rates(rates_t& out)
+    {
+        reply_t r = submit(CMD_GET_RATES).get();
+        if (!r || r->cmd != CMD_GET_RATES || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    bool sensor_client::get_trend(trend_report_t& out)
+    {
+        reply_t r = submit(CMD_GET_TREND).get();
+        if (!r || r->cmd != CMD_GET_TREND || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    bool sensor_client::get_power(power_report_t& out)
+    {
+        reply_t r = submit(CMD_GET_POWER).get();
+        if (!r || r->cmd != CMD_GET_POWER || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    bool sensor_client::get_boot(boot_report_t& out)
+    {
+        reply_t r = submit(CMD_GET_BOOT).get();
+        if (!r || r->cmd != CMD_GET_BOOT || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    bool sensor_client::get_upload_status(profile_upload_status& out)
+    {
+        reply_t r = submit(CMD_PROFILE_STATUS).get();
+        if (!r || r->cmd != CMD_PROFILE_STATUS || r->payload.size() != sizeof(out)) return false;
+        memcpy(&out, r->payload.data(), sizeof(out));
+        return true;
+    }
+
+    int sensor_client::upload_profile(const float* points, size_t length)
+    {
+        if (length == 0 || length > CYCLE_LENGTH) return -1;
+        uint16_t l = length;
+        int rsp = -1;
+        for (size_t i = 0; i < UPLOAD_ROUNDS && (rsp < 0 || rsp == RSP_BAD_CRC); i++) rsp = command(CMD_PROFILE_BEGIN, &l, sizeof(l));
+        if (rsp != RSP_OK) return rsp;
+
+        //After a lost frame the chunk replies no longer line up with their requests: only the status is trusted
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(points);
+        size_t total = length * sizeof(float);
+        std::vector<uint8_t> args;
+        std::deque<std::future<reply_t>> chunks;
+        size_t from = 0; //bytes
+        bool complete = false;
+        for (size_t round = 0; round < UPLOAD_ROUNDS && !complete; round++)
+        {
+            for (size_t offset = from; offset < total; offset += PROFILE_CHUNK_MAX)
+            {
+                profile_chunk_header h;
+                h.offset = offset;
+                h.length = std::min<size_t>(PROFILE_CHUNK_MAX, total - offset);
+                h.crc = ~crc32_le(~0u, data + offset, h.length);
+                args.assign(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+                args.insert(args.end(), data + offset, data + offset + h.length);
+                chunks.push_back(submit(CMD_PROFILE_CHUNK, args.data(), args.size()));
+            }
+            for (auto& f : chunks) f.wait();
+            chunks.clear();
+            profile_upload_status st;
+            if (!get_upload_status(st)) continue; //Resend the same range
+            if (st.length != length) return RSP_SET_FAILED; //Restarted or discarded meanwhile
+            from = st.first_missing * sizeof(float);
+            complete = st.first_missing == length;
+        }
+        if (!complete) return -1; //The upload stays open: CMD_PROFILE_STATUS tells where to resume
+
+        uint32_t crc = ~crc32_le(~0u, data, total);
+        for (size_t i = 0; i < UPLOAD_ROUNDS; i++)
+        {
+            rsp = command(CMD_PROFILE_COMMIT, &crc, sizeof(crc));
+            if (rsp >= 0 && rsp != RSP_BAD_CRC) return rsp; //The frame may have been corrupted rather than the profile
+            profile_upload_status st;
+            if (get_upload_status(st) && st.length == 0) return RSP_OK; //Committed, only the reply has been lost
+        }
+        return rsp;
+    }
+
+    bool sensor_client::expects(uint8_t request, uint8_t response)
+    {
+        if (request == response) return true;
+        return request == CMD_GET_DATA_SEQ && response == CMD_GET_DATA; //Found cycles are sent as CMD_GET_DATA
+    }
+
+    bool sensor_client::write_all(const uint8_t* buf, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = ::write(fd, buf, len);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN)
+                {
+                    struct pollfd p = { fd, POLLOUT, 0 };
+                    poll(&p, 1, POLL_PERIOD_MS);
+                    continue;
+                }
+                return false;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void sensor_client::dispatch(frame_t& f)
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        stats.received++;
+        if (device_wdt_valid && f.wdt != static_cast<uint8_t>(device_wdt + 1))
+        {
+            stats.missed += static_cast<uint8_t>(f.wdt - device_wdt - 1);
+        }
+        device_wdt = f.wdt;
+        device_wdt_valid = true;
+
+        auto it = pending.end();
+        if (f.cmd == CMD_BATCH && f.payload.size() >= sizeof(batch_response_header))
+        {
+            batch_response_header h;
+            memcpy(&h, f.payload.data(), sizeof(h));
+            it = std::find_if(pending.begin(), pending.end(), [&h](const pending_t& p) { return p.request_id == h.request_id; });
+        }
+        if (it == pending.end())
+        {
+            it = std::find_if(pending.begin(), pending.end(), [&f](const pending_t& p) { return expects(p.cmd, f.cmd); });
+        }
+        if (it == pending.end())
+        {
+            stats.unsolicited++;
+            unsolicited_handler_t h = unsolicited;
+            lock.unlock();
+            if (h) h(f);
+            return;
+        }
+        std::promise<reply_t> p = std::move(it->promise);
+        pending.erase(it);
+        window_cv.notify_all();
+        lock.unlock();
+        p.set_value(std::make_shared<const frame_t>(std::move(f)));
+    }
+
+    void sensor_client::expire()
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto now = std::chrono::steady_clock::now();
+        stats.crc_errors = decoder.get_crc_errors();
+        stats.format_errors = decoder.get_format_errors();
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (it->deadline > now)
+            {
+                ++it;
+                continue;
+            }
+            it->promise.set_value(reply_t());
+            it = pending.erase(it);
+            stats.timeouts++;
+            window_cv.notify_all();
+        }
+    }
+
+    void sensor_client::reader_task()
+    {
+        std::vector<uint8_t> buf(READ_CHUNK_SIZE);
+        frame_t f;
+        while (running)
+        {
+            struct pollfd p = { fd, POLLIN, 0 };
+            int r = poll(&p, 1, POLL_PERIOD_MS);
+            if (r > 0 && (p.revents & POLLIN))
+            {
+                ssize_t n = ::read(fd, buf.data(), buf.size());
+                for (ssize_t i = 0; i < n; i++)
+                {
+                    if (decoder.feed(buf[i], f)) dispatch(f);
+                }
+            }
+            else if (r > 0 && (p.revents & (POLLHUP | POLLERR)))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD_MS)); //pty without a peer yet
+            }
+            expire();
+        }
+    }
+}
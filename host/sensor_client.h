@@ -0,0 +1,316 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "protocol.h"
+#include "my_pid.h"
+#include "my_dac.h"
+#include "heater_guard.h"
+#include "cycle_features.h"
+#include "cycle_average.h"
+#include "baseline_tracker.h"
+#include "event_detector.h"
+#include "rate_scheduler.h"
+#include "filter_bank.h"
+#include "heater_model.h"
+
+/***
+ * Host client for the USB CDC protocol (Linux, termios).
+ * Requests are pipelined: up to `window` commands may be in flight, the firmware answers them in order,
+ * each reply is matched to the oldest pending request that expects its command code.
+ * Frames no request is waiting for (CMD_PID_TRACE etc.) go to the unsolicited handler, on the reader thread.
+ */
+
+namespace protocol
+{
+    typedef std::shared_ptr<const frame_t> reply_t; // NULL on timeout or disconnect
+
+    // CMD_GET_DATA payload, read in place: uint32_t seq, then (temp, res) pairs
+    class cycle_view
+    {
+    private:
+        reply_t frame;
+
+    public:
+        cycle_view() = default;
+        explicit cycle_view(reply_t f) : frame(f) {}
+
+        bool valid() const // false for RSP_NO_DATA and failed requests
+        {
+            return frame && frame->cmd == CMD_GET_DATA && frame->payload.size() >= sizeof(uint32_t) &&
+                (frame->payload.size() - sizeof(uint32_t)) % (sizeof(float) * FLOATS_PER_POINT) == 0;
+        }
+        uint32_t seq() const
+        {
+            uint32_t s;
+            memcpy(&s, frame->payload.data(), sizeof(s));
+            return s;
+        }
+        size_t size() const // points
+        {
+            return (frame->payload.size() - sizeof(uint32_t)) / (sizeof(float) * FLOATS_PER_POINT);
+        }
+        const float* data() const // temp, res, timestamp, temp, res, timestamp...
+        {
+            return reinterpret_cast<const float*>(frame->payload.data() + sizeof(uint32_t));
+        }
+        float temp(size_t i) const { return data()[i * FLOATS_PER_POINT]; }
+        float res(size_t i) const { return data()[i * FLOATS_PER_POINT + 1]; }
+        uint32_t timestamp_us(size_t i) const // Device monotonic timer, wraps after 71 minutes
+        {
+            uint32_t t;
+            memcpy(&t, data() + i * FLOATS_PER_POINT + 2, sizeof(t));
+            return t;
+        }
+    };
+
+    // CMD_GET_FEATURES payload, read in place, see cycle_features.h
+    class feature_view
+    {
+    private:
+        reply_t frame;
+        feature_report_header header = {};
+
+        size_t expected_size() const
+        {
+            return sizeof(header) + header.segment_count * sizeof(feature_segment_t) + 2 * header.probe_count * sizeof(float);
+        }
+        float probe(size_t i) const
+        {
+            float r;
+            memcpy(&r, frame->payload.data() + sizeof(header) + header.segment_count * sizeof(feature_segment_t) +
+                i * sizeof(float), sizeof(r));
+            return r;
+        }
+
+    public:
+        feature_view() = default;
+        explicit feature_view(reply_t f) : frame(f)
+        {
+            if (frame && frame->cmd == CMD_GET_FEATURES && frame->payload.size() >= sizeof(header))
+            {
+                memcpy(&header, frame->payload.data(), sizeof(header));
+            }
+        }
+
+        bool valid() const // false for RSP_NO_DATA and failed requests
+        {
+            return frame && frame->cmd == CMD_GET_FEATURES && frame->payload.size() >= sizeof(header) &&
+                frame->payload.size() == expected_size();
+        }
+        uint32_t seq() const { return header.seq; }
+        size_t points() const { return header.points; }
+        size_t segments() const { return header.segment_count; }
+        size_t probes() const { return header.probe_count; }
+        feature_segment_t segment(size_t i) const
+        {
+            feature_segment_t s;
+            memcpy(&s, frame->payload.data() + sizeof(header) + i * sizeof(s), sizeof(s));
+            return s;
+        }
+        float res_rising(size_t i) const { return probe(i); } // NaN if not crossed
+        float res_falling(size_t i) const { return probe(header.probe_count + i); }
+    };
+
+    // CMD_GET_AVERAGE payload, read in place, see cycle_average.h
+    class average_view
+    {
+    private:
+        reply_t frame;
+        average_report_header header = {};
+
+    public:
+        average_view() = default;
+        explicit average_view(reply_t f) : frame(f)
+        {
+            if (frame && frame->cmd == CMD_GET_AVERAGE && frame->payload.size() >= sizeof(header))
+            {
+                memcpy(&header, frame->payload.data(), sizeof(header));
+            }
+        }
+
+        bool valid() const // false for RSP_NO_DATA and failed requests
+        {
+            return frame && frame->cmd == CMD_GET_AVERAGE && frame->payload.size() >= sizeof(header) &&
+                frame->payload.size() == AVERAGE_REPORT_SIZE(header.points);
+        }
+        uint32_t seq() const { return header.seq; }
+        size_t cycles() const { return header.cycles; }
+        size_t size() const { return header.points; }
+        const float* data() const // temp, res, res variance, temp...
+        {
+            return reinterpret_cast<const float*>(frame->payload.data() + sizeof(header));
+        }
+        float temp(size_t i) const { return data()[i * AVERAGE_FLOATS_PER_POINT]; }
+        float res(size_t i) const { return data()[i * AVERAGE_FLOATS_PER_POINT + 1]; }
+        float res_variance(size_t i) const { return data()[i * AVERAGE_FLOATS_PER_POINT + 2]; }
+    };
+
+    // CMD_BATCH body: setting sub-commands, see my_protocol.h
+    class batch_builder
+    {
+    private:
+        std::vector<uint8_t> body;
+        size_t count = 0;
+
+    public:
+        bool add(uint8_t cmd, const void* args = NULL, size_t len = 0); // false if the batch would overflow
+        bool set_heater_params(const heater_params& p) { return add(CMD_SET_HEATER_PARAMS, &p, sizeof(p)); }
+        bool set_measure_params(const measure_params& p) { return add(CMD_SET_MEASURE_PARAMS, &p, sizeof(p)); }
+        bool set_pid_params(const my_pid_params_t& p) { return add(CMD_SET_PID_PARAMS, &p, sizeof(p)); }
+        bool set_adc_cal(uint8_t channel, float gain, float offset);
+        bool set_dac_cal(const my_dac_cal_t& c) { return add(CMD_SET_DAC_CAL, &c, sizeof(c)); }
+        bool set_trip_limits(const heater_limits_t& l) { return add(CMD_SET_TRIP_LIMITS, &l, sizeof(l)); }
+        bool set_features(const feature_config_t& c) { return add(CMD_SET_FEATURES, &c, sizeof(c)); }
+        bool set_averaging(const average_config_t& c) { return add(CMD_SET_AVERAGING, &c, sizeof(c)); }
+        bool set_baseline(const baseline_config_t& c) { return add(CMD_SET_BASELINE, &c, sizeof(c)); }
+        bool set_events(const event_config_t& c) { return add(CMD_SET_EVENTS, &c, sizeof(c)); }
+        bool set_timings(const my_timings_t& t) { return add(CMD_SET_TIMINGS, &t, sizeof(t)); }
+        bool set_filters(const filter_config_t& c) { return add(CMD_SET_FILTERS, &c, sizeof(c)); }
+        bool set_heater_model(const heater_model_t& m) { return add(CMD_SET_HEATER_MODEL, &m, sizeof(m)); } // Checked against the tempco before the batch
+        bool save_nvs() { return add(CMD_SAVE_NVS); }
+        bool select_sensor(uint8_t index) { return add(CMD_SELECT_SENSOR, &index, sizeof(index)); } // For the entries after it
+        size_t size() const { return count; }
+        const std::vector<uint8_t>& get_body() const { return body; }
+        void clear();
+    };
+
+    // CMD_BATCH reply
+    class batch_view
+    {
+    private:
+        reply_t frame;
+        batch_response_header header = {};
+
+    public:
+        batch_view() = default;
+        explicit batch_view(reply_t f) : frame(f)
+        {
+            if (valid()) memcpy(&header, frame->payload.data(), sizeof(header));
+        }
+
+        bool valid() const // false for RSP_BAD_CRC and failed requests
+        {
+            return frame && frame->cmd == CMD_BATCH && frame->payload.size() >= sizeof(batch_response_header);
+        }
+        uint16_t request_id() const { return header.request_id; }
+        uint8_t result() const { return header.result; }
+        size_t size() const { return header.count; }
+        uint8_t code(size_t i) const { return frame->payload[sizeof(batch_response_header) + i]; } // NO_STD_RSP = not applied
+    };
+
+    struct client_stats_t
+    {
+        size_t sent;
+        size_t received;
+        size_t unsolicited;
+        size_t timeouts;
+        size_t missed; // device frames lost, judging by the device WDT counter
+        size_t crc_errors;
+        size_t format_errors;
+    };
+
+    class sensor_client
+    {
+    public:
+        typedef std::function<void(const frame_t&)> unsolicited_handler_t;
+
+        sensor_client();
+        ~sensor_client();
+
+        bool open(const char* path); // Serial device, switched to raw mode
+        bool attach(int fd); // Already configured descriptor, owned by the client afterwards
+        void close();
+        bool is_open() const { return fd >= 0; }
+
+        void set_window(size_t n); // Max requests in flight, 1 gives strict request/response
+        void set_timeout(std::chrono::milliseconds t);
+        void set_unsolicited_handler(unsolicited_handler_t h);
+
+        // Blocks while the window is full. The WDT counter is appended automatically.
+        std::future<reply_t> submit(uint8_t cmd, const void* args = NULL, size_t len = 0);
+
+        // Standard one-byte response (RSP_*), -1 on timeout or unexpected reply
+        static int status(const reply_t& r);
+        int command(uint8_t cmd, const void* args = NULL, size_t len = 0);
+
+        // Convenience wrappers
+        std::future<reply_t> get_data() { return submit(CMD_GET_DATA); }
+        std::future<reply_t> get_data(uint32_t seq) { return submit(CMD_GET_DATA_SEQ, &seq, sizeof(seq)); }
+        std::future<reply_t> get_features() { return submit(CMD_GET_FEATURES); } // See feature_view
+        int set_features(const feature_config_t& c) { return command(CMD_SET_FEATURES, &c, sizeof(c)); } // From the next cycle
+        std::future<reply_t> get_average() { return submit(CMD_GET_AVERAGE); } // See average_view
+        int set_averaging(const average_config_t& c) { return command(CMD_SET_AVERAGING, &c, sizeof(c)); } // From the next cycle
+        int set_baseline(const baseline_config_t& c) { return command(CMD_SET_BASELINE, &c, sizeof(c)); } // From the next cycle
+        bool get_baseline(baseline_state_t<CYCLE_LENGTH>& out); // ln(R) per profile point, NaN where not learned
+        bool get_rates(rates_t& out); // Loop rate board-wide, point rate of the selected sensor
+        int set_timings(const my_timings_t& t) { return command(CMD_SET_TIMINGS, &t, sizeof(t)); } // From the next cycle; loop rate only while stopped
+        int set_events(const event_config_t& c) { return command(CMD_SET_EVENTS, &c, sizeof(c)); } // From the next cycle; CMD_EVENT frames go to the unsolicited handler
+        int set_filters(const filter_config_t& c) { return command(CMD_SET_FILTERS, &c, sizeof(c)); } // From the next cycle
+        bool get_trend(trend_report_t& out); // Slow outputs of the selected sensor as of its last point, NaN while off
+        bool get_power(power_report_t& out); // Board-wide
+        bool get_boot(boot_report_t& out); // Init phase timestamps of the last boot
+        // Addresses the commands after it, so it can be pipelined with them
+        std::future<reply_t> select_sensor(uint8_t index) { return submit(CMD_SELECT_SENSOR, &index, sizeof(index)); }
+        int start() { return command(CMD_START); }
+        int stop() { return command(CMD_STOP); }
+        int set_heater_params(const heater_params& p) { return command(CMD_SET_HEATER_PARAMS, &p, sizeof(p)); }
+        int set_heater_model(const heater_model_t& m) { return command(CMD_SET_HEATER_MODEL, &m, sizeof(m)); } // After set_heater_params()
+        int set_measure_params(const measure_params& p) { return command(CMD_SET_MEASURE_PARAMS, &p, sizeof(p)); }
+        // Chunked upload and commit, pipelined. Lost or corrupted chunks are resent from CMD_PROFILE_STATUS's first
+        // missing point, up to UPLOAD_ROUNDS times
+        int upload_profile(const float* points, size_t length);
+        bool get_upload_status(profile_upload_status& out);
+        std::future<reply_t> submit_batch(const batch_builder& b); // Reply matched by request ID, see batch_view
+
+        client_stats_t get_stats() const;
+
+    private:
+        struct pending_t
+        {
+            uint8_t cmd;
+            int32_t request_id = -1; // CMD_BATCH only
+            std::chrono::steady_clock::time_point deadline;
+            std::promise<reply_t> promise;
+        };
+
+        int fd = -1;
+        std::thread reader;
+        std::atomic<bool> running{false};
+
+        std::mutex write_mutex; // Orders frames on the wire the same way as in `pending`
+        uint8_t wdt = 0;
+        std::atomic<uint16_t> request_id{0};
+        std::vector<uint8_t> tx_buffer;
+
+        mutable std::mutex pending_mutex;
+        std::condition_variable window_cv;
+        std::deque<pending_t> pending;
+        size_t window = 8;
+        std::chrono::milliseconds timeout{1000};
+        unsolicited_handler_t unsolicited;
+
+        bool device_wdt_valid = false;
+        uint8_t device_wdt = 0;
+        client_stats_t stats = {};
+        frame_decoder decoder;
+
+        std::future<reply_t> submit(uint8_t cmd, const void* args, size_t len, int32_t id);
+        void reader_task();
+        void dispatch(frame_t& f);
+        void expire();
+        bool write_all(const uint8_t* buf, size_t len);
+        static bool expects(uint8_t request, uint8_t response);
+    };
+}
@@ -0,0 +1,361 @@
+/***
+ * Replays a session recording (CMD_SET_SESSION, see session_format.h) through the firmware's processing path:
+ * the ADC filter banks, the calibration, the heater model, my_pid and the telemetry conversions, as fast as the
+ * host runs them. Reads a raw capture of the CDC stream (e.g. `cat /dev/ttyACM0 > session.bin`), compares the
+ * replayed temperature, heater voltage and telemetry points with the recorded ones and reports per-stage timing.
+ * Usage: session_replay [-o ticks.csv] [-a control window] [-e tolerance] [capture]   (reads stdin without a file)
+ * -a replaces the control window of every parameter set, to try another filter on real data: expect a diff then.
+ * The filters are fed the recorded millivolts (the eFuse curve of the unit isn't known here). Trips aren't
+ * re-evaluated, the recorded flag is followed. After the start and after lost records the replay has no filter
+ * history, so for the first REPLAY_WARMUP ticks the PID runs on the recorded temperature and nothing is compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "protocol.h"
+#include "session_format.h"
+#include "my_uart.h"
+
+#define REPLAY_WINDOW_MAX 256 //ADC_AVERAGE_MAX
+#define REPLAY_WARMUP REPLAY_WINDOW_MAX //ticks, longest window the device may have been using
+
+// my_pid.cpp reports a non-finite output through the firmware's error flags
+namespace my_uart
+{
+    void raise_error(my_error_codes, uint8_t, uint16_t) {}
+}
+
+enum replay_channels { ch_i_h, ch_v_h_mon, ch_v_r4, ch_v_div }; //my_adc_channels order
+enum replay_outputs { out_control, out_telemetry }; //adc_output order of my_adc_channel
+enum replay_stages { stage_filter, stage_temperature, stage_telemetry, stage_pid, stage_count };
+static const char* stage_names[stage_count] = { "filter", "temperature", "telemetry", "pid" };
+
+struct replay_params_t
+{
+    bool valid;
+    session_params_t rec;
+    heater_lut_t heater;
+};
+
+struct sensor_state_t
+{
+    std::vector<uint32_t> store[SESSION_CHANNELS];
+    std::vector<filter_bank<uint32_t>> banks;
+    replay_params_t params[256]; // by seq
+    const replay_params_t* current;
+    my_pid pid;
+    size_t gaps_seen;
+    size_t warmup; // ticks left
+    // results
+    size_t ticks, compared, points, skipped, mismatches;
+    double temp_max, temp_sq, volt_max, volt_sq, point_temp_max, point_res_max;
+
+    sensor_state_t() : current(NULL), pid(NULL), gaps_seen(0), warmup(0), ticks(0), compared(0), points(0), skipped(0),
+        mismatches(0), temp_max(0), temp_sq(0), volt_max(0), volt_sq(0), point_temp_max(0), point_res_max(0)
+    {
+        for (size_t i = 0; i < SESSION_CHANNELS; i++) store[i].resize(REPLAY_WINDOW_MAX);
+        for (size_t i = 0; i < SESSION_CHANNELS; i++) banks.emplace_back(store[i].data(), REPLAY_WINDOW_MAX, 2);
+        memset(params, 0, sizeof(params));
+    }
+};
+
+static sensor_state_t sensors[8]; //Sensor index is a byte on the wire, the mask of CMD_SET_SESSION limits it to 8
+static uint32_t control_override = 0;
+static double tolerance = 0.01; //K and V
+static double stage_ns[stage_count];
+static FILE* csv = NULL;
+
+static float calibrate(const session_params_t* p, size_t ch, float mean_mv)
+{
+    return mean_mv / 1000.0f * p->adc_gain[ch] + p->adc_offset[ch];
+}
+
+static float calc_resistance(float vr_ref, float vdiv, float r_ref)
+{
+    return r_ref * (vdiv - vr_ref) / vr_ref;
+}
+
+// my_sensor::apply_filters
+static void apply_filters(sensor_state_t* s)
+{
+    const session_params_t* p = &s->current->rec;
+    uint32_t t_len;
+    float alpha;
+    filter_windows(&p->filters, p->loop_rate, p->point_rate, REPLAY_WINDOW_MAX, &t_len, &alpha);
+    uint32_t len = control_override ? control_override : p->timings.averaging_len;
+    for (auto& b : s->banks)
+    {
+        b.set_length(out_control, len);
+        b.set_length(out_telemetry, t_len);
+        b.set_trend(alpha);
+    }
+}
+
+static void diff(double& max, double recorded, double replayed)
+{
+    double d = fabs(replayed - recorded);
+    if (isnan(recorded) != isnan(replayed)) d = INFINITY;
+    else if (isnan(d)) d = 0; //Both NaN
+    if (d > max) max = d;
+}
+
+template <class F> static auto timed(replay_stages stage, F f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    auto res = f();
+    stage_ns[stage] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    return res;
+}
+
+// my_sensor::scan and my_sensor::control for one recorded tick
+static void replay_tick(size_t index, sensor_state_t* s, const session_tick_t* t, size_t gaps)
+{
+    const replay_params_t* rp = &s->params[t->params_seq];
+    if (!rp->valid)
+    {
+        s->skipped++; //Its parameters were lost
+        return;
+    }
+    if (rp != s->current)
+    {
+        bool resync = (s->current == NULL || s->gaps_seen != gaps);
+        s->current = rp;
+        s->gaps_seen = gaps;
+        s->pid.set_params(&rp->rec.pid);
+        s->pid.restore(rp->rec.pid_setpoint, rp->rec.pid_integral);
+        if (resync)
+        {
+            for (auto& b : s->banks) b.clear();
+            apply_filters(s); //The device may still have been using older windows until its next cycle start
+            s->warmup = REPLAY_WARMUP;
+        }
+    }
+    const session_params_t* p = &rp->rec;
+    s->ticks++;
+
+    float v[SESSION_CHANNELS];
+    timed(stage_filter, [&]() {
+        for (size_t i = 0; i < SESSION_CHANNELS; i++)
+        {
+            s->banks[i].push(t->mv[i]);
+            v[i] = calibrate(p, i, s->banks[i].mean(out_control));
+        }
+        return 0;
+    });
+    bool warm = (s->warmup == 0);
+    float temp = NAN, voltage = 0, point_temp = NAN, point_res = NAN;
+    if (t->flags & session_operate)
+    {
+        temp = timed(stage_temperature, [&]() { return rp->heater.temperature(v[ch_v_h_mon] / v[ch_i_h]); });
+        if (t->flags & session_point)
+        {
+            timed(stage_telemetry, [&]() {
+                float tv[SESSION_CHANNELS];
+                for (size_t i = 0; i < SESSION_CHANNELS; i++) tv[i] = calibrate(p, i, s->banks[i].mean(out_telemetry));
+                point_temp = rp->heater.temperature(tv[ch_v_h_mon] / tv[ch_i_h]);
+                point_res = calc_resistance(tv[ch_v_r4], tv[ch_v_div], p->ref_res);
+                return 0;
+            });
+        }
+        if (t->flags & session_filters) apply_filters(s);
+        voltage = timed(stage_pid, [&]() {
+            if (t->flags & session_continuous) s->pid.track(t->setpoint);
+            else s->pid.set(t->setpoint);
+            float power = s->pid.next(warm ? temp : t->temp);
+            return sqrtf(power * rp->heater.resistance(s->pid.get_setpoint()));
+        });
+    }
+    else
+    {
+        s->pid.set(p->rt_temp);
+        if (t->flags & session_filters) apply_filters(s);
+    }
+
+    if (warm)
+    {
+        s->compared++;
+        double dt = 0, dv = 0, dpt = 0, dpr = 0;
+        diff(dt, t->temp, temp);
+        diff(dv, t->voltage, voltage);
+        if (t->flags & session_point)
+        {
+            s->points++;
+            diff(dpt, t->point_temp, point_temp);
+            diff(dpr, t->point_res, point_res);
+        }
+        if (dt > s->temp_max) s->temp_max = dt;
+        if (dv > s->volt_max) s->volt_max = dv;
+        if (dpt > s->point_temp_max) s->point_temp_max = dpt;
+        if (dpr > s->point_res_max) s->point_res_max = dpr;
+        if (isfinite(dt)) s->temp_sq += dt * dt;
+        if (isfinite(dv)) s->volt_sq += dv * dv;
+        if (dt > tolerance || dv > tolerance || dpt > tolerance || dpr > tolerance * p->ref_res) s->mismatches++;
+    }
+    else
+    {
+        s->warmup--;
+    }
+    if (csv != NULL)
+    {
+        fprintf(csv, "%u,%zu,%u,%d,%.3f,%.3f,%.3f,%.4f,%.4f,%.3f,%.3f,%.3f,%.3f,%u\n", t->timestamp_us, index, t->flags,
+            warm, t->setpoint, t->temp, temp, t->voltage, voltage, t->point_temp, point_temp, t->point_res, point_res,
+            t->dac_code);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            csv = fopen(argv[++i], "w");
+            if (csv == NULL)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+        {
+            control_override = strtoul(argv[++i], NULL, 10);
+            if (control_override < 1 || control_override > REPLAY_WINDOW_MAX)
+            {
+                fprintf(stderr, "Control window: 1..%u samples\n", REPLAY_WINDOW_MAX);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc) tolerance = atof(argv[++i]);
+        else path = argv[i];
+    }
+    FILE* in = (path != NULL) ? fopen(path, "rb") : stdin;
+    if (in == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    if (csv != NULL)
+    {
+        fprintf(csv, "time_us,sensor,flags,compared,setpoint,temp,temp_replay,voltage,voltage_replay,"
+            "point_temp,point_temp_replay,point_res,point_res_replay,dac_code\n");
+    }
+
+    protocol::frame_decoder decoder;
+    protocol::frame_t frame;
+    uint32_t last_seq = 0, last_dropped = 0, last_tx_dropped = 0;
+    uint32_t first_ts = 0, last_ts = 0;
+    bool first = true, first_tick = true;
+    size_t packets = 0, gaps = 0, commands = 0, bad_commands = 0, bad_records = 0;
+    auto begin = std::chrono::steady_clock::now();
+    int c;
+    while ((c = fgetc(in)) != EOF)
+    {
+        if (!decoder.feed(static_cast<uint8_t>(c), frame) || frame.cmd != CMD_SESSION) continue;
+        const uint8_t* data = frame.payload.data();
+        size_t size = frame.payload.size();
+        session_header_t h;
+        if (size < sizeof(h)) continue;
+        memcpy(&h, data, sizeof(h));
+        if (h.version != SESSION_FORMAT_VERSION)
+        {
+            fprintf(stderr, "Packet #%u: format version %u, expected %u\n", h.seq, h.version, SESSION_FORMAT_VERSION);
+            continue;
+        }
+        if (!first && (h.seq != last_seq + 1 || h.dropped != last_dropped || h.tx_dropped != last_tx_dropped))
+        {
+            fprintf(stderr, "Packet #%u: %u packets missing, %u records dropped on device\n", h.seq, h.seq - last_seq - 1,
+                h.dropped - last_dropped);
+            gaps++;
+        }
+        first = false;
+        last_seq = h.seq;
+        last_dropped = h.dropped;
+        last_tx_dropped = h.tx_dropped;
+        packets++;
+        size_t pos = sizeof(h);
+        for (size_t i = 0; i < h.count; i++)
+        {
+            session_record_header_t r;
+            if (pos + sizeof(r) > size) break;
+            memcpy(&r, data + pos, sizeof(r));
+            pos += sizeof(r);
+            if (pos + r.size > size) break;
+            const uint8_t* body = data + pos;
+            pos += r.size;
+            if (r.sensor >= sizeof(sensors) / sizeof(sensors[0]))
+            {
+                bad_records++;
+                continue;
+            }
+            sensor_state_t* s = &sensors[r.sensor];
+            switch (r.kind)
+            {
+            case session_tick:
+            {
+                session_tick_t t;
+                if (r.size != sizeof(t)) break;
+                memcpy(&t, body, sizeof(t));
+                if (first_tick) first_ts = t.timestamp_us;
+                first_tick = false;
+                last_ts = t.timestamp_us;
+                replay_tick(r.sensor, s, &t, gaps);
+                continue;
+            }
+            case session_params:
+            {
+                replay_params_t* p = &s->params[body[0]]; //seq leads the record
+                if (r.size != sizeof(p->rec)) break;
+                memcpy(&p->rec, body, sizeof(p->rec));
+                heater_model::prepare(&p->heater, &p->rec.heater_model, p->rec.heater_coef, p->rec.rt_res, p->rec.rt_temp);
+                if (p == s->current) s->current = NULL; //Reused seq: a fresh snapshot, start over from it
+                p->valid = true;
+                continue;
+            }
+            case session_command:
+            {
+                session_command_t cmd;
+                if (r.size != sizeof(cmd)) break;
+                memcpy(&cmd, body, sizeof(cmd));
+                commands++;
+                if (!cmd.crc_ok) bad_commands++;
+                if (csv != NULL) fprintf(csv, "# %u: sensor %u command 0x%02X response 0x%02X%s\n", cmd.timestamp_us,
+                    r.sensor, cmd.cmd, cmd.response, cmd.crc_ok ? "" : " CRC error");
+                continue;
+            }
+            default:
+                break;
+            }
+            bad_records++;
+        }
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("sensor,ticks,compared,points,skipped,mismatches,temp_max,temp_rms,voltage_max,voltage_rms,point_temp_max,point_res_max\n");
+    size_t ticks = 0;
+    for (size_t i = 0; i < sizeof(sensors) / sizeof(sensors[0]); i++)
+    {
+        const sensor_state_t* s = &sensors[i];
+        if (s->ticks == 0 && s->skipped == 0) continue;
+        ticks += s->ticks;
+        double n = s->compared ? s->compared : 1;
+        printf("%zu,%zu,%zu,%zu,%zu,%zu,%g,%g,%g,%g,%g,%g\n", i, s->ticks, s->compared, s->points, s->skipped,
+            s->mismatches, s->temp_max, sqrt(s->temp_sq / n), s->volt_max, sqrt(s->volt_sq / n), s->point_temp_max,
+            s->point_res_max);
+    }
+    //Each stage is timed on its own, the clock reads add a few tens of ns to every figure
+    fprintf(stderr, "Stage ns/tick:");
+    for (size_t i = 0; i < stage_count; i++) fprintf(stderr, " %s %.1f", stage_names[i], ticks ? stage_ns[i] / ticks : 0);
+    double recorded_ms = (last_ts - first_ts) / 1000.0;
+    fprintf(stderr, "\n%zu packets, %zu gaps, %zu ticks in %.1f ms (%.0fx real time), %zu commands (%zu CRC errors), "
+        "%zu bad records, %zu frame CRC errors\n", packets, gaps, ticks, total_ms,
+        total_ms > 0 ? recorded_ms / total_ms : 0, commands, bad_commands, bad_records, decoder.get_crc_errors());
+    if (csv != NULL) fclose(csv);
+    if (in != stdin) fclose(in);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal assertions for the host tests: a failed CHECK reports its location, the test then exits non-zero
+static int check_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+static inline int check_result(const char* name)
+{
+    if (check_failures == 0) printf("%s: OK\n", name);
+    else printf("%s: %d check(s) failed\n", name, check_failures);
+    return check_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+// Averaging window changes at runtime: filter_bank::set_length() against a plain history, through wrap-around,
+// growth past the samples seen so far and shrinking below them
+#include "filter_bank.h"
+#include "check.h"
+
+#include <deque>
+#include <random>
+
+#define CAPACITY 64
+#define STEPS 200000
+
+// Mean of the newest min(len, size) samples
+static double reference_mean(const std::deque<uint32_t>& history, uint32_t len)
+{
+    size_t n = std::min<size_t>(len, history.size());
+    if (n == 0) return 0;
+    double sum = 0;
+    for (size_t i = history.size() - n; i < history.size(); i++) sum += history[i];
+    return sum / n;
+}
+
+// The sums are exact integers, the division is the only rounding
+static bool same_mean(float got, double want)
+{
+    return fabs(got - want) <= 1e-6 * want;
+}
+
+static void test_filter_bank()
+{
+    uint32_t store[CAPACITY];
+    filter_bank<uint32_t> bank(store, CAPACITY, 3);
+    uint32_t len[3] = { 1, 1, 1 };
+    std::deque<uint32_t> history;
+    std::minstd_rand rng(7);
+    size_t mismatches = 0, jumps = 0;
+    for (size_t step = 0; step < STEPS; step++)
+    {
+        if (rng() % 16 == 0)
+        {
+            size_t o = rng() % 3;
+            uint32_t l = rng() % (CAPACITY + 8); //0 and past the capacity are clamped
+            bank.set_length(o, l);
+            len[o] = (l == 0) ? 1 : (l > CAPACITY ? CAPACITY : l);
+            CHECK(bank.get_length(o) == len[o]);
+            //The new window starts from the history it already has: no restart from zero
+            if (!history.empty() && !same_mean(bank.mean(o), reference_mean(history, len[o]))) jumps++;
+        }
+        uint32_t x = 1000 + rng() % 2000; //mV
+        bank.push(x);
+        history.push_back(x);
+        if (history.size() > CAPACITY) history.pop_front();
+        for (size_t o = 0; o < 3; o++)
+        {
+            if (!same_mean(bank.mean(o), reference_mean(history, len[o]))) mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+    CHECK(jumps == 0);
+    CHECK(bank.get_length(3) == 0);
+
+    bank.clear();
+    CHECK(bank.mean(0) == 0);
+    bank.set_length(0, 4);
+    bank.push(10);
+    CHECK(bank.mean(0) == 10); //Fewer samples than the window
+}
+
+int main()
+{
+    test_filter_bank();
+    return check_result("test_average_resize");
+}
@@ -0,0 +1,130 @@
+// Batch parsing and validation: batch_split() on malformed bodies, batch_builder limits, and the all-or-nothing
+// apply through the pty stand-in
+#include "sensor_client.h"
+#include "device_sim.h"
+#include "check.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace protocol;
+
+static void append(std::vector<uint8_t>& body, uint8_t cmd, size_t len)
+{
+    batch_entry_header e = { cmd, static_cast<uint8_t>(len) };
+    body.insert(body.end(), reinterpret_cast<const uint8_t*>(&e), reinterpret_cast<const uint8_t*>(&e) + sizeof(e));
+    body.insert(body.end(), len, static_cast<uint8_t>(len));
+}
+
+static int split(const std::vector<uint8_t>& body, const batch_entry_header** entries, size_t max = BATCH_MAX_COMMANDS)
+{
+    return batch_split(body.data(), body.size(), entries, max);
+}
+
+static void test_split()
+{
+    const batch_entry_header* entries[BATCH_MAX_COMMANDS + 1];
+    std::vector<uint8_t> body;
+    CHECK(split(body, entries) == 0);
+
+    append(body, CMD_SELECT_SENSOR, 1);
+    append(body, CMD_SAVE_NVS, 0);
+    append(body, CMD_SET_AVERAGING, sizeof(average_config_t));
+    CHECK(split(body, entries) == 3);
+    CHECK(entries[0]->cmd == CMD_SELECT_SENSOR && batch_args(entries[0])[0] == 1);
+    CHECK(entries[1]->cmd == CMD_SAVE_NVS && entries[1]->length == 0);
+    CHECK(entries[2]->cmd == CMD_SET_AVERAGING && batch_args(entries[2]) + entries[2]->length == body.data() + body.size());
+
+    std::vector<uint8_t> truncated(body.begin(), body.end() - 1); // Args run past the end
+    CHECK(split(truncated, entries) == -1);
+    truncated = body;
+    truncated.push_back(CMD_SAVE_NVS); // Half an entry header
+    CHECK(split(truncated, entries) == -1);
+    CHECK(split(body, entries, 2) == -1); // More entries than the caller has room for
+
+    body.clear();
+    for (size_t i = 0; i < BATCH_MAX_COMMANDS; i++) append(body, CMD_SAVE_NVS, 0);
+    CHECK(split(body, entries) == BATCH_MAX_COMMANDS);
+    append(body, CMD_SAVE_NVS, 0);
+    CHECK(split(body, entries, BATCH_MAX_COMMANDS + 1) == BATCH_MAX_COMMANDS + 1);
+    CHECK(split(body, entries) == -1);
+}
+
+static void test_builder()
+{
+    batch_builder b;
+    for (size_t i = 0; i < BATCH_MAX_COMMANDS; i++) CHECK(b.save_nvs());
+    CHECK(!b.save_nvs());
+    CHECK(b.size() == BATCH_MAX_COMMANDS);
+
+    b.clear();
+    CHECK(b.size() == 0 && b.get_body().empty());
+    std::vector<uint8_t> args(UINT8_MAX);
+    while (b.add(CMD_SET_FEATURES, args.data(), args.size())) {}
+    CHECK(b.get_body().size() <= BATCH_MAX_SIZE);
+    CHECK(b.get_body().size() + sizeof(batch_entry_header) + args.size() > BATCH_MAX_SIZE);
+    CHECK(!b.add(CMD_SET_FEATURES, args.data(), UINT8_MAX + 1));
+}
+
+static void test_apply(sensor_client& client)
+{
+    average_config_t good = { 4, 0, 0.25f };
+    average_config_t bad = { 4, 0, 1.5f };
+
+    batch_builder b;
+    b.select_sensor(1);
+    b.set_averaging(good);
+    b.select_sensor(0);
+    batch_view v(client.submit_batch(b).get());
+    CHECK(v.valid() && v.result() == RSP_OK && v.size() == 3);
+    for (size_t i = 0; v.valid() && i < v.size(); i++) CHECK(v.code(i) == RSP_OK);
+
+    // One bad entry rejects the whole batch, the selection before it included
+    b.clear();
+    b.select_sensor(1);
+    b.set_averaging(bad);
+    b.save_nvs();
+    v = batch_view(client.submit_batch(b).get());
+    CHECK(v.valid() && v.result() == RSP_SET_FAILED && v.size() == 3);
+    if (v.valid() && v.size() == 3)
+    {
+        CHECK(v.code(0) == NO_STD_RSP);
+        CHECK(v.code(1) == RSP_SET_FAILED);
+        CHECK(v.code(2) == NO_STD_RSP);
+    }
+    CHECK(client.command(CMD_START) == RSP_OK);
+    CHECK(client.command(CMD_START) == RSP_ALREADY_IN_REQUESTED_STATE); // Still sensor 0
+    CHECK(client.command(CMD_STOP) == RSP_OK);
+
+    // Wrong argument size and an out-of-range sensor are caught the same way
+    b.clear();
+    b.add(CMD_SET_AVERAGING, &good, sizeof(good) - 1);
+    b.select_sensor(2);
+    v = batch_view(client.submit_batch(b).get());
+    CHECK(v.valid() && v.result() == RSP_SET_FAILED && v.size() == 2);
+    if (v.valid() && v.size() == 2) CHECK(v.code(0) == RSP_SET_FAILED && v.code(1) == RSP_SET_FAILED);
+
+    // A body that doesn't split is answered with no entries
+    std::vector<uint8_t> args(sizeof(batch_header));
+    batch_header h = { 0x55AA, 3 };
+    memcpy(args.data(), &h, sizeof(h));
+    append(args, CMD_SELECT_SENSOR, 2); // 4 bytes where the header announces 3
+    args.pop_back();
+    v = batch_view(client.submit(CMD_BATCH, args.data(), args.size()).get());
+    CHECK(v.valid() && v.request_id() == h.request_id && v.result() == RSP_SET_FAILED && v.size() == 0);
+}
+
+int main()
+{
+    test_split();
+    test_builder();
+
+    device_sim sim;
+    sim.set_sensors(2);
+    CHECK(sim.start());
+    sensor_client client;
+    CHECK(client.open(sim.get_path()));
+    client.set_timeout(std::chrono::milliseconds(2000));
+    test_apply(client);
+    return check_result("test_batch");
+}
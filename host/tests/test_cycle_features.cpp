@@ -0,0 +1,212 @@
+// cycle_features against a two-pass double-precision reference over the stored cycle
+#include "cycle_features.h"
+#include "check.h"
+
+#include <vector>
+
+#define POINTS 500
+
+struct reference_t
+{
+    std::vector<feature_segment_t> segments;
+    std::vector<float> rising, falling;
+};
+
+static bool valid(float temp, float res)
+{
+    return isfinite(temp) && isfinite(res) && res > 0;
+}
+
+static reference_t reference(const feature_config_t& c, const std::vector<float>& temp, const std::vector<float>& res)
+{
+    reference_t ref;
+    for (size_t s = 0; s < c.segment_count; s++)
+    {
+        size_t first = c.segment_starts[s];
+        size_t end = (s + 1 < c.segment_count) ? c.segment_starts[s + 1] : temp.size();
+        std::vector<double> x, y;
+        double area = 0;
+        for (size_t i = first; i < end && i < temp.size(); i++)
+        {
+            if (!valid(temp[i], res[i])) continue;
+            if (!y.empty()) area += (exp(y.back()) + res[i]) / 2;
+            x.push_back(i - first);
+            y.push_back(logf(res[i])); //The same rounded logarithms, the statistics are what is checked
+        }
+        feature_segment_t f = {};
+        f.points = y.size();
+        if (!y.empty())
+        {
+            double mx = 0, my = 0;
+            for (size_t i = 0; i < y.size(); i++)
+            {
+                mx += x[i];
+                my += y[i];
+            }
+            mx /= y.size();
+            my /= y.size();
+            double sxx = 0, syy = 0, sxy = 0, mn = y[0], mxv = y[0];
+            for (size_t i = 0; i < y.size(); i++)
+            {
+                sxx += (x[i] - mx) * (x[i] - mx);
+                syy += (y[i] - my) * (y[i] - my);
+                sxy += (x[i] - mx) * (y[i] - my);
+                mn = fmin(mn, y[i]);
+                mxv = fmax(mxv, y[i]);
+            }
+            f.log_res_mean = my;
+            f.log_res_min = mn;
+            f.log_res_max = mxv;
+            f.area = area;
+            if (y.size() > 1 && sxx > 0)
+            {
+                f.slope = sxy / sxx;
+                f.r = (syy > 0) ? sxy / sqrt(sxx * syy) : 0;
+            }
+        }
+        ref.segments.push_back(f);
+    }
+    for (size_t p = 0; p < c.probe_count; p++)
+    {
+        double t = c.probe_temps[p];
+        float rising = NAN, falling = NAN;
+        bool have_last = false;
+        double last_temp = 0, last_res = 0;
+        for (size_t i = 0; i < temp.size(); i++)
+        {
+            if (!valid(temp[i], res[i])) continue;
+            if (have_last)
+            {
+                double r = last_res + (res[i] - last_res) * (t - last_temp) / (temp[i] - last_temp);
+                if (isnan(rising) && last_temp < t && temp[i] >= t) rising = r;
+                if (isnan(falling) && last_temp > t && temp[i] <= t) falling = r;
+            }
+            last_temp = temp[i];
+            last_res = res[i];
+            have_last = true;
+        }
+        ref.rising.push_back(rising);
+        ref.falling.push_back(falling);
+    }
+    return ref;
+}
+
+static bool near(float a, double b, double tol)
+{
+    if (isnan(b)) return isnan(a);
+    return fabs(a - b) <= tol * fmax(1, fabs(b));
+}
+
+static void compare(const feature_config_t& c, const std::vector<float>& temp, const std::vector<float>& res,
+    uint32_t seq)
+{
+    cycle_features f;
+    f.begin(&c);
+    for (size_t i = 0; i < temp.size(); i++) f.push(temp[i], res[i]);
+    std::vector<uint8_t> out(FEATURE_REPORT_MAX_SIZE);
+    size_t size = f.finish(seq, out.data());
+    CHECK(size == sizeof(feature_report_header) + c.segment_count * sizeof(feature_segment_t) +
+        2 * c.probe_count * sizeof(float));
+    if (size == 0) return;
+
+    feature_report_header h;
+    memcpy(&h, out.data(), sizeof(h));
+    CHECK(h.seq == seq && h.points == temp.size() && h.segment_count == c.segment_count &&
+        h.probe_count == c.probe_count);
+    reference_t ref = reference(c, temp, res);
+    const uint8_t* p = out.data() + sizeof(h);
+    for (size_t s = 0; s < c.segment_count; s++, p += sizeof(feature_segment_t))
+    {
+        feature_segment_t got;
+        memcpy(&got, p, sizeof(got));
+        const feature_segment_t& want = ref.segments[s];
+        CHECK(got.points == want.points);
+        CHECK(near(got.log_res_mean, want.log_res_mean, 1e-5));
+        CHECK(got.log_res_min == want.log_res_min && got.log_res_max == want.log_res_max);
+        CHECK(near(got.slope, want.slope, 1e-4));
+        CHECK(near(got.r, want.r, 1e-4));
+        CHECK(near(got.area, want.area, 1e-5));
+    }
+    for (size_t i = 0; i < c.probe_count; i++, p += sizeof(float))
+    {
+        float got;
+        memcpy(&got, p, sizeof(got));
+        CHECK(near(got, ref.rising[i], 1e-5));
+    }
+    for (size_t i = 0; i < c.probe_count; i++, p += sizeof(float))
+    {
+        float got;
+        memcpy(&got, p, sizeof(got));
+        CHECK(near(got, ref.falling[i], 1e-5));
+    }
+}
+
+// The stand-in's cycle: a 300..500..300 K triangle, resistance falling with temperature, with ripple
+static void make_cycle(std::vector<float>& temp, std::vector<float>& res, float scale, float offset)
+{
+    temp.resize(POINTS);
+    res.resize(POINTS);
+    for (size_t i = 0; i < POINTS; i++)
+    {
+        float x = static_cast<float>(i) / POINTS;
+        temp[i] = 300 + 200 * (x < 0.5f ? 2 * x : 2 - 2 * x);
+        res[i] = offset + scale * expf(-(temp[i] - 300) / 150) * (1 + 0.05f * sinf(i * 0.3f));
+    }
+}
+
+int main()
+{
+    feature_config_t c = {};
+    c.mode = features_and_points;
+    c.segment_count = 5;
+    uint16_t starts[] = { 0, 120, 250, 251, 400 }; //A one-point segment included
+    memcpy(c.segment_starts, starts, sizeof(starts));
+    c.probe_count = 5;
+    float probes[] = { 350, 450, 499, 300, 600 }; //300 is where the cycle starts, 600 is never reached
+    memcpy(c.probe_temps, probes, sizeof(probes));
+    CHECK(cycle_features::validate(&c));
+
+    std::vector<float> temp, res;
+    make_cycle(temp, res, 1000, 0);
+    compare(c, temp, res, 1);
+
+    // Invalid points are skipped by every statistic, but keep their place in the segment
+    for (size_t i = 5; i < POINTS; i += 37) res[i] = NAN;
+    res[121] = -1;
+    res[122] = 0;
+    temp[250] = INFINITY; //The one-point segment ends up empty
+    temp[POINTS - 1] = NAN;
+    compare(c, temp, res, 2);
+
+    // A large offset with a small spread, where plain sums of squares would cancel
+    make_cycle(temp, res, 10, 1e5f);
+    compare(c, temp, res, 3);
+
+    // Shorter than the segment table, and one segment only
+    temp.resize(200);
+    res.resize(200);
+    compare(c, temp, res, 4);
+    c.segment_count = 1;
+    c.probe_count = 0;
+    compare(c, temp, res, 5);
+
+    // Off and invalid configurations report nothing
+    feature_config_t off = {};
+    CHECK(cycle_features::validate(&off));
+    cycle_features f;
+    f.begin(&off);
+    f.push(300, 1000);
+    std::vector<uint8_t> out(FEATURE_REPORT_MAX_SIZE);
+    CHECK(f.finish(0, out.data()) == 0);
+    feature_config_t bad = c;
+    bad.segment_count = 2;
+    bad.segment_starts[1] = 0;
+    CHECK(!cycle_features::validate(&bad));
+    f.begin(&bad);
+    CHECK(f.get_mode() == features_off);
+    bad = c;
+    bad.probe_count = 1;
+    bad.probe_temps[0] = NAN;
+    CHECK(!cycle_features::validate(&bad));
+    return check_result("test_cycle_features");
+}
@@ -0,0 +1,161 @@
+// cycle_ring: slot choice on publish() and the producer/consumer race
+#include "cycle_ring.h"
+#include "check.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define DEPTH 4
+#define WORDS 64 //Per cycle: all of them carry the cycle's sequence number, a torn slot shows up as a mismatch
+#define RACE_CYCLES 200000
+
+struct cycle_t
+{
+    uint32_t words[WORDS];
+};
+typedef cycle_ring<cycle_t> ring_t;
+
+static void fill(ring_t& ring)
+{
+    ring_t::slot_t* s = ring.producer_slot();
+    for (size_t i = 0; i < WORDS; i++) s->data->words[i] = s->seq;
+    s->length = WORDS;
+}
+
+static size_t index_of(ring_t::slot_t* slots, ring_t::slot_t* s)
+{
+    return static_cast<size_t>(s - slots);
+}
+
+static void test_prefers_free_slots()
+{
+    ring_t::slot_t slots[DEPTH];
+    cycle_t storage[DEPTH];
+    ring_t ring(slots, DEPTH);
+    ring.init(storage);
+    for (size_t i = 0; i < DEPTH - 1; i++) CHECK(ring.publish()); // 0, 1, 2 ready, filling 3
+    ring_t::slot_t* s = ring.acquire(1);
+    CHECK(s == &slots[1]);
+    ring.release(s);
+    // Slot 0 is next in ring order but still unsent: the sent slot 1 has to be taken instead
+    CHECK(ring.publish());
+    CHECK(index_of(slots, ring.producer_slot()) == 1);
+    CHECK(ring.get_overruns() == 0);
+    CHECK(slots[0].state.load() == slot_ready);
+    CHECK(slots[3].state.load() == slot_ready);
+}
+
+static void test_overwrites_oldest_ready()
+{
+    ring_t::slot_t slots[DEPTH];
+    cycle_t storage[DEPTH];
+    ring_t ring(slots, DEPTH);
+    ring.init(storage);
+    for (size_t i = 0; i < DEPTH - 1; i++) CHECK(ring.publish()); // 0, 1, 2 ready, filling 3
+    CHECK(!ring.publish()); // seq 0 is the oldest
+    CHECK(index_of(slots, ring.producer_slot()) == 0);
+    CHECK(ring.get_overruns() == 1);
+    ring_t::slot_t* s = ring.acquire(3);
+    CHECK(s == &slots[3]);
+    ring.release(s);
+    CHECK(ring.publish()); // Past the ready slots 1 and 2
+    CHECK(index_of(slots, ring.producer_slot()) == 3);
+    CHECK(ring.get_overruns() == 1);
+}
+
+static void test_drops_when_all_sending()
+{
+    ring_t::slot_t slots[DEPTH];
+    cycle_t storage[DEPTH];
+    ring_t ring(slots, DEPTH);
+    ring.init(storage);
+    for (size_t i = 0; i < DEPTH - 1; i++) CHECK(ring.publish());
+    ring_t::slot_t* held[DEPTH - 1];
+    for (size_t i = 0; i < DEPTH - 1; i++) held[i] = ring.acquire();
+    for (size_t i = 0; i < DEPTH - 1; i++) CHECK(held[i] != NULL);
+    uint32_t seq = ring.producer_slot()->seq;
+    CHECK(!ring.publish());
+    CHECK(index_of(slots, ring.producer_slot()) == DEPTH - 1);
+    CHECK(ring.producer_slot()->seq == seq + 1);
+    for (size_t i = 0; i < DEPTH - 1; i++) ring.release(held[i]);
+    CHECK(ring.publish());
+}
+
+// The producer never blocks and the consumer never sees a torn or reordered cycle. Every published cycle is
+// either fetched once or counted as an overrun.
+static void test_race()
+{
+    ring_t::slot_t slots[DEPTH];
+    static cycle_t storage[DEPTH];
+    ring_t ring(slots, DEPTH);
+    ring.init(storage);
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> torn(0), reordered(0);
+    std::vector<uint8_t> fetched(RACE_CYCLES + 1, 0);
+
+    std::thread consumer([&]() {
+        uint32_t last = 0;
+        bool first = true;
+        while (true) {
+            bool finished = done.load(std::memory_order_acquire);
+            ring_t::slot_t* s = ring.acquire();
+            if (s == NULL) {
+                if (finished) break;
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++) {
+                if (s->data->words[i] != s->seq) {
+                    torn++;
+                    break;
+                }
+            }
+            if (!first && static_cast<int32_t>(s->seq - last) <= 0) reordered++;
+            first = false;
+            last = s->seq;
+            if (s->seq <= RACE_CYCLES) fetched[s->seq]++;
+            // Now and then by sequence number too, like CMD_GET_DATA_SEQ
+            ring_t::slot_t* again = (s->seq % 7 == 0) ? s : NULL;
+            ring.release(s);
+            if (again != NULL) {
+                ring_t::slot_t* r = ring.acquire(last);
+                if (r != NULL) {
+                    if (r->data->words[0] != last) torn++;
+                    ring.release(r);
+                }
+            }
+        }
+    });
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < RACE_CYCLES; i++) {
+        fill(ring);
+        if (!ring.publish()) failed++;
+        if (i % 4 == 0) std::this_thread::yield(); //The control loop is periodic, let the consumer in
+    }
+    done.store(true, std::memory_order_release);
+    consumer.join();
+
+    size_t once = 0, twice = 0;
+    for (uint32_t i = 0; i < RACE_CYCLES; i++) {
+        if (fetched[i] == 1) once++;
+        if (fetched[i] > 1) twice++;
+    }
+    printf("race: %u cycles, %zu fetched, %u overruns, %u publish() failures\n", RACE_CYCLES, once,
+        ring.get_overruns(), failed);
+    CHECK(torn.load() == 0);
+    CHECK(reordered.load() == 0);
+    CHECK(twice == 0);
+    CHECK(once + ring.get_overruns() == RACE_CYCLES);
+    CHECK(failed <= ring.get_overruns());
+}
+
+int main()
+{
+    test_prefers_free_slots();
+    test_overwrites_oldest_ready();
+    test_drops_when_all_sending();
+    test_race();
+    return check_result("test_cycle_ring");
+}
@@ -0,0 +1,196 @@
+// Heater model tables against the closed forms: R(T) and its inverse for the linear and quadratic models, the
+// measured-ratio table, R0 from a (R, T) pair, and the linear fallback
+#include "heater_model.h"
+#include "check.h"
+
+#include <math.h>
+#include <string.h>
+
+#define RT_TEMP 273.0f //K, my_params::rt_temp
+#define R0 10.0f //Ohm
+#define TEMPCO 3.9083e-3f //Platinum
+#define BETA -5.775e-7f
+#define TEMP_MAX 1073.0f
+#define SAMPLES 10000
+#define LINEAR_TEMP_ERROR 0.01 //K, float rounding only
+#define QUADRATIC_TEMP_ERROR 0.05 //K, interpolation of a curve over HEATER_LUT_SIZE intervals
+#define TABLE_TEMP_ERROR 0.5 //K, both tables cut the table's kinks, each on its own grid
+#define RES_ERROR 1e-4 //relative
+
+static heater_model_t make(uint8_t kind)
+{
+    heater_model_t m = {};
+    m.kind = kind;
+    m.beta = BETA;
+    m.temp_max = TEMP_MAX;
+    return m;
+}
+
+// Closed-form inverse of R = R0 * (1 + a t + b t^2), the rising root
+static double quadratic_temp(double r, double a, double b)
+{
+    double c = 1 - r / R0;
+    if (b == 0) return RT_TEMP - c / a;
+    return RT_TEMP + (-a + sqrt(a * a - 4 * b * c)) / (2 * b);
+}
+
+struct errors_t
+{
+    double temp = 0, res = 0, round_trip = 0;
+};
+
+// Worst errors of the table over rt_temp..temp_max against the model evaluated in double
+static errors_t sweep(const heater_model_t& m, float tempco)
+{
+    heater_lut_t lut;
+    heater_model::prepare(&lut, &m, tempco, R0, RT_TEMP);
+    errors_t e;
+    for (size_t i = 0; i <= SAMPLES; i++)
+    {
+        double t = RT_TEMP + (TEMP_MAX - RT_TEMP) * i / SAMPLES;
+        double ratio = (m.kind == heater_table) ? heater_model::ratio(&m, tempco, RT_TEMP, t) :
+            1 + (t - RT_TEMP) * (tempco + (m.kind == heater_quadratic ? m.beta : 0) * (t - RT_TEMP));
+        double r = R0 * ratio;
+        e.res = fmax(e.res, fabs(lut.resistance(t) - r) / r);
+        if (m.kind != heater_table) e.temp = fmax(e.temp, fabs(lut.temperature(r) - t));
+        e.round_trip = fmax(e.round_trip, fabs(lut.temperature(lut.resistance(t)) - t));
+    }
+    return e;
+}
+
+static void test_linear()
+{
+    heater_model_t m = make(heater_linear);
+    errors_t e = sweep(m, TEMPCO);
+    printf("linear: T %.5f K, R %.2e, round trip %.5f K\n", e.temp, e.res, e.round_trip);
+    CHECK(e.temp < LINEAR_TEMP_ERROR);
+    CHECK(e.res < RES_ERROR);
+    CHECK(e.round_trip < LINEAR_TEMP_ERROR);
+
+    heater_lut_t lut;
+    heater_model::prepare(&lut, &m, TEMPCO, R0, RT_TEMP);
+    //Above temp_max the last interval extrapolates, which is exact for a line
+    double r = R0 * (1 + TEMPCO * (1500 - RT_TEMP));
+    CHECK(fabs(lut.temperature(r) - 1500) < 10 * LINEAR_TEMP_ERROR);
+    CHECK(fabs(lut.resistance(1500) - r) / r < RES_ERROR);
+    //Below R0, and for NaN, the temperature is clamped to rt_temp
+    CHECK(lut.temperature(R0 * 0.9f) == RT_TEMP);
+    CHECK(lut.temperature(NAN) == RT_TEMP);
+    CHECK(lut.resistance(200) == R0);
+}
+
+static void test_quadratic()
+{
+    heater_model_t m = make(heater_quadratic);
+    CHECK(heater_model::validate(&m, RT_TEMP) && heater_model::monotonic(&m, TEMPCO, RT_TEMP));
+    errors_t e = sweep(m, TEMPCO);
+    printf("quadratic: T %.5f K, R %.2e, round trip %.5f K\n", e.temp, e.res, e.round_trip);
+    CHECK(e.temp < QUADRATIC_TEMP_ERROR);
+    CHECK(e.res < RES_ERROR);
+    CHECK(e.round_trip < QUADRATIC_TEMP_ERROR);
+
+    heater_lut_t lut;
+    heater_model::prepare(&lut, &m, TEMPCO, R0, RT_TEMP);
+    double worst = 0;
+    for (size_t i = 1; i < HEATER_LUT_SIZE; i++) //The bisected breakpoints themselves
+    {
+        double r = lut.r_min + (lut.res[HEATER_LUT_SIZE] - lut.r_min) * i / HEATER_LUT_SIZE;
+        worst = fmax(worst, fabs(lut.temp[i] - quadratic_temp(r, TEMPCO, BETA)));
+    }
+    CHECK(worst < LINEAR_TEMP_ERROR);
+
+    //A beta that turns the curve over before temp_max: the tables fall back to the linear model
+    heater_model_t over = m;
+    over.beta = -3e-6f;
+    CHECK(!heater_model::monotonic(&over, TEMPCO, RT_TEMP));
+    heater_model_t linear = make(heater_linear);
+    heater_lut_t a, b;
+    heater_model::prepare(&a, &over, TEMPCO, R0, RT_TEMP);
+    heater_model::prepare(&b, &linear, TEMPCO, R0, RT_TEMP);
+    CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+}
+
+static void test_table()
+{
+    heater_model_t m = make(heater_table);
+    const float temps[] = { 273, 400, 550, 700, 900, 1073 }; //Breakpoints off the uniform grid
+    m.points = sizeof(temps) / sizeof(temps[0]);
+    for (size_t i = 0; i < m.points; i++)
+    {
+        double t = temps[i] - RT_TEMP;
+        m.temp[i] = temps[i];
+        m.ratio[i] = 1 + t * (TEMPCO + BETA * t);
+    }
+    CHECK(heater_model::validate(&m, RT_TEMP));
+    errors_t e = sweep(m, 0); //tempco isn't used by tables
+    printf("table: R %.2e, round trip %.5f K\n", e.res, e.round_trip);
+    CHECK(e.res < RES_ERROR * 10); //The kinks fall inside LUT intervals
+    CHECK(e.round_trip < TABLE_TEMP_ERROR);
+    heater_lut_t lut;
+    heater_model::prepare(&lut, &m, 0, R0, RT_TEMP);
+    for (size_t i = 0; i < m.points; i++)
+    {
+        double t = quadratic_temp(R0 * m.ratio[i], TEMPCO, BETA); //The breakpoints lie on the quadratic
+        CHECK(fabs(t - m.temp[i]) < LINEAR_TEMP_ERROR);
+        CHECK(fabs(lut.temperature(R0 * m.ratio[i]) - m.temp[i]) < TABLE_TEMP_ERROR);
+    }
+}
+
+// R0 from a resistance measured at some temperature, then the tables through that R0 reproduce the measurement
+static void test_base_resistance()
+{
+    const float temps[] = { RT_TEMP, 293.15f, 350, 600 };
+    for (uint8_t kind = heater_linear; kind <= heater_quadratic; kind++)
+    {
+        heater_model_t m = make(kind);
+        for (float t : temps)
+        {
+            double r = R0 * (1 + (t - RT_TEMP) * (TEMPCO + (kind == heater_quadratic ? BETA : 0) * (t - RT_TEMP)));
+            float r0 = heater_model::base_resistance(&m, TEMPCO, RT_TEMP, r, t);
+            CHECK(fabs(r0 - R0) < R0 * 1e-6);
+            heater_lut_t lut;
+            heater_model::prepare(&lut, &m, TEMPCO, r0, RT_TEMP);
+            CHECK(fabs(lut.temperature(r) - t) < QUADRATIC_TEMP_ERROR);
+        }
+    }
+    //Non-monotonic quadratic: R0 under the same linear fallback prepare() uses
+    heater_model_t over = make(heater_quadratic);
+    over.beta = -3e-6f;
+    float r0 = heater_model::base_resistance(&over, TEMPCO, RT_TEMP, R0 * (1 + TEMPCO * 100), RT_TEMP + 100);
+    CHECK(fabs(r0 - R0) < R0 * 1e-6);
+    //No positive ratio at that temperature
+    heater_model_t m = make(heater_linear);
+    CHECK(isnan(heater_model::base_resistance(&m, TEMPCO, RT_TEMP, R0, RT_TEMP - 1 / TEMPCO - 10)));
+}
+
+static void test_validate()
+{
+    heater_model_t m = make(heater_linear);
+    CHECK(heater_model::validate(&m, RT_TEMP));
+    CHECK(!heater_model::monotonic(&m, 0, RT_TEMP));
+    CHECK(!heater_model::monotonic(&m, -TEMPCO, RT_TEMP));
+    CHECK(!heater_model::monotonic(&m, NAN, RT_TEMP));
+    m.temp_max = RT_TEMP + 5;
+    CHECK(!heater_model::validate(&m, RT_TEMP));
+    m.temp_max = HEATER_TEMP_LIMIT + 1;
+    CHECK(!heater_model::validate(&m, RT_TEMP));
+    m = make(heater_table);
+    m.points = 2;
+    m.temp[0] = 300;
+    m.temp[1] = 400;
+    m.ratio[0] = 1;
+    m.ratio[1] = 1; //Not rising
+    CHECK(!heater_model::validate(&m, RT_TEMP));
+    m.kind = heater_table + 1;
+    CHECK(!heater_model::validate(&m, RT_TEMP));
+}
+
+int main()
+{
+    test_linear();
+    test_quadratic();
+    test_table();
+    test_base_resistance();
+    test_validate();
+    return check_result("test_heater_model");
+}
@@ -0,0 +1,143 @@
+// Trip latency: heater_guard switches the DAC off on the conversion that crosses a limit, and the pty stand-in,
+// which runs the same guard on its points, never drives the heater past it
+#include "heater_guard.h"
+#include "sensor_client.h"
+#include "device_sim.h"
+#include "check.h"
+
+#include <thread>
+
+#define TRIP_LATENCY_TICKS 1 //Conversions from the first one over a limit to the DAC off, inclusive
+#define RAMP_TICKS 2000
+#define SIM_POINTS 100
+#define SIM_PERIOD_MS 500
+#define SIM_MAX_TEMP 420 //K, inside the stand-in's 300..500 K cycle
+#define SIM_TRIP_WAIT_MS 3000
+
+using namespace protocol;
+
+// my_dac_channel as seen by my_trip::check() and my_sensor::control()
+struct fake_dac
+{
+    float voltage = 0;
+    bool is_off = false;
+    void set(float v) { voltage = v; is_off = false; }
+    void off() { voltage = 0; is_off = true; }
+};
+
+// One control tick in the firmware's order: the guard on the raw sample first, the DAC forced off on a trip,
+// otherwise driven. Returns true while tripped
+static bool control_tick(heater_guard& guard, fake_dac& dac, float v, float i, const heater_guard_limits_t* l)
+{
+    if (guard.check(v, i, l) != trip_none || guard.get_trip() != trip_none)
+    {
+        dac.off();
+        return true;
+    }
+    dac.set(v);
+    return false;
+}
+
+static const heater_limits_t limits = { 1000, 0.7f, 0.5f, 0.002f, 1, 0.05f }; //Firmware defaults
+static const float max_resistance = 30; //Ohm at limits.max_temp
+
+// Steps (v, i) from a safe sample to a bad one over RAMP_TICKS: the DAC goes off on the first sample over a limit,
+// as found by a fresh guard, and stays off
+static void check_ramp(float v0, float i0, float v1, float i1, uint8_t cause)
+{
+    heater_guard_limits_t l;
+    heater_guard::prepare(&l, &limits, max_resistance);
+    heater_guard guard;
+    fake_dac dac;
+    int first_bad = -1, off_at = -1;
+    uint8_t seen = trip_none;
+    for (int t = 0; t < RAMP_TICKS; t++)
+    {
+        float x = static_cast<float>(t) / (RAMP_TICKS - 1);
+        float v = v0 + x * (v1 - v0);
+        float i = i0 + x * (i1 - i0);
+        heater_guard probe; //Fresh, to find the first sample over a limit independently of the latch
+        if (first_bad < 0 && probe.check(v, i, &l) != trip_none) first_bad = t;
+        control_tick(guard, dac, v, i, &l);
+        if (off_at < 0 && dac.is_off)
+        {
+            off_at = t;
+            seen = guard.get_trip();
+        }
+        if (off_at >= 0) CHECK(dac.is_off && dac.voltage == 0); //Latched for the rest of the ramp
+    }
+    CHECK(first_bad >= 0);
+    CHECK(off_at >= first_bad && off_at - first_bad < TRIP_LATENCY_TICKS);
+    CHECK(seen == cause);
+    CHECK(guard.get_trip() == cause);
+}
+
+static void test_latency()
+{
+    check_ramp(1.0f, 0.1f, 4.0f, 0.1f, trip_over_temp); //10..40 Ohm at a constant current
+    check_ramp(1.0f, 0.1f, 2.0f, 0.9f, trip_over_current);
+    check_ramp(0.0f, 0.0f, 1.0f, 0.0f, trip_open); //A falling current reads as over-temperature first
+    check_ramp(1.0f, 0.1f, 0.05f, 0.2f, trip_short);
+
+    heater_guard_limits_t l;
+    heater_guard::prepare(&l, &limits, max_resistance);
+    heater_guard guard;
+    fake_dac dac;
+    CHECK(!control_tick(guard, dac, 1.0f, 0.1f, &l) && !dac.is_off);
+    CHECK(control_tick(guard, dac, NAN, 0.1f, &l) && dac.is_off);
+    CHECK(guard.get_trip() == trip_invalid);
+
+    // Latched through good samples, until cleared. A second cause doesn't replace the first
+    for (int t = 0; t < 10; t++) CHECK(control_tick(guard, dac, 1.0f, 0.1f, &l) && dac.is_off);
+    CHECK(guard.check(1.0f, 0.9f, &l) == trip_none && guard.get_trip() == trip_invalid);
+    CHECK(guard.clear());
+    CHECK(!guard.clear());
+    CHECK(!control_tick(guard, dac, 1.0f, 0.1f, &l) && !dac.is_off);
+    CHECK(control_tick(guard, dac, 1.0f, 0.9f, &l) && guard.get_trip() == trip_over_current); //Trips again at once
+}
+
+static void test_sim()
+{
+    device_sim sim;
+    sim.set_cycle(SIM_POINTS, std::chrono::milliseconds(SIM_PERIOD_MS));
+    CHECK(sim.start());
+    sensor_client client;
+    CHECK(client.open(sim.get_path()));
+    client.set_timeout(std::chrono::milliseconds(2000));
+
+    heater_limits_t low = limits;
+    low.max_temp = SIM_MAX_TEMP;
+    CHECK(client.command(CMD_SET_TRIP_LIMITS, &low, sizeof(low)) == RSP_OK);
+    CHECK(client.command(CMD_GET_TRIP) == trip_none);
+    CHECK(client.command(CMD_START) == RSP_OK);
+    int trip = trip_none;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SIM_TRIP_WAIT_MS);
+    while (trip == trip_none && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        trip = client.command(CMD_GET_TRIP);
+    }
+    CHECK(trip == trip_over_temp);
+    // The stand-in steps 400 K per cycle in SIM_POINTS points: the last point driven is within one of the limit
+    float step = 400.0f / SIM_POINTS;
+    float peak = sim.get_peak_temp(0);
+    CHECK(peak <= SIM_MAX_TEMP && peak > SIM_MAX_TEMP - TRIP_LATENCY_TICKS * step);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_PERIOD_MS / 5));
+    CHECK(sim.get_peak_temp(0) == peak); //Stays off
+    CHECK(client.command(CMD_GET_TRIP) == trip_over_temp);
+
+    CHECK(client.command(CMD_SET_TRIP_LIMITS, &limits, sizeof(limits)) == RSP_OK);
+    CHECK(client.command(CMD_CLEAR_TRIP) == RSP_OK);
+    CHECK(client.command(CMD_CLEAR_TRIP) == RSP_ALREADY_IN_REQUESTED_STATE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_PERIOD_MS));
+    CHECK(client.command(CMD_GET_TRIP) == trip_none);
+    CHECK(sim.get_peak_temp(0) > SIM_MAX_TEMP); //Heating again, through the whole cycle
+    CHECK(client.command(CMD_STOP) == RSP_OK);
+}
+
+int main()
+{
+    test_latency();
+    test_sim();
+    return check_result("test_heater_trip");
+}
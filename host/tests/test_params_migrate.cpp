@@ -0,0 +1,85 @@
+// NVS records of older schemas on the firmware's parameter store (main/my_params.cpp): the previous schema's records
+// are prefixes of the current ones, anything else falls back to the defaults. Either way the records are rewritten
+#include "idf_host.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "my_params.h"
+#include "check.h"
+
+#include <string.h>
+#include <vector>
+
+#define SCHEMA 1 //PARAMS_SCHEMA_VERSION, my_params.cpp
+#define DEFAULT_OPEN_VOLTAGE 0.5f //TRIP_OPEN_VOLTAGE
+#define DEFAULT_SHORT_CURRENT 0.05f //TRIP_SHORT_CURRENT
+
+struct record_header //my_record_header_t
+{
+    uint16_t version;
+    uint16_t size;
+};
+
+static void write_record(nvs_handle_t handle, const char* key, uint16_t version, const void* data, size_t size)
+{
+    record_header h = { version, static_cast<uint16_t>(size) };
+    std::vector<uint8_t> blob(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+    blob.insert(blob.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+    CHECK(nvs_set_blob(handle, key, blob.data(), blob.size()) == ESP_OK);
+}
+
+static record_header read_header(nvs_handle_t handle, const char* key)
+{
+    size_t len = 0;
+    record_header h = {};
+    if (nvs_get_blob(handle, key, NULL, &len) != ESP_OK || len < sizeof(h)) return h;
+    std::vector<uint8_t> blob(len);
+    if (nvs_get_blob(handle, key, blob.data(), &len) == ESP_OK) memcpy(&h, blob.data(), sizeof(h));
+    return h;
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    CHECK(nvs_flash_init() == ESP_OK);
+    nvs_handle_t handle;
+    CHECK(nvs_open("my", NVS_READWRITE, &handle) == ESP_OK);
+
+    //Previous schema, shorter: the fields it has are kept, the appended ones get their defaults
+    heater_limits_t trip = {};
+    trip.max_temp = 850;
+    trip.max_current = 0.5f;
+    write_record(handle, "trip", SCHEMA - 1, &trip, 2 * sizeof(float));
+    //Previous schema, same size
+    my_pid_params_t pid = {};
+    pid.kI = 0.25f;
+    pid.limI = 2;
+    pid.kPE = 0.3f;
+    write_record(handle, "pid", SCHEMA - 1, &pid, sizeof(pid));
+    //Previous schema but longer than the current record: not a prefix
+    my_timings_t timings[2] = { { 8, 5, 250 }, {} };
+    write_record(handle, "timings", SCHEMA - 1, timings, sizeof(timings));
+    //Newer schema
+    my_dac_cal_t dac = { 1, 2 };
+    write_record(handle, "dac_cal", SCHEMA + 1, &dac, sizeof(dac));
+    nvs_close(handle);
+
+    CHECK(my_params::init() == ESP_OK);
+    const heater_limits_t* l = my_params::get_trip_limits(0);
+    CHECK(l->max_temp == 850 && l->max_current == 0.5f);
+    CHECK(l->open_voltage == DEFAULT_OPEN_VOLTAGE && l->short_current == DEFAULT_SHORT_CURRENT);
+    CHECK(memcmp(my_params::get_pid_params(0), &pid, sizeof(pid)) == 0);
+    CHECK(my_params::get_timings(0)->averaging_len != 8 && my_params::get_timings(0)->oversampling_rate != 250);
+    CHECK(memcmp(my_params::get_dac_cal(0), &my_params::default_dac_cal, sizeof(dac)) == 0);
+
+    //Stored again in the current schema, so the next boot loads them directly
+    CHECK(nvs_open("my", NVS_READONLY, &handle) == ESP_OK);
+    for (const char* key : { "trip", "pid", "timings", "dac_cal" })
+    {
+        record_header h = read_header(handle, key);
+        CHECK(h.version == SCHEMA);
+    }
+    CHECK(read_header(handle, "trip").size == sizeof(heater_limits_t));
+    nvs_close(handle);
+    return check_result("test_params_migrate");
+}
@@ -0,0 +1,107 @@
+// Profile library slots: save order, validation of erased, torn and corrupted slots, in-place activation cost
+#include "profile_store.h"
+#include "protocol.h"
+#include "check.h"
+
+#include <chrono>
+#include <vector>
+
+#define SLOTS 8
+#define ACTIVATIONS 2000
+#define ACTIVATION_BUDGET_US 5000 //Host, per activation, with the bitwise CRC of protocol.h in an unoptimized build
+
+static uint32_t crc(uint32_t c, uint8_t const* buf, uint32_t len)
+{
+    return protocol::crc32_le(c, buf, len);
+}
+
+// Flash image, written the way my_profile_store::save() does. header_too = false leaves a torn entry
+static void save(std::vector<uint8_t>& flash, size_t slot, uint8_t mode, size_t length, float start, const char* name,
+    const void* data, bool header_too = true)
+{
+    uint8_t* base = flash.data() + slot * PROFILE_STORE_SLOT_SIZE;
+    memset(base, 0xFF, PROFILE_STORE_SLOT_SIZE);
+    profile_store_header_t h;
+    bool ok = profile_store::make_header(&h, mode, length, start, name, data, &crc);
+    CHECK(ok);
+    if (!ok) return;
+    memcpy(base + sizeof(h), data, h.payload_size);
+    if (header_too) memcpy(base, &h, sizeof(h));
+}
+
+static std::vector<float> make_table(size_t length)
+{
+    std::vector<float> t(length);
+    for (size_t i = 0; i < length; i++) t[i] = 300 + i;
+    return t;
+}
+
+static std::vector<profile_segment_t> make_segments(size_t count)
+{
+    std::vector<profile_segment_t> s(count);
+    for (size_t i = 0; i < count; i++) s[i] = { segment_ramp, {}, 100, 300.0f + 10 * i, 0 };
+    return s;
+}
+
+static void test_validation()
+{
+    std::vector<uint8_t> flash(SLOTS * PROFILE_STORE_SLOT_SIZE, 0xFF);
+    size_t table_max = profile_store::max_length(profile_table);
+    size_t segments_max = profile_store::max_length(profile_segments);
+    CHECK(table_max == (PROFILE_STORE_SLOT_SIZE - sizeof(profile_store_header_t)) / sizeof(float));
+    std::vector<float> table = make_table(table_max);
+    std::vector<profile_segment_t> segments = make_segments(segments_max);
+
+    save(flash, 0, profile_table, table_max, 0, "full table", table.data());
+    save(flash, 1, profile_segments, segments_max, 290, "0123456789abcdef", segments.data()); // Name without a terminator
+    save(flash, 3, profile_table, 10, 0, "torn", table.data(), false);
+    save(flash, 4, profile_table, 10, 0, "flipped", table.data());
+    flash[4 * PROFILE_STORE_SLOT_SIZE + sizeof(profile_store_header_t) + 5] ^= 0x10;
+
+    const void* base = flash.data();
+    CHECK(profile_store::valid(profile_store::slot(base, 0), &crc));
+    CHECK(profile_store::valid(profile_store::slot(base, 1), &crc));
+    CHECK(!profile_store::valid(profile_store::slot(base, 2), &crc)); // Erased
+    CHECK(!profile_store::valid(profile_store::slot(base, 3), &crc));
+    CHECK(!profile_store::valid(profile_store::slot(base, 4), &crc));
+    CHECK(memcmp(profile_store::slot(base, 1)->name, "0123456789abcdef", PROFILE_STORE_NAME_LEN) == 0);
+
+    profile_store_header_t h;
+    CHECK(!profile_store::make_header(&h, profile_table, table_max + 1, 0, "too long", table.data(), &crc));
+    CHECK(!profile_store::make_header(&h, profile_table, 0, 0, "empty", table.data(), &crc));
+    CHECK(!profile_store::make_header(&h, 7, 10, 0, "bad mode", table.data(), &crc));
+}
+
+// Activation plays the entry in place: a CRC check over the slot and a pointer, no copy
+static void test_activation()
+{
+    std::vector<uint8_t> flash(SLOTS * PROFILE_STORE_SLOT_SIZE, 0xFF);
+    size_t count = profile_store::max_length(profile_segments);
+    std::vector<profile_segment_t> segments = make_segments(count);
+    save(flash, 2, profile_segments, count, 290, "segments", segments.data());
+    const profile_store_header_t* h = profile_store::slot(flash.data(), 2);
+    const uint8_t* payload = static_cast<const uint8_t*>(profile_store::payload(h));
+    CHECK(payload == flash.data() + 2 * PROFILE_STORE_SLOT_SIZE + sizeof(profile_store_header_t));
+    CHECK(reinterpret_cast<uintptr_t>(payload) % sizeof(float) == 0);
+
+    segment_profile engine;
+    float first = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ACTIVATIONS; i++)
+    {
+        if (!profile_store::valid(h, &crc)) break;
+        engine.init(static_cast<const profile_segment_t*>(profile_store::payload(h)), h->length, h->start, 500);
+        engine.next(first);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / ACTIVATIONS;
+    printf("activation of a full slot: %.1f us\n", us);
+    CHECK(us < ACTIVATION_BUDGET_US);
+    CHECK(first > 289 && first < 301); // Ramping from the start value
+}
+
+int main()
+{
+    test_validation();
+    test_activation();
+    return check_result("test_profile_store");
+}
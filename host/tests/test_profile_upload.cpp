@@ -0,0 +1,103 @@
+// Chunked profile upload through the firmware's receiver (main/my_uart.cpp), on a link that loses and corrupts frames
+#include "idf_host.h"
+#include "esp_log.h"
+#include "my_uart.h"
+#include "my_params.h"
+#include "sensor_client.h"
+#include "check.h"
+
+#include <vector>
+
+using namespace protocol;
+
+static std::vector<float> make_profile(size_t length, float base)
+{
+    std::vector<float> p(length);
+    for (size_t i = 0; i < length; i++) p[i] = base + 0.5f * i;
+    return p;
+}
+
+// The control task's part: switch to the committed profile, then play one cycle and collect its points
+static std::vector<float> play_cycle(size_t length)
+{
+    my_uart::set_timings(0, my_params::get_timings(0));
+    my_uart::idle(0);
+    std::vector<float> points;
+    while (points.size() < length)
+    {
+        bool due = my_uart::point_due(0);
+        float v = my_uart::tick(0);
+        if (due) points.push_back(v);
+    }
+    return points;
+}
+
+// A new connection per upload, so that its frames are counted on their own
+static bool connect(sensor_client& client, float drop, float corrupt, uint32_t seed)
+{
+    idf_host::set_usb_rx_faults(drop, corrupt, seed);
+    return client.attach(idf_host::usb_connect());
+}
+
+// Fault probabilities, see idf_host::set_usb_rx_faults()
+static void upload(float drop, float corrupt, size_t length, uint32_t seed)
+{
+    sensor_client client;
+    size_t frames = idf_host::get_usb_frames_received();
+    CHECK(connect(client, drop, corrupt, seed));
+    client.set_timeout(std::chrono::milliseconds(200)); //Each lost frame costs one timeout
+    std::vector<float> profile = make_profile(length, 300 + seed);
+    int rsp = client.upload_profile(profile.data(), profile.size());
+    printf("%.0f%% lost, %.0f%% corrupted, %zu points: response %d, %zu frames received\n", drop * 100, corrupt * 100,
+        length, rsp, idf_host::get_usb_frames_received() - frames);
+    CHECK(rsp == RSP_OK);
+    profile_upload_status st;
+    bool have_status = false;
+    for (size_t i = 0; i < 8 && !have_status; i++) have_status = client.get_upload_status(st);
+    CHECK(have_status && st.length == 0 && st.pending); //Nothing left open, committed
+    CHECK(play_cycle(length) == profile);
+    client.close();
+}
+
+// A bad whole-profile CRC is refused, the upload stays open for a resend
+static void bad_commit()
+{
+    sensor_client client;
+    CHECK(connect(client, 0, 0, 1));
+    std::vector<float> profile = make_profile(100, 400);
+    uint16_t length = profile.size();
+    CHECK(client.command(CMD_PROFILE_BEGIN, &length, sizeof(length)) == RSP_OK);
+    std::vector<uint8_t> args(sizeof(profile_chunk_header) + length * sizeof(float));
+    profile_chunk_header h = { 0, static_cast<uint16_t>(length * sizeof(float)), 0 };
+    h.crc = ~crc32_le(~0u, reinterpret_cast<const uint8_t*>(profile.data()), h.length);
+    memcpy(args.data(), &h, sizeof(h));
+    memcpy(args.data() + sizeof(h), profile.data(), h.length);
+    CHECK(client.command(CMD_PROFILE_CHUNK, args.data(), args.size()) == RSP_OK);
+    uint32_t crc = 0;
+    CHECK(client.command(CMD_PROFILE_COMMIT, &crc, sizeof(crc)) == RSP_BAD_CRC);
+    profile_upload_status st;
+    CHECK(client.get_upload_status(st) && !st.pending && st.length == length && st.first_missing == length);
+    crc = h.crc; //A single chunk: the same CRC
+    CHECK(client.command(CMD_PROFILE_COMMIT, &crc, sizeof(crc)) == RSP_OK);
+    CHECK(play_cycle(length) == profile);
+    client.close();
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_ERROR); //Corrupted frames are logged as warnings
+    CHECK(my_params::init() == ESP_OK);
+    my_uart::init();
+    my_uart::init_usb();
+
+    upload(0, 0, CYCLE_LENGTH, 1);
+    for (uint32_t seed = 1; seed <= 4; seed++)
+    {
+        upload(0.2f, 0, CYCLE_LENGTH, seed);
+        upload(0, 0.2f, CYCLE_LENGTH, seed);
+        upload(0.15f, 0.15f, CYCLE_LENGTH, seed);
+    }
+    upload(0.3f, 0, 37, 1); //One short chunk
+    bad_commit();
+    return check_result("test_profile_upload");
+}
@@ -0,0 +1,241 @@
+// Long runs of the phase accumulators and the segment profile: event counts stay exact, and profiles repeat
+// cycle after cycle without drifting
+#include "rate_scheduler.h"
+#include "profile_engine.h"
+#include "check.h"
+
+#include <math.h>
+#include <vector>
+
+#define DIVIDER_TICKS 10000000 //Base ticks per (rate, base) pair
+#define PERIOD_EVENTS 1000000
+#define PROFILE_CYCLES 2000
+#define SINE_HOURS 1
+
+static void test_divider(uint32_t rate, uint32_t base)
+{
+    rate_divider d;
+    d.configure(rate, base);
+    d.arm();
+    uint64_t fired = 0;
+    uint64_t last = 0;
+    uint32_t min_gap = UINT32_MAX, max_gap = 0;
+    bool exact = true;
+    for (uint64_t n = 1; n <= DIVIDER_TICKS; n++)
+    {
+        bool due = d.due();
+        bool f = d.tick();
+        if (f != due) exact = false;
+        if (!f) continue;
+        fired++;
+        if (fired > 1)
+        {
+            uint32_t gap = static_cast<uint32_t>(n - last);
+            if (gap < min_gap) min_gap = gap;
+            if (gap > max_gap) max_gap = gap;
+        }
+        last = n;
+        //Armed: the first tick fires, then one every base / rate ticks on average
+        if (fired != (static_cast<uint64_t>(base - rate) + n * rate) / base) exact = false;
+    }
+    CHECK(exact);
+    CHECK(fired == (static_cast<uint64_t>(base - rate) + static_cast<uint64_t>(DIVIDER_TICKS) * rate) / base);
+    CHECK(min_gap >= base / rate && max_gap <= (base + rate - 1) / rate);
+}
+
+static void test_period(uint32_t rate, uint32_t clock_rate)
+{
+    tick_period p;
+    p.configure(rate, clock_rate);
+    uint64_t ticks = 0;
+    bool bounded = true;
+    for (uint64_t k = 1; k <= PERIOD_EVENTS; k++)
+    {
+        uint32_t n = p.next();
+        if (n < clock_rate / rate || n > (clock_rate + rate - 1) / rate) bounded = false;
+        ticks += n;
+    }
+    CHECK(bounded);
+    CHECK(ticks == static_cast<uint64_t>(PERIOD_EVENTS) * clock_rate / rate);
+}
+
+// Points per cycle, the way the player restarts the divider at every cycle start
+static void test_cycle_points(uint32_t loop_rate, uint32_t point_rate, uint32_t cycle_ticks)
+{
+    rate_divider d;
+    d.configure(point_rate, loop_rate);
+    uint32_t first = 0;
+    bool same = true;
+    for (int c = 0; c < PROFILE_CYCLES; c++)
+    {
+        d.arm();
+        uint32_t points = 0;
+        for (uint32_t t = 0; t < cycle_ticks; t++) points += d.tick();
+        if (c == 0) first = points;
+        else if (points != first) same = false;
+    }
+    CHECK(same);
+    CHECK(first == (static_cast<uint64_t>(loop_rate - point_rate) + static_cast<uint64_t>(cycle_ticks) * point_rate) / loop_rate);
+}
+
+static void test_profile_cycles()
+{
+    const uint32_t rate = 997; //Not a divisor of any duration
+    profile_segment_t segments[] = {
+        { segment_ramp, {}, 1234, 500, 0 },
+        { segment_exp, {}, 777, 350, 0.2f },
+        { segment_sine, {}, 2001, 20, 0.333f },
+        { segment_step, {}, 13, 420, 0 },
+        { segment_ramp, {}, 999, 300, 0 },
+        { segment_hold, {}, 500, 0, 0 },
+    };
+    size_t count = sizeof(segments) / sizeof(segments[0]);
+    CHECK(segment_profile::validate(segments, count, rate));
+    uint32_t expected = 0;
+    for (size_t i = 0; i < count; i++) expected += static_cast<uint64_t>(segments[i].duration_ms) * rate / 1000;
+
+    segment_profile p;
+    p.init(segments, count, 300, rate);
+    std::vector<float> first;
+    bool same_length = true, same_values = true;
+    for (int c = 0; c < PROFILE_CYCLES; c++)
+    {
+        p.rewind();
+        float v;
+        size_t n = 0;
+        while (p.next(v))
+        {
+            if (c == 0) first.push_back(v);
+            else if (n >= first.size() || v != first[n]) same_values = false;
+            n++;
+        }
+        if (n != expected) same_length = false;
+        if (c == 0) CHECK(p.get_value() == 300); //The last ramp lands on its target
+    }
+    CHECK(same_length);
+    CHECK(same_values);
+    CHECK(first.size() == expected);
+}
+
+// Segments that would truncate to no tick at the rate they're played at are refused
+static void test_profile_validate()
+{
+    profile_segment_t segments[] = {
+        { segment_ramp, {}, 1000, 500, 0 },
+        { segment_step, {}, 10, 420, 0 },
+    };
+    CHECK(segment_profile::validate(segments, 2, 1000));
+    CHECK(segment_profile::validate(segments, 2, 100)); //10 ms: exactly one tick
+    CHECK(!segment_profile::validate(segments, 2, 99));
+    CHECK(!segment_profile::validate(segments, 0, 1000));
+    segments[1].duration_ms = 0;
+    CHECK(!segment_profile::validate(segments, 2, 1000));
+
+    //A profile that validates plays every segment for at least one tick
+    profile_segment_t short_steps[] = {
+        { segment_step, {}, 1, 100, 0 },
+        { segment_step, {}, 1, 200, 0 },
+    };
+    CHECK(!segment_profile::validate(short_steps, 2, 500));
+    CHECK(segment_profile::validate(short_steps, 2, 1000));
+    segment_profile p;
+    p.init(short_steps, 2, 0, 1000);
+    float v1 = 0, v2 = 0, v3 = 0;
+    CHECK(p.next(v1) && p.next(v2) && !p.next(v3));
+    CHECK(v1 == 100 && v2 == 200);
+}
+
+// Loop rate changes the way control_task() and cycle_end() take them, both through effective_rates(): the period
+// and the segment ticks follow the clamped rate, so the profile keeps its wall-clock duration at every rate
+static void test_rate_change()
+{
+    const uint32_t clock_rate = 1000;
+    const uint32_t requested[] = { 1000, 300, 2000, 7, 997 }; //2000 is above the clock
+    const profile_segment_t s = { segment_ramp, {}, 2500, 500, 0 };
+    tick_period period;
+    for (uint32_t r : requested)
+    {
+        rates_t rates;
+        effective_rates(clock_rate, r, r, &rates);
+        period.configure(rates.loop_rate, clock_rate);
+        segment_profile p;
+        p.init(&s, 1, 300, rates.loop_rate);
+        uint64_t loop_ticks = 0, clock_ticks = 0;
+        bool bounded = true, same_duration = true;
+        for (int c = 0; c < PROFILE_CYCLES; c++)
+        {
+            p.rewind();
+            uint64_t start = clock_ticks;
+            float v;
+            while (p.next(v))
+            {
+                uint32_t n = period.next();
+                if (n < rates.loop_period_min || n > rates.loop_period_max) bounded = false;
+                clock_ticks += n;
+                loop_ticks++;
+            }
+            //Within one loop period short of the segment, never longer
+            uint64_t ms = (clock_ticks - start) * 1000 / clock_rate;
+            if (ms > s.duration_ms || ms + rates.loop_period_max < s.duration_ms) same_duration = false;
+        }
+        CHECK(bounded);
+        CHECK(same_duration);
+        CHECK(loop_ticks == static_cast<uint64_t>(PROFILE_CYCLES) * (static_cast<uint64_t>(s.duration_ms) * rates.loop_rate / 1000));
+        CHECK(clock_ticks == loop_ticks * clock_rate / rates.loop_rate); //No drift since the change
+    }
+}
+
+// One long sine segment: amplitude and phase after hours of ticks
+static void test_sine_drift()
+{
+    const uint32_t rate = 1000;
+    const float period_s = 0.7f;
+    profile_segment_t s = { segment_sine, {}, SINE_HOURS * 3600000u, 50, period_s };
+    segment_profile p;
+    p.init(&s, 1, 400, rate);
+    float v;
+    uint64_t n = 0;
+    float peak = 0;
+    double worst = 0;
+    while (p.next(v))
+    {
+        n++;
+        float a = fabsf(v - 400);
+        if (a > peak) peak = a;
+        //Against the ideal phase: the rotation per tick is rounded to float once, so its error grows with n
+        if (n % 100003 == 0 || n == static_cast<uint64_t>(s.duration_ms))
+        {
+            double w = 2 * M_PI * (1.0f / rate) / period_s;
+            double want = 400 + 50 * sin(w * static_cast<double>(n));
+            if (fabs(v - want) > worst) worst = fabs(v - want);
+        }
+    }
+    CHECK(n == static_cast<uint64_t>(s.duration_ms) * rate / 1000);
+    CHECK(peak <= 50 * 1.0001f && peak >= 50 * 0.9999f);
+    printf("sine after %llu ticks: peak %.4f, worst deviation %.4f\n", static_cast<unsigned long long>(n), peak, worst);
+    CHECK(worst < 0.5); //K, 1% of the amplitude
+}
+
+int main()
+{
+    test_divider(1, 1);
+    test_divider(7, 1000);
+    test_divider(333, 1000);
+    test_divider(999, 1000);
+    test_divider(10, 30);
+
+    test_period(1, 1000);
+    test_period(3, 1000);
+    test_period(700, 1000);
+    test_period(999, 1000);
+
+    test_cycle_points(1000, 10, 5000);
+    test_cycle_points(1000, 7, 5000);
+    test_cycle_points(997, 333, 12345);
+
+    test_profile_cycles();
+    test_profile_validate();
+    test_rate_change();
+    test_sine_drift();
+    return check_result("test_rate_scheduler");
+}
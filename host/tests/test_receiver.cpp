@@ -0,0 +1,300 @@
+// The firmware's receiver (main/my_uart.cpp) on the host: frames whose CRC fails are answered with RSP_BAD_CRC and
+// change nothing, single commands, batches, profiles and the profile store alike
+#include "idf_host.h"
+#include "esp_log.h"
+#include "my_uart.h"
+#include "my_params.h"
+#include "my_profile_store.h"
+#include "rate_scheduler.h"
+#include "freertos/FreeRTOS.h"
+#include "protocol.h"
+#include "sensor_client.h"
+#include "check.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+#define REPLY_TIMEOUT_MS 2000
+
+using namespace protocol;
+
+static int fd = -1;
+static uint8_t wdt = 0;
+static frame_decoder decoder;
+
+// Flips the last CRC byte, so that the frame keeps its shape but fails its check
+static void break_crc(std::vector<uint8_t>& frame)
+{
+    uint8_t& last = frame[frame.size() - 2];
+    for (uint8_t mask = 1; mask; mask <<= 1)
+    {
+        uint8_t v = last ^ mask;
+        if (v != preamble && v != postamble && v != escape)
+        {
+            last = v;
+            return;
+        }
+    }
+}
+
+// Sends one frame and waits for the device's next frame, false on timeout
+static bool exchange(uint8_t cmd, const void* args, size_t len, bool bad_crc, frame_t& reply)
+{
+    std::vector<uint8_t> frame;
+    encode_frame(frame, cmd, args, len, ++wdt);
+    if (bad_crc) break_crc(frame);
+    if (write(fd, frame.data(), frame.size()) != static_cast<ssize_t>(frame.size())) return false;
+    uint8_t buf[256];
+    while (true)
+    {
+        struct pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, REPLY_TIMEOUT_MS) <= 0) return false;
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) return false;
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (decoder.feed(buf[i], reply)) return true; //One request in flight: the rest of buf is empty
+        }
+    }
+}
+
+// Response code of a standard response, -1 for anything else
+static int command(uint8_t cmd, const void* args = NULL, size_t len = 0, bool bad_crc = false)
+{
+    frame_t reply;
+    if (!exchange(cmd, args, len, bad_crc, reply)) return -1;
+    return (reply.cmd == cmd && reply.payload.size() == 1) ? reply.payload[0] : -1;
+}
+
+static profile_upload_status upload_status()
+{
+    profile_upload_status st = {};
+    frame_t reply;
+    if (exchange(CMD_PROFILE_STATUS, NULL, 0, false, reply) && reply.payload.size() == sizeof(st))
+        memcpy(&st, reply.payload.data(), sizeof(st));
+    return st;
+}
+
+// The control task's part: the committed profile becomes current at the cycle boundary
+static void switch_profile()
+{
+    my_uart::set_timings(0, my_params::get_timings(0));
+    my_uart::idle(0);
+}
+
+static bool published()
+{
+    bool changed = false;
+    my_params::acquire(0, &changed);
+    return changed;
+}
+
+static heater_limits_t limits(float max_temp)
+{
+    heater_limits_t l = *my_params::get_trip_limits(0);
+    l.max_temp = max_temp;
+    return l;
+}
+
+static void test_single()
+{
+    published(); //Consume the boot snapshot
+    heater_limits_t l = limits(900);
+    CHECK(command(CMD_SET_TRIP_LIMITS, &l, sizeof(l)) == RSP_OK);
+    CHECK(my_params::get_trip_limits(0)->max_temp == 900);
+    CHECK(published());
+
+    l = limits(800);
+    CHECK(command(CMD_SET_TRIP_LIMITS, &l, sizeof(l), true) == RSP_BAD_CRC);
+    CHECK(my_params::get_trip_limits(0)->max_temp == 900);
+    CHECK(!published());
+
+    my_pid_params_t pid = *my_params::get_pid_params(0);
+    pid.kPE *= 2;
+    CHECK(command(CMD_SET_PID_PARAMS, &pid, sizeof(pid), true) == RSP_BAD_CRC);
+    CHECK(memcmp(&pid, my_params::get_pid_params(0), sizeof(pid)) != 0);
+    CHECK(!published());
+
+    //Invalid: refused after the CRC, nothing published either
+    heater_model_t m = *my_params::get_heater_model(0);
+    m.kind = heater_table + 1;
+    CHECK(command(CMD_SET_HEATER_MODEL, &m, sizeof(m)) == RSP_SET_FAILED);
+    CHECK(my_params::get_heater_model(0)->kind != m.kind);
+
+    //Commands without arguments wait for the CRC as well
+    CHECK(command(CMD_START, NULL, 0, true) == RSP_BAD_CRC);
+    CHECK(!my_uart::get_operate(0));
+    CHECK(command(CMD_ENABLE_PID_DBG, NULL, 0, true) == RSP_BAD_CRC);
+    CHECK(!my_params::enable_pid_dbg);
+    CHECK(command(CMD_START) == RSP_OK);
+    CHECK(my_uart::get_operate(0));
+    CHECK(command(CMD_STOP) == RSP_OK);
+    CHECK(!my_uart::get_operate(0));
+}
+
+static std::vector<uint8_t> batch_args(const batch_builder& b, uint16_t id)
+{
+    batch_header h = { id, static_cast<uint16_t>(b.get_body().size()) };
+    std::vector<uint8_t> args(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+    args.insert(args.end(), b.get_body().begin(), b.get_body().end());
+    return args;
+}
+
+static void test_batch()
+{
+    published();
+    batch_builder b;
+    b.select_sensor(0);
+    b.set_trip_limits(limits(700));
+    my_pid_params_t pid = *my_params::get_pid_params(0);
+    pid.kI = 0.5f;
+    b.set_pid_params(pid);
+    std::vector<uint8_t> args = batch_args(b, 7);
+
+    frame_t reply;
+    CHECK(exchange(CMD_BATCH, args.data(), args.size(), true, reply));
+    CHECK(reply.cmd == CMD_BATCH && reply.payload.size() == 1 && reply.payload[0] == RSP_BAD_CRC);
+    CHECK(my_params::get_trip_limits(0)->max_temp == 900);
+    CHECK(my_params::get_pid_params(0)->kI != 0.5f);
+    CHECK(!published());
+
+    CHECK(exchange(CMD_BATCH, args.data(), args.size(), false, reply));
+    batch_response_header h = {};
+    CHECK(reply.cmd == CMD_BATCH && reply.payload.size() == sizeof(h) + 3);
+    memcpy(&h, reply.payload.data(), sizeof(h));
+    CHECK(h.request_id == 7 && h.result == RSP_OK && h.count == 3);
+    CHECK(my_params::get_trip_limits(0)->max_temp == 700);
+    CHECK(my_params::get_pid_params(0)->kI == 0.5f);
+    CHECK(published());
+
+    //One invalid entry: none applied
+    b.clear();
+    b.set_trip_limits(limits(600));
+    uint8_t bad_sensor = MY_SENSOR_NUM;
+    b.add(CMD_SELECT_SENSOR, &bad_sensor, sizeof(bad_sensor));
+    args = batch_args(b, 8);
+    CHECK(exchange(CMD_BATCH, args.data(), args.size(), false, reply));
+    CHECK(reply.cmd == CMD_BATCH && reply.payload.size() == sizeof(h) + 2);
+    memcpy(&h, reply.payload.data(), sizeof(h));
+    CHECK(h.result == RSP_SET_FAILED && reply.payload[sizeof(h)] == NO_STD_RSP && reply.payload[sizeof(h) + 1] == RSP_SET_FAILED);
+    CHECK(my_params::get_trip_limits(0)->max_temp == 700);
+    CHECK(!published());
+}
+
+struct store_save_args
+{
+    uint8_t slot;
+    char name[PROFILE_STORE_NAME_LEN];
+};
+
+// Flash is erased and written, and a stored profile activated, only once the CRC checks out
+static void test_store()
+{
+    store_save_args save = { 3, "corrupted" };
+    CHECK(command(CMD_STORE_SAVE, &save, sizeof(save), true) == RSP_BAD_CRC);
+    CHECK(my_profile_store::get(3) == NULL);
+    snprintf(save.name, sizeof(save.name), "default");
+    CHECK(command(CMD_STORE_SAVE, &save, sizeof(save)) == RSP_OK);
+    const profile_store_header_t* h = my_profile_store::get(3);
+    CHECK(h != NULL && strncmp(h->name, "default", sizeof(h->name)) == 0);
+    snprintf(save.name, sizeof(save.name), "corrupted");
+    CHECK(command(CMD_STORE_SAVE, &save, sizeof(save), true) == RSP_BAD_CRC);
+    CHECK(my_profile_store::get(3) == h && strncmp(h->name, "default", sizeof(h->name)) == 0);
+
+    uint8_t slot = 3;
+    CHECK(command(CMD_STORE_ACTIVATE, &slot, sizeof(slot), true) == RSP_BAD_CRC);
+    CHECK(!upload_status().pending);
+    CHECK(command(CMD_STORE_ACTIVATE, &slot, sizeof(slot)) == RSP_OK);
+    CHECK(upload_status().pending);
+    switch_profile();
+    CHECK(!upload_status().pending);
+    CHECK(command(CMD_STORE_SAVE, &save, sizeof(save)) == RSP_SET_FAILED); //Played from flash
+}
+
+static std::vector<uint8_t> segments_args(const profile_segment_t* segments, uint16_t count, float start)
+{
+    segments_header h = { count, 0, start };
+    std::vector<uint8_t> args(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+    args.insert(args.end(), reinterpret_cast<const uint8_t*>(segments), reinterpret_cast<const uint8_t*>(segments + count));
+    return args;
+}
+
+// Profiles are committed only once the frame's CRC checks out, segments only if each lasts a control tick
+static void test_profiles()
+{
+    CHECK(!upload_status().pending);
+    profile_segment_t segments[] = {
+        { segment_ramp, {}, 500, 400, 0 },
+        { segment_hold, {}, 500, 0, 0 },
+    };
+    std::vector<uint8_t> args = segments_args(segments, 2, 300);
+    CHECK(command(CMD_SET_SEGMENTS, args.data(), args.size(), true) == RSP_BAD_CRC);
+    CHECK(!upload_status().pending);
+    CHECK(command(CMD_SET_SEGMENTS, args.data(), args.size()) == RSP_OK);
+    CHECK(upload_status().pending);
+    switch_profile();
+
+    rates_t rates;
+    effective_rates(configTICK_RATE_HZ, my_params::get_timings()->oversampling_rate, 1, &rates);
+    segments[1].duration_ms = 999 / rates.loop_rate; //Truncates to no tick
+    args = segments_args(segments, 2, 300);
+    CHECK(command(CMD_SET_SEGMENTS, args.data(), args.size()) == RSP_SET_FAILED);
+    CHECK(!upload_status().pending);
+
+    std::vector<float> table(CYCLE_LENGTH, 350);
+    CHECK(command(CMD_SET_TEMP_CYCLE, table.data(), table.size() * sizeof(float), true) == RSP_BAD_CRC);
+    CHECK(!upload_status().pending);
+    CHECK(command(CMD_SET_TEMP_CYCLE, table.data(), table.size() * sizeof(float)) == RSP_OK);
+    CHECK(upload_status().pending);
+    switch_profile();
+
+    //Chunked upload: BEGIN and chunks wait for the frame's CRC too, the commit frame's is checked before the profile's
+    const uint16_t points = 64;
+    CHECK(command(CMD_PROFILE_BEGIN, &points, sizeof(points), true) == RSP_BAD_CRC);
+    CHECK(upload_status().length == 0);
+    CHECK(command(CMD_PROFILE_BEGIN, &points, sizeof(points)) == RSP_OK);
+    std::vector<uint8_t> chunk(sizeof(profile_chunk_header) + points * sizeof(float));
+    profile_chunk_header ch = { 0, static_cast<uint16_t>(points * sizeof(float)), 0 };
+    ch.crc = ~crc32_le(~0u, reinterpret_cast<const uint8_t*>(table.data()), ch.length);
+    memcpy(chunk.data(), &ch, sizeof(ch));
+    memcpy(chunk.data() + sizeof(ch), table.data(), ch.length);
+    CHECK(command(CMD_PROFILE_CHUNK, chunk.data(), chunk.size(), true) == RSP_BAD_CRC); //The chunk's own CRC is fine
+    profile_upload_status st = upload_status();
+    CHECK(st.length == points && st.first_missing == 0);
+    CHECK(command(CMD_PROFILE_CHUNK, chunk.data(), chunk.size()) == RSP_OK);
+    const uint16_t restart = 32;
+    CHECK(command(CMD_PROFILE_BEGIN, &restart, sizeof(restart), true) == RSP_BAD_CRC);
+    uint32_t crc = ch.crc;
+    CHECK(command(CMD_PROFILE_COMMIT, &crc, sizeof(crc), true) == RSP_BAD_CRC);
+    st = upload_status();
+    CHECK(!st.pending && st.length == points && st.first_missing == points);
+    CHECK(command(CMD_PROFILE_COMMIT, &crc, sizeof(crc)) == RSP_OK);
+    CHECK(upload_status().pending);
+    switch_profile();
+
+    //A table frame is received into the upload buffer: even a bad one drops the upload
+    CHECK(command(CMD_PROFILE_BEGIN, &points, sizeof(points)) == RSP_OK);
+    CHECK(upload_status().length == points);
+    CHECK(command(CMD_SET_TEMP_CYCLE, table.data(), table.size() * sizeof(float), true) == RSP_BAD_CRC);
+    st = upload_status();
+    CHECK(!st.pending && st.length == 0);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    CHECK(my_params::init() == ESP_OK);
+    my_uart::init();
+    my_uart::init_usb();
+    CHECK(my_profile_store::init() == ESP_OK);
+    fd = idf_host::usb_connect();
+    CHECK(fd >= 0);
+
+    test_single();
+    test_batch();
+    test_store();
+    test_profiles();
+    CHECK(decoder.get_crc_errors() == 0);
+    return check_result("test_receiver");
+}
@@ -0,0 +1,127 @@
+// The firmware's receive path (TinyUSB callback, stream buffer, parser task of main/my_uart.cpp) under load: producer
+// threads pipeline large and small frames through one client
+#include "idf_host.h"
+#include "esp_log.h"
+#include "my_uart.h"
+#include "my_params.h"
+#include "sensor_client.h"
+#include "check.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CHUNKS 3000 //Full-size CMD_PROFILE_CHUNK frames
+#define STATUS_QUERIES 1000 //Small frames from a second thread, interleaved with the chunks
+#define WINDOW 7 //Frames in flight: all of them fit the parser's RX stream (RX_STREAM_SIZE, 4096 bytes), so none overflow
+#define MIN_THROUGHPUT 50000 //bytes/s of chunk payload, far below the ~1.2 MB/s the USB stand-in delivers
+
+using namespace protocol;
+
+// Futures handed from a producer thread to the thread that checks them
+struct reply_queue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::future<reply_t>> futures;
+    bool done = false;
+
+    void push(std::future<reply_t>&& f)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        futures.push_back(std::move(f));
+        cv.notify_one();
+    }
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_one();
+    }
+    bool pop(std::future<reply_t>& f)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return done || !futures.empty(); });
+        if (futures.empty()) return false;
+        f = std::move(futures.front());
+        futures.pop_front();
+        return true;
+    }
+};
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    CHECK(my_params::init() == ESP_OK);
+    my_uart::init();
+    my_uart::init_usb();
+    sensor_client client;
+    CHECK(client.attach(idf_host::usb_connect()));
+    client.set_window(WINDOW);
+    client.set_timeout(std::chrono::milliseconds(2000));
+    uint16_t length = CYCLE_LENGTH;
+    CHECK(client.command(CMD_PROFILE_BEGIN, &length, sizeof(length)) == RSP_OK);
+
+    std::vector<float> profile(CYCLE_LENGTH);
+    for (size_t i = 0; i < profile.size(); i++) profile[i] = 300 + i;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(profile.data());
+    size_t total = profile.size() * sizeof(float);
+
+    reply_queue chunk_replies, status_replies;
+    size_t payload_bytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread chunk_producer([&]() {
+        std::vector<uint8_t> args;
+        for (size_t i = 0; i < CHUNKS; i++)
+        {
+            profile_chunk_header h;
+            h.offset = (i * PROFILE_CHUNK_MAX) % (total - total % PROFILE_CHUNK_MAX);
+            h.length = PROFILE_CHUNK_MAX;
+            h.crc = ~crc32_le(~0u, data + h.offset, h.length);
+            args.assign(reinterpret_cast<const uint8_t*>(&h), reinterpret_cast<const uint8_t*>(&h) + sizeof(h));
+            args.insert(args.end(), data + h.offset, data + h.offset + h.length);
+            payload_bytes += args.size();
+            chunk_replies.push(client.submit(CMD_PROFILE_CHUNK, args.data(), args.size()));
+        }
+        chunk_replies.finish();
+    });
+    std::thread status_producer([&]() {
+        for (size_t i = 0; i < STATUS_QUERIES; i++) status_replies.push(client.submit(CMD_PROFILE_STATUS));
+        status_replies.finish();
+    });
+
+    size_t chunks_ok = 0, status_ok = 0;
+    std::thread status_checker([&]() {
+        std::future<reply_t> f;
+        while (status_replies.pop(f))
+        {
+            reply_t r = f.get();
+            if (r && r->cmd == CMD_PROFILE_STATUS && r->payload.size() == sizeof(profile_upload_status)) status_ok++;
+        }
+    });
+    std::future<reply_t> f;
+    while (chunk_replies.pop(f))
+    {
+        if (sensor_client::status(f.get()) == RSP_OK) chunks_ok++;
+    }
+    chunk_producer.join();
+    status_producer.join();
+    status_checker.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    client_stats_t stats = client.get_stats();
+    printf("%zu chunks and %zu status frames in %.2f s: %.0f frames/s, %.0f KB/s of payload\n", chunks_ok, status_ok, s,
+        (CHUNKS + STATUS_QUERIES) / s, payload_bytes / s / 1024);
+    CHECK(chunks_ok == CHUNKS);
+    CHECK(status_ok == STATUS_QUERIES);
+    CHECK(stats.timeouts == 0);
+    CHECK(stats.crc_errors == 0);
+    CHECK(stats.missed == 0);
+    CHECK(idf_host::get_usb_frames_received() == CHUNKS + STATUS_QUERIES + 1);
+    CHECK(payload_bytes / s > MIN_THROUGHPUT);
+    client.close();
+    return check_result("test_rx_throughput");
+}
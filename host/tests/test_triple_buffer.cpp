@@ -0,0 +1,78 @@
+// triple_buffer under a concurrent writer and reader: every read is a complete set, never older than the one before
+#include "triple_buffer.h"
+#include "check.h"
+
+#include <atomic>
+#include <thread>
+
+#define PUBLISHES 500000
+#define WORDS 16 //Large enough that a torn copy would show
+
+struct sample_t
+{
+    uint32_t seq;
+    uint32_t words[WORDS]; // Derived from seq
+};
+
+static uint32_t word(uint32_t seq, size_t i)
+{
+    return seq * 2654435761u + i;
+}
+
+int main()
+{
+    triple_buffer<sample_t> buffer;
+    std::atomic<bool> done(false);
+
+    std::thread writer([&]() {
+        for (uint32_t seq = 1; seq <= PUBLISHES; seq++)
+        {
+            sample_t* s = buffer.back();
+            s->seq = seq;
+            for (size_t i = 0; i < WORDS; i++) s->words[i] = word(seq, i);
+            buffer.publish();
+            if (seq % 64 == 0) std::this_thread::yield(); //Single-CPU hosts: let the reader in
+        }
+        done.store(true);
+    });
+
+    uint32_t last = 0;
+    size_t reads = 0, changes = 0, torn = 0, backwards = 0, stale_changes = 0, silent_changes = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        finished = done.load(); //One more read after the writer is done must see its last publish
+        bool changed;
+        const sample_t* s = buffer.read(&changed);
+        reads++;
+        for (size_t i = 0; s->seq != 0 && i < WORDS; i++) //0: nothing published yet
+        {
+            if (s->words[i] != word(s->seq, i))
+            {
+                torn++;
+                break;
+            }
+        }
+        if (s->seq < last) backwards++;
+        if (changed)
+        {
+            changes++;
+            if (s->seq == last) stale_changes++;
+        }
+        else if (s->seq != last) silent_changes++;
+        last = s->seq;
+        if (!changed) std::this_thread::yield();
+    }
+    writer.join();
+
+    CHECK(torn == 0);
+    CHECK(backwards == 0);
+    CHECK(stale_changes == 0);
+    CHECK(silent_changes == 0);
+    CHECK(last == PUBLISHES);
+    CHECK(changes > 1);
+    bool changed = true;
+    CHECK(buffer.read(&changed)->seq == PUBLISHES && !changed);
+    printf("%zu reads, %zu saw a new set\n", reads, changes);
+    return check_result("test_triple_buffer");
+}
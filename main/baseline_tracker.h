@@ -0,0 +1,123 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+/***
+ * Slow per-point baseline of the sensor resistance, for drift compensation.
+ * Each profile position keeps an exponentially weighted mean of ln(R); a step is clipped to `clip`, so a gas
+ * response that lasts a few cycles barely moves it (bounded influence). New bins are seeded with a plain mean
+ * until 1/n drops below alpha. O(1) per point: a logf() and an expf().
+ * The baseline belongs to one profile (CRC of its data), it's discarded when another one is played.
+ * Platform-independent (host-testable).
+ */
+
+enum baseline_mode : uint8_t
+{
+    baseline_off,
+    baseline_track, // raw points, the baseline is fetched with CMD_GET_BASELINE
+    baseline_normalize // points carry R / R_baseline instead of R (NaN until the bin has a baseline)
+};
+
+struct baseline_config_t // Wire and storage format (CMD_SET_BASELINE)
+{
+    uint8_t mode; // baseline_mode
+    uint8_t reserved;
+    uint16_t save_cycles; // written to NVS every this many cycles, 0 = with CMD_SAVE_NVS only
+    float alpha; // weight of the newest cycle, 0..1
+    float clip; // largest ln(R) step of one update, 0 = unclipped
+};
+
+template <size_t N> struct baseline_state_t // Wire (CMD_GET_BASELINE) and storage format
+{
+    uint32_t profile; // CRC of the profile the baseline has been learned on
+    float log_res[N]; // ln(Ohm), NaN = not learned yet
+};
+
+template <size_t N> class baseline_tracker
+{
+    private:
+        baseline_state_t<N> _state;
+        uint16_t _n[N];                                      // updates per bin, saturates
+        baseline_config_t _config;
+
+    public:
+        baseline_tracker();
+        void configure(const baseline_config_t* config);    // The baseline is kept
+        void restore(const baseline_state_t<N>* state);     // Saved bins count as fully seeded
+        void set_profile(uint32_t profile);                  // Resets the baseline if the profile differs
+        void reset();
+        float update(size_t index, float res);               // Returns R / R_baseline before the update, NaN if unknown
+        uint8_t get_mode();
+        const baseline_state_t<N>* get_state();
+
+        static bool validate(const baseline_config_t* config);
+};
+
+template <size_t N> baseline_tracker<N>::baseline_tracker() {
+    _config = {};
+    _state.profile = 0;
+    reset();
+}
+
+template <size_t N> bool baseline_tracker<N>::validate(const baseline_config_t* c) {
+    if (c->mode > baseline_normalize) return false;
+    if (c->mode == baseline_off) return true;
+    return isfinite(c->alpha) && c->alpha > 0 && c->alpha < 1 && isfinite(c->clip) && c->clip >= 0;
+}
+
+template <size_t N> void baseline_tracker<N>::configure(const baseline_config_t* config) {
+    _config = *config;
+    if (!validate(&_config)) _config.mode = baseline_off;
+}
+
+template <size_t N> void baseline_tracker<N>::restore(const baseline_state_t<N>* state) {
+    _state = *state;
+    for (size_t i = 0; i < N; i++) _n[i] = isfinite(_state.log_res[i]) ? UINT16_MAX : 0;
+}
+
+template <size_t N> void baseline_tracker<N>::set_profile(uint32_t profile) {
+    if (profile == _state.profile) return;
+    _state.profile = profile;
+    reset();
+}
+
+template <size_t N> void baseline_tracker<N>::reset() {
+    for (size_t i = 0; i < N; i++) {
+        _state.log_res[i] = NAN;
+        _n[i] = 0;
+    }
+}
+
+template <size_t N> float baseline_tracker<N>::update(size_t index, float res) {
+    if (_config.mode == baseline_off || index >= N || !isfinite(res) || !(res > 0)) return NAN;
+    float y = logf(res);
+    float& b = _state.log_res[index];
+    if (_n[index] == 0) {
+        b = y;
+        _n[index] = 1;
+        return NAN;
+    }
+    float d = y - b;
+    float ratio = expf(d);
+    if (_n[index] < UINT16_MAX) _n[index]++;
+    float w = 1.0f / _n[index];
+    if (w <= _config.alpha) {
+        w = _config.alpha;
+        if (_config.clip > 0) {
+            if (d > _config.clip) d = _config.clip;
+            else if (d < -_config.clip) d = -_config.clip;
+        }
+    }
+    b += w * d;
+    return ratio;
+}
+
+template <size_t N> uint8_t baseline_tracker<N>::get_mode() {
+    return _config.mode;
+}
+
+template <size_t N> const baseline_state_t<N>* baseline_tracker<N>::get_state() {
+    return &_state;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+/***
+ * Coherent averaging of repeated cycles: the point measured at profile position i of every cycle goes into bin i.
+ * Each bin keeps a running mean of temperature and resistance and the variance of the resistance, updated in O(1)
+ * per point (Welford). With forgetting > 0 the newest cycle's weight never drops below it, so older cycles fade out
+ * exponentially. Memory is fixed by the bin count. Platform-independent (host-testable).
+ */
+
+struct average_config_t // Wire and storage format (CMD_SET_AVERAGING)
+{
+    uint16_t cycles; // a report every this many cycles, 0 = off
+    uint16_t reserved;
+    float forgetting; // 0: plain mean of the last `cycles` cycles. 0..1: weight of the newest cycle, never restarted
+};
+
+struct average_report_header // Wire format (CMD_GET_AVERAGE)
+{
+    uint32_t seq; // report counter, separate from the CMD_GET_DATA sequence
+    uint16_t cycles; // accumulated since the last restart, saturates
+    uint16_t points;
+};
+
+// Report: header, then (temp mean, res mean, res variance) per point. NaN in bins that never got a point
+#define AVERAGE_FLOATS_PER_POINT 3
+#define AVERAGE_REPORT_SIZE(points) (sizeof(average_report_header) + (points) * AVERAGE_FLOATS_PER_POINT * sizeof(float))
+
+template <size_t N> class cycle_average
+{
+    private:
+        float _bins[N][AVERAGE_FLOATS_PER_POINT];            // in report order
+        uint16_t _n[N];
+        average_config_t _config;
+        size_t _points;                                      // highest bin used + 1
+        uint32_t _cycles;                                    // completed since the last restart
+        uint32_t _pending;                                   // completed since the last report
+
+    public:
+        cycle_average();
+        void configure(const average_config_t* config);     // Restarts if the config differs
+        void restart();                                      // Profile switch: the bins don't line up anymore
+        bool enabled();
+        void push(size_t index, float temp, float res);
+        bool cycle_end();                                    // true if a report is due
+        size_t finish(uint32_t seq, uint8_t* out);           // Returns the report size, restarts a plain mean
+
+        static bool validate(const average_config_t* config);
+};
+
+template <size_t N> cycle_average<N>::cycle_average() {
+    _config = {};
+    restart();
+}
+
+template <size_t N> bool cycle_average<N>::validate(const average_config_t* c) {
+    return isfinite(c->forgetting) && c->forgetting >= 0 && c->forgetting < 1;
+}
+
+template <size_t N> void cycle_average<N>::configure(const average_config_t* config) {
+    if (memcmp(config, &_config, sizeof(_config)) == 0) return;
+    _config = *config;
+    if (!validate(&_config)) _config.cycles = 0;
+    restart();
+}
+
+template <size_t N> void cycle_average<N>::restart() {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < AVERAGE_FLOATS_PER_POINT; j++) _bins[i][j] = NAN;
+        _n[i] = 0;
+    }
+    _points = 0;
+    _cycles = 0;
+    _pending = 0;
+}
+
+template <size_t N> bool cycle_average<N>::enabled() {
+    return _config.cycles > 0;
+}
+
+template <size_t N> void cycle_average<N>::push(size_t index, float temp, float res) {
+    if (_config.cycles == 0 || index >= N || !isfinite(temp) || !isfinite(res)) return;
+    float* b = _bins[index];
+    if (_n[index] < UINT16_MAX) _n[index]++;
+    if (index >= _points) _points = index + 1;
+    if (_n[index] == 1) {
+        b[0] = temp;
+        b[1] = res;
+        b[2] = 0;
+        return;
+    }
+    float w = 1.0f / _n[index];
+    if (w < _config.forgetting) w = _config.forgetting;
+    float d = res - b[1];
+    b[0] += w * (temp - b[0]);
+    b[1] += w * d;
+    b[2] = (1 - w) * (b[2] + w * d * d);
+}
+
+template <size_t N> bool cycle_average<N>::cycle_end() {
+    if (_config.cycles == 0 || _points == 0) return false;
+    _cycles++;
+    if (++_pending < _config.cycles) return false;
+    _pending = 0;
+    return true;
+}
+
+template <size_t N> size_t cycle_average<N>::finish(uint32_t seq, uint8_t* out) {
+    average_report_header h = { seq, static_cast<uint16_t>(_cycles < UINT16_MAX ? _cycles : UINT16_MAX),
+        static_cast<uint16_t>(_points) };
+    memcpy(out, &h, sizeof(h));
+    memcpy(out + sizeof(h), _bins, _points * sizeof(_bins[0]));
+    size_t size = AVERAGE_REPORT_SIZE(_points);
+    if (_config.forgetting == 0) restart();
+    return size;
+}
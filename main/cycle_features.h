@@ -0,0 +1,206 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+/***
+ * Per-cycle feature extraction, fed one telemetry point at a time.
+ * Every statistic is kept as a running sum (least squares in Welford form), so the cycle is never stored
+ * or read twice; push() costs a logf() and a few multiply-adds, finish() packs the report.
+ * Platform-independent (host-testable).
+ */
+
+#define FEATURE_MAX_SEGMENTS 8
+#define FEATURE_MAX_PROBES 8
+
+enum feature_mode : uint8_t
+{
+    features_off,
+    features_and_points, // CMD_GET_FEATURES and CMD_GET_DATA
+    features_only // points aren't buffered at all
+};
+
+struct feature_config_t // Wire and storage format (CMD_SET_FEATURES)
+{
+    uint8_t mode; // feature_mode
+    uint8_t segment_count; // 1..FEATURE_MAX_SEGMENTS
+    uint8_t probe_count; // 0..FEATURE_MAX_PROBES
+    uint8_t reserved;
+    uint16_t segment_starts[FEATURE_MAX_SEGMENTS]; // point index in the cycle, [0] = 0, increasing. The last segment runs to the cycle end
+    float probe_temps[FEATURE_MAX_PROBES]; // K, resistance is reported where the temperature crosses these
+};
+
+struct feature_report_header // Wire format (CMD_GET_FEATURES)
+{
+    uint32_t seq; // report counter, separate from the CMD_GET_DATA sequence
+    uint16_t points; // in the cycle, including skipped ones
+    uint8_t segment_count;
+    uint8_t probe_count;
+};
+
+struct feature_segment_t // Wire format, follows feature_report_header
+{
+    uint16_t points; // valid points (finite, positive resistance)
+    uint16_t reserved;
+    float log_res_mean; // ln(Ohm)
+    float log_res_min;
+    float log_res_max;
+    float slope; // d ln(R) per telemetry point, least squares
+    float r; // correlation coefficient of that fit
+    float area; // of R over telemetry points (trapezoidal), Ohm * points
+};
+
+// Report: header, feature_segment_t[segment_count], float res_rising[probe_count], float res_falling[probe_count] (NaN if not crossed)
+#define FEATURE_REPORT_MAX_SIZE (sizeof(feature_report_header) + FEATURE_MAX_SEGMENTS * sizeof(feature_segment_t) + \
+    2 * FEATURE_MAX_PROBES * sizeof(float))
+
+class cycle_features
+{
+    private:
+        struct accumulator_t
+        {
+            uint32_t n;
+            float origin_y;                                   // first ln(R) of the segment, y is accumulated relative to it
+            float mean_x, mean_y;
+            float m2_x, m2_y, c_xy;                           // sums of squared deviations and of co-deviations
+            float min, max;
+            float area;
+            float last_res;                                   // previous valid point of this segment, for the area
+        };
+
+        feature_config_t _config;
+        accumulator_t _acc[FEATURE_MAX_SEGMENTS];
+        float _rising[FEATURE_MAX_PROBES];
+        float _falling[FEATURE_MAX_PROBES];
+        size_t _segment;
+        uint32_t _points;
+        uint32_t _segment_first;                              // cycle index of the current segment's first point
+        float _last_temp, _last_res;                          // previous point, for the probe crossings
+        bool _have_last;
+
+    public:
+        cycle_features();
+        void begin(const feature_config_t* config);          // Cycle start, the config is copied
+        void push(float temp, float res);
+        size_t finish(uint32_t seq, uint8_t* out);           // Returns the report size, 0 if disabled
+        uint8_t get_mode();
+
+        static bool validate(const feature_config_t* config);
+};
+
+inline cycle_features::cycle_features() {
+    feature_config_t off = {};
+    begin(&off);
+}
+
+inline bool cycle_features::validate(const feature_config_t* c) {
+    if (c->mode > features_only) return false;
+    if (c->mode == features_off) return true;
+    if (c->segment_count == 0 || c->segment_count > FEATURE_MAX_SEGMENTS || c->probe_count > FEATURE_MAX_PROBES) return false;
+    if (c->segment_starts[0] != 0) return false;
+    for (size_t i = 1; i < c->segment_count; i++) {
+        if (c->segment_starts[i] <= c->segment_starts[i - 1]) return false;
+    }
+    for (size_t i = 0; i < c->probe_count; i++) {
+        if (!isfinite(c->probe_temps[i])) return false;
+    }
+    return true;
+}
+
+inline void cycle_features::begin(const feature_config_t* config) {
+    _config = *config;
+    if (!validate(&_config)) _config.mode = features_off;
+    memset(_acc, 0, sizeof(_acc));
+    for (size_t i = 0; i < FEATURE_MAX_PROBES; i++) {
+        _rising[i] = NAN;
+        _falling[i] = NAN;
+    }
+    _segment = 0;
+    _points = 0;
+    _segment_first = 0;
+    _have_last = false;
+}
+
+inline void cycle_features::push(float temp, float res) {
+    if (_config.mode == features_off) return;
+    while (_segment + 1 < _config.segment_count && _points >= _config.segment_starts[_segment + 1]) {
+        _segment_first = _config.segment_starts[++_segment];
+    }
+    uint32_t index = _points++;
+    if (!isfinite(temp) || !isfinite(res) || !(res > 0)) return;
+
+    // Probes: first crossing in each direction, linear between the neighbouring points
+    if (_have_last) {
+        for (size_t i = 0; i < _config.probe_count; i++) {
+            float t = _config.probe_temps[i];
+            float* dst = NULL;
+            if (_last_temp < t && temp >= t) dst = &_rising[i];
+            else if (_last_temp > t && temp <= t) dst = &_falling[i];
+            if (dst == NULL || !isnan(*dst)) continue;
+            *dst = _last_res + (res - _last_res) * (t - _last_temp) / (temp - _last_temp);
+        }
+    }
+    _last_temp = temp;
+    _last_res = res;
+    _have_last = true;
+
+    accumulator_t& a = _acc[_segment];
+    float x = static_cast<float>(index - _segment_first);
+    float y = logf(res);
+    if (a.n == 0) {
+        a.min = y;
+        a.max = y;
+        a.origin_y = y;
+    } else {
+        if (y < a.min) a.min = y;
+        if (y > a.max) a.max = y;
+        a.area += (a.last_res + res) * 0.5f;
+    }
+    a.last_res = res;
+    a.n++;
+    y -= a.origin_y; //Exact near the origin, and the mean stays small enough to take increments much below ln(R)
+    float dx = x - a.mean_x;
+    float dy = y - a.mean_y;
+    float inv_n = 1.0f / a.n;
+    a.mean_x += dx * inv_n;
+    a.mean_y += dy * inv_n;
+    a.m2_x += dx * (x - a.mean_x);
+    a.m2_y += dy * (y - a.mean_y);
+    a.c_xy += dx * (y - a.mean_y);
+}
+
+inline size_t cycle_features::finish(uint32_t seq, uint8_t* out) {
+    if (_config.mode == features_off) return 0;
+    feature_report_header h = { seq, static_cast<uint16_t>(_points), _config.segment_count, _config.probe_count };
+    uint8_t* p = out;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    for (size_t i = 0; i < _config.segment_count; i++) {
+        const accumulator_t& a = _acc[i];
+        feature_segment_t s = {};
+        s.points = static_cast<uint16_t>(a.n);
+        if (a.n > 0) {
+            s.log_res_mean = a.origin_y + a.mean_y;
+            s.log_res_min = a.min;
+            s.log_res_max = a.max;
+            s.area = a.area;
+        }
+        if (a.n > 1 && a.m2_x > 0) {
+            s.slope = a.c_xy / a.m2_x;
+            s.r = (a.m2_y > 0) ? a.c_xy / sqrtf(a.m2_x * a.m2_y) : 0;
+        }
+        memcpy(p, &s, sizeof(s));
+        p += sizeof(s);
+    }
+    memcpy(p, _rising, _config.probe_count * sizeof(float));
+    p += _config.probe_count * sizeof(float);
+    memcpy(p, _falling, _config.probe_count * sizeof(float));
+    p += _config.probe_count * sizeof(float);
+    return p - out;
+}
+
+inline uint8_t cycle_features::get_mode() {
+    return _config.mode;
+}
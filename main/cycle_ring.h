@@ -0,0 +1,206 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <atomic>
+
+/***
+ * N-slot ring of measurement cycles.
+ * Single producer (control loop) fills free slots first, single consumer (parser task) fetches them
+ * by age or by sequence number. Slot ownership is transferred with CAS on the state word,
+ * so neither side ever blocks the other. Platform-independent (host-testable).
+ */
+
+enum cycle_slot_state : uint32_t
+{
+    slot_empty,   // never filled since init
+    slot_filling, // owned by the producer
+    slot_ready,   // complete, not fetched yet
+    slot_sending, // owned by the consumer
+    slot_sent     // fetched at least once, may be recycled
+};
+
+template <class T> class cycle_ring
+{
+    public:
+        struct slot_t
+        {
+            std::atomic<uint32_t> state;
+            uint32_t seq;    // cycle number, assigned when the producer claims the slot
+            uint32_t crc;    // running CRC, maintained by the user
+            size_t length;   // fill level, maintained by the user
+            T* data;
+        };
+
+    private:
+        slot_t* _slots;
+        size_t _depth;
+        size_t _fill;                                         // index of the slot being filled
+        uint32_t _next_seq;
+        std::atomic<uint32_t> _overruns;
+
+        bool claim(size_t index, uint32_t expected);
+        void advance(size_t next);
+        slot_t* acquire_helper(slot_t* s, uint32_t seq);
+        bool older_ready(uint32_t seq);
+
+    public:
+        cycle_ring(slot_t* slots, size_t depth);
+        void init(T* storage);
+        slot_t* producer_slot();
+        bool publish();
+        slot_t* acquire();
+        slot_t* acquire(uint32_t seq);
+        void release(slot_t* s);
+        void requeue(slot_t* s);
+        bool have_data();
+        uint32_t get_overruns();
+        size_t get_depth();
+};
+
+template <class T> cycle_ring<T>::cycle_ring(slot_t* slots, size_t depth) {
+    _slots = slots;
+    _depth = depth;
+    _fill = 0;
+    _next_seq = 0;
+    _overruns = 0;
+}
+
+// Not thread-safe, call before starting the producer/consumer
+template <class T> void cycle_ring<T>::init(T* storage) {
+    for (size_t i = 0; i < _depth; i++) {
+        _slots[i].data = storage + i;
+        _slots[i].seq = 0;
+        _slots[i].crc = 0;
+        _slots[i].length = 0;
+        _slots[i].state.store(slot_empty);
+    }
+    _fill = 0;
+    _slots[0].seq = _next_seq++;
+    _slots[0].state.store(slot_filling);
+}
+
+template <class T> typename cycle_ring<T>::slot_t* cycle_ring<T>::producer_slot() {
+    return &_slots[_fill];
+}
+
+template <class T> bool cycle_ring<T>::claim(size_t index, uint32_t expected) {
+    return _slots[index].state.compare_exchange_strong(expected, slot_filling, std::memory_order_acq_rel); // Else the consumer got there first
+}
+
+template <class T> void cycle_ring<T>::advance(size_t next) {
+    _slots[_fill].state.store(slot_ready, std::memory_order_release);
+    _fill = next;
+    _slots[_fill].seq = _next_seq++;
+}
+
+// Marks the current slot ready and moves the producer to a free (empty or sent) slot, or else to the oldest ready one.
+// Returns false if an unsent cycle had to be overwritten or dropped.
+template <class T> bool cycle_ring<T>::publish() {
+    while (true) {
+        size_t oldest = _depth;
+        uint32_t oldest_seq = 0;
+        for (size_t i = 1; i < _depth; i++) {
+            size_t next = (_fill + i) % _depth;
+            uint32_t st = _slots[next].state.load(std::memory_order_acquire);
+            if (st == slot_empty || st == slot_sent) {
+                if (claim(next, st)) {
+                    advance(next);
+                    return true;
+                }
+            } else if (st == slot_ready) {
+                uint32_t seq = _slots[next].seq;
+                if (oldest == _depth || static_cast<int32_t>(seq - oldest_seq) < 0) {
+                    oldest = next;
+                    oldest_seq = seq;
+                }
+            }
+        }
+        if (oldest == _depth) break;
+        if (claim(oldest, slot_ready)) {
+            _overruns++;                                      // Unsent cycle is lost
+            advance(oldest);
+            return false;
+        }
+        // The consumer took it meanwhile: look again, it may have released another slot
+    }
+    // Every other slot is being sent: drop the current cycle, keep its sequence number consumed
+    _overruns++;
+    _slots[_fill].seq = _next_seq++;
+    return false;
+}
+
+template <class T> typename cycle_ring<T>::slot_t* cycle_ring<T>::acquire_helper(slot_t* s, uint32_t seq) {
+    uint32_t st = s->state.load(std::memory_order_acquire);
+    if (st != slot_ready && st != slot_sent) return NULL;
+    if (!s->state.compare_exchange_strong(st, slot_sending, std::memory_order_acq_rel)) return NULL;
+    if (s->seq != seq) {                                      // Recycled between the lookup and the CAS
+        s->state.store(st, std::memory_order_release);
+        return NULL;
+    }
+    return s;
+}
+
+// Only the filling slot can turn ready and it's newer than any acquired one, so a check after the acquisition holds
+template <class T> bool cycle_ring<T>::older_ready(uint32_t seq) {
+    for (size_t i = 0; i < _depth; i++) {
+        if (_slots[i].state.load(std::memory_order_acquire) != slot_ready) continue;
+        if (static_cast<int32_t>(_slots[i].seq - seq) < 0) return true;
+    }
+    return false;
+}
+
+// Oldest ready (not yet fetched) cycle, or NULL
+template <class T> typename cycle_ring<T>::slot_t* cycle_ring<T>::acquire() {
+    while (true) {
+        slot_t* oldest = NULL;
+        uint32_t oldest_seq = 0;
+        for (size_t i = 0; i < _depth; i++) {
+            if (_slots[i].state.load(std::memory_order_acquire) != slot_ready) continue;
+            uint32_t seq = _slots[i].seq;
+            if (oldest == NULL || static_cast<int32_t>(seq - oldest_seq) < 0) {
+                oldest = &_slots[i];
+                oldest_seq = seq;
+            }
+        }
+        if (oldest == NULL) return NULL;
+        slot_t* s = acquire_helper(oldest, oldest_seq);
+        if (s == NULL) continue;
+        if (!older_ready(oldest_seq)) return s;
+        s->state.store(slot_ready, std::memory_order_release); // The scan missed an older cycle published meanwhile
+    }
+}
+
+// Specific cycle (ready or already sent), or NULL if it has been recycled or is still being filled
+template <class T> typename cycle_ring<T>::slot_t* cycle_ring<T>::acquire(uint32_t seq) {
+    for (size_t i = 0; i < _depth; i++) {
+        if (_slots[i].seq != seq) continue;
+        slot_t* s = acquire_helper(&_slots[i], seq);
+        if (s != NULL) return s;
+    }
+    return NULL;
+}
+
+template <class T> void cycle_ring<T>::release(slot_t* s) {
+    s->state.store(slot_sent, std::memory_order_release);
+}
+
+// Back to ready instead of sent, e.g. when the transfer failed: acquire() returns it again
+template <class T> void cycle_ring<T>::requeue(slot_t* s) {
+    s->state.store(slot_ready, std::memory_order_release);
+}
+
+template <class T> bool cycle_ring<T>::have_data() {
+    for (size_t i = 0; i < _depth; i++) {
+        if (_slots[i].state.load(std::memory_order_acquire) == slot_ready) return true;
+    }
+    return false;
+}
+
+template <class T> uint32_t cycle_ring<T>::get_overruns() {
+    return _overruns.load();
+}
+
+template <class T> size_t cycle_ring<T>::get_depth() {
+    return _depth;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+/***
+ * Incremental event detection on the baseline-normalized response s = ln(R / R_baseline), one point at a time:
+ * a level threshold on |s|, a rate threshold on |s - s_prev| and a two-sided CUSUM of s.
+ * Each detector has separate raise/clear levels (hysteresis). State changes are reported as event_frame_t,
+ * at most one per holdoff; changes within the holdoff are merged into the next frame. Constant cost per point.
+ * Platform-independent (host-testable).
+ */
+
+enum event_detectors : uint8_t
+{
+    event_level = 0x01,
+    event_rate = 0x02,
+    event_cusum = 0x04
+};
+
+struct event_config_t // Wire and storage format (CMD_SET_EVENTS)
+{
+    uint8_t detectors; // event_detectors bits, 0 = off
+    uint8_t reserved;
+    uint16_t holdoff_ms; // minimum interval between two frames of a sensor
+    float level_on, level_off; // |s|
+    float rate_on, rate_off; // |s - s_prev| between consecutive points
+    float cusum_drift; // per point, the response the CUSUM ignores
+    float cusum_on, cusum_off; // the sums are capped at cusum_on
+};
+
+struct event_frame_t // Wire format (CMD_EVENT, unsolicited)
+{
+    uint32_t timestamp_us; // of the point that triggered the frame
+    uint32_t seq; // frame counter of the sensor
+    uint16_t index; // profile position of that point
+    uint8_t sensor;
+    uint8_t active; // event_detectors bits active after that point
+    uint8_t raised; // bits raised since the previous frame
+    uint8_t cleared; // bits cleared since the previous frame
+    uint16_t suppressed; // points with state changes merged into this frame because of the holdoff
+    float response; // s
+    float rate;
+    float cusum; // larger of the two one-sided sums
+};
+
+class event_detector
+{
+    private:
+        event_config_t _config;
+        uint8_t _active;
+        uint8_t _raised, _cleared;                           // not reported yet
+        uint16_t _suppressed;
+        bool _pending;
+        bool _sent_once;
+        uint32_t _last_sent_us;
+        uint32_t _seq;
+        float _last_s;
+        size_t _last_index;
+        bool _have_last;
+        float _cusum_pos, _cusum_neg;
+
+        bool update(uint8_t bit, bool on, bool off);
+
+    public:
+        event_detector();
+        void configure(const event_config_t* config);       // Clears the state if the config differs
+        void reset();
+        bool push(uint32_t now_us, size_t index, float ratio, event_frame_t* out); // true if a frame is due
+        void cycle_end();                                    // The next point doesn't follow the last one
+
+        static bool validate(const event_config_t* config);
+};
+
+inline event_detector::event_detector() {
+    _config = {};
+    _seq = 0;
+    reset();
+}
+
+inline bool event_detector::validate(const event_config_t* c) {
+    if (c->detectors & ~(event_level | event_rate | event_cusum)) return false;
+    const float v[] = { c->level_on, c->level_off, c->rate_on, c->rate_off, c->cusum_drift, c->cusum_on, c->cusum_off };
+    for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+        if (!isfinite(v[i]) || v[i] < 0) return false;
+    }
+    if ((c->detectors & event_level) && !(c->level_off < c->level_on)) return false;
+    if ((c->detectors & event_rate) && !(c->rate_off < c->rate_on)) return false;
+    if ((c->detectors & event_cusum) && !(c->cusum_off < c->cusum_on)) return false;
+    return true;
+}
+
+inline void event_detector::configure(const event_config_t* config) {
+    event_config_t c = *config;
+    if (!validate(&c)) c.detectors = 0;
+    if (c.detectors == _config.detectors && c.holdoff_ms == _config.holdoff_ms && c.level_on == _config.level_on &&
+        c.level_off == _config.level_off && c.rate_on == _config.rate_on && c.rate_off == _config.rate_off &&
+        c.cusum_drift == _config.cusum_drift && c.cusum_on == _config.cusum_on && c.cusum_off == _config.cusum_off) return;
+    _config = c;
+    reset();
+}
+
+inline void event_detector::reset() {
+    _active = 0;
+    _raised = 0;
+    _cleared = 0;
+    _suppressed = 0;
+    _pending = false;
+    _sent_once = false;
+    _last_sent_us = 0;
+    _have_last = false;
+    _cusum_pos = 0;
+    _cusum_neg = 0;
+}
+
+inline void event_detector::cycle_end() {
+    _have_last = false;
+}
+
+// Returns true if the detector changed state
+inline bool event_detector::update(uint8_t bit, bool on, bool off) {
+    if (!(_config.detectors & bit)) return false;
+    if (!(_active & bit) && on) {
+        _active |= bit;
+        _raised |= bit;
+        return true;
+    }
+    if ((_active & bit) && off) {
+        _active &= ~bit;
+        _cleared |= bit;
+        return true;
+    }
+    return false;
+}
+
+inline bool event_detector::push(uint32_t now_us, size_t index, float ratio, event_frame_t* out) {
+    if (_config.detectors == 0) return false;
+    float s = NAN, rate = 0;
+    if (isfinite(ratio) && ratio > 0) {
+        s = logf(ratio);
+        float a = fabsf(s);
+        bool changed = update(event_level, a > _config.level_on, a < _config.level_off);
+
+        bool consecutive = _have_last && index == _last_index + 1;
+        if (consecutive) {
+            rate = s - _last_s;
+            float r = fabsf(rate);
+            changed = update(event_rate, r > _config.rate_on, r < _config.rate_off) || changed;
+        }
+        _last_s = s;
+        _last_index = index;
+        _have_last = true;
+
+        // Capped at the raise level, so that clearing takes (on - off) / drift points however long the response was
+        _cusum_pos = fminf(_config.cusum_on, fmaxf(0, _cusum_pos + s - _config.cusum_drift));
+        _cusum_neg = fminf(_config.cusum_on, fmaxf(0, _cusum_neg - s - _config.cusum_drift));
+        float g = fmaxf(_cusum_pos, _cusum_neg);
+        changed = update(event_cusum, g >= _config.cusum_on, g < _config.cusum_off) || changed;
+        if (changed && _pending) _suppressed++; //The previous change is still held back
+        _pending = _pending || changed;
+    }
+    // A merged change goes out with the first point after the holdoff, even if nothing changes with it
+    if (!_pending) return false;
+    if (_sent_once && now_us - _last_sent_us < static_cast<uint32_t>(_config.holdoff_ms) * 1000) return false;
+    out->timestamp_us = now_us;
+    out->seq = _seq++;
+    out->index = static_cast<uint16_t>(index);
+    out->sensor = 0;
+    out->active = _active;
+    out->raised = _raised;
+    out->cleared = _cleared;
+    out->suppressed = _suppressed;
+    out->response = s;
+    out->rate = rate;
+    out->cusum = fmaxf(_cusum_pos, _cusum_neg);
+    _raised = 0;
+    _cleared = 0;
+    _suppressed = 0;
+    _pending = false;
+    _sent_once = true;
+    _last_sent_us = now_us;
+    return true;
+}
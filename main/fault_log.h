@@ -0,0 +1,96 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <atomic>
+
+/***
+ * Per-code event counters and a ring of the most recent events with their context.
+ * Any number of writers (tasks on both cores) and one reader. raise() is a few atomic RMWs, never blocks;
+ * when the ring wraps, the oldest events are overwritten and counted as lost.
+ * Platform-independent (host-testable).
+ */
+
+#define FAULT_CODE_COUNT 16 //Codes are bit indexes of my_error_codes
+
+struct fault_event_t // Wire format (CMD_GET_FAULTS)
+{
+    uint32_t timestamp_us;
+    uint8_t code; // bit index
+    uint8_t cmd; // command being parsed, 0 outside the parser
+    uint16_t offset; // byte offset within the frame arguments (parser)
+    float temp; // heater temperature at the time, K
+};
+
+template <size_t Depth> class fault_log
+{
+    private:
+        struct entry_t
+        {
+            std::atomic<uint32_t> ticket;                     // index + 1 once written, 0 while being written
+            fault_event_t event;
+        };
+
+        std::atomic<uint32_t> _counters[FAULT_CODE_COUNT];
+        entry_t _entries[Depth];
+        std::atomic<uint32_t> _head;                          // next ticket to hand out
+        uint32_t _tail;                                       // next ticket to read, reader only
+
+    public:
+        fault_log();
+        void raise(uint8_t code, const fault_event_t& context);
+        uint32_t take_counters(uint32_t* counters);
+        size_t take_events(fault_event_t* events, size_t max, uint32_t* lost);
+};
+
+template <size_t Depth> fault_log<Depth>::fault_log() : _head(0), _tail(0) {
+    for (auto& c : _counters) c.store(0, std::memory_order_relaxed);
+    for (auto& e : _entries) e.ticket.store(0, std::memory_order_relaxed);
+}
+
+template <size_t Depth> void fault_log<Depth>::raise(uint8_t code, const fault_event_t& context) {
+    if (code >= FAULT_CODE_COUNT) return;
+    _counters[code].fetch_add(1, std::memory_order_relaxed);
+    uint32_t t = _head.fetch_add(1, std::memory_order_relaxed);
+    entry_t& e = _entries[t % Depth];
+    e.ticket.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.event = context;
+    e.event.code = code;
+    e.ticket.store(t + 1, std::memory_order_release);
+}
+
+// Copies and zeroes the counters, returns the total
+template <size_t Depth> uint32_t fault_log<Depth>::take_counters(uint32_t* counters) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < FAULT_CODE_COUNT; i++) {
+        counters[i] = _counters[i].exchange(0, std::memory_order_relaxed);
+        total += counters[i];
+    }
+    return total;
+}
+
+// Moves the unread events out, oldest first. Events being written at this moment are left for the next call.
+template <size_t Depth> size_t fault_log<Depth>::take_events(fault_event_t* events, size_t max, uint32_t* lost) {
+    uint32_t head = _head.load(std::memory_order_acquire);
+    *lost = 0;
+    if (head - _tail > Depth) {
+        *lost = head - _tail - Depth;
+        _tail = head - Depth;
+    }
+    size_t n = 0;
+    while (_tail != head && n < max) {
+        entry_t& e = _entries[_tail % Depth];
+        if (e.ticket.load(std::memory_order_acquire) != _tail + 1) break;    // Not finished yet
+        events[n] = e.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.ticket.load(std::memory_order_relaxed) != _tail + 1) {         // Overwritten while copying
+            (*lost)++;
+            _tail++;
+            continue;
+        }
+        n++;
+        _tail++;
+    }
+    return n;
+}
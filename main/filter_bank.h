@@ -0,0 +1,133 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+/***
+ * Several filters of one sample stream sharing a single history ring: each boxcar output keeps only its running
+ * sum, adding the new sample and dropping the one `len` samples back, so an extra output costs an add and a
+ * subtract per sample. The trend output is a first-order low-pass (one multiply-add). Means are only divided out
+ * when read, so decimated outputs cost nothing between reads. Platform-independent (host-testable).
+ */
+
+#define FILTER_MAX_BOXCARS 4
+
+struct filter_config_t // Wire and storage format (CMD_SET_FILTERS)
+{
+    uint16_t telemetry_len; // ADC samples averaged per telemetry point, 0 = one telemetry period
+    uint16_t reserved;
+    uint32_t trend_ms; // time constant of the trend output, 0 = off
+};
+
+// Telemetry window and trend weight of a loop at loop_rate Hz with telemetry points at point_rate Hz (both > 0)
+inline void filter_windows(const filter_config_t* c, uint32_t loop_rate, uint32_t point_rate, uint32_t max_len,
+    uint32_t* telemetry_len, float* trend_alpha) {
+    uint32_t len = c->telemetry_len;
+    if (len == 0) len = (loop_rate + point_rate - 1) / point_rate; // one telemetry period
+    *telemetry_len = (len > max_len) ? max_len : len;
+    *trend_alpha = (c->trend_ms == 0) ? 0 : 1000.0f / (c->trend_ms * static_cast<float>(loop_rate));
+}
+
+template <class T> class filter_bank
+{
+    private:
+        struct boxcar_t
+        {
+            uint32_t len;
+            T sum;                                            // of the newest min(len, _count) samples
+        };
+
+        T* _store;
+        uint32_t _capacity;
+        uint32_t _position;                                   // next write
+        uint32_t _count;                                      // saturates at _capacity
+        boxcar_t _boxcars[FILTER_MAX_BOXCARS];
+        size_t _outputs;
+        float _alpha;                                         // trend weight of a new sample, 0 = off
+        float _trend;
+
+    public:
+        filter_bank(T* store, uint32_t capacity, size_t outputs);  // Boxcars of length 1 until set_length()
+        void set_length(size_t output, uint32_t len);        // 1.._capacity, O(len): keeps the history, the mean doesn't jump
+        uint32_t get_length(size_t output);
+        void set_trend(float alpha);                         // 0..1, 0 = off
+        void push(T x);
+        float mean(size_t output);                           // 0 before the first sample
+        float trend();                                       // NaN while off or before the first sample
+        void clear();
+};
+
+template <class T> filter_bank<T>::filter_bank(T* store, uint32_t capacity, size_t outputs) {
+    _store = store;
+    _capacity = (capacity == 0) ? 1 : capacity;
+    _outputs = (outputs > FILTER_MAX_BOXCARS) ? FILTER_MAX_BOXCARS : outputs;
+    for (size_t i = 0; i < FILTER_MAX_BOXCARS; i++) _boxcars[i].len = 1;
+    _alpha = 0;
+    clear();
+}
+
+template <class T> void filter_bank<T>::clear() {
+    _position = 0;
+    _count = 0;
+    for (size_t i = 0; i < FILTER_MAX_BOXCARS; i++) _boxcars[i].sum = 0;
+    _trend = NAN;
+}
+
+template <class T> void filter_bank<T>::set_length(size_t output, uint32_t len) {
+    if (output >= _outputs) return;
+    if (len == 0) len = 1;
+    if (len > _capacity) len = _capacity;
+    boxcar_t& b = _boxcars[output];
+    if (b.len == len) return;
+    b.len = len;
+    b.sum = 0;
+    uint32_t n = (_count < len) ? _count : len;
+    uint32_t p = _position;
+    for (uint32_t i = 0; i < n; i++) {
+        p = (p == 0) ? _capacity - 1 : p - 1;
+        b.sum += _store[p];
+    }
+}
+
+template <class T> uint32_t filter_bank<T>::get_length(size_t output) {
+    return (output < _outputs) ? _boxcars[output].len : 0;
+}
+
+template <class T> void filter_bank<T>::set_trend(float alpha) {
+    _alpha = (isfinite(alpha) && alpha > 0) ? (alpha > 1 ? 1 : alpha) : 0;
+    if (_alpha == 0) _trend = NAN;
+}
+
+template <class T> void filter_bank<T>::push(T x) {
+    // Locals: the sums are T like the history, so the compiler would reload the members after every store
+    const uint32_t position = _position, count = _count, capacity = _capacity;
+    const T* store = _store;
+    for (size_t i = 0; i < _outputs; i++) {
+        boxcar_t& b = _boxcars[i];
+        T sum = b.sum + x;
+        if (count >= b.len) {
+            uint32_t p = position + ((position < b.len) ? capacity : 0) - b.len; // select, not a branch
+            sum -= store[p];                                  // read before the write below: len == _capacity drops _store[_position]
+        }
+        b.sum = sum;
+    }
+    _store[position] = x;
+    _position = (position + 1 == capacity) ? 0 : position + 1;
+    if (count < capacity) _count = count + 1;
+    if (_alpha > 0) {
+        if (isnan(_trend)) _trend = static_cast<float>(x);
+        else _trend += _alpha * (static_cast<float>(x) - _trend);
+    }
+}
+
+template <class T> float filter_bank<T>::mean(size_t output) {
+    if (output >= _outputs || _count == 0) return 0;
+    const boxcar_t& b = _boxcars[output];
+    uint32_t n = (_count < b.len) ? _count : b.len;
+    return static_cast<float>(b.sum) / n;
+}
+
+template <class T> float filter_bank<T>::trend() {
+    return _trend;
+}
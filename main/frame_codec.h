@@ -0,0 +1,38 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "my_protocol.h"
+
+/***
+ * Outbound framing of the CDC stream, see my_protocol.h: the CRC is computed by the caller (ROM routine on the
+ * device), the bytes between the markers are escaped here. Platform-independent (host-benchmarked).
+ */
+
+#define FRAME_ENCODED_MAX(payload) (((payload) + 6) * 2 + 2) //Every byte of cmd, payload, wdt and crc escaped
+
+inline void frame_escape(uint8_t*& current, uint8_t value) {
+    switch (value) {
+    case preamble:
+    case postamble:
+    case escape:
+        *current++ = escape;
+        break;
+    default:
+        break;
+    }
+    *current++ = value;
+}
+
+// Writes a complete frame to `out` (FRAME_ENCODED_MAX(sz) bytes), returns its length
+inline size_t frame_encode(uint8_t* out, uint8_t cmd, const uint8_t* payload, size_t sz, uint8_t wdt, uint32_t crc) {
+    uint8_t* current = out;
+    *current++ = preamble;
+    frame_escape(current, cmd);
+    for (size_t i = 0; i < sz; i++) frame_escape(current, payload[i]);
+    frame_escape(current, wdt);
+    for (size_t i = 0; i < sizeof(crc); i++) frame_escape(current, static_cast<uint8_t>(crc >> (8 * i))); // LE
+    *current++ = postamble;
+    return current - out;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+#include <atomic>
+
+/***
+ * Hard heater protection, evaluated on every raw (not averaged) I_h / V_h_mon conversion.
+ * All checks are comparisons of products, no divisions, so the cost is constant and a zero current is harmless.
+ * A trip latches until clear() is called explicitly. Platform-independent (host-testable).
+ */
+
+enum heater_trip : uint8_t
+{
+    trip_none,
+    trip_over_temp, // heater resistance above the one at max_temp
+    trip_over_current,
+    trip_open, // voltage applied, no current
+    trip_short, // current flows, resistance too low
+    trip_invalid // non-finite reading
+};
+
+struct heater_limits_t // Wire and storage format (CMD_SET_TRIP_LIMITS)
+{
+    float max_temp; // K
+    float max_current; // A
+    float open_voltage; // V, above this some current must flow
+    float open_current; // A, less than this at open_voltage means an open heater
+    float short_resistance; // Ohm, less than this means a shorted heater
+    float short_current; // A, the short check needs at least this much current
+};
+
+struct heater_guard_limits_t // Precomputed from heater_limits_t and the heater calibration
+{
+    float max_current;
+    float open_voltage;
+    float open_current;
+    float short_resistance;
+    float short_current;
+    float max_resistance; // at max_temp
+};
+
+class heater_guard
+{
+    private:
+        std::atomic<uint8_t> _trip;
+
+    public:
+        heater_guard();
+        uint8_t check(float v, float i, const heater_guard_limits_t* l);
+        uint8_t get_trip();
+        bool clear();
+
+        static void prepare(heater_guard_limits_t* out, const heater_limits_t* in, float max_resistance); // Heater R at in->max_temp
+};
+
+inline heater_guard::heater_guard() : _trip(trip_none) {
+}
+
+// Returns the new trip cause, trip_none if nothing tripped (or it had already been latched)
+inline uint8_t heater_guard::check(float v, float i, const heater_guard_limits_t* l) {
+    uint8_t t = trip_none;
+    if (!isfinite(v) || !isfinite(i)) t = trip_invalid;
+    else if (i > l->max_current) t = trip_over_current;
+    else if (i > l->short_current && v < i * l->short_resistance) t = trip_short;
+    else if (v > l->open_voltage && i < l->open_current) t = trip_open;
+    else if (i > l->open_current && v > i * l->max_resistance) t = trip_over_temp;
+    if (t == trip_none) return trip_none;
+    uint8_t expected = trip_none;
+    return _trip.compare_exchange_strong(expected, t, std::memory_order_relaxed) ? t : (uint8_t)trip_none;
+}
+
+inline uint8_t heater_guard::get_trip() {
+    return _trip.load(std::memory_order_relaxed);
+}
+
+// Returns false if there was nothing to clear. Trips again on the next sample if the condition persists.
+inline bool heater_guard::clear() {
+    return _trip.exchange(trip_none, std::memory_order_relaxed) != trip_none;
+}
+
+inline void heater_guard::prepare(heater_guard_limits_t* out, const heater_limits_t* in, float max_resistance) {
+    out->max_current = in->max_current;
+    out->open_voltage = in->open_voltage;
+    out->open_current = in->open_current;
+    out->short_resistance = in->short_resistance;
+    out->short_current = in->short_current;
+    out->max_resistance = max_resistance;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+/***
+ * Heater resistance against temperature, R = R0 * ratio(T), R0 at the reference temperature (rt_temp):
+ * linear (ratio = 1 + tempco * t), quadratic (Callendar-Van Dusen above 0 C: 1 + tempco * t + beta * t^2)
+ * or a table of measured ratios, piecewise linear. t = T - rt_temp.
+ * prepare() tabulates R(T) and its inverse T(R) on uniform grids up to temp_max, so that the control loop only
+ * does a lookup and a linear interpolation per conversion. Below rt_temp T is clamped, above temp_max both
+ * tables extrapolate their last interval. Platform-independent (host-testable).
+ */
+
+#define HEATER_MODEL_POINTS 8 //Table breakpoints
+#define HEATER_LUT_SIZE 64 //Intervals of the precomputed tables
+#define HEATER_TEMP_LIMIT 2000 //K, largest temp_max accepted
+
+enum heater_model_kind : uint8_t
+{
+    heater_linear, // tempco from CMD_SET_HEATER_PARAMS
+    heater_quadratic, // tempco and beta
+    heater_table // temp[] and ratio[], tempco isn't used
+};
+
+struct heater_model_t // Wire and storage format (CMD_SET_HEATER_MODEL)
+{
+    uint8_t kind; // heater_model_kind
+    uint8_t points; // table breakpoints in use, 2..HEATER_MODEL_POINTS
+    uint16_t reserved;
+    float beta; // 1/K^2, quadratic. Platinum: tempco 3.9083e-3, beta -5.775e-7
+    float temp_max; // K, end of the precomputed tables
+    float temp[HEATER_MODEL_POINTS]; // K, strictly ascending
+    float ratio[HEATER_MODEL_POINTS]; // R / R0 at temp[], strictly ascending
+};
+
+struct heater_lut_t // Precomputed by heater_model::prepare(), read by the control loop
+{
+    float t_min, t_scale; // R(T): index = (T - t_min) * t_scale
+    float r_min, r_scale; // T(R): index = (R - r_min) * r_scale
+    float res[HEATER_LUT_SIZE + 1]; // Ohm
+    float temp[HEATER_LUT_SIZE + 1]; // K
+
+    float resistance(float temp) const;
+    float temperature(float res) const;
+};
+
+namespace heater_model
+{
+    // Shape only, tempco and beta must also make the quadratic rise up to temp_max, see monotonic()
+    inline bool validate(const heater_model_t* m, float rt_temp) {
+        if (m->kind > heater_table) return false;
+        if (!isfinite(m->temp_max) || m->temp_max < rt_temp + 10 || m->temp_max > HEATER_TEMP_LIMIT) return false;
+        if (m->kind == heater_quadratic && !isfinite(m->beta)) return false;
+        if (m->kind != heater_table) return true;
+        if (m->points < 2 || m->points > HEATER_MODEL_POINTS) return false;
+        for (size_t i = 0; i < m->points; i++) {
+            if (!isfinite(m->temp[i]) || !isfinite(m->ratio[i]) || !(m->ratio[i] > 0)) return false;
+            if (i > 0 && !(m->temp[i] > m->temp[i - 1] && m->ratio[i] > m->ratio[i - 1])) return false;
+        }
+        return true;
+    }
+
+    // dR/dT > 0 over rt_temp..temp_max, so that T(R) exists. The table is checked by validate()
+    inline bool monotonic(const heater_model_t* m, float tempco, float rt_temp) {
+        if (m->kind == heater_table) return true;
+        if (!isfinite(tempco) || !(tempco > 0)) return false;
+        return m->kind == heater_linear || tempco + 2 * m->beta * (m->temp_max - rt_temp) > 0;
+    }
+
+    inline float ratio(const heater_model_t* m, float tempco, float rt_temp, float temp) {
+        float t = temp - rt_temp;
+        switch (m->kind) {
+        case heater_quadratic:
+            return 1 + t * (tempco + m->beta * t);
+        case heater_table:
+        {
+            size_t i = 1;
+            while (i < m->points - 1u && temp > m->temp[i]) i++; // the end intervals extrapolate
+            float f = (temp - m->temp[i - 1]) / (m->temp[i] - m->temp[i - 1]);
+            return m->ratio[i - 1] + f * (m->ratio[i] - m->ratio[i - 1]);
+        }
+        default:
+            return 1 + tempco * t;
+        }
+    }
+
+    // The model prepare() tabulates: `model`, or its linear fallback in `linear` if it doesn't rise with this tempco
+    inline const heater_model_t* effective(const heater_model_t* model, float tempco, float rt_temp, heater_model_t* linear) {
+        if (monotonic(model, tempco, rt_temp)) return model;
+        *linear = *model;
+        linear->kind = heater_linear;
+        return linear;
+    }
+
+    // R0 from a resistance measured at `temp`, under the effective model. NaN if the model has no positive ratio there
+    inline float base_resistance(const heater_model_t* model, float tempco, float rt_temp, float res, float temp) {
+        heater_model_t linear;
+        float r = ratio(effective(model, tempco, rt_temp, &linear), tempco, rt_temp, temp);
+        return (r > 0 && isfinite(r)) ? res / r : NAN;
+    }
+
+    // Falls back to the linear model if `m` doesn't rise with this tempco. Bisection, call on parameter changes only
+    inline void prepare(heater_lut_t* out, const heater_model_t* model, float tempco, float rt_res, float rt_temp) {
+        heater_model_t linear;
+        const heater_model_t* m = effective(model, tempco, rt_temp, &linear);
+        float span = m->temp_max - rt_temp;
+        out->t_min = rt_temp;
+        out->t_scale = HEATER_LUT_SIZE / span;
+        for (size_t i = 0; i <= HEATER_LUT_SIZE; i++) {
+            out->res[i] = rt_res * ratio(m, tempco, rt_temp, rt_temp + span * i / HEATER_LUT_SIZE);
+        }
+        out->r_min = out->res[0];
+        float r_span = out->res[HEATER_LUT_SIZE] - out->r_min;
+        out->r_scale = HEATER_LUT_SIZE / r_span;
+        out->temp[0] = rt_temp;
+        out->temp[HEATER_LUT_SIZE] = m->temp_max;
+        for (size_t i = 1; i < HEATER_LUT_SIZE; i++) {
+            float r = out->r_min + r_span * i / HEATER_LUT_SIZE;
+            float lo = rt_temp, hi = m->temp_max;
+            for (size_t k = 0; k < 32; k++) {
+                float mid = 0.5f * (lo + hi);
+                if (rt_res * ratio(m, tempco, rt_temp, mid) < r) lo = mid;
+                else hi = mid;
+            }
+            out->temp[i] = 0.5f * (lo + hi);
+        }
+    }
+}
+
+inline float heater_lut_t::resistance(float t) const {
+    float x = (t - t_min) * t_scale;
+    if (!(x > 0)) return res[0];
+    size_t i = (x < HEATER_LUT_SIZE) ? static_cast<size_t>(x) : HEATER_LUT_SIZE - 1;
+    return res[i] + (x - i) * (res[i + 1] - res[i]);
+}
+
+// NaN and resistances below R0 give rt_temp
+inline float heater_lut_t::temperature(float r) const {
+    float x = (r - r_min) * r_scale;
+    if (!(x > 0)) return temp[0];
+    size_t i = (x < HEATER_LUT_SIZE) ? static_cast<size_t>(x) : HEATER_LUT_SIZE - 1;
+    return temp[i] + (x - i) * (temp[i + 1] - temp[i]);
+}
@@ -2,7 +2,10 @@
 #include "my_params.h"
 
 #include <stdlib.h>
+#include <assert.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <rom/ets_sys.h>
 
 //ADC Calibration
 #if CONFIG_IDF_TARGET_ESP32
@@ -15,36 +18,63 @@
 #define ADC_EXAMPLE_CALI_SCHEME     ESP_ADC_CAL_VAL_EFUSE_TP_FIT
 #endif
 
+#define ADC_RAW_MAX 4095 //12-bit codes, nominal scaling of uncalibrated units
+
+#define RAIL_SETTLE_MV 4 //Change between readings still counted as steady
+#define RAIL_SETTLE_COUNT 8 //Steady readings in a row
+#define RAIL_SETTLE_INTERVAL 250 //us
+
 static const char* TAG = "MY_ADC";
 
-static bool adc_calibration_init(esp_adc_cal_characteristics_t* chars, adc_atten_t att)
-{
-    esp_err_t ret;
-    bool cali_enable = false;
-
-    ret = esp_adc_cal_check_efuse(ADC_EXAMPLE_CALI_SCHEME);
-    if (ret == ESP_ERR_NOT_SUPPORTED) {
-        ESP_LOGW(TAG, "Calibration scheme not supported, skip software calibration");
-    } else if (ret == ESP_ERR_INVALID_VERSION) {
-        ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
-    } else if (ret == ESP_OK) {
-        cali_enable = true;
-        esp_adc_cal_characterize(ADC_UNIT_1, att, ADC_BITS, 0, chars);
-    } else {
-        ESP_LOGE(TAG, "Invalid arg");
-    }
+//Averaging windows of all channels, handed out in construction order
+static uint32_t average_pool[MY_SENSOR_NUM * MY_ADC_CHANNEL_NUM][ADC_AVERAGE_MAX];
+static size_t average_pool_used = 0;
+
+static uint32_t* average_storage()
+{
+    assert(average_pool_used < MY_SENSOR_NUM * MY_ADC_CHANNEL_NUM);
+    return average_pool[average_pool_used++];
+}
+
+//eFuse curves, characterized once per attenuation and shared by the channels that use it
+static esp_adc_cal_characteristics_t adc_chars_cache[ADC_ATTEN_MAX];
+static bool adc_chars_valid[ADC_ATTEN_MAX] = {};
+static esp_err_t efuse_status = ESP_ERR_INVALID_STATE; //Not checked yet
 
-    return cali_enable;
+static const esp_adc_cal_characteristics_t* adc_calibration_init(adc_atten_t att)
+{
+    if (efuse_status == ESP_ERR_INVALID_STATE) {
+        efuse_status = esp_adc_cal_check_efuse(ADC_EXAMPLE_CALI_SCHEME);
+        if (efuse_status == ESP_ERR_NOT_SUPPORTED) {
+            ESP_LOGW(TAG, "Calibration scheme not supported, skip software calibration");
+        } else if (efuse_status == ESP_ERR_INVALID_VERSION) {
+            ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
+        } else if (efuse_status != ESP_OK) {
+            ESP_LOGE(TAG, "Invalid arg");
+        }
+    }
+    if (efuse_status != ESP_OK) return NULL;
+    if (!adc_chars_valid[att]) {
+        esp_adc_cal_characterize(ADC_UNIT_1, att, ADC_BITS, 0, &adc_chars_cache[att]);
+        adc_chars_valid[att] = true;
+    }
+    return &adc_chars_cache[att];
 }
 
+//Nominal full scale per attenuation (mV), when there is no eFuse curve: readings stay usable but uncalibrated
+static const uint32_t nominal_full_scale[ADC_ATTEN_MAX] = { 950, 1250, 1750, 3100 };
+
 namespace my_adc
 {
-    my_adc_channel channels[MY_ADC_CHANNEL_NUM] = 
+    //One row per sensor, in my_adc_channels order
+    my_adc_channel channels[MY_SENSOR_NUM][MY_ADC_CHANNEL_NUM] = 
     {
-        my_adc_channel(ADC1_CHANNEL_3, ADC_ATTEN_DB_0, "I_h"),
-        my_adc_channel(ADC1_CHANNEL_4, ADC_ATTEN_DB_6, "V_h_mon"),
-        my_adc_channel(ADC1_CHANNEL_8, ADC_ATTEN_DB_0, "V_r4"),
-        my_adc_channel(ADC1_CHANNEL_9, ADC_ATTEN_DB_0, "V_div")
+        {
+            my_adc_channel(ADC1_CHANNEL_3, ADC_ATTEN_DB_0, "I_h"),
+            my_adc_channel(ADC1_CHANNEL_4, ADC_ATTEN_DB_6, "V_h_mon"),
+            my_adc_channel(ADC1_CHANNEL_8, ADC_ATTEN_DB_0, "V_r4"),
+            my_adc_channel(ADC1_CHANNEL_9, ADC_ATTEN_DB_0, "V_div")
+        }
     };
 
     void init()
@@ -52,37 +82,120 @@ namespace my_adc
         //ADC1 config
         ESP_ERROR_CHECK(adc1_config_width(ADC_BITS));
     }
+
+    //Every sensor's divider supply, after my_adc_channel::init()
+    bool wait_settled(uint32_t timeout_us)
+    {
+        int64_t start = esp_timer_get_time();
+        uint32_t last[MY_SENSOR_NUM] = {};
+        uint32_t stable = 0;
+        while (esp_timer_get_time() - start < timeout_us)
+        {
+            bool steady = true;
+            for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+            {
+                uint32_t mv = channels[i][v_div].probe();
+                if (mv + RAIL_SETTLE_MV < last[i] || mv > last[i] + RAIL_SETTLE_MV) steady = false;
+                last[i] = mv;
+            }
+            stable = steady ? stable + 1 : 0;
+            if (stable >= RAIL_SETTLE_COUNT)
+            {
+                ESP_LOGI(TAG, "Rails settled in %lld us", esp_timer_get_time() - start);
+                return true;
+            }
+            ets_delay_us(RAIL_SETTLE_INTERVAL);
+        }
+        ESP_LOGW(TAG, "Rails not settled after %u us", timeout_us);
+        return false;
+    }
 }
 
 my_adc_channel::my_adc_channel(adc1_channel_t ch, adc_atten_t att, const char* t) 
-    : channel(ch), tag(t), attenuation(att)
-{
-    calibration = &my_params::default_adc_cal;
-    av = new Average<uint32_t>(my_params::get_timings()->averaging_len);
-}
-my_adc_channel::~my_adc_channel()
+    : bank(average_storage(), ADC_AVERAGE_MAX, adc_output_num), channel(ch), tag(t), adc_chars(NULL), attenuation(att), instant(0),
+    raw(0), millivolts(0)
 {
-    av->~Average();
-    delete av;
+    calibration = &my_params::default_adc_cal; //The windows are set by my_sensor::init()
 }
 
+//Configures the channel even without an eFuse curve, the conversions then fall back to nominal scaling
 bool my_adc_channel::init(const my_adc_cal_t* cal)
 {
-    bool cali_enable = adc_calibration_init(&adc_chars, attenuation);
-    if (!cali_enable)
+    adc_chars = adc_calibration_init(attenuation);
+    ESP_ERROR_CHECK(adc1_config_channel_atten(channel, attenuation));
+    calibration = cal;
+    if (adc_chars == NULL)
     {
         ESP_LOGE(TAG, "Calibrate the ADC first!");
         return false;
     }
-    ESP_ERROR_CHECK(adc1_config_channel_atten(channel, attenuation));
-    calibration = cal;
     return true;
 }
 
+uint32_t my_adc_channel::to_millivolts(uint32_t code)
+{
+    if (adc_chars == NULL) return code * nominal_full_scale[attenuation] / ADC_RAW_MAX;
+    return esp_adc_cal_raw_to_voltage(code, adc_chars);
+}
+
+void my_adc_channel::set_calibration(const my_adc_cal_t* cal)
+{
+    calibration = cal;
+}
+
+void my_adc_channel::set_averaging(uint32_t len)
+{
+    bank.set_length(adc_control, len);
+}
+
+void my_adc_channel::set_telemetry_window(uint32_t len)
+{
+    bank.set_length(adc_telemetry, len);
+}
+
+void my_adc_channel::set_trend(float alpha)
+{
+    bank.set_trend(alpha);
+}
+
 float my_adc_channel::get_value()
 {
-    uint32_t voltage = esp_adc_cal_raw_to_voltage(adc1_get_raw(channel), &adc_chars);
-    return av->rolling(voltage) / 1000.0f * calibration->gain + calibration->offset;
+    raw = adc1_get_raw(channel);
+    uint32_t voltage = to_millivolts(raw);
+    millivolts = voltage;
+    instant = voltage / 1000.0f * calibration->gain + calibration->offset;
+    bank.push(voltage);
+    return bank.mean(adc_control) / 1000.0f * calibration->gain + calibration->offset;
+}
+
+uint32_t my_adc_channel::probe()
+{
+    return to_millivolts(adc1_get_raw(channel));
+}
+
+float my_adc_channel::get_telemetry()
+{
+    return bank.mean(adc_telemetry) / 1000.0f * calibration->gain + calibration->offset;
+}
+
+float my_adc_channel::get_trend()
+{
+    return bank.trend() / 1000.0f * calibration->gain + calibration->offset;
+}
+
+float my_adc_channel::get_instant()
+{
+    return instant;
+}
+
+uint16_t my_adc_channel::get_raw()
+{
+    return raw;
+}
+
+uint16_t my_adc_channel::get_millivolts()
+{
+    return millivolts;
 }
 
 const char* my_adc_channel::get_tag()
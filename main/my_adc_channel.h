@@ -1,12 +1,14 @@
 #pragma once
 
-#include "average.h"
+#include "filter_bank.h"
+#include "my_board.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
 #include <stdint.h>
 
 #define ADC_BITS (static_cast<adc_bits_width_t>(ADC_WIDTH_BIT_DEFAULT))
 #define MY_ADC_CHANNEL_NUM 4
+#define ADC_AVERAGE_MAX 256 //samples, largest averaging window; storage for all channels is reserved statically
 
 struct my_adc_cal_t
 {
@@ -14,6 +16,13 @@ struct my_adc_cal_t
     float offset;
 };
 
+enum my_adc_outputs // Boxcars of each channel's filter bank
+{
+    adc_control, // every tick: PID, trip context
+    adc_telemetry, // read once per telemetry point
+    adc_output_num
+};
+
 enum my_adc_channels
 {
     i_h,
@@ -25,23 +34,38 @@ enum my_adc_channels
 class my_adc_channel
 {
 private:
-    Average<uint32_t>* av;
+    filter_bank<uint32_t> bank; // mV. History from the static pool, see my_adc_channel.cpp
     adc1_channel_t channel;
     const char* tag;
-    esp_adc_cal_characteristics_t adc_chars;
+    const esp_adc_cal_characteristics_t* adc_chars; // Shared per attenuation, NULL without an eFuse curve
     adc_atten_t attenuation;
     const my_adc_cal_t* calibration;
+    float instant;
+    uint16_t raw;
+    uint16_t millivolts;
+
+    uint32_t to_millivolts(uint32_t code);
 public:
     my_adc_channel(adc1_channel_t ch, adc_atten_t att, const char* t);
-    ~my_adc_channel();
-    float get_value();
+    float get_value(); // Converts, returns the control output
+    float get_telemetry(); // Calibrated telemetry output of the conversions so far
+    float get_trend(); // Calibrated trend output, NaN while off
+    float get_instant(); // Calibrated, not averaged, from the last get_value() conversion
+    uint32_t probe(); // One conversion in mV, not fed to the filters. After init()
+    uint16_t get_raw(); // ADC code of the last conversion
+    uint16_t get_millivolts(); // The same after the eFuse curve, as fed to the filters
     const char* get_tag();
     bool init(const my_adc_cal_t* cal);
+    void set_calibration(const my_adc_cal_t* cal);
+    void set_averaging(uint32_t len); // Control output, 1..ADC_AVERAGE_MAX, keeps the history: the average doesn't jump
+    void set_telemetry_window(uint32_t len); // Likewise
+    void set_trend(float alpha); // Weight of a new sample, 0 = off
 };
 
 namespace my_adc
 {
-    extern my_adc_channel channels[MY_ADC_CHANNEL_NUM];
+    extern my_adc_channel channels[MY_SENSOR_NUM][MY_ADC_CHANNEL_NUM];
 
     void init();
+    bool wait_settled(uint32_t timeout_us); // Until the divider supplies read steady, false on timeout
 } // namespace my_adc
\ No newline at end of file
@@ -0,0 +1,3 @@
+#pragma once
+
+#define MY_SENSOR_NUM 1 //Heater/sensor channel sets populated on this board, see my_adc::channels and my_dac::channels
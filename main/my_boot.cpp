@@ -0,0 +1,93 @@
+#include "my_boot.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <atomic>
+
+static const char* TAG = "BOOT";
+static const char* phase_names[boot_phase_count] = { "params", "store", "uart", "usb", "console", "adc", "rails" };
+
+static boot_report_t report = {}; //Written by the init tasks on both cores
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<uint32_t> ended(0); //Bit per phase
+static std::atomic<bool> sampled(false);
+
+static uint32_t now_us()
+{
+    return static_cast<uint32_t>(esp_timer_get_time());
+}
+
+namespace my_boot
+{
+    void begin(boot_phase phase)
+    {
+        uint32_t now = now_us();
+        portENTER_CRITICAL(&report_lock);
+        report.start_us[phase] = now;
+        portEXIT_CRITICAL(&report_lock);
+    }
+
+    void end(boot_phase phase)
+    {
+        uint32_t now = now_us();
+        portENTER_CRITICAL(&report_lock);
+        report.end_us[phase] = now;
+        portEXIT_CRITICAL(&report_lock);
+        ended.fetch_or(1u << phase);
+    }
+
+    void mark_main()
+    {
+        uint32_t now = now_us();
+        portENTER_CRITICAL(&report_lock);
+        report.main_us = now;
+        portEXIT_CRITICAL(&report_lock);
+    }
+
+    void mark_ready(bool rails_settled)
+    {
+        uint32_t now = now_us();
+        portENTER_CRITICAL(&report_lock);
+        report.rails_settled = rails_settled;
+        report.ready_us = now;
+        portEXIT_CRITICAL(&report_lock);
+    }
+
+    void note_sample()
+    {
+        if (sampled.load(std::memory_order_relaxed)) return;
+        uint32_t now = now_us();
+        portENTER_CRITICAL(&report_lock);
+        report.first_sample_us = now;
+        portEXIT_CRITICAL(&report_lock);
+        sampled.store(true);
+    }
+
+    bool complete()
+    {
+        return sampled.load() && ended.load() == (1u << boot_phase_count) - 1;
+    }
+
+    void log()
+    {
+        boot_report_t report;
+        get_report(&report);
+        for (size_t i = 0; i < boot_phase_count; i++)
+        {
+            if (report.end_us[i] == 0) ESP_LOGW(TAG, "%-8s %7u us, running", phase_names[i], report.start_us[i]);
+            else ESP_LOGI(TAG, "%-8s %7u .. %7u us (%u us)", phase_names[i], report.start_us[i], report.end_us[i],
+                report.end_us[i] - report.start_us[i]);
+        }
+        ESP_LOGI(TAG, "app_main at %u us, control started at %u us%s, first sample at %u us", report.main_us,
+            report.ready_us, report.rails_settled ? "" : " (rails not settled)", report.first_sample_us);
+    }
+
+    void get_report(boot_report_t* r)
+    {
+        portENTER_CRITICAL(&report_lock);
+        *r = report;
+        portEXIT_CRITICAL(&report_lock);
+        if (!sampled.load()) r->first_sample_us = 0;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "my_protocol.h"
+
+/***
+ * Boot timeline: start and end of each init phase, the control task start and its first conversions.
+ * Phases may run on either core; each is marked by the task that runs it.
+ */
+namespace my_boot
+{
+    void begin(boot_phase phase);
+    void end(boot_phase phase);
+    void mark_main(); // app_main entered
+    void mark_ready(bool rails_settled); // Control tasks started
+    void note_sample(); // Control task, every tick: only the first one is kept
+    bool complete(); // Every phase ended and the first sample taken
+    void log();
+    void get_report(boot_report_t* r);
+}
@@ -2,6 +2,7 @@
 #include <driver/gpio.h>
 #include <rom/ets_sys.h>
 #include <esp_log.h>
+#include <math.h>
 
 #include "my_params.h"
 #include "macros.h"
@@ -14,7 +15,7 @@ typedef uint16_t my_adc_code_t;
 
 static const char* TAG = "MY_DAC";
 
-gpio_num_t dac_pins[] = //LSB->MSB
+static const uint8_t dac0_pins[] = //LSB->MSB
 {
     GPIO_NUM_38,
     GPIO_NUM_37,
@@ -27,58 +28,88 @@ gpio_num_t dac_pins[] = //LSB->MSB
     GPIO_NUM_2,
     GPIO_NUM_1
 };
-gpio_num_t clk_pin = GPIO_NUM_13;
-
-const my_dac_cal_t* calibration = &my_params::default_dac_cal;
-float last = 0;
 
 namespace my_dac
 {
-    void init(const my_dac_cal_t* cal)
+    //One per sensor
+    my_dac_channel channels[MY_SENSOR_NUM] = 
     {
-        calibration = cal;
-        gpio_config_t io_conf = {};
-        //disable interrupt
-        io_conf.intr_type = GPIO_INTR_DISABLE;
-        //set as output mode
-        io_conf.mode = GPIO_MODE_OUTPUT;
-        //bit mask of the pins that you want to set
-        for (auto &&i : dac_pins)
-        {
-            io_conf.pin_bit_mask |= (1ULL << i);  
-        }
-        io_conf.pin_bit_mask |= (1ULL << clk_pin);
-        //disable pull-down mode
-        io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-        //disable pull-up mode
-        io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
-        //configure GPIO with the given settings
-        gpio_config(&io_conf);
-        set(0);
-        ESP_LOGI(TAG, "DAC initialized.");
+        my_dac_channel(dac0_pins, ARRAY_SIZE(dac0_pins), GPIO_NUM_13)
+    };
+}
+
+my_dac_channel::my_dac_channel(const uint8_t* p, size_t count, uint8_t clk)
+    : pins(p), pin_count(count), clk_pin(clk), calibration(&my_params::default_dac_cal), last(0), last_code(0)
+{
+}
+
+void my_dac_channel::init(const my_dac_cal_t* cal)
+{
+    calibration = cal;
+    gpio_config_t io_conf = {};
+    //disable interrupt
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    //set as output mode
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    //bit mask of the pins that you want to set
+    for (size_t i = 0; i < pin_count; i++)
+    {
+        io_conf.pin_bit_mask |= (1ULL << pins[i]);  
     }
-    void set(float volt)
+    io_conf.pin_bit_mask |= (1ULL << clk_pin);
+    //disable pull-down mode
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    //disable pull-up mode
+    io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+    //configure GPIO with the given settings
+    gpio_config(&io_conf);
+    set(0);
+    ESP_LOGI(TAG, "DAC initialized.");
+}
+
+void my_dac_channel::set_cal(const my_dac_cal_t* cal)
+{
+    calibration = cal;
+}
+
+void my_dac_channel::write_code(my_adc_code_t code)
+{
+    last_code = code;
+    gpio_set_level(static_cast<gpio_num_t>(clk_pin), 0);
+    for (size_t i = 0; i < pin_count; i++)
     {
-        if (!isfinite(volt))
-        {
-            ESP_LOGW(TAG, "DAC ignored infinte value: %f", volt);
-            return;
-        }
-        last = volt;
-        volt = volt * calibration->gain + 0.5 + calibration->offset;
-        if (volt > MY_DAC_FULL_SCALE) volt = MY_DAC_FULL_SCALE;
-        else if (volt < MY_DAC_ZERO_SCALE) volt = MY_DAC_ZERO_SCALE;
-        my_adc_code_t code = static_cast<my_adc_code_t>(volt);
-        gpio_set_level(clk_pin, 0);
-        for (size_t i = 0; i < ARRAY_SIZE(dac_pins); i++)
-        {
-            gpio_set_level(dac_pins[i], (code & (1u << i)) > 0);
-        }
-        ets_delay_us(1);
-        gpio_set_level(clk_pin, 1);
+        gpio_set_level(static_cast<gpio_num_t>(pins[i]), (code & (1u << i)) > 0);
     }
-    float get()
+    ets_delay_us(1);
+    gpio_set_level(static_cast<gpio_num_t>(clk_pin), 1);
+}
+
+void my_dac_channel::set(float volt)
+{
+    if (!isfinite(volt))
     {
-        return last;
+        ESP_LOGW(TAG, "DAC ignored infinte value: %f", volt);
+        return;
     }
-}
\ No newline at end of file
+    last = volt;
+    volt = volt * calibration->gain + 0.5 + calibration->offset;
+    if (volt > MY_DAC_FULL_SCALE) volt = MY_DAC_FULL_SCALE;
+    else if (volt < MY_DAC_ZERO_SCALE) volt = MY_DAC_ZERO_SCALE;
+    write_code(static_cast<my_adc_code_t>(volt));
+}
+
+void my_dac_channel::off()
+{
+    last = 0;
+    write_code(MY_DAC_ZERO_SCALE);
+}
+
+float my_dac_channel::get()
+{
+    return last;
+}
+
+uint16_t my_dac_channel::get_code()
+{
+    return last_code;
+}
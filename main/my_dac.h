@@ -1,6 +1,8 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
+#include "my_board.h"
 
 struct my_dac_cal_t
 {
@@ -8,9 +10,27 @@ struct my_dac_cal_t
     float offset;
 };
 
-namespace my_dac
+class my_dac_channel // Parallel-input DAC latched by a clock pin
 {
+private:
+    const uint8_t* pins; // GPIO numbers, LSB->MSB
+    size_t pin_count;
+    uint8_t clk_pin;
+    const my_dac_cal_t* calibration;
+    float last;
+    uint16_t last_code;
+    void write_code(uint16_t code);
+public:
+    my_dac_channel(const uint8_t* p, size_t count, uint8_t clk);
     void init(const my_dac_cal_t* cal);
+    void set_cal(const my_dac_cal_t* cal);
     void set(float volt);
+    void off(); // Zero code regardless of the calibration, for the protection path
     float get();
-}
\ No newline at end of file
+    uint16_t get_code();
+};
+
+namespace my_dac
+{
+    extern my_dac_channel channels[MY_SENSOR_NUM];
+}
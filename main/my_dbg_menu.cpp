@@ -1,6 +1,8 @@
 #include "my_dbg_menu.h"
 #include "my_params.h"
 #include "my_uart.h"
+#include "my_sensor.h"
+#include "my_power.h"
 #include "macros.h"
 
 #include "esp_log.h"
@@ -77,7 +79,7 @@ namespace my_dbg_commands
 
     static int set_pid(int argc, char** argv)
     {
-        my_pid_params_t buf = *my_params::get_pid_params();
+        my_pid_params_t buf = *my_params::get_pid_params(my_dbg_menu::sensor);
         float* vals[] = { &buf.kPE, &buf.kPD, &buf.kI, &buf.limI, &buf.ambient_temp, &buf.timing_factor, &buf.setpoint_tolerance };
         if (argc > (ARRAY_SIZE(vals) + 1)) argc = ARRAY_SIZE(vals) + 1;
         int res = 0;
@@ -87,7 +89,8 @@ namespace my_dbg_commands
         }
         if (res > 0)
         {
-            my_params::set_pid_params(&buf);
+            my_params::set_pid_params(my_dbg_menu::sensor, &buf);
+            my_params::publish();
             return 0;
         }
         return 1;
@@ -97,9 +100,11 @@ namespace my_dbg_commands
     {
         if (argc < 2) return 1;
         float res, temp;
-        if (sscanf(argv[1], "%f,%f", &res, &temp) == 2)
+        if (sscanf(argv[1], "%f,%f", &res, &temp) == 2 &&
+            my_params::validate_heater_params(my_params::get_heater_coef(my_dbg_menu::sensor), res, temp))
         {
-            my_params::set_rt_resistance(res, temp);
+            my_params::set_rt_resistance(my_dbg_menu::sensor, res, temp);
+            my_params::publish();
             return 0;
         }
         else
@@ -110,19 +115,25 @@ namespace my_dbg_commands
 
     static int dump_nvs(int argc, char** argv)
     {
+        size_t s = my_dbg_menu::sensor;
+        printf("    Sensor #%u\n", s);
         for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++)
         {
-            auto ch = my_params::get_adc_channel_cal(i);
+            auto ch = my_params::get_adc_channel_cal(s, i);
             printf("    ADC cal #%u: g=%f, o=%f", i, ch->gain, ch->offset);
         }
-        auto pid = my_params::get_pid_params();
-        auto dac = my_params::get_dac_cal();
+        auto pid = my_params::get_pid_params(s);
+        auto dac = my_params::get_dac_cal(s);
+        auto model = my_params::get_heater_model(s);
+        static const char* model_names[] = { "linear", "quadratic", "table" };
         printf("    RT heater res: %f\n"
             "   Heater alpha: %f\n"
+            "   Heater model: %s, beta=%g, points=%u, up to %.0f K\n"
             "   DAC cal: g=%f, o=%f\n"
             "   PID coefs: I=%f, limI=%f, PE=%f, PD=%f, amb=%f, tim=%f, tol=%f\n",
-            my_params::get_rt_resistance(),
-            my_params::get_heater_coef(),
+            my_params::get_rt_resistance(s),
+            my_params::get_heater_coef(s),
+            model_names[model->kind], model->beta, model->points, model->temp_max,
             dac->gain, dac->offset,
             pid->kI, pid->limI, pid->kPE, pid->kPD, pid->ambient_temp, pid->timing_factor, pid->setpoint_tolerance);
         return 0;
@@ -130,7 +141,17 @@ namespace my_dbg_commands
 
     static int operate(int argc, char** argv)
     {
-        my_dbg_menu::operate = !my_dbg_menu::operate;
+        my_dbg_menu::operate[my_dbg_menu::sensor] = !my_dbg_menu::operate[my_dbg_menu::sensor];
+        if (my_dbg_menu::operate[my_dbg_menu::sensor]) my_sensors::wake();
+        return 0;
+    }
+
+    static int select_sensor(int argc, char** argv)
+    {
+        if (argc < 2) return 1;
+        unsigned int index;
+        if (sscanf(argv[1], "%u", &index) != 1 || index >= MY_SENSOR_NUM) return 2;
+        my_dbg_menu::sensor = index;
         return 0;
     }
 
@@ -140,7 +161,7 @@ namespace my_dbg_commands
         float start, end;
         if (sscanf(argv[1], "%f,%f", &start, &end) == 2)
         {
-            my_uart::fill_buffer_dbg(start, end);
+            my_uart::fill_buffer_dbg(my_dbg_menu::sensor, start, end);
             return 0;
         }
         else
@@ -149,6 +170,39 @@ namespace my_dbg_commands
         }
     }
 
+    static int set_timings(int argc, char** argv)
+    {
+        my_timings_t t = *my_params::get_timings(my_dbg_menu::sensor);
+        if (argc < 2)
+        {
+            printf("Averaging %u samples, sampling %u Hz, oversampling %u Hz\n", t.averaging_len, t.sampling_rate,
+                t.oversampling_rate);
+            return 0;
+        }
+        uint32_t* vals[] = { &t.averaging_len, &t.sampling_rate, &t.oversampling_rate };
+        if (argc > (ARRAY_SIZE(vals) + 1)) argc = ARRAY_SIZE(vals) + 1;
+        for (size_t i = 1; i < argc; i++)
+        {
+            if (sscanf(argv[i], "%u", vals[i - 1]) != 1) return 2;
+        }
+        if (t.oversampling_rate != my_params::get_timings()->oversampling_rate && !my_sensors::idle()) return 3;
+        if (!my_params::set_timings(my_dbg_menu::sensor, &t)) return 2;
+        my_params::publish();
+        return 0;
+    }
+
+    static int power(int argc, char** argv)
+    {
+        power_report_t r;
+        my_power::get_report(&r);
+        printf("State: %s, CPU %u/%u MHz (operating/idle)\n"
+            "Active %u ms, idle %u ms, %u wake-ups\n"
+            "Wake-up to first conversion: %u us, max %u us\n",
+            r.state == power_active ? "active" : "idle", r.freq_max_mhz, r.freq_min_mhz,
+            r.active_ms, r.idle_ms, r.wakes, r.wake_latency_us, r.wake_latency_max_us);
+        return 0;
+    }
+
     static int reset_nvs(int argc, char** argv)
     {
         return my_params::factory_reset();
@@ -192,12 +246,30 @@ const esp_console_cmd_t commands[] =
         .hint = NULL,
         .func = &my_dbg_commands::operate
     },
+    {
+        .command = "sensor",
+        .help = "Select the sensor addressed by the other commands",
+        .hint = NULL,
+        .func = &my_dbg_commands::select_sensor
+    },
     {
         .command = "set_profile",
         .help = "Set temperature profile (linear interpolation of 2 endpoints)",
         .hint = NULL,
         .func = &my_dbg_commands::set_profile
     },
+    {
+        .command = "timings",
+        .help = "Show or set averaging length, sampling and oversampling rate (stopped only), from the next cycle",
+        .hint = NULL,
+        .func = &my_dbg_commands::set_timings
+    },
+    {
+        .command = "power",
+        .help = "Show the power state, time spent in each state and the wake-up latency",
+        .hint = NULL,
+        .func = &my_dbg_commands::power
+    },
     {
         .command = "reset_nvs",
         .help = "Erase NVS storage section (reset required to load defaults)",
@@ -338,7 +410,8 @@ void parser_task(void *arg)
 
 namespace my_dbg_menu
 {
-    bool operate = false;
+    bool operate[MY_SENSOR_NUM] = {};
+    size_t sensor = 0;
 
     void init()
     {
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <stddef.h>
+#include "my_board.h"
+
 namespace my_dbg_commands {};
 
 namespace my_dbg_menu
 {
-    extern bool operate;
+    extern bool operate[MY_SENSOR_NUM];
+    extern size_t sensor; // Addressed by the menu commands
 
     void init();
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "my_events.h"
+#include "my_uart.h"
+#include "my_protocol.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#define EVENT_QUEUE_LEN 16 //frames, the detectors rate-limit themselves
+#define EVENT_TASK_PRIORITY 2 //Above the parser and the control loops: an alarm goes out before anything else queued
+
+static QueueHandle_t queue;
+static TaskHandle_t send_task_handle;
+
+//Wakes up per frame instead of flushing periodically like the PID trace: latency matters more than packing
+static void send_task(void* arg)
+{
+    event_frame_t f;
+    while (1)
+    {
+        if (xQueueReceive(queue, &f, portMAX_DELAY) != pdTRUE) continue;
+        if (!my_uart::send_frame(CMD_EVENT, reinterpret_cast<uint8_t*>(&f), sizeof(f)))
+        {
+            my_uart::raise_error(my_error_codes::data_overrun, CMD_EVENT);
+        }
+    }
+}
+
+namespace my_events
+{
+    void init()
+    {
+        queue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(event_frame_t));
+        assert(queue);
+        xTaskCreatePinnedToCore(send_task, "events", 3072, NULL, EVENT_TASK_PRIORITY, &send_task_handle, 1);
+        assert(send_task_handle);
+    }
+
+    void push(const event_frame_t* f)
+    {
+        if (xQueueSend(queue, f, 0) != pdTRUE) my_uart::raise_error(my_error_codes::data_overrun, CMD_EVENT);
+    }
+}
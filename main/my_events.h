@@ -0,0 +1,9 @@
+#pragma once
+
+#include "event_detector.h"
+
+namespace my_events
+{
+    void init();
+    void push(const event_frame_t* f); // Control loop, never blocks. Sent as CMD_EVENT right away
+}
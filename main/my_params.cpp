@@ -4,6 +4,18 @@
 #include "nvs.h"
 #include "nvs_handle.hpp"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "triple_buffer.h"
+#include "my_uart.h"
+#include "macros.h"
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdio.h>
 
 #define MY_DAC_MAX 6.0 //V
 #define MY_DAC_RESOLUTION 1024.0 //Steps
@@ -19,9 +31,37 @@
 #define OVERSAMPLING_LEN 32
 #define SAMPLING_RATE 10
 #define OVERSAMPLING_RATE 500
+#define LOOP_RATE_WINDOW 1000000 //us
+#define TREND_TIME_CONSTANT 60000 //ms
+#define TRIP_MAX_TEMP 1000.0 //K
+#define HEATER_MODEL_TEMP_MAX 1100.0 //K, end of the heater lookup tables
+#define TRIP_MAX_CURRENT 0.7 //A, close to the I_h channel full scale
+#define TRIP_OPEN_VOLTAGE 0.5 //V
+#define TRIP_OPEN_CURRENT 0.002 //A
+#define TRIP_SHORT_RESISTANCE 1.0 //Ohms
+#define TRIP_SHORT_CURRENT 0.05 //A
+#define BASELINE_SAVE_CYCLES 60 //About an hour with full-length cycles
+#define BASELINE_ALPHA 0.01
+#define BASELINE_CLIP 0.05 //ln(R), 5%
+#define EVENT_HOLDOFF 1000 //ms
+#define EVENT_LEVEL_ON 0.2 //ln(R / R_baseline), about 20%
+#define EVENT_LEVEL_OFF 0.1
+#define EVENT_RATE_ON 0.1 //per telemetry point
+#define EVENT_RATE_OFF 0.02
+#define EVENT_CUSUM_DRIFT 0.02
+#define EVENT_CUSUM_ON 0.5
+#define EVENT_CUSUM_OFF 0.1
+#define PARAMS_SCHEMA_VERSION 1
+#define SAVE_COALESCE_MS 500 //Save requests closer than this are merged into one write
+#define SAVE_TASK_STACK 3072
 
 static const char TAG[] = "NVS";
 
+struct my_rt_point_t
+{
+    float res; // Ohm
+    float temp; // K
+};
 struct my_param_storage
 {
     my_adc_cal_t adc_cals[MY_ADC_CHANNEL_NUM];
@@ -31,11 +71,72 @@ struct my_param_storage
     float ref_res;
     float rt_res;
     my_pid_params_t pid_params;
+    heater_limits_t trip_limits; // Fields before this one form the schema 0 blob
+    feature_config_t features;
+    average_config_t averaging;
+    baseline_config_t baseline_config;
+    my_baseline_t baseline; // Learned by the control task, see update_baseline()
+    event_config_t events;
+    filter_config_t filters;
+    heater_model_t heater_model;
+    my_rt_point_t rt_point; // Measured (R, T), rt_res is derived from it under the current model, see publish()
+};
+//Edited by the parser and the debug menu, the control loops only see published snapshots (one reader each)
+static triple_buffer<my_control_params_t> snapshots[MY_SENSOR_NUM];
+static SemaphoreHandle_t publish_mutex = NULL; //Serializes the writers, the readers never take it
+//The setters run in the parser and the console: an edit lands in storage as a whole, never half-way into a snapshot
+struct storage_lock
+{
+    storage_lock() { xSemaphoreTake(publish_mutex, portMAX_DELAY); }
+    ~storage_lock() { xSemaphoreGive(publish_mutex); }
 };
-static const char storage_nvs_id[] = "storage";
-static const char storage_nvs_namespace[] = "my";
-my_param_storage storage = 
+static const char storage_nvs_namespace[] = "my"; //Sensor 0, the others get "my1", "my2", ...
+
+/***
+ * NVS layout: one namespace per sensor, one blob per record, my_record_header_t followed by the record bytes.
+ * Records are written only when they differ from what has been saved last.
+ */
+struct my_record_header_t
+{
+    uint16_t version; // PARAMS_SCHEMA_VERSION at the time of writing
+    uint16_t size; // bytes following
+};
+struct my_record_t
 {
+    const char* key;
+    size_t offset; // in my_param_storage
+    size_t size;
+};
+static const my_record_t records[] = {
+    { "adc_cals", offsetof(my_param_storage, adc_cals), sizeof(my_param_storage::adc_cals) },
+    { "dac_cal", offsetof(my_param_storage, dac_cal), sizeof(my_param_storage::dac_cal) },
+    { "timings", offsetof(my_param_storage, timings), sizeof(my_param_storage::timings) },
+    { "resistance", offsetof(my_param_storage, heater_coef), 
+        offsetof(my_param_storage, pid_params) - offsetof(my_param_storage, heater_coef) }, // heater_coef, ref_res, rt_res
+    { "pid", offsetof(my_param_storage, pid_params), sizeof(my_param_storage::pid_params) },
+    { "trip", offsetof(my_param_storage, trip_limits), sizeof(my_param_storage::trip_limits) },
+    { "features", offsetof(my_param_storage, features), sizeof(my_param_storage::features) },
+    { "averaging", offsetof(my_param_storage, averaging), sizeof(my_param_storage::averaging) },
+    { "baseline_cfg", offsetof(my_param_storage, baseline_config), sizeof(my_param_storage::baseline_config) },
+    { "baseline", offsetof(my_param_storage, baseline), sizeof(my_param_storage::baseline) },
+    { "events", offsetof(my_param_storage, events), sizeof(my_param_storage::events) },
+    { "filters", offsetof(my_param_storage, filters), sizeof(my_param_storage::filters) },
+    { "heater_model", offsetof(my_param_storage, heater_model), sizeof(my_param_storage::heater_model) },
+    { "rt_point", offsetof(my_param_storage, rt_point), sizeof(my_param_storage::rt_point) }
+};
+static const char legacy_nvs_id[] = "storage"; // Schema 0: the whole struct as one blob
+static my_param_storage saved[MY_SENSOR_NUM]; // As last written to NVS
+static my_param_storage requested[MY_SENSOR_NUM]; // Captured by save()
+static TaskHandle_t save_task_handle = NULL;
+//Flash stall statistics: raised by the control loop, read and reset by the save task
+static std::atomic<bool> saving{false};
+static std::atomic<uint32_t> max_period_saving{0}; // us
+static std::atomic<uint32_t> max_period_idle{0};
+static std::atomic<float> loop_rate{0}; // Hz, last complete window
+
+//Sensors other than 0 start from a copy of sensor 0's defaults, see init()
+my_param_storage storage[MY_SENSOR_NUM] = 
+{{
     .adc_cals = {
         {I_H_MULT, CURRENT_OFFSET},
         {V_H_MON_MULT, V_H_OFFSET},
@@ -55,8 +156,64 @@ my_param_storage storage =
         .setpoint_tolerance = 1,
         .timing_factor = 1.0f / OVERSAMPLING_RATE,
         .ambient_temp = my_params::rt_temp + 25
-    }
-};
+    },
+    .trip_limits = {
+        .max_temp = TRIP_MAX_TEMP,
+        .max_current = TRIP_MAX_CURRENT,
+        .open_voltage = TRIP_OPEN_VOLTAGE,
+        .open_current = TRIP_OPEN_CURRENT,
+        .short_resistance = TRIP_SHORT_RESISTANCE,
+        .short_current = TRIP_SHORT_CURRENT
+    },
+    .features = {
+        .mode = features_off,
+        .segment_count = 1,
+        .probe_count = 0,
+        .reserved = 0,
+        .segment_starts = {},
+        .probe_temps = {}
+    },
+    .averaging = {
+        .cycles = 0,
+        .reserved = 0,
+        .forgetting = 0
+    },
+    .baseline_config = {
+        .mode = baseline_off,
+        .reserved = 0,
+        .save_cycles = BASELINE_SAVE_CYCLES,
+        .alpha = BASELINE_ALPHA,
+        .clip = BASELINE_CLIP
+    },
+    .baseline = {}, //Not learned, see init()
+    .events = {
+        .detectors = 0,
+        .reserved = 0,
+        .holdoff_ms = EVENT_HOLDOFF,
+        .level_on = EVENT_LEVEL_ON,
+        .level_off = EVENT_LEVEL_OFF,
+        .rate_on = EVENT_RATE_ON,
+        .rate_off = EVENT_RATE_OFF,
+        .cusum_drift = EVENT_CUSUM_DRIFT,
+        .cusum_on = EVENT_CUSUM_ON,
+        .cusum_off = EVENT_CUSUM_OFF
+    },
+    .filters = {
+        .telemetry_len = 0, //One telemetry period
+        .reserved = 0,
+        .trend_ms = TREND_TIME_CONSTANT
+    },
+    .heater_model = {
+        .kind = heater_linear,
+        .points = 0,
+        .reserved = 0,
+        .beta = 0,
+        .temp_max = HEATER_MODEL_TEMP_MAX,
+        .temp = {},
+        .ratio = {}
+    },
+    .rt_point = { NAN, NAN } //None: rt_res is used as it is (defaults, or saved by older firmware)
+}};
 
 namespace my_params
 {
@@ -66,82 +223,391 @@ namespace my_params
 
     bool enable_pid_dbg = false;
 
-    float get_ref_resistance()
+    float get_ref_resistance(size_t sensor)
+    {
+        return storage[sensor].ref_res;
+    }
+    void set_ref_resistance(size_t sensor, float val)
     {
-        return storage.ref_res;
+        storage_lock lock;
+        storage[sensor].ref_res = val;
     }
-    void set_ref_resistance(float val)
+    float get_heater_coef(size_t sensor)
     {
-        storage.ref_res = val;
+        return storage[sensor].heater_coef;
     }
-    float get_heater_coef()
+    void set_heater_coef(size_t sensor, float val)
     {
-        return storage.heater_coef;
+        storage_lock lock;
+        storage[sensor].heater_coef = val;
     }
-    void set_heater_coef(float val)
+    float get_rt_resistance(size_t sensor)
     {
-        storage.heater_coef = val;
+        return storage[sensor].rt_res;
     }
-    float get_rt_resistance()
+    void set_rt_resistance(size_t sensor, float val, float temp)
     {
-        return storage.rt_res;
+        storage_lock lock;
+        storage[sensor].rt_point = { val, temp };
     }
-    void set_rt_resistance(float val, float temp)
+    const heater_model_t* get_heater_model(size_t sensor)
     {
-        storage.rt_res = val / (1 + get_heater_coef() * (temp - rt_temp));
+        return &(storage[sensor].heater_model);
     }
-    const my_adc_cal_t* get_adc_channel_cal(size_t index)
+    void set_heater_model(size_t sensor, heater_model_t* m)
     {
-        return &(storage.adc_cals[index]);
+        storage_lock lock;
+        storage[sensor].heater_model = *m;
     }
-    void set_adc_channel_cal(size_t index, my_adc_cal_t* c)
+    bool validate_heater_params(float tempco, float res, float temp)
     {
-        storage.adc_cals[index] = *c;
+        return isfinite(tempco) && tempco > 0 && isfinite(res) && res > 0 && isfinite(temp);
     }
-    const my_dac_cal_t* get_dac_cal()
+    bool validate_heater_model(size_t sensor, const heater_model_t* m)
     {
-        return &(storage.dac_cal);
+        return heater_model::validate(m, rt_temp) && heater_model::monotonic(m, get_heater_coef(sensor), rt_temp);
     }
-    void set_dac_cal(my_dac_cal_t* c)
+    const my_adc_cal_t* get_adc_channel_cal(size_t sensor, size_t index)
     {
-        storage.dac_cal = *c;
+        return &(storage[sensor].adc_cals[index]);
+    }
+    void set_adc_channel_cal(size_t sensor, size_t index, my_adc_cal_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].adc_cals[index] = *c;
+    }
+    const my_dac_cal_t* get_dac_cal(size_t sensor)
+    {
+        return &(storage[sensor].dac_cal);
+    }
+    void set_dac_cal(size_t sensor, my_dac_cal_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].dac_cal = *c;
     }
     const my_timings_t* get_timings()
     {
-        return &(storage.timings);
+        return &(storage[0].timings);
+    }
+    const filter_config_t* get_filter_config(size_t sensor)
+    {
+        return &(storage[sensor].filters);
+    }
+    void set_filter_config(size_t sensor, filter_config_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].filters = *c;
+    }
+    bool validate_filter_config(const filter_config_t* c)
+    {
+        return c->telemetry_len <= ADC_AVERAGE_MAX;
+    }
+    const my_timings_t* get_timings(size_t sensor)
+    {
+        return &(storage[sensor].timings);
+    }
+    bool validate_timings(const my_timings_t* t)
+    {
+        return t->averaging_len >= 1 && t->averaging_len <= ADC_AVERAGE_MAX && t->oversampling_rate >= 1 &&
+            t->oversampling_rate <= configTICK_RATE_HZ && t->sampling_rate >= 1 && t->sampling_rate <= t->oversampling_rate;
+    }
+    bool set_timings(size_t sensor, my_timings_t* t)
+    {
+        storage_lock lock;
+        if (!validate_timings(t)) return false;
+        storage[sensor].timings = *t;
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++) storage[i].timings.oversampling_rate = t->oversampling_rate;
+        return true;
+    }
+    const my_pid_params_t* get_pid_params(size_t sensor)
+    {
+        return &(storage[sensor].pid_params);
+    }
+    void set_pid_params(size_t sensor, my_pid_params_t* p)
+    {
+        storage_lock lock;
+        storage[sensor].pid_params = *p;
+    }
+    const heater_limits_t* get_trip_limits(size_t sensor)
+    {
+        return &(storage[sensor].trip_limits);
+    }
+    void set_trip_limits(size_t sensor, heater_limits_t* l)
+    {
+        storage_lock lock;
+        storage[sensor].trip_limits = *l;
+    }
+    const feature_config_t* get_feature_config(size_t sensor)
+    {
+        return &(storage[sensor].features);
+    }
+    void set_feature_config(size_t sensor, feature_config_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].features = *c;
+    }
+    const average_config_t* get_average_config(size_t sensor)
+    {
+        return &(storage[sensor].averaging);
+    }
+    void set_average_config(size_t sensor, average_config_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].averaging = *c;
+    }
+    const baseline_config_t* get_baseline_config(size_t sensor)
+    {
+        return &(storage[sensor].baseline_config);
+    }
+    void set_baseline_config(size_t sensor, baseline_config_t* c)
+    {
+        storage_lock lock;
+        storage[sensor].baseline_config = *c;
     }
-    const my_pid_params_t* get_pid_params()
+    const event_config_t* get_event_config(size_t sensor)
     {
-        return &(storage.pid_params);
+        return &(storage[sensor].events);
     }
-    void set_pid_params(my_pid_params_t* p)
+    void set_event_config(size_t sensor, event_config_t* c)
     {
-        storage.pid_params = *p;
+        storage_lock lock;
+        storage[sensor].events = *c;
     }
-    esp_err_t open_helper(nvs_handle_t* handle, nvs_open_mode_t mode)
+    const my_baseline_t* get_baseline(size_t sensor)
     {
-        esp_err_t err = nvs_open("my", mode, handle);
+        return &(storage[sensor].baseline);
+    }
+    bool update_baseline(size_t sensor, const my_baseline_t* b, bool save)
+    {
+        if (xSemaphoreTake(publish_mutex, 0) != pdTRUE) return false;
+        storage[sensor].baseline = *b;
+        if (save) requested[sensor].baseline = *b; //Nothing else of the pending edits gets saved
+        xSemaphoreGive(publish_mutex);
+        if (save) xTaskNotifyGive(save_task_handle);
+        return true;
+    }
+    void read_baseline(size_t sensor, my_baseline_t* out)
+    {
+        xSemaphoreTake(publish_mutex, portMAX_DELAY);
+        *out = storage[sensor].baseline;
+        xSemaphoreGive(publish_mutex);
+    }
+    void publish()
+    {
+        xSemaphoreTake(publish_mutex, portMAX_DELAY);
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+        {
+            my_param_storage* st = &storage[i];
+            if (isfinite(st->rt_point.res))
+            {
+                float r0 = heater_model::base_resistance(&st->heater_model, st->heater_coef, rt_temp, st->rt_point.res, st->rt_point.temp);
+                if (isfinite(r0)) st->rt_res = r0;
+            }
+            my_control_params_t* p = snapshots[i].back();
+            memcpy(p->adc_cals, st->adc_cals, sizeof(p->adc_cals));
+            p->dac_cal = st->dac_cal;
+            p->pid_params = st->pid_params;
+            p->heater_coef = st->heater_coef;
+            p->ref_res = st->ref_res;
+            p->rt_res = st->rt_res;
+            p->heater_model = st->heater_model;
+            heater_model::prepare(&p->heater, &st->heater_model, st->heater_coef, st->rt_res, rt_temp);
+            heater_guard::prepare(&p->guard_limits, &st->trip_limits, p->heater.resistance(st->trip_limits.max_temp));
+            p->features = st->features;
+            p->averaging = st->averaging;
+            p->baseline = st->baseline_config;
+            p->events = st->events;
+            p->timings = st->timings;
+            p->filters = st->filters;
+            snapshots[i].publish();
+        }
+        xSemaphoreGive(publish_mutex);
+    }
+    const my_control_params_t* acquire(size_t sensor, bool* changed)
+    {
+        return snapshots[sensor].read(changed);
+    }
+    esp_err_t open_helper(size_t sensor, nvs_handle_t* handle, nvs_open_mode_t mode)
+    {
+        char name[NVS_KEY_NAME_MAX_SIZE];
+        if (sensor == 0) snprintf(name, sizeof(name), "%s", storage_nvs_namespace);
+        else snprintf(name, sizeof(name), "%s%u", storage_nvs_namespace, sensor);
+        esp_err_t err = nvs_open(name, mode, handle);
         if (err == ESP_ERR_NVS_NOT_FOUND)
         {
-            ESP_LOGW(TAG, "NVS namespace doesn't exist and will be created (first run?)");
-            err = nvs_open(storage_nvs_namespace, NVS_READWRITE, handle); // retry with write permissions
+            ESP_LOGW(TAG, "NVS namespace %s doesn't exist and will be created (first run?)", name);
+            err = nvs_open(name, NVS_READWRITE, handle); // retry with write permissions
         }
         if (err != ESP_OK)
         {
             ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
         }
-        else
+        return err;
+    }
+
+    //Returns true if the record has been loaded (directly or migrated)
+    bool migrate_record(my_param_storage* dst, const my_record_t* rec, uint16_t version, const uint8_t* data, size_t size)
+    {
+        //Add a case here whenever a record changes other than by appending fields (and bump PARAMS_SCHEMA_VERSION)
+        switch (version)
+        {
+        case PARAMS_SCHEMA_VERSION - 1:
+            //Fields are appended at the end of a record: the previous schema's record is a prefix of the current one,
+            //the appended fields keep their defaults
+            if (size > rec->size) break;
+            memcpy(reinterpret_cast<uint8_t*>(dst) + rec->offset, data, size);
+            ESP_LOGI(TAG, "Record %s migrated from schema %u, %u of %u bytes", rec->key, version, size, rec->size);
+            return true;
+        default:
+            break;
+        }
+        ESP_LOGW(TAG, "Record %s: no migration from schema %u (%u bytes), defaults used", rec->key, version, size);
+        return false;
+    }
+    //Returns true if the record has been loaded, sets `migrated` if it needs to be written in the current schema
+    bool load_record(nvs_handle_t handle, my_param_storage* dst, const my_record_t* rec, bool* migrated)
+    {
+        static uint8_t buf[sizeof(my_record_header_t) + sizeof(my_param_storage)];
+        size_t len = sizeof(buf);
+        esp_err_t err = nvs_get_blob(handle, rec->key, buf, &len);
+        if (err != ESP_OK)
         {
-            ESP_LOGI(TAG, "NVS handle opening SUCCESS.");
+            if (err != ESP_ERR_NVS_NOT_FOUND) ESP_LOGE(TAG, "Record %s: %s", rec->key, esp_err_to_name(err));
+            return false;
         }
-        return err;
+        my_record_header_t header;
+        memcpy(&header, buf, sizeof(header));
+        if (len < sizeof(header) || header.size != len - sizeof(header))
+        {
+            ESP_LOGE(TAG, "Record %s is malformed", rec->key);
+            return false;
+        }
+        const uint8_t* data = buf + sizeof(header);
+        if (header.version == PARAMS_SCHEMA_VERSION && header.size == rec->size)
+        {
+            memcpy(reinterpret_cast<uint8_t*>(dst) + rec->offset, data, rec->size);
+            return true;
+        }
+        if (header.version > PARAMS_SCHEMA_VERSION)
+        {
+            ESP_LOGW(TAG, "Record %s has a newer schema (%u), defaults used", rec->key, header.version);
+            return false;
+        }
+        *migrated = true; //Rewritten either way: migrated, or with its defaults
+        return migrate_record(dst, rec, header.version, data, header.size);
     }
-    esp_err_t save_helper(nvs_handle_t handle, my_param_storage* val)
+    //Schema 0 (sensor 0 only): one blob of the struct up to trip_limits. Only accepted if the size matches exactly.
+    bool load_legacy(nvs_handle_t handle, my_param_storage* dst)
     {
-        return nvs_set_blob(handle, storage_nvs_id, val, sizeof(my_param_storage));
+        my_param_storage tmp = *dst;
+        size_t len = 0;
+        if (nvs_get_blob(handle, legacy_nvs_id, NULL, &len) != ESP_OK) return false;
+        if (len != offsetof(my_param_storage, trip_limits) || nvs_get_blob(handle, legacy_nvs_id, &tmp, &len) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Legacy parameter blob has an unexpected size (%u), ignored", len);
+            return false;
+        }
+        *dst = tmp;
+        ESP_LOGI(TAG, "Legacy parameter blob migrated");
+        return true;
+    }
+    //Writes the records of `now` that differ from `before` (all if NULL). Each record is committed
+    //separately, so every flash stall stays short.
+    esp_err_t write_records(nvs_handle_t handle, const my_param_storage* now, const my_param_storage* before, size_t* written)
+    {
+        static uint8_t buf[sizeof(my_record_header_t) + sizeof(my_param_storage)];
+        *written = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(records); i++)
+        {
+            const my_record_t* rec = &records[i];
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(now) + rec->offset;
+            if (before && memcmp(data, reinterpret_cast<const uint8_t*>(before) + rec->offset, rec->size) == 0) continue;
+            my_record_header_t header = { PARAMS_SCHEMA_VERSION, static_cast<uint16_t>(rec->size) };
+            memcpy(buf, &header, sizeof(header));
+            memcpy(buf + sizeof(header), data, rec->size);
+            esp_err_t err = nvs_set_blob(handle, rec->key, buf, sizeof(header) + rec->size);
+            if (err == ESP_OK) err = nvs_commit(handle);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Can't write record %s: %s", rec->key, esp_err_to_name(err));
+                return err;
+            }
+            (*written)++;
+            if (before) vTaskDelay(1); //Let the control loop run between flash operations
+        }
+        return ESP_OK;
+    }
+    void save_task(void* arg)
+    {
+        static my_param_storage now[MY_SENSOR_NUM];
+        while (1)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SAVE_COALESCE_MS)) > 0); //Merge request bursts
+            xSemaphoreTake(publish_mutex, portMAX_DELAY);
+            memcpy(now, requested, sizeof(now));
+            xSemaphoreGive(publish_mutex);
+
+            size_t written = 0;
+            max_period_saving.store(0, std::memory_order_relaxed);
+            saving.store(true, std::memory_order_relaxed);
+            int64_t start = esp_timer_get_time();
+            for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+            {
+                if (memcmp(&now[i], &saved[i], sizeof(now[i])) == 0) continue;
+                nvs_handle_t handle;
+                size_t n = 0;
+                esp_err_t err = open_helper(i, &handle, NVS_READWRITE);
+                if (err == ESP_OK)
+                {
+                    err = write_records(handle, &now[i], &saved[i], &n);
+                    nvs_close(handle);
+                }
+                written += n;
+                if (err == ESP_OK)
+                {
+                    saved[i] = now[i];
+                }
+                else
+                {
+                    my_uart::raise_error(my_error_codes::nvs_error);
+                }
+            }
+            saving.store(false, std::memory_order_relaxed);
+            ESP_LOGI(TAG, "Saved %u records in %lld ms, max loop period %u us during the save, %u us otherwise",
+                written, (esp_timer_get_time() - start) / 1000, max_period_saving.load(std::memory_order_relaxed),
+                max_period_idle.exchange(0, std::memory_order_relaxed));
+        }
+    }
+    //A reset by the save task is never overwritten with a stale maximum
+    void raise_max(std::atomic<uint32_t>& max, uint32_t us)
+    {
+        uint32_t m = max.load(std::memory_order_relaxed);
+        while (us > m && !max.compare_exchange_weak(m, us, std::memory_order_relaxed));
+    }
+    void note_loop_period(uint32_t us)
+    {
+        static uint32_t rate_window_us = 0; //Control loop only
+        static uint32_t rate_window_ticks = 0;
+        raise_max(saving.load(std::memory_order_relaxed) ? max_period_saving : max_period_idle, us);
+        rate_window_us += us;
+        rate_window_ticks++;
+        if (rate_window_us >= LOOP_RATE_WINDOW)
+        {
+            loop_rate.store(rate_window_ticks * 1e6f / rate_window_us, std::memory_order_relaxed);
+            rate_window_us = 0;
+            rate_window_ticks = 0;
+        }
+    }
+    float get_loop_rate()
+    {
+        return loop_rate.load(std::memory_order_relaxed);
     }
     esp_err_t init()
     {
+        publish_mutex = xSemaphoreCreateMutex();
+        assert(publish_mutex);
+        publish(); // Defaults, in case NVS can't be read
         // Initialize NVS
         ESP_LOGI(TAG, "NVS Init...");
         esp_err_t err = nvs_flash_init();
@@ -153,46 +619,81 @@ namespace my_params
         }
         ESP_ERROR_CHECK(err);
 
-        // Open
-        nvs_handle_t handle;
-        err = open_helper(&handle, NVS_READONLY);
-        if (err != ESP_OK) return err;
-        // Read the size of memory space required for blob
-        my_param_storage tmp;
-        size_t required_size = sizeof(tmp); // value will default to sizeof(tmp), if not set yet in NVS
-        err = nvs_get_blob(handle, storage_nvs_id, &tmp, &required_size);
-        if (err == ESP_ERR_NVS_NOT_FOUND) 
-        {
-            save_helper(handle, &storage); //If not found, write defaults
-            ESP_LOGW(TAG, "NVS reset to defaults.");
-            return ESP_OK; 
-        }
-        else if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Error reading NVS: %s", esp_err_to_name(err));
-            return err;
-        }
-        storage = tmp;
-
-        nvs_close(handle);
-        return ESP_OK;
+        for (size_t i = 0; i < CYCLE_LENGTH; i++) storage[0].baseline.log_res[i] = NAN;
+        for (size_t s = 1; s < MY_SENSOR_NUM; s++) storage[s] = storage[0];
+        for (size_t s = 0; s < MY_SENSOR_NUM; s++)
+        {
+            nvs_handle_t handle;
+            esp_err_t e = open_helper(s, &handle, NVS_READWRITE);
+            if (e == ESP_OK)
+            {
+                bool legacy = (s == 0) && load_legacy(handle, &storage[s]);
+                bool complete = true, migrated = false;
+                for (size_t i = 0; i < ARRAY_SIZE(records); i++)
+                {
+                    complete = load_record(handle, &storage[s], &records[i], &migrated) && complete;
+                }
+                if (legacy || migrated || !complete)
+                {
+                    //Nothing runs yet, write synchronously. Missing records are stored with their defaults.
+                    size_t written;
+                    e = write_records(handle, &storage[s], NULL, &written);
+                    if (e == ESP_OK && legacy)
+                    {
+                        nvs_erase_key(handle, legacy_nvs_id);
+                        e = nvs_commit(handle);
+                    }
+                    ESP_LOGW(TAG, "Sensor %u: NVS records rewritten (schema %u)", s, PARAMS_SCHEMA_VERSION);
+                }
+                nvs_close(handle);
+            }
+            if (e != ESP_OK) err = e;
+        }
+        for (size_t s = 0; s < MY_SENSOR_NUM; s++)
+        {
+            //Older firmware didn't check them
+            if (!validate_timings(&storage[s].timings)) storage[s].timings = { OVERSAMPLING_LEN, SAMPLING_RATE, OVERSAMPLING_RATE };
+            storage[s].timings.oversampling_rate = storage[0].timings.oversampling_rate;
+            if (!validate_filter_config(&storage[s].filters)) storage[s].filters = { 0, 0, TREND_TIME_CONSTANT };
+            if (!heater_model::validate(&storage[s].heater_model, rt_temp)) storage[s].heater_model = { heater_linear, 0, 0, 0, HEATER_MODEL_TEMP_MAX, {}, {} };
+        }
+        publish();
+        memcpy(saved, storage, sizeof(saved));
+        memcpy(requested, storage, sizeof(requested));
+        xTaskCreatePinnedToCore(save_task, "nvs_save", SAVE_TASK_STACK, NULL, 1, &save_task_handle, 1);
+        assert(save_task_handle);
+        return err;
     }
     esp_err_t save()
     {
-        nvs_handle_t handle;
-        esp_err_t err = open_helper(&handle, NVS_READWRITE);
-        if (err != ESP_OK) return err;
-        return save_helper(handle, &storage);
+        //Captured in the caller's (writer's) context, so the copy is consistent
+        xSemaphoreTake(publish_mutex, portMAX_DELAY);
+        memcpy(requested, storage, sizeof(requested));
+        xSemaphoreGive(publish_mutex);
+        xTaskNotifyGive(save_task_handle);
+        return ESP_OK;
     }
-    uint8_t* get_nvs_dump(size_t* len)
+    uint8_t* get_nvs_dump(size_t sensor, size_t* len)
     {
-        *len = sizeof(storage);
-        return reinterpret_cast<uint8_t*>(&storage);
+        *len = sizeof(storage[sensor]);
+        return reinterpret_cast<uint8_t*>(&storage[sensor]);
     }
     esp_err_t factory_reset()
     {
-        nvs_handle_t handle;
-        auto err = open_helper(&handle, NVS_READWRITE);
-        if (err != ESP_OK) return err;
-        return nvs_erase_key(handle, storage_nvs_id);
+        for (size_t s = 0; s < MY_SENSOR_NUM; s++)
+        {
+            nvs_handle_t handle;
+            auto err = open_helper(s, &handle, NVS_READWRITE);
+            if (err != ESP_OK) return err;
+            if (s == 0) nvs_erase_key(handle, legacy_nvs_id);
+            for (size_t i = 0; i < ARRAY_SIZE(records); i++)
+            {
+                nvs_erase_key(handle, records[i].key);
+            }
+            err = nvs_commit(handle);
+            nvs_close(handle);
+            if (err != ESP_OK) return err;
+        }
+        return ESP_OK;
     }
 }
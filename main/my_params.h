@@ -3,15 +3,37 @@
 #include "my_adc_channel.h"
 #include "my_dac.h"
 #include "my_pid.h"
+#include "heater_guard.h"
+#include "heater_model.h"
+#include "cycle_features.h"
+#include "cycle_average.h"
+#include "baseline_tracker.h"
+#include "event_detector.h"
+#include "filter_bank.h"
+#include "my_protocol.h"
 #include <inttypes.h>
 
-struct my_timings_t
+struct my_control_params_t // Consistent parameter set of one sensor for the control loop, see my_params::acquire()
 {
-    size_t averaging_len;
-    uint sampling_rate;
-    uint oversampling_rate;
+    my_adc_cal_t adc_cals[MY_ADC_CHANNEL_NUM];
+    my_dac_cal_t dac_cal;
+    my_pid_params_t pid_params;
+    float heater_coef;
+    float ref_res;
+    float rt_res;
+    heater_model_t heater_model;
+    heater_lut_t heater; // Derived from the heater model, so that the loop only interpolates
+    heater_guard_limits_t guard_limits;
+    feature_config_t features;
+    average_config_t averaging;
+    baseline_config_t baseline;
+    event_config_t events;
+    my_timings_t timings; // Applied at the sensor's next cycle start, see my_sensor::control()
+    filter_config_t filters; // Likewise
 };
 
+typedef baseline_state_t<CYCLE_LENGTH> my_baseline_t;
+
 namespace my_params
 {
     extern const my_dac_cal_t default_dac_cal;
@@ -20,21 +42,50 @@ namespace my_params
     
     extern bool enable_pid_dbg;
 
-    float get_ref_resistance(); // For measurement
-    void set_ref_resistance(float val);
-    float get_heater_coef();
-    float get_rt_resistance(); // For the heater, calculated at 273K
-    void set_rt_resistance(float val, float temp); // Call aftet heater_coef (tempco) has been set!
-    void set_heater_coef(float val);
-    const my_adc_cal_t* get_adc_channel_cal(size_t index);
-    void set_adc_channel_cal(size_t index, my_adc_cal_t* c);
-    const my_dac_cal_t* get_dac_cal();
-    void set_dac_cal(my_dac_cal_t* c);
-    const my_timings_t* get_timings();
-    const my_pid_params_t* get_pid_params();
-    void set_pid_params(my_pid_params_t* p);
+    //Per sensor, `sensor` < MY_SENSOR_NUM
+    float get_ref_resistance(size_t sensor); // For measurement
+    void set_ref_resistance(size_t sensor, float val);
+    float get_heater_coef(size_t sensor);
+    float get_rt_resistance(size_t sensor); // For the heater, calculated at 273K as of the last publish()
+    void set_rt_resistance(size_t sensor, float val, float temp); // Measured at temp, R0 follows the tempco and model at publish()
+    void set_heater_coef(size_t sensor, float val);
+    const heater_model_t* get_heater_model(size_t sensor);
+    void set_heater_model(size_t sensor, heater_model_t* m); // Validate first, see validate_heater_model()
+    bool validate_heater_params(float tempco, float res, float temp); // tempco > 0, res > 0
+    bool validate_heater_model(size_t sensor, const heater_model_t* m); // Against the sensor's current tempco
+    const my_adc_cal_t* get_adc_channel_cal(size_t sensor, size_t index);
+    void set_adc_channel_cal(size_t sensor, size_t index, my_adc_cal_t* c);
+    const my_dac_cal_t* get_dac_cal(size_t sensor);
+    void set_dac_cal(size_t sensor, my_dac_cal_t* c);
+    const my_pid_params_t* get_pid_params(size_t sensor);
+    void set_pid_params(size_t sensor, my_pid_params_t* p);
+    const heater_limits_t* get_trip_limits(size_t sensor);
+    void set_trip_limits(size_t sensor, heater_limits_t* l);
+    const feature_config_t* get_feature_config(size_t sensor);
+    void set_feature_config(size_t sensor, feature_config_t* c); // Validate first, see cycle_features::validate()
+    const average_config_t* get_average_config(size_t sensor);
+    void set_average_config(size_t sensor, average_config_t* c); // Validate first, see cycle_average::validate()
+    const baseline_config_t* get_baseline_config(size_t sensor);
+    void set_baseline_config(size_t sensor, baseline_config_t* c); // Validate first, see baseline_tracker::validate()
+    const event_config_t* get_event_config(size_t sensor);
+    void set_event_config(size_t sensor, event_config_t* c); // Validate first, see event_detector::validate()
+    const my_baseline_t* get_baseline(size_t sensor); // Saved baseline, for seeding the tracker before the control loops start
+    bool update_baseline(size_t sensor, const my_baseline_t* b, bool save); // Control task, never waits: false if busy
+    void read_baseline(size_t sensor, my_baseline_t* out); // Latest update_baseline() copy
+    const my_control_params_t* acquire(size_t sensor, bool* changed = NULL); // That sensor's control task only, valid until the next call
+    uint8_t* get_nvs_dump(size_t sensor, size_t* len);
+
+    const filter_config_t* get_filter_config(size_t sensor);
+    void set_filter_config(size_t sensor, filter_config_t* c); // Validate first, see validate_filter_config()
+    bool validate_filter_config(const filter_config_t* c);
+    const my_timings_t* get_timings(size_t sensor);
+    bool set_timings(size_t sensor, my_timings_t* t); // The oversampling rate goes to every sensor. false if invalid
+    bool validate_timings(const my_timings_t* t);
+    const my_timings_t* get_timings(); // Board-wide: sensor 0's, for the control loop rate
+    void publish(); // Call after a set of set_*() calls, makes them visible to the control loops at once
     esp_err_t init();
-    esp_err_t save();
-    uint8_t* get_nvs_dump(size_t* len);
+    esp_err_t save(); // Asynchronous: changed records are written by a background task, failures raise nvs_error
+    void note_loop_period(uint32_t us); // Control loop, for the flash stall statistics and the measured loop rate
+    float get_loop_rate(); // Hz, control ticks over the last second, 0 until measured
     esp_err_t factory_reset();
 }
\ No newline at end of file
@@ -8,12 +8,20 @@ my_pid::my_pid(const my_pid_params_t* p)
     params = p;
 }
 
+void my_pid::set_params(const my_pid_params_t* p)
+{
+    params = p;
+}
+
 float my_pid::next(float current_temp)
 {
     float e = last_setpoint - current_temp;
     integral_term += e * params->timing_factor;
     if (integral_term > params->limI) integral_term = params->limI;
-    float res = params->kPE * e + params->kPD * (current_temp - params->ambient_temp) + params->kI * integral_term;
+    terms.p = params->kPE * e;
+    terms.ff = params->kPD * (current_temp - params->ambient_temp);
+    terms.i = params->kI * integral_term;
+    float res = terms.p + terms.ff + terms.i;
     if (!isfinite(res))
     {
         res = 0;
@@ -33,7 +41,29 @@ void my_pid::set(float setpoint)
     last_setpoint = setpoint;
 }
 
+void my_pid::track(float setpoint)
+{
+    if (setpoint < last_setpoint - params->setpoint_tolerance) integral_term = 0;
+    last_setpoint = setpoint;
+}
+
 float my_pid::get_setpoint()
 {
     return last_setpoint;
+}
+
+const my_pid_terms_t* my_pid::get_terms()
+{
+    return &terms;
+}
+
+float my_pid::get_integral()
+{
+    return integral_term;
+}
+
+void my_pid::restore(float setpoint, float integral)
+{
+    last_setpoint = setpoint;
+    integral_term = integral;
 }
\ No newline at end of file
@@ -11,16 +11,29 @@ struct my_pid_params_t
     float ambient_temp; // for kPD
 };
 
+struct my_pid_terms_t
+{
+    float p; // kPE
+    float i; // kI
+    float ff; // kPD
+};
+
 class my_pid // Actually, a PI (yet)
 {
 private:
     const my_pid_params_t* params;
     float last_setpoint;
     float integral_term;
+    my_pid_terms_t terms;
 public:
     my_pid(const my_pid_params_t* p);
+    void set_params(const my_pid_params_t* p); // Switch to a new parameter set (snapshot), keeps the state
     //void init(const my_pid_params_t* p);
     float next(float current_temp); // Returns next power setting
     void set(float setpoint); // Temperature in Kelvin
+    void track(float setpoint); // Continuously varying setpoint: no dead band
     float get_setpoint();
+    const my_pid_terms_t* get_terms(); // Of the last next() call
+    float get_integral();
+    void restore(float setpoint, float integral); // State of a recorded session, see session_format.h
 };
\ No newline at end of file
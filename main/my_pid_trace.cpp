@@ -0,0 +1,82 @@
+#include "my_pid_trace.h"
+#include "my_uart.h"
+#include "my_protocol.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <atomic>
+
+#define PID_TRACE_QUEUE_LEN 256 //records, ~0.5 s at 500 Hz
+#define PID_TRACE_BATCH 64 //records per packet
+#define PID_TRACE_DEFAULT_PERIOD 100 //ms
+#define PID_TRACE_MIN_PERIOD 10 //ms
+
+static const char* TAG = "PID_TRACE";
+
+static QueueHandle_t queue;
+static TaskHandle_t flush_task_handle;
+static std::atomic<uint32_t> dropped(0);
+static std::atomic<uint32_t> period_ms(PID_TRACE_DEFAULT_PERIOD);
+
+static void flush_task(void* arg)
+{
+    static uint8_t packet[sizeof(pid_trace_header_t) + PID_TRACE_BATCH * sizeof(pid_trace_record_t)];
+    static uint32_t seq = 0;
+    static uint32_t tx_dropped = 0;
+    pid_trace_header_t* header = reinterpret_cast<pid_trace_header_t*>(packet);
+    pid_trace_record_t* records = reinterpret_cast<pid_trace_record_t*>(packet + sizeof(pid_trace_header_t));
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms.load()));
+        size_t n;
+        do
+        {
+            for (n = 0; n < PID_TRACE_BATCH; n++)
+            {
+                if (xQueueReceive(queue, &records[n], 0) != pdTRUE) break;
+            }
+            if (n == 0) break;
+            header->seq = seq++;
+            header->dropped = dropped.load();
+            header->tx_dropped = tx_dropped;
+            header->count = n;
+            header->record_size = sizeof(pid_trace_record_t);
+            if (!my_uart::send_frame(CMD_PID_TRACE, packet, sizeof(pid_trace_header_t) + n * sizeof(pid_trace_record_t)))
+            {
+                tx_dropped++;
+            }
+        } while (n == PID_TRACE_BATCH);
+    }
+}
+
+namespace my_pid_trace
+{
+    void init()
+    {
+        queue = xQueueCreate(PID_TRACE_QUEUE_LEN, sizeof(pid_trace_record_t));
+        assert(queue);
+        xTaskCreatePinnedToCore(flush_task, "pid_trace", 3072, NULL, 1, &flush_task_handle, 1);
+        assert(flush_task_handle);
+    }
+
+    void push(const pid_trace_record_t* r)
+    {
+        if (xQueueSend(queue, r, 0) != pdTRUE) dropped++;
+    }
+
+    void set_period(uint32_t ms)
+    {
+        if (ms < PID_TRACE_MIN_PERIOD) ms = PID_TRACE_MIN_PERIOD;
+        period_ms.store(ms);
+        ESP_LOGI(TAG, "Flush period: %u ms", ms);
+    }
+
+    uint32_t get_dropped()
+    {
+        return dropped.load();
+    }
+}
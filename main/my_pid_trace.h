@@ -0,0 +1,11 @@
+#pragma once
+
+#include "pid_trace_format.h"
+
+namespace my_pid_trace
+{
+    void init();
+    void push(const pid_trace_record_t* r); // Control loop, never blocks
+    void set_period(uint32_t ms);
+    uint32_t get_dropped();
+}
@@ -0,0 +1,104 @@
+#include "my_power.h"
+
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <atomic>
+
+#define MY_POWER_MIN_FREQ_MHZ 80 //Lowest with the APB (USB, UART, ADC, timers) still at 80 MHz
+
+static const char* TAG = "POWER";
+
+static esp_pm_lock_handle_t control_lock = NULL;
+static uint16_t freq_max = 0, freq_min = 0;
+static std::atomic<uint32_t> active_tasks(0);
+static std::atomic<bool> started(false); //The first activation is the control tasks starting, not a wake
+//Residency, in ms of the 64-bit timer truncated to 32 bits: only differences are used
+static std::atomic<uint32_t> state_since_ms(0);
+static std::atomic<uint32_t> active_ms(0);
+static std::atomic<uint32_t> idle_ms(0);
+static std::atomic<uint32_t> wakes(0);
+static std::atomic<uint32_t> wake_latency(0);
+static std::atomic<uint32_t> wake_latency_max(0);
+
+static uint32_t now_ms()
+{
+    return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+namespace my_power
+{
+    void init()
+    {
+        active_tasks.store(0);
+        started.store(false);
+#if CONFIG_PM_ENABLE
+        esp_pm_config_esp32s3_t config = {
+            .max_freq_mhz = CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ,
+            .min_freq_mhz = MY_POWER_MIN_FREQ_MHZ,
+            .light_sleep_enable = false
+        };
+        esp_err_t err = esp_pm_configure(&config);
+        if (err == ESP_OK) err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "control", &control_lock);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Frequency scaling unavailable: %s", esp_err_to_name(err));
+            control_lock = NULL;
+            return;
+        }
+        freq_max = CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ;
+        freq_min = MY_POWER_MIN_FREQ_MHZ;
+        ESP_LOGI(TAG, "CPU %u MHz while operating, %u MHz idle", freq_max, freq_min);
+#else
+        ESP_LOGI(TAG, "CONFIG_PM_ENABLE is off, the CPU stays at %u MHz", CONFIG_ESP32S3_DEFAULT_CPU_FREQ_MHZ);
+#endif
+    }
+
+    //The lock counts its holders, the residency only follows the first and the last of them
+    void set_active(bool active)
+    {
+        if (active)
+        {
+            if (control_lock != NULL) esp_pm_lock_acquire(control_lock);
+            if (active_tasks.fetch_add(1) != 0) return;
+            uint32_t now = now_ms();
+            uint32_t since = state_since_ms.exchange(now);
+            if (!started.exchange(true)) return; //Residency counts from here
+            idle_ms += now - since;
+            wakes++;
+        }
+        else
+        {
+            if (active_tasks.fetch_sub(1) == 1)
+            {
+                uint32_t now = now_ms();
+                active_ms += now - state_since_ms.exchange(now);
+            }
+            if (control_lock != NULL) esp_pm_lock_release(control_lock);
+        }
+    }
+
+    void note_wake(uint32_t request_us)
+    {
+        uint32_t latency = static_cast<uint32_t>(esp_timer_get_time()) - request_us;
+        wake_latency.store(latency);
+        if (latency > wake_latency_max.load()) wake_latency_max.store(latency);
+    }
+
+    void get_report(power_report_t* r)
+    {
+        bool active = active_tasks.load() != 0;
+        uint32_t current = started.load() ? now_ms() - state_since_ms.load() : 0;
+        r->state = active ? power_active : power_idle;
+        r->reserved = 0;
+        r->freq_max_mhz = freq_max;
+        r->freq_min_mhz = freq_min;
+        r->reserved2 = 0;
+        r->active_ms = active_ms.load() + (active ? current : 0);
+        r->idle_ms = idle_ms.load() + (active ? 0 : current);
+        r->wakes = wakes.load();
+        r->wake_latency_us = wake_latency.load();
+        r->wake_latency_max_us = wake_latency_max.load();
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "my_protocol.h"
+
+/***
+ * Dynamic frequency scaling: the CPU runs at the configured maximum while any control task holds the control lock
+ * and drops to MY_POWER_MIN_FREQ_MHZ otherwise. Light sleep stays off, it would power down the USB OTG
+ * peripheral and drop the host connection.
+ */
+namespace my_power
+{
+    void init(); // Before the control tasks start. Without CONFIG_PM_ENABLE the CPU stays at its default frequency
+    void set_active(bool active); // Control task, on its transitions between the control loop and the idle cadence
+    void note_wake(uint32_t request_us); // Control task, first conversions after my_sensors::wake() at request_us
+    void get_report(power_report_t* r);
+}
@@ -0,0 +1,85 @@
+#include "my_profile_store.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "rom/crc.h"
+
+#define PROFILE_PARTITION_SUBTYPE 0x40
+#define PROFILE_PARTITION_LABEL "profiles"
+
+static const char* TAG = "PROFILES";
+
+static const esp_partition_t* partition = NULL;
+static const void* mapped = NULL; // Whole partition, entries are played from here directly
+static spi_flash_mmap_handle_t mmap_handle;
+static size_t slot_count = 0;
+
+namespace my_profile_store
+{
+    esp_err_t init()
+    {
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            static_cast<esp_partition_subtype_t>(PROFILE_PARTITION_SUBTYPE), PROFILE_PARTITION_LABEL);
+        if (partition == NULL)
+        {
+            ESP_LOGE(TAG, "Profile partition not found");
+            return ESP_ERR_NOT_FOUND;
+        }
+        esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &mmap_handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Can't map profile partition: %s", esp_err_to_name(err));
+            partition = NULL;
+            return err;
+        }
+        slot_count = partition->size / PROFILE_STORE_SLOT_SIZE;
+        ESP_LOGI(TAG, "Profile store: %u slots", slot_count);
+        return ESP_OK;
+    }
+
+    size_t get_slot_count()
+    {
+        return slot_count;
+    }
+
+    const profile_store_header_t* get(size_t slot)
+    {
+        if (slot >= slot_count) return NULL;
+        const profile_store_header_t* h = profile_store::slot(mapped, slot);
+        return profile_store::valid(h, &crc32_le) ? h : NULL;
+    }
+
+    size_t list(profile_store_list_entry_t* entries, size_t max)
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < slot_count && n < max; i++)
+        {
+            const profile_store_header_t* h = get(i);
+            if (h == NULL) continue;
+            entries[n].slot = i;
+            entries[n].mode = h->mode;
+            entries[n].length = h->length;
+            memcpy(entries[n].name, h->name, sizeof(entries[n].name));
+            n++;
+        }
+        return n;
+    }
+
+    // The caller must make sure the slot isn't being played
+    esp_err_t save(size_t slot, const char* name, uint8_t mode, size_t length, float start, const void* data)
+    {
+        if (partition == NULL) return ESP_ERR_INVALID_STATE;
+        if (slot >= slot_count) return ESP_ERR_INVALID_ARG;
+        profile_store_header_t h;
+        if (!profile_store::make_header(&h, mode, length, start, name, data, &crc32_le)) return ESP_ERR_INVALID_SIZE;
+        size_t offset = slot * PROFILE_STORE_SLOT_SIZE;
+        esp_err_t err = esp_partition_erase_range(partition, offset, PROFILE_STORE_SLOT_SIZE);
+        if (err != ESP_OK) return err;
+        // Payload first, so that a power loss leaves an invalid header rather than a valid header over garbage
+        err = esp_partition_write(partition, offset + sizeof(h), data, h.payload_size);
+        if (err != ESP_OK) return err;
+        err = esp_partition_write(partition, offset, &h, sizeof(h));
+        ESP_LOGI(TAG, "Profile saved to slot %u: %s", slot, esp_err_to_name(err));
+        return err;
+    }
+}
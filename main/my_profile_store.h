@@ -0,0 +1,13 @@
+#pragma once
+
+#include "esp_err.h"
+#include "profile_store.h"
+
+namespace my_profile_store
+{
+    esp_err_t init();
+    size_t get_slot_count();
+    const profile_store_header_t* get(size_t slot); // NULL if empty or corrupted
+    size_t list(profile_store_list_entry_t* entries, size_t max);
+    esp_err_t save(size_t slot, const char* name, uint8_t mode, size_t length, float start, const void* data);
+}
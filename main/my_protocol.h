@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/***
+ * USB CDC protocol definitions, shared by the firmware and the host library (host/).
+ * Frame: preamble, cmd, args, wdt counter, CRC32, postamble. Every byte between preamble and postamble
+ * that equals one of the three markers is preceded by the escape byte.
+ * CRC: crc32_le over cmd, args and the wdt counter (see my_uart.cpp), sent little-endian.
+ */
+
+static const uint8_t preamble = 0x7E;
+static const uint8_t postamble = 0x81;
+static const uint8_t escape = 0x55;
+
+/***
+ * Limits
+ */
+#define CYCLE_LENGTH 600 //pts, max
+#define FLOATS_PER_POINT 3 //(temp, res, timestamp): the timestamp is a uint32_t, us of the monotonic timer at the conversion
+#define PROFILE_CHUNK_MAX 512 //bytes
+#define PROFILE_MAX_SEGMENTS 64
+
+/***
+ * Commands 
+ */
+#define RSP_OK 0x00
+#define RSP_BAD_CRC 0xFE
+#define NO_STD_RSP 0xFF
+
+//Sensor addressing: everything below applies to the selected sensor, except error/fault reports, the profile store list,
+//the PID trace and CMD_SAVE_NVS, which are board-wide
+#define CMD_SELECT_SENSOR 0x19 //Args: uint8_t index. Sticky, 0 after reset. RSP_SET_FAILED if the board has no such sensor
+
+#define CMD_STOP 0x01
+#define CMD_START 0x02
+#define RSP_ALREADY_IN_REQUESTED_STATE 0x01
+#define RSP_STATE_SWITCH_ERROR 0x02
+
+#define CMD_GET_DATA 0x03 //Oldest unsent cycle: uint32_t sequence number followed by (temp, res, timestamp) points
+#define CMD_GET_DATA_SEQ 0x0A //Args: uint32_t sequence number. Responds with a CMD_GET_DATA frame
+
+#define CMD_GET_ERROR 0x04
+//Responses are located in my_uart.h (enum-bitfield)
+#define CMD_GET_FAULTS 0x15 //Read and clear: fault_report_header, uint32_t counters[code_count], fault_event_t[event_count]
+
+//Heater protection
+#define CMD_SET_TRIP_LIMITS 0x16 //Args: heater_limits_t
+#define CMD_CLEAR_TRIP 0x17 //RSP_ALREADY_IN_REQUESTED_STATE if nothing was latched
+#define CMD_GET_TRIP 0x18 //Responds with uint8_t heater_trip (trip_none if not latched)
+
+//Per-cycle features, see cycle_features.h
+#define CMD_SET_FEATURES 0x1A //Args: feature_config_t. Applied at the next cycle start
+#define CMD_GET_FEATURES 0x1B //Oldest unsent report: feature_report_header, feature_segment_t[], float probes[2][]. RSP_NO_DATA if none
+
+//Coherent multi-cycle averaging, see cycle_average.h. While enabled, CMD_GET_DATA gets no cycles
+#define CMD_SET_AVERAGING 0x1C //Args: average_config_t. Applied at the next cycle start, restarts the average
+#define CMD_GET_AVERAGE 0x1D //Oldest unsent averaged cycle: average_report_header, (temp, res, res variance) points. RSP_NO_DATA if none
+
+//Drift baseline, see baseline_tracker.h. Saved to NVS by the device itself, every save_cycles cycles
+#define CMD_SET_BASELINE 0x1E //Args: baseline_config_t. Applied at the next cycle start, the learned baseline is kept
+#define CMD_GET_BASELINE 0x1F //Responds with baseline_state_t<CYCLE_LENGTH>, as of the last cycle end
+
+//Event detection on the baseline-normalized response, see event_detector.h. Needs the baseline enabled
+#define CMD_SET_EVENTS 0x21 //Args: event_config_t. Applied at the next cycle start
+#define CMD_EVENT 0xA4 //Unsolicited, event_frame_t, sent as soon as a detector changes state
+
+#define CMD_GET_RATES 0x22 //Responds with rates_t: the control and telemetry rates actually scheduled, see rate_scheduler.h
+//Args: my_timings_t (3 x uint32_t: averaging length, sampling rate, oversampling rate). Applied at the next cycle start.
+//The oversampling rate is board-wide and can only be changed while no sensor operates; scale the PID timing_factor with it
+#define CMD_SET_TIMINGS 0x23
+
+//Per-channel filter bank, see filter_bank.h: control, telemetry and trend outputs from the same conversions
+#define CMD_SET_FILTERS 0x24 //Args: filter_config_t. Applied at the next cycle start
+#define CMD_GET_TREND 0x25 //Responds with trend_report_t as of the last telemetry point, NaN while the trend is off
+
+//Heater R(T) model, see heater_model.h. Validated against the tempco in effect (before the batch, in a batch), so send
+//CMD_SET_HEATER_PARAMS first. A model that no longer rises with a later tempco falls back to linear.
+//R0 is derived from the measured (R, T) of CMD_SET_HEATER_PARAMS under whichever model is current, in either order
+#define CMD_SET_HEATER_MODEL 0x26 //Args: heater_model_t
+
+//CPU frequency scaling while no sensor operates, see my_power.h
+#define CMD_GET_POWER 0x27 //Responds with power_report_t
+
+#define CMD_GET_BOOT 0x28 //Responds with boot_report_t: start and end of each init phase, first conversions
+
+#define CMD_SET_HEATER_PARAMS 0x05 //Args: heater_params, tempco and resistance > 0
+#define CMD_SET_MEASURE_PARAMS 0x06 //Args: measure_params
+#define CMD_SET_TEMP_CYCLE 0x07 //Full CYCLE_LENGTH profile in one frame, applied at the next cycle boundary
+#define RSP_SET_FAILED 0x01
+
+//Chunked profile upload: BEGIN, any number of (re)sent CHUNKs, COMMIT. Chunk CRCs follow the frame CRC convention.
+#define CMD_PROFILE_BEGIN 0x0B //Args: uint16_t point count. Discards any unfinished upload
+#define CMD_PROFILE_CHUNK 0x0C //Args: profile_chunk_header, data
+#define CMD_PROFILE_STATUS 0x0D //Responds with profile_upload_status
+#define CMD_PROFILE_COMMIT 0x0E //Args: uint32_t CRC of the whole profile. Applied at the next cycle boundary
+#define CMD_SET_SEGMENTS 0x0F //Args: segments_header, profile_segment_t[count]. Applied at the next cycle boundary
+
+//Flash profile library
+#define CMD_STORE_LIST 0x12 //Responds with profile_store_list_entry_t[] of the valid slots
+#define CMD_STORE_SAVE 0x13 //Args: uint8_t slot, char name[PROFILE_STORE_NAME_LEN]. Saves the current profile
+#define CMD_STORE_ACTIVATE 0x14 //Args: uint8_t slot. Played from flash starting with the next cycle boundary
+
+#define CMD_GET_HAVE_DATA 0x08
+#define RSP_NO_DATA 0x01
+
+#define CMD_SET_PID_PARAMS 0x09 //Args: my_pid_params_t
+#define CMD_SET_ADC_CAL 0x10 //Args: uint8_t channel, my_adc_cal_t
+#define CMD_SET_DAC_CAL 0x11 //Args: my_dac_cal_t
+#define CMD_SAVE_NVS 0x20
+#define CMD_GET_NVS 0xA0
+#define CMD_ENABLE_PID_DBG 0xA1 //Toggles the CMD_PID_TRACE stream
+#define CMD_PID_TRACE 0xA2 //Unsolicited, pid_trace_header_t followed by pid_trace_record_t[]
+#define CMD_SET_PID_TRACE_PERIOD 0xA3 //Args: uint16_t flush period, ms
+//Session recording for host-side replay, see session_format.h. Board-wide, like the PID trace
+#define CMD_SET_SESSION 0xA5 //Args: uint8_t sensor mask, 0 = off
+#define CMD_SESSION 0xA6 //Unsolicited, session_header_t followed by records
+
+//Several setting commands under one frame and CRC. Checked as a whole after the CRC, applied only if every
+//sub-command is valid. Args: batch_header, then batch_entry_header + args for each sub-command.
+//Responds with batch_response_header followed by one RSP_* byte per sub-command (NO_STD_RSP = not applied).
+//Allowed: CMD_SET_HEATER_PARAMS, CMD_SET_MEASURE_PARAMS, CMD_SET_PID_PARAMS, CMD_SET_ADC_CAL, CMD_SET_DAC_CAL,
+//CMD_SET_PID_TRACE_PERIOD, CMD_SET_SESSION, CMD_SET_TRIP_LIMITS, CMD_SELECT_SENSOR, CMD_SET_FEATURES, CMD_SET_AVERAGING,
+//CMD_SET_BASELINE, CMD_SET_EVENTS, CMD_SET_TIMINGS, CMD_SET_FILTERS, CMD_SET_HEATER_MODEL, CMD_SAVE_NVS
+#define CMD_BATCH 0x30
+#define BATCH_MAX_SIZE 512 //bytes after batch_header
+#define BATCH_MAX_COMMANDS 16
+
+/***
+ * Argument and response layouts
+ */
+struct heater_params
+{
+    float tempco;
+    float rt_resistance;
+    float rt_temp;
+};
+struct measure_params
+{
+    float ref_resistance;
+};
+struct my_timings_t // Also the NVS record, same layout as the former size_t/uint fields
+{
+    uint32_t averaging_len; // ADC samples, 1..ADC_AVERAGE_MAX
+    uint32_t sampling_rate; // Hz, telemetry points, <= oversampling_rate
+    uint32_t oversampling_rate; // Hz, control ticks, <= RTOS tick rate. Board-wide
+};
+#define TREND_CHANNELS 4 //MY_ADC_CHANNEL_NUM
+struct trend_report_t
+{
+    uint32_t timestamp_us; // of the telemetry point it was taken at
+    float temp; // K, heater, from the trend of its voltage and current
+    float res; // Ohm, sensor
+    float volts[TREND_CHANNELS]; // calibrated, in my_adc_channels order
+};
+enum power_state : uint8_t
+{
+    power_active, // control loop at the full rate, CPU frequency locked at the maximum
+    power_idle // no sensor operates: no conversions, the CPU may scale down
+};
+enum boot_phase : uint8_t // Init steps of app_main, see main.cpp for which run concurrently
+{
+    boot_params, // NVS
+    boot_store, // profile partition
+    boot_uart, // protocol state, parser and stream tasks
+    boot_usb, // TinyUSB install
+    boot_console,
+    boot_adc, // eFuse curves, channel and DAC setup
+    boot_rails, // divider supplies settling
+    boot_phase_count
+};
+struct boot_report_t // Microseconds of the high-resolution timer, which starts before app_main (bootloader not included)
+{
+    uint32_t main_us; // app_main entered
+    uint32_t ready_us; // control tasks started
+    uint32_t first_sample_us; // first conversions of the control loop, 0 until then
+    uint8_t rails_settled; // 0 if the settle wait timed out
+    uint8_t reserved[3];
+    uint32_t start_us[boot_phase_count];
+    uint32_t end_us[boot_phase_count]; // 0 while running
+};
+struct power_report_t
+{
+    uint8_t state; // power_state
+    uint8_t reserved;
+    uint16_t freq_max_mhz; // CPU, both 0 if frequency scaling isn't enabled
+    uint16_t freq_min_mhz;
+    uint16_t reserved2;
+    uint32_t active_ms; // time in each state since boot
+    uint32_t idle_ms;
+    uint32_t wakes; // idle to active transitions
+    uint32_t wake_latency_us; // last start request to the first conversions
+    uint32_t wake_latency_max_us;
+};
+struct profile_chunk_header
+{
+    uint16_t offset;
+    uint16_t length;
+    uint32_t crc;
+};
+struct profile_upload_status
+{
+    uint16_t length; // points expected, 0 if no upload is in progress
+    uint16_t first_missing; // index of the first point not received yet (== length when complete)
+    uint16_t pending; // committed, waiting for a cycle boundary
+};
+struct segments_header
+{
+    uint16_t count;
+    uint16_t reserved;
+    float start; // initial setpoint
+};
+struct fault_report_header
+{
+    uint32_t timestamp_us; // now, same clock as the events
+    uint32_t lost; // events overwritten before they could be read
+    uint16_t code_count; // counters follow, indexed by my_error_codes bit
+    uint16_t event_count; // fault_event_t (fault_log.h) follow, oldest first
+};
+struct batch_header
+{
+    uint16_t request_id; // echoed in the response
+    uint16_t size; // bytes of sub-commands following
+};
+struct batch_entry_header
+{
+    uint8_t cmd;
+    uint8_t length; // args following
+};
+struct batch_response_header
+{
+    uint16_t request_id;
+    uint8_t result; // RSP_OK if every sub-command was applied
+    uint8_t count;
+};
+
+// Splits a batch body into sub-commands, their args follow each entry header. Returns the count, -1 if malformed.
+inline int batch_split(const uint8_t* body, size_t size, const batch_entry_header** entries, size_t max)
+{
+    size_t count = 0;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        if (count >= max || size - offset < sizeof(batch_entry_header)) return -1;
+        const batch_entry_header* e = reinterpret_cast<const batch_entry_header*>(body + offset);
+        offset += sizeof(batch_entry_header) + e->length;
+        if (offset > size) return -1;
+        entries[count++] = e;
+    }
+    return count;
+}
+
+inline const uint8_t* batch_args(const batch_entry_header* e)
+{
+    return reinterpret_cast<const uint8_t*>(e) + sizeof(batch_entry_header);
+}
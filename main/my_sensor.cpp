@@ -0,0 +1,457 @@
+#include "my_sensor.h"
+
+#include <math.h>
+#include <atomic>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "my_uart.h"
+#include "my_dbg_menu.h"
+#include "my_pid_trace.h"
+#include "my_trip.h"
+#include "my_session.h"
+#include "my_power.h"
+#include "my_boot.h"
+#include "rate_scheduler.h"
+#include "macros.h"
+
+#define CONTROL_TASK_STACK 4096
+#define CONTROL_TASK_PRIORITY 1 //Same as the main task that used to run the loop
+#define CONTROL_TASKS ((MY_SENSOR_NUM < portNUM_PROCESSORS) ? MY_SENSOR_NUM : portNUM_PROCESSORS)
+#define IDLE_PERIOD_MS 100 //Idle cadence: parameter and profile player updates, no conversions
+
+static const char *TAG = "SENSOR";
+
+static float calc_resistance(float vr_ref, float vdiv, float r_ref)
+{
+    return r_ref * (vdiv - vr_ref) / vr_ref;
+}
+
+//Heater model lookups, see heater_model.h: clamped to rt_temp below R0
+static float calc_temperature(float voltage, float current, const my_control_params_t* p)
+{
+    auto res = p->heater.temperature(voltage / current);
+    if (res > 1000)
+    {
+        ESP_LOGW(TAG, "Calc temp too high: v=%f, i=%f, rt_r=%f, rt_t=%f, alpha=%f", voltage, current, p->rt_res,
+            my_params::rt_temp, p->heater_coef);
+    }
+    return res;
+}
+
+static float calc_voltage(float power, float setpoint, const my_control_params_t* p)
+{
+    float res = sqrtf(power * p->heater.resistance(setpoint)); // P * R_heater(setpoint)
+    if (!isfinite(res))
+    {
+        ESP_LOGW(TAG, "Heater V is infinite: setpoint=%f, power=%f", setpoint, power);
+    }
+    return res;
+}
+
+my_sensor::my_sensor() : index(0), channels(NULL), dac(NULL), pid(NULL), params(NULL), buffer(), scan_us(0), averaging_len(0),
+    telemetry_len(0), trend_alpha(0), trend(), session(), session_seq(0), session_epoch(0), session_params_due(true)
+{
+    trend_report_t* t = trend.back();
+    t->timestamp_us = 0;
+    t->temp = NAN;
+    t->res = NAN;
+    for (size_t i = 0; i < TREND_CHANNELS; i++) t->volts[i] = NAN;
+    trend.publish();
+}
+
+bool my_sensor::init(size_t i)
+{
+    index = i;
+    channels = my_adc::channels[i];
+    dac = &my_dac::channels[i];
+    //Parameters are only read from the snapshot taken at the start of each tick
+    params = my_params::acquire(index);
+    pid.set_params(&params->pid_params);
+    my_uart::set_feature_config(index, &params->features);
+    my_uart::set_average_config(index, &params->averaging);
+    my_uart::set_baseline_config(index, &params->baseline);
+    my_uart::set_event_config(index, &params->events);
+    my_uart::set_timings(index, &params->timings);
+    apply_filters();
+
+    bool init_ok = true;
+    for (size_t j = 0; j < MY_ADC_CHANNEL_NUM; j++)
+    {
+        init_ok = init_ok && channels[j].init(&params->adc_cals[j]);
+    }
+    dac->init(&params->dac_cal);
+    dac->set(my_uart::first(index));
+    return init_ok;
+}
+
+//Snapshot of this tick, handed on to the consumers that keep pointers into it. True if it's a new one
+bool my_sensor::take_params()
+{
+    bool params_changed;
+    params = my_params::acquire(index, &params_changed);
+    if (params_changed)
+    {
+        pid.set_params(&params->pid_params);
+        for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) channels[i].set_calibration(&params->adc_cals[i]);
+        dac->set_cal(&params->dac_cal);
+        my_uart::set_feature_config(index, &params->features);
+        my_uart::set_average_config(index, &params->averaging);
+        my_uart::set_baseline_config(index, &params->baseline);
+        my_uart::set_event_config(index, &params->events);
+        my_uart::set_timings(index, &params->timings);
+        session_params_due = true;
+    }
+    return params_changed;
+}
+
+void my_sensor::scan()
+{
+    take_params();
+    if (my_session::recording(index) && (session_params_due || session_epoch != my_session::get_epoch())) record_params();
+    scan_us = static_cast<uint32_t>(esp_timer_get_time());
+    for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++)
+    {
+        buffer[i] = channels[i].get_value();
+    }
+}
+
+//Before this tick's conversions and PID step: the replay starts from exactly this state
+void my_sensor::record_params()
+{
+    static_assert(SESSION_CHANNELS == MY_ADC_CHANNEL_NUM, "session_params_t doesn't match the ADC channel set");
+    uint32_t epoch = my_session::get_epoch();
+    session_params_t s = {};
+    s.seq = session_seq + 1;
+    s.rt_temp = my_params::rt_temp;
+    for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++)
+    {
+        s.adc_gain[i] = params->adc_cals[i].gain;
+        s.adc_offset[i] = params->adc_cals[i].offset;
+    }
+    s.pid = params->pid_params;
+    s.pid_setpoint = pid.get_setpoint();
+    s.pid_integral = pid.get_integral();
+    s.heater_coef = params->heater_coef;
+    s.rt_res = params->rt_res;
+    s.ref_res = params->ref_res;
+    s.heater_model = params->heater_model;
+    s.guard_limits = params->guard_limits;
+    s.timings = params->timings;
+    s.filters = params->filters;
+    rates_t rates;
+    effective_rates(configTICK_RATE_HZ, params->timings.oversampling_rate, params->timings.sampling_rate, &rates);
+    s.loop_rate = rates.loop_rate;
+    s.point_rate = rates.point_rate;
+    if (!my_session::push_params(index, &s)) return; //Retried next tick
+    session_seq = s.seq;
+    session_epoch = epoch;
+    session_params_due = false;
+}
+
+//Resizing keeps the history, so the averages carry on without a step
+void my_sensor::apply_filters()
+{
+    rates_t rates;
+    effective_rates(configTICK_RATE_HZ, params->timings.oversampling_rate, params->timings.sampling_rate, &rates);
+    uint32_t t_len;
+    float alpha;
+    filter_windows(&params->filters, rates.loop_rate, rates.point_rate, ADC_AVERAGE_MAX, &t_len, &alpha);
+    if (params->timings.averaging_len != averaging_len)
+    {
+        averaging_len = params->timings.averaging_len;
+        for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) channels[i].set_averaging(averaging_len);
+    }
+    if (t_len != telemetry_len)
+    {
+        telemetry_len = t_len;
+        for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) channels[i].set_telemetry_window(telemetry_len);
+    }
+    if (alpha != trend_alpha)
+    {
+        trend_alpha = alpha;
+        for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) channels[i].set_trend(trend_alpha);
+    }
+}
+
+//Trend outputs are converted like the telemetry ones, only at telemetry points
+void my_sensor::publish_trend()
+{
+    static_assert(TREND_CHANNELS == MY_ADC_CHANNEL_NUM, "trend_report_t doesn't match the ADC channel set");
+    trend_report_t* t = trend.back();
+    t->timestamp_us = scan_us;
+    for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) t->volts[i] = channels[i].get_trend();
+    if (trend_alpha > 0)
+    {
+        t->temp = calc_temperature(t->volts[my_adc_channels::v_h_mon], t->volts[my_adc_channels::i_h], params);
+        t->res = calc_resistance(t->volts[my_adc_channels::v_r4], t->volts[my_adc_channels::v_div], params->ref_res);
+    }
+    else
+    {
+        t->temp = NAN;
+        t->res = NAN;
+    }
+    trend.publish();
+}
+
+const trend_report_t* my_sensor::read_trend()
+{
+    return trend.read();
+}
+
+void my_sensor::control()
+{
+    //Hard limits on this very conversion, not on the averages: trips within one sample
+    bool tripped = my_trip::check(index, channels[my_adc_channels::v_h_mon].get_instant(),
+        channels[my_adc_channels::i_h].get_instant(), params);
+    bool recording = my_session::recording(index) && !session_params_due;
+    if (recording)
+    {
+        session.timestamp_us = scan_us;
+        for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++)
+        {
+            session.raw[i] = channels[i].get_raw();
+            session.mv[i] = channels[i].get_millivolts();
+        }
+        session.setpoint = NAN;
+        session.temp = NAN;
+        session.point_temp = NAN;
+        session.point_res = NAN;
+        session.flags = tripped ? session_tripped : 0;
+        session.params_seq = session_seq;
+    }
+    if (!tripped && (my_uart::get_operate(index) || my_dbg_menu::operate[index]))
+    {
+        float current_temp = calc_temperature(buffer[my_adc_channels::v_h_mon], buffer[my_adc_channels::i_h], params);
+        my_uart::note_temperature(current_temp);
+        if (my_uart::point_due(index))
+        {
+            //Telemetry outputs: averaged over the point period by default, independent of the control window
+            float v[MY_ADC_CHANNEL_NUM];
+            for (size_t i = 0; i < MY_ADC_CHANNEL_NUM; i++) v[i] = channels[i].get_telemetry();
+            float point_temp = calc_temperature(v[my_adc_channels::v_h_mon], v[my_adc_channels::i_h], params);
+            printf("#%u mV: %6.1f; %6.1f; %6.1f (%6.1f); mA: %6.1f (%3.0f)\n", index,
+                v[my_adc_channels::v_r4] * 1000,
+                v[my_adc_channels::v_div] * 1000,
+                v[my_adc_channels::v_h_mon] * 1000, dac->get() * 1000,
+                v[my_adc_channels::i_h] * 1000, point_temp
+                );
+            float point_res = calc_resistance(v[my_adc_channels::v_r4], v[my_adc_channels::v_div], params->ref_res);
+            my_uart::enqueue(index, point_temp, point_res, scan_us);
+            publish_trend();
+            session.point_temp = point_temp;
+            session.point_res = point_res;
+            session.flags |= session_point;
+        }
+        float setpoint = my_uart::tick(index);
+        if (my_uart::cycle_started(index))
+        {
+            apply_filters(); //Same boundary as the telemetry rate
+            session.flags |= session_filters;
+        }
+        session.flags |= session_operate;
+        session.setpoint = setpoint;
+        session.temp = current_temp;
+        if (my_uart::setpoint_is_continuous(index))
+        {
+            session.flags |= session_continuous;
+            pid.track(setpoint);
+        }
+        else
+        {
+            pid.set(setpoint);
+        }
+        float pid_next = pid.next(current_temp);
+        if (!isfinite(pid_next)) ESP_LOGW(TAG, "PID is infinite: %f, %f", pid_next, current_temp);
+        float commanded_voltage = calc_voltage(pid_next, pid.get_setpoint(), params);
+        dac->set(commanded_voltage);
+        session.voltage = commanded_voltage;
+        if (my_params::enable_pid_dbg)
+        {
+            auto terms = pid.get_terms();
+            pid_trace_record_t r = {
+                .timestamp_us = static_cast<uint32_t>(esp_timer_get_time()),
+                .setpoint = pid.get_setpoint(),
+                .temp = current_temp,
+                .p_term = terms->p,
+                .i_term = terms->i,
+                .ff_term = terms->ff,
+                .voltage = commanded_voltage,
+                .dac_code = dac->get_code(),
+                .sensor = static_cast<uint8_t>(index),
+                .reserved = 0
+            };
+            my_pid_trace::push(&r);
+        }
+    }
+    else
+    {
+        if (tripped)
+        {
+            dac->off(); //Regardless of the DAC calibration offset
+        }
+        else
+        {
+            dac->set(0);
+        }
+        pid.set(my_params::rt_temp);
+        my_uart::idle(index);
+        apply_filters();
+        session.voltage = 0;
+        session.flags |= session_filters;
+    }
+    if (recording)
+    {
+        session.dac_code = dac->get_code();
+        my_session::push_tick(index, &session);
+    }
+}
+
+//Idle cadence, instead of scan() and control(): parameters and the profile player are kept current, no conversions
+void my_sensor::rest()
+{
+    if (take_params() && my_trip::get_trip(index) == trip_none) dac->set(0); //A new DAC calibration moves the zero
+    my_uart::idle(index);
+}
+
+namespace my_sensors
+{
+    my_sensor sensors[MY_SENSOR_NUM];
+    static TaskHandle_t control_tasks[CONTROL_TASKS];
+    static std::atomic<uint32_t> wake_request_us(0);
+
+    /***
+     * Sensor i runs on core i % CONTROL_TASKS. Each task scans and then controls its sensors one after the other,
+     * so every sensor's DAC update follows its own conversions as closely as possible. The tasks run at the same
+     * rate, shifted by a fraction of the period, so that their ADC scans interleave instead of queueing up
+     * on the (shared, driver-serialized) ADC1.
+     * Periods are whole RTOS ticks, alternating between floor and ceil so that the mean rate is exact.
+     * Once a full-rate tick has run with no sensor operating, the task drops to the idle cadence (no conversions,
+     * CPU frequency lock released, see my_power.h) until wake() or the next idle period finds a sensor operating.
+     */
+    static void control_task(void* arg)
+    {
+        size_t core = reinterpret_cast<size_t>(arg);
+        const my_sensor& first = sensors[core]; //The loop rate is board-wide, any sensor's snapshot has it
+        uint32_t loop_rate = first.get_timings()->oversampling_rate;
+        rates_t rates;
+        effective_rates(configTICK_RATE_HZ, loop_rate, loop_rate, &rates);
+        tick_period period;
+        period.configure(rates.loop_rate, configTICK_RATE_HZ);
+        my_power::set_active(true);
+        vTaskDelay(rates.loop_period_min * core / CONTROL_TASKS);
+        TickType_t last_wake = xTaskGetTickCount();
+        int64_t last_tick = esp_timer_get_time();
+        bool active = true;
+        bool was_idle = false; //At the end of the previous tick
+        bool woken = false; //First tick after the idle cadence
+        while (1)
+        {
+            if (!active)
+            {
+                for (size_t i = core; i < MY_SENSOR_NUM; i += CONTROL_TASKS) sensors[i].rest();
+                if (idle())
+                {
+                    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_PERIOD_MS));
+                    continue;
+                }
+                my_power::set_active(true);
+                active = true;
+                was_idle = false;
+                woken = true;
+                effective_rates(configTICK_RATE_HZ, loop_rate, loop_rate, &rates);
+                vTaskDelay(rates.loop_period_min * core / CONTROL_TASKS); //Interleave again, the first tick runs right away
+                last_wake = xTaskGetTickCount();
+                last_tick = esp_timer_get_time();
+            }
+            else
+            {
+                vTaskDelayUntil(&last_wake, period.next());
+            }
+            if (first.get_timings()->oversampling_rate != loop_rate) //Only accepted while no sensor operates, see CMD_SET_TIMINGS
+            {
+                loop_rate = first.get_timings()->oversampling_rate;
+                effective_rates(configTICK_RATE_HZ, loop_rate, loop_rate, &rates); //Clamped as at startup
+                period.configure(rates.loop_rate, configTICK_RATE_HZ);
+            }
+            if (core == 0)
+            {
+                int64_t now = esp_timer_get_time();
+                my_params::note_loop_period(static_cast<uint32_t>(now - last_tick));
+                last_tick = now;
+            }
+            for (size_t i = core; i < MY_SENSOR_NUM; i += CONTROL_TASKS)
+            {
+                sensors[i].scan();
+                my_boot::note_sample();
+                if (woken)
+                {
+                    uint32_t request = wake_request_us.exchange(0);
+                    if (request != 0) my_power::note_wake(request);
+                    woken = false;
+                }
+                sensors[i].control();
+            }
+            //Two idle checks around a whole tick: control() has switched every heater off and rewound the players
+            bool is_idle = idle();
+            if (is_idle && was_idle)
+            {
+                my_power::set_active(false);
+                active = false;
+                wake_request_us.store(0); //Requests while active don't count as wake-ups
+            }
+            was_idle = is_idle;
+        }
+    }
+
+    bool init()
+    {
+        bool init_ok = true;
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+        {
+            if (!sensors[i].init(i))
+            {
+                ESP_LOGE(TAG, "Sensor %u init failed", i);
+                init_ok = false;
+            }
+        }
+        return init_ok;
+    }
+
+    bool idle()
+    {
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+        {
+            if (my_uart::get_operate(i) || my_dbg_menu::operate[i]) return false;
+        }
+        return true;
+    }
+
+    void wake()
+    {
+        uint32_t now = static_cast<uint32_t>(esp_timer_get_time());
+        wake_request_us.store(now ? now : 1); //0 = no request pending
+        for (size_t core = 0; core < CONTROL_TASKS; core++)
+        {
+            if (control_tasks[core] != NULL) xTaskNotifyGive(control_tasks[core]);
+        }
+    }
+
+    const trend_report_t* read_trend(size_t sensor)
+    {
+        return sensors[sensor].read_trend();
+    }
+
+    void start()
+    {
+        for (size_t core = 0; core < CONTROL_TASKS; core++)
+        {
+            xTaskCreatePinnedToCore(control_task, "control", CONTROL_TASK_STACK, reinterpret_cast<void*>(core),
+                CONTROL_TASK_PRIORITY, &control_tasks[core], core);
+            assert(control_tasks[core]);
+        }
+        ESP_LOGI(TAG, "%u sensors on %u control tasks", MY_SENSOR_NUM, CONTROL_TASKS);
+    }
+}
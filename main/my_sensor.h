@@ -0,0 +1,56 @@
+#pragma once
+
+#include "my_adc_channel.h"
+#include "my_dac.h"
+#include "my_params.h"
+#include "my_pid.h"
+#include "triple_buffer.h"
+#include "session_format.h"
+
+/***
+ * One heater/sensor: its ADC channel set, DAC, PID state and parameter snapshot.
+ * The profile player and the telemetry ring are kept by my_uart under the same index.
+ */
+class my_sensor
+{
+private:
+    size_t index;
+    my_adc_channel* channels; // MY_ADC_CHANNEL_NUM, in my_adc_channels order
+    my_dac_channel* dac;
+    my_pid pid;
+    const my_control_params_t* params; // Snapshot of the current tick
+    float buffer[MY_ADC_CHANNEL_NUM];
+    uint32_t scan_us; // Monotonic timer at the last scan(), telemetry timestamp
+    uint32_t averaging_len; // ADC windows in use, follow params->timings and params->filters at cycle starts
+    uint32_t telemetry_len;
+    float trend_alpha;
+    triple_buffer<trend_report_t> trend; // Written at telemetry points, read by the parser
+    session_tick_t session; // Being recorded this tick, see my_session.h
+    uint8_t session_seq; // Of the last parameter snapshot sent
+    uint32_t session_epoch;
+    bool session_params_due;
+
+    void apply_filters();
+    void publish_trend();
+    void record_params();
+    bool take_params();
+public:
+    my_sensor();
+    bool init(size_t i);
+    void scan(); // ADC conversions of this tick
+    void control(); // Trip check, PID, DAC and telemetry, on the values of the last scan()
+    void rest(); // Idle cadence, while no sensor operates
+    const trend_report_t* read_trend(); // Single reader
+    const my_timings_t* get_timings() const { return &params->timings; } // Control task: in the current snapshot
+};
+
+namespace my_sensors
+{
+    extern my_sensor sensors[MY_SENSOR_NUM];
+
+    bool init();
+    void start(); // One control task per core that has sensors assigned
+    bool idle(); // No sensor operates
+    void wake(); // After setting an operate flag: the control tasks leave the idle cadence without waiting it out
+    const trend_report_t* read_trend(size_t sensor); // As of the last telemetry point, the parser is the only reader
+}
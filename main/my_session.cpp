@@ -0,0 +1,147 @@
+#include "my_session.h"
+#include "my_uart.h"
+#include "my_protocol.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <string.h>
+#include <atomic>
+
+#define SESSION_TICK_QUEUE_LEN 256 //records, ~0.5 s of one sensor at 500 Hz
+#define SESSION_EVENT_QUEUE_LEN 8 //parameter snapshots and commands
+#define SESSION_PACKET_MAX 2048 //bytes, header included
+#define SESSION_FLUSH_PERIOD 20 //ms
+
+static const char* TAG = "SESSION";
+
+struct tick_item_t
+{
+    uint8_t sensor;
+    session_tick_t tick;
+};
+struct event_item_t //Parameter snapshots are rare, commands don't need the space but share the queue to keep their order
+{
+    session_record_header_t header;
+    union
+    {
+        session_params_t params;
+        session_command_t command;
+    };
+};
+
+static QueueHandle_t tick_queue;
+static QueueHandle_t event_queue;
+static TaskHandle_t flush_task_handle;
+static std::atomic<uint8_t> sensor_mask(0);
+static std::atomic<uint32_t> epoch(0);
+static std::atomic<uint32_t> dropped(0);
+
+//Packs whole records, the replay never sees a split one
+static bool append(uint8_t* packet, size_t& used, uint8_t kind, uint8_t sensor, const void* body, size_t size)
+{
+    if (used + sizeof(session_record_header_t) + size > SESSION_PACKET_MAX) return false;
+    session_record_header_t h = { kind, sensor, static_cast<uint16_t>(size) };
+    memcpy(packet + used, &h, sizeof(h));
+    memcpy(packet + used + sizeof(h), body, size);
+    used += sizeof(h) + size;
+    return true;
+}
+
+static void flush_task(void* arg)
+{
+    static uint8_t packet[SESSION_PACKET_MAX];
+    static uint32_t seq = 0;
+    static uint32_t tx_dropped = 0;
+    static event_item_t event;
+    static tick_item_t tick;
+    bool event_held = false, tick_held = false; //Taken from a queue, didn't fit into the last packet
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(SESSION_FLUSH_PERIOD));
+        while (1)
+        {
+            size_t used = sizeof(session_header_t);
+            uint16_t count = 0;
+            //Events first: a parameter snapshot precedes the ticks that refer to it
+            while (event_held || xQueueReceive(event_queue, &event, 0) == pdTRUE)
+            {
+                const void* body = (event.header.kind == session_params) ? static_cast<const void*>(&event.params) :
+                    static_cast<const void*>(&event.command);
+                event_held = !append(packet, used, event.header.kind, event.header.sensor, body, event.header.size);
+                if (event_held) break;
+                count++;
+            }
+            while (!event_held && (tick_held || xQueueReceive(tick_queue, &tick, 0) == pdTRUE))
+            {
+                tick_held = !append(packet, used, session_tick, tick.sensor, &tick.tick, sizeof(tick.tick));
+                if (tick_held) break;
+                count++;
+            }
+            if (count == 0) break;
+            session_header_t header = { seq++, dropped.load(), tx_dropped, count, SESSION_FORMAT_VERSION };
+            memcpy(packet, &header, sizeof(header));
+            if (!my_uart::send_frame(CMD_SESSION, packet, used)) tx_dropped++;
+            if (!event_held && !tick_held) break;
+        }
+    }
+}
+
+namespace my_session
+{
+    void init()
+    {
+        tick_queue = xQueueCreate(SESSION_TICK_QUEUE_LEN, sizeof(tick_item_t));
+        event_queue = xQueueCreate(SESSION_EVENT_QUEUE_LEN, sizeof(event_item_t));
+        assert(tick_queue && event_queue);
+        xTaskCreatePinnedToCore(flush_task, "session", 3072, NULL, 1, &flush_task_handle, 1);
+        assert(flush_task_handle);
+    }
+
+    void set_sensors(uint8_t mask)
+    {
+        if (mask != 0 && sensor_mask.load() == 0) epoch++;
+        sensor_mask.store(mask);
+        ESP_LOGI(TAG, "Recording sensors 0x%02x", mask);
+    }
+
+    bool recording(size_t sensor)
+    {
+        return sensor_mask.load(std::memory_order_relaxed) & (1u << sensor);
+    }
+
+    uint32_t get_epoch()
+    {
+        return epoch.load(std::memory_order_relaxed);
+    }
+
+    void push_tick(size_t sensor, const session_tick_t* t)
+    {
+        tick_item_t item = { static_cast<uint8_t>(sensor), *t };
+        if (xQueueSend(tick_queue, &item, 0) == pdTRUE) return;
+        dropped++;
+        epoch++; //The replay resynchronizes on the next parameter snapshot
+    }
+
+    bool push_params(size_t sensor, const session_params_t* p)
+    {
+        event_item_t item;
+        item.header = { session_params, static_cast<uint8_t>(sensor), sizeof(session_params_t) };
+        item.params = *p;
+        if (xQueueSend(event_queue, &item, 0) == pdTRUE) return true;
+        dropped++;
+        return false;
+    }
+
+    void push_command(size_t sensor, const session_command_t* c)
+    {
+        if (sensor_mask.load(std::memory_order_relaxed) == 0) return;
+        event_item_t item;
+        item.header = { session_command, static_cast<uint8_t>(sensor), sizeof(session_command_t) };
+        item.command = *c;
+        if (xQueueSend(event_queue, &item, 0) != pdTRUE) dropped++;
+    }
+}
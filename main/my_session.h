@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include "session_format.h"
+
+namespace my_session
+{
+    void init();
+    void set_sensors(uint8_t mask); // Bit per sensor, 0 stops recording. Parameters are sent again on a new start
+    bool recording(size_t sensor);
+    uint32_t get_epoch(); // Counts starts and lost ticks, a sensor sends its parameters (and PID state) when it sees a new one
+    //Never block, a full queue counts as dropped
+    void push_tick(size_t sensor, const session_tick_t* t); // Sensor's control task
+    bool push_params(size_t sensor, const session_params_t* p); // Likewise. False if dropped
+    void push_command(size_t sensor, const session_command_t* c); // Parser. Ignored while nothing is recorded
+}
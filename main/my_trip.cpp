@@ -0,0 +1,37 @@
+#include "my_trip.h"
+
+#include "esp_log.h"
+#include "my_dac.h"
+#include "my_uart.h"
+
+static const char* TAG = "TRIP";
+
+static heater_guard guards[MY_SENSOR_NUM];
+
+namespace my_trip
+{
+    bool check(size_t sensor, float v_h, float i_h, const my_control_params_t* p)
+    {
+        uint8_t t = guards[sensor].check(v_h, i_h, &p->guard_limits);
+        if (t != trip_none)
+        {
+            my_dac::channels[sensor].off(); //Before anything else
+            my_uart::raise_error(my_error_codes::heater);
+            ESP_LOGE(TAG, "Sensor %u heater trip %u: V=%f, I=%f", sensor, t, v_h, i_h);
+            return true;
+        }
+        return guards[sensor].get_trip() != trip_none;
+    }
+
+    uint8_t get_trip(size_t sensor)
+    {
+        return guards[sensor].get_trip();
+    }
+
+    bool clear(size_t sensor)
+    {
+        bool ret = guards[sensor].clear();
+        if (ret) ESP_LOGI(TAG, "Sensor %u trip cleared", sensor);
+        return ret;
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "my_params.h"
+
+namespace my_trip
+{
+    //Per sensor, `sensor` < MY_SENSOR_NUM
+    bool check(size_t sensor, float v_h, float i_h, const my_control_params_t* p); // Sensor's control task, every conversion. True while tripped
+    uint8_t get_trip(size_t sensor); // heater_trip
+    bool clear(size_t sensor); // Any task. False if nothing was latched
+}
@@ -1,66 +1,66 @@
 #include "my_uart.h"
+#include "my_protocol.h"
+#include "frame_codec.h"
 #include "my_params.h"
+#include "cycle_ring.h"
+#include "cycle_features.h"
+#include "cycle_average.h"
+#include "baseline_tracker.h"
+#include "event_detector.h"
+#include "rate_scheduler.h"
+#include "profile_engine.h"
+#include "my_profile_store.h"
+#include "my_pid_trace.h"
+#include "my_events.h"
+#include "my_session.h"
+#include "my_power.h"
+#include "my_boot.h"
+#include "fault_log.h"
+#include "my_trip.h"
+#include "my_sensor.h"
 
 #include "esp_log.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/stream_buffer.h"
 #include "tinyusb.h"
 #include "tusb_cdc_acm.h"
 #include "rom/crc.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include <atomic>
+#include <string.h>
+#if CONFIG_SPIRAM
+#include "esp_heap_caps.h"
+#endif
 
-/***
- * Protocol
- */
-
-static const uint8_t preamble = 0x7E;
-static const uint8_t postamble = 0x81;
-static const uint8_t escape = 0x55;
 static const float debug_prefix = -100.1;
 
-/***
- * Commands 
- */
-#define RSP_OK 0x00
-#define RSP_BAD_CRC 0xFE
-#define NO_STD_RSP 0xFF
-
-#define CMD_STOP 0x01
-#define CMD_START 0x02
-#define RSP_ALREADY_IN_REQUESTED_STATE 0x01
-#define RSP_STATE_SWITCH_ERROR 0x02
-
-#define CMD_GET_DATA 0x03
-
-#define CMD_GET_ERROR 0x04
-//Responses are located in the header (enum-bitfield)
-
-#define CMD_SET_HEATER_PARAMS 0x05
-#define CMD_SET_MEASURE_PARAMS 0x06
-#define CMD_SET_TEMP_CYCLE 0x07
-#define RSP_SET_FAILED 0x01
-
-#define CMD_GET_HAVE_DATA 0x08
-#define RSP_NO_DATA 0x01
-
-#define CMD_SET_PID_PARAMS 0x09
-#define CMD_SET_ADC_CAL 0x10
-#define CMD_SET_DAC_CAL 0x11
-#define CMD_SAVE_NVS 0x20
-#define CMD_GET_NVS 0xA0
-#define CMD_ENABLE_PID_DBG 0xA1
-
 // Alive indicator
 #define ENABLE_DEBUG_INFO_CMD 1 //Falls through standard communication because lacks start/end flags
 
 /***
  * Internal defines
  */
-#define CYCLE_LENGTH 600 //pts
-#define FLOATS_PER_POINT 2
+#define PROFILE_STORE_LIST_MAX 64
+#define FAULT_LOG_DEPTH 32 //Events kept between CMD_GET_FAULTS reads
+#define SETTING_MAX_SIZE 96 //bytes, largest fixed-size setting command
+#define RX_STREAM_SIZE 4096 //bytes between the TinyUSB task and the parser
+#define RX_CHUNK_SIZE 64 //bytes copied per read, matches rx_unread_buf_sz
 #define TRANSMIT_BUFFER_SIZE (CYCLE_LENGTH * FLOATS_PER_POINT) //pts
+#define CYCLE_RING_DEPTH 4 //Cycles kept for the host to fetch
+#define CYCLE_RING_PSRAM_DEPTH 8 //Rings this deep go to PSRAM (when available)
+#define FEATURE_RING_DEPTH 16 //Feature reports kept for the host to fetch
+#define AVERAGE_RING_DEPTH 2 //Averaged cycles kept for the host to fetch, each one is as large as a cycle slot
+#if CONFIG_SPIRAM && (CYCLE_RING_DEPTH >= CYCLE_RING_PSRAM_DEPTH)
+#define CYCLE_RING_IN_PSRAM 1
+#else
+#define CYCLE_RING_IN_PSRAM 0
+#endif
 #define CDC_CHANNEL ((tinyusb_cdcacm_itf_t)TINYUSB_CDC_ACM_0)
+#define CDC_WRITE_TIMEOUT 100 //ms for a whole frame to get into the TX FIFO (CONFIG_TINYUSB_CDC_TX_BUFSIZE), a cycle frame is larger
+#define CDC_FLUSH_WAIT 10 //ms per flush while waiting for room
 
 static const char* TAG = "USB_CDC";
 
@@ -70,8 +70,9 @@ static const char* TAG = "USB_CDC";
 
 namespace my_uart
 {
-    static bool operate = false;
-    static my_error_codes error_codes = my_error_codes::none;
+    static std::atomic<uint32_t> error_codes(my_error_codes::none); //Flags since the last CMD_GET_ERROR
+    static fault_log<FAULT_LOG_DEPTH> faults;
+    static std::atomic<float> last_temp(0);
 }
 
 namespace receiver
@@ -86,58 +87,144 @@ namespace receiver
         postamble_encountered
     };
 
+    struct profile_t
+    {
+        profile_mode mode;
+        size_t length; // points or segments
+        float start;
+        const void* data; // float[length] or profile_segment_t[length]
+    };
+
+    struct player_t // One per sensor: the profile being played, the next one and its upload
+    {
+        bool operate;
+        float buffer1[CYCLE_LENGTH];
+        float buffer2[CYCLE_LENGTH];
+        profile_t current_profile;
+        size_t cycle_ticks; //Control ticks elapsed in the current cycle
+        size_t cycle_counter; //Telemetry points of the current cycle started so far (table: points handed out)
+        const float* current_element;
+        rate_divider point_rate; //Telemetry points per control tick, restarted with each cycle
+        const my_timings_t* timings; //In the control task's parameter snapshot, read at cycle starts
+        float current_setpoint;
+        segment_profile segment_engine;
+        //Upload state: next_buffer is owned by the parser while !next_pending, by the control loop otherwise
+        float* next_buffer;
+        profile_t next_profile;
+        size_t upload_length;
+        uint8_t upload_received[(CYCLE_LENGTH + 7) / 8]; //Bitmap of uploaded points
+        std::atomic<bool> next_pending;
+    };
+    static_assert(sizeof(profile_segment_t) * PROFILE_MAX_SEGMENTS <= sizeof(player_t::buffer1), "Segments must fit a profile buffer");
+
     //Receiver state
-    static float buffer1[CYCLE_LENGTH] = {};
-    static float buffer2[CYCLE_LENGTH] = {};
-    static size_t cycle_counter = 0;
-    static float* current_buffer = buffer1;
-    static float* current_element = current_buffer;
-    static float* next_buffer = buffer2;
-    static uint8_t receive_raw[sizeof(buffer1) + 100];
+    static player_t players[MY_SENSOR_NUM]; //Each played by its sensor's control task, see init()
+    static uint8_t selected = 0; //Sensor addressed by the commands (CMD_SELECT_SENSOR), parser only
     static uint8_t receiver_wdt = 0;
     static uint32_t receiver_crc;
     static TaskHandle_t parser_task_handle;
-    static QueueHandle_t parser_queue_handle;
-    static SemaphoreHandle_t parser_semaphore;
+    static StreamBufferHandle_t rx_stream; //Single writer (TinyUSB task), single reader (parser task)
+    static batch_header batch = {};
+    static uint8_t batch_body[BATCH_MAX_SIZE];
+    static uint8_t setting_args[SETTING_MAX_SIZE]; //Of a single setting command
+    static struct
+    {
+        uint8_t slot;
+        char name[PROFILE_STORE_NAME_LEN];
+    } store_args = {}; //CMD_STORE_SAVE, CMD_STORE_ACTIVATE (slot only)
+    static segments_header segments_args = {}; //CMD_SET_SEGMENTS, the segments themselves go to next_buffer
+    static bool profile_accepted = false; //CMD_SET_TEMP_CYCLE, CMD_SET_SEGMENTS: next_buffer was ours when the frame began
+    static uint16_t upload_points = 0; //CMD_PROFILE_BEGIN
+    static profile_chunk_header chunk_header = {}; //CMD_PROFILE_CHUNK
+    static uint8_t chunk_data[PROFILE_CHUNK_MAX];
+    static uint32_t commit_crc = 0; //CMD_PROFILE_COMMIT
+    static bool staged = false; //The frame's command takes effect once its CRC checks out, see apply_staged()
 
-    void parse_input(size_t sz);
+    void parse_input(const uint8_t* data, size_t sz);
     void parser_task(void* arg);
-    float get_next();
-    void cycle_end();
+    float tick(size_t sensor);
+    void cycle_end(size_t sensor);
+    bool commit_next(player_t& p, profile_mode mode, size_t length, float start, const void* data);
+    uint32_t profile_id(const profile_t& profile);
     void init();
 }
 
 namespace transmitter
 {
-    struct buffer_t
+    struct cycle_data_t
+    {
+        uint32_t seq;
+        float points[TRANSMIT_BUFFER_SIZE];
+    };
+    typedef cycle_ring<cycle_data_t>::slot_t slot_t;
+
+    struct feature_data_t
+    {
+        uint8_t report[FEATURE_REPORT_MAX_SIZE];
+    };
+    typedef cycle_ring<feature_data_t>::slot_t feature_slot_t;
+
+    struct average_data_t
     {
-        float* const start;
-        float* current;
-        uint32_t crc;
+        uint8_t report[AVERAGE_REPORT_SIZE(CYCLE_LENGTH)];
+    };
+    typedef cycle_ring<average_data_t>::slot_t average_slot_t;
+
+    //Largest frame payload: a cycle slot or an averaged cycle
+    static const size_t payload_max_size = (sizeof(cycle_data_t) > sizeof(average_data_t)) ?
+        sizeof(cycle_data_t) : sizeof(average_data_t);
+
+    struct telemetry_t // One per sensor
+    {
+        slot_t slots[CYCLE_RING_DEPTH];
+        cycle_ring<cycle_data_t> ring; //Produced by the sensor's control task only
+        //Features of the cycle being enqueued, started at its first point with the config of that moment
+        cycle_features features;
+        bool features_started;
+        const feature_config_t* feature_config; //In the control task's parameter snapshot
+        feature_slot_t feature_slots[FEATURE_RING_DEPTH];
+        cycle_ring<feature_data_t> feature_ring;
+        //Coherent average, binned by profile position. Reconfigured at cycle boundaries only
+        cycle_average<CYCLE_LENGTH> average;
+        const average_config_t* average_config; //In the control task's parameter snapshot
+        average_slot_t average_slots[AVERAGE_RING_DEPTH];
+        cycle_ring<average_data_t> average_ring;
+        //Drift baseline of the current profile, seeded from NVS. Reconfigured at cycle boundaries only
+        baseline_tracker<CYCLE_LENGTH> baseline;
+        const baseline_config_t* baseline_config; //In the control task's parameter snapshot
+        uint16_t baseline_cycles; //Since the last save
+        //Runs on every point, frames go out through my_events. Reconfigured at cycle boundaries only
+        event_detector events;
+        const event_config_t* event_config; //In the control task's parameter snapshot
+        telemetry_t() : ring(slots, CYCLE_RING_DEPTH), features_started(false), feature_config(NULL),
+            feature_ring(feature_slots, FEATURE_RING_DEPTH), average_config(NULL),
+            average_ring(average_slots, AVERAGE_RING_DEPTH), baseline_config(NULL), baseline_cycles(0),
+            event_config(NULL) {}
     };
 
     //Transmission state
-    static size_t cycle_counter = 0;
     static uint8_t wdt_counter = 0;
-    static const size_t buffers_count = 2;
-    static float data_buffer1[TRANSMIT_BUFFER_SIZE];
-    static float data_buffer2[TRANSMIT_BUFFER_SIZE];
-    static buffer_t buffer1 = { data_buffer1, data_buffer1, ~0u };
-    static buffer_t buffer2 = { data_buffer2, data_buffer2, ~0u };
-    static buffer_t* const buffers[] = { &buffer1, &buffer2 };
-    static buffer_t* empty_buffer = buffers[0];
-    static buffer_t* full_buffer = buffers[1];
-    static SemaphoreHandle_t transmit_mutex;
-    static bool have_data = false;
+#if CYCLE_RING_IN_PSRAM
+    static cycle_data_t* ring_storage[MY_SENSOR_NUM] = {};
+#else
+    static cycle_data_t ring_storage[MY_SENSOR_NUM][CYCLE_RING_DEPTH];
+#endif
+    static feature_data_t feature_storage[MY_SENSOR_NUM][FEATURE_RING_DEPTH];
+    static average_data_t average_storage[MY_SENSOR_NUM][AVERAGE_RING_DEPTH];
+    static telemetry_t telemetry[MY_SENSOR_NUM];
+    static SemaphoreHandle_t transmit_mutex; //Responses (parser task) vs unsolicited frames
 
     void write_immedeately(const uint8_t* buf, size_t sz);
-    void write_dbg(float val);
-    void send_buffer(uint8_t cmd, uint8_t* buffer, size_t sz);
-    void send_precalc_buffer(uint8_t cmd, uint8_t* buffer, size_t sz, uint32_t crc);
+    bool send_buffer(uint8_t cmd, uint8_t* buffer, size_t sz);
+    bool send_precalc_buffer(uint8_t cmd, uint8_t* buffer, size_t sz, uint32_t crc);
     void send_cmd_response(uint8_t cmd, uint8_t rsp);
-    void enqueue_next(float res, float temp);
-    void send_cycle_data();
-    void cycle_end();
+    void enqueue_next(size_t sensor, float res, float temp, uint32_t timestamp_us, size_t index);
+    void send_cycle_data(size_t sensor);
+    bool send_cycle_data(size_t sensor, uint32_t seq);
+    void send_features(size_t sensor);
+    void send_average(size_t sensor);
+    void cycle_end(size_t sensor);
+    void profile_switched(size_t sensor, uint32_t profile);
     void init();
 }
 
@@ -147,114 +234,713 @@ namespace transmitter
 
 namespace receiver
 {
-    struct heater_params
+    //Sensor's control task: advances its profile by one control tick, returns the setpoint
+    float tick(size_t sensor)
     {
-        float tempco;
-        float rt_resistance;
-        float rt_temp;
-    };
-    struct measure_params
+        player_t& p = players[sensor];
+        bool point = p.point_rate.tick();
+        if (p.current_profile.mode == profile_segments)
+        {
+            if (!p.segment_engine.next(p.current_setpoint))
+            {
+                cycle_end(sensor);
+                point = p.point_rate.tick(); //Armed by cycle_end(): the new cycle starts with a point
+                p.segment_engine.next(p.current_setpoint);
+            }
+        }
+        else if (point)
+        {
+            if (p.cycle_counter >= p.current_profile.length)
+            {
+                cycle_end(sensor);
+                point = p.point_rate.tick();
+            }
+            p.current_setpoint = *p.current_element++;
+        }
+        if (point) p.cycle_counter++;
+        p.cycle_ticks++;
+        return p.current_setpoint;
+    }
+
+    //Sensor's control task: the only place where an uploaded profile becomes current
+    void cycle_end(size_t sensor)
     {
-        float ref_resistance;
-    };
+        player_t& p = players[sensor];
+        if (p.cycle_ticks > 0) transmitter::cycle_end(sensor);
+        const my_timings_t* timings = p.timings; //Board-wide oversampling rate included, set_timings() copies it to every sensor
+        assert(timings);
+        uint32_t loop_rate = timings->oversampling_rate;
+        if (p.next_pending.load(std::memory_order_acquire))
+        {
+            if (p.next_profile.data == p.next_buffer) p.next_buffer = (p.next_buffer == p.buffer1) ? p.buffer2 : p.buffer1; //Otherwise it's played from flash
+            p.current_profile = p.next_profile;
+            p.next_pending.store(false, std::memory_order_release);
+            transmitter::profile_switched(sensor, profile_id(p.current_profile));
+            ESP_LOGI(TAG, "Sensor %u profile switched: mode %u, length %u", sensor, p.current_profile.mode, p.current_profile.length);
+        }
+        rates_t rates; //The rates control_task() runs at
+        effective_rates(configTICK_RATE_HZ, loop_rate, timings->sampling_rate, &rates);
+        if (p.current_profile.mode == profile_segments)
+        {
+            p.segment_engine.init(static_cast<const profile_segment_t*>(p.current_profile.data), p.current_profile.length,
+                p.current_profile.start, rates.loop_rate);
+        }
+        p.point_rate.configure(rates.point_rate, rates.loop_rate);
+        p.point_rate.arm();
+        p.cycle_ticks = 0;
+        p.cycle_counter = 0;
+        p.current_element = static_cast<const float*>(p.current_profile.data);
+    }
+
+    //Identifies the profile a baseline has been learned on
+    uint32_t profile_id(const profile_t& profile)
+    {
+        size_t element = (profile.mode == profile_segments) ? sizeof(profile_segment_t) : sizeof(float);
+        uint32_t crc = crc32_le(~0, reinterpret_cast<const uint8_t*>(&profile.mode), sizeof(profile.mode));
+        crc = crc32_le(crc, reinterpret_cast<const uint8_t*>(&profile.start), sizeof(profile.start));
+        return ~crc32_le(crc, static_cast<const uint8_t*>(profile.data), profile.length * element);
+    }
+
+    //Parser context: hand next_buffer (or a flash entry) over to the control task
+    bool commit_next(player_t& p, profile_mode mode, size_t length, float start, const void* data)
+    {
+        if (p.next_pending.load(std::memory_order_acquire) || length == 0) return false;
+        if (mode == profile_table && length > CYCLE_LENGTH) return false;
+        if (mode == profile_segments)
+        {
+            rates_t rates; //Segments are played at the loop rate cycle_end() configures
+            effective_rates(configTICK_RATE_HZ, my_params::get_timings()->oversampling_rate, 1, &rates);
+            if (length > PROFILE_MAX_SEGMENTS ||
+                !segment_profile::validate(static_cast<const profile_segment_t*>(data), length, rates.loop_rate))
+            {
+                return false;
+            }
+        }
+        p.next_profile = { mode, length, start, data };
+        p.upload_length = 0;
+        p.next_pending.store(true, std::memory_order_release);
+        return true;
+    }
+
+    bool upload_complete(const player_t& p)
+    {
+        if (p.upload_length == 0) return false;
+        for (size_t i = 0; i < p.upload_length; i++)
+        {
+            if (!(p.upload_received[i / 8] & _BV(i % 8))) return false;
+        }
+        return true;
+    }
+
+    profile_upload_status get_upload_status(const player_t& p)
+    {
+        profile_upload_status ret = {};
+        ret.pending = p.next_pending.load(std::memory_order_acquire);
+        if (ret.pending) return ret;
+        ret.length = p.upload_length;
+        for (ret.first_missing = 0; ret.first_missing < p.upload_length; ret.first_missing++)
+        {
+            if (!(p.upload_received[ret.first_missing / 8] & _BV(ret.first_missing % 8))) break;
+        }
+        return ret;
+    }
+
+    uint8_t begin_upload(player_t& p, uint16_t length)
+    {
+        if (p.next_pending.load(std::memory_order_acquire) || length == 0 || length > CYCLE_LENGTH) return RSP_SET_FAILED;
+        p.upload_length = length;
+        memset(p.upload_received, 0, sizeof(p.upload_received));
+        return RSP_OK;
+    }
+
+    //Returns the response code
+    uint8_t process_chunk(player_t& p, const profile_chunk_header* header, const uint8_t* data)
+    {
+        if (p.next_pending.load(std::memory_order_acquire)) return RSP_SET_FAILED;
+        if ((header->offset % sizeof(float)) || (header->length % sizeof(float)) || (header->length == 0) ||
+            (header->length > PROFILE_CHUNK_MAX) || (header->offset + header->length > p.upload_length * sizeof(float)))
+        {
+            ESP_LOGW(TAG, "Bad chunk: offset=%u, length=%u", header->offset, header->length);
+            return RSP_SET_FAILED;
+        }
+        if (~crc32_le(~0, data, header->length) != header->crc)
+        {
+            ESP_LOGW(TAG, "Chunk CRC error at %u", header->offset);
+            return RSP_BAD_CRC;
+        }
+        memcpy(reinterpret_cast<uint8_t*>(p.next_buffer) + header->offset, data, header->length);
+        for (size_t i = header->offset / sizeof(float); i < (header->offset + header->length) / sizeof(float); i++)
+        {
+            p.upload_received[i / 8] |= _BV(i % 8);
+        }
+        return RSP_OK;
+    }
+
+    uint8_t commit_upload(player_t& p, uint32_t crc)
+    {
+        if (!upload_complete(p) || p.next_pending.load(std::memory_order_acquire)) return RSP_SET_FAILED;
+        if (~crc32_le(~0, reinterpret_cast<uint8_t*>(p.next_buffer), p.upload_length * sizeof(float)) != crc) return RSP_BAD_CRC;
+        if (!commit_next(p, profile_table, p.upload_length, 0, p.next_buffer)) return RSP_SET_FAILED;
+        ESP_LOGI(TAG, "Profile upload committed");
+        return RSP_OK;
+    }
+
+    //A flash entry must not be rewritten while any sensor plays it or is about to
+    bool store_in_use(const profile_store_header_t* h)
+    {
+        if (h == NULL) return false;
+        const void* payload = profile_store::payload(h);
+        for (const player_t& p : players)
+        {
+            //next_pending first: once it reads false, a switched profile is already in current_profile
+            if (p.next_pending.load(std::memory_order_acquire) && p.next_profile.data == payload) return true;
+            if (p.current_profile.data == payload) return true;
+        }
+        return false;
+    }
+
+    uint8_t store_save(const player_t& p, uint8_t slot, const char* name)
+    {
+        //current_profile is only switched after a commit, so it's stable while nothing is pending
+        if (p.next_pending.load(std::memory_order_acquire)) return RSP_SET_FAILED;
+        if (store_in_use(my_profile_store::get(slot))) return RSP_SET_FAILED;
+        esp_err_t err = my_profile_store::save(slot, name, p.current_profile.mode, p.current_profile.length, 
+            p.current_profile.start, p.current_profile.data);
+        return (err == ESP_OK) ? RSP_OK : RSP_SET_FAILED;
+    }
+
+    uint8_t store_activate(player_t& p, uint8_t slot)
+    {
+        const profile_store_header_t* h = my_profile_store::get(slot);
+        if (h == NULL) return RSP_NO_DATA;
+        return commit_next(p, static_cast<profile_mode>(h->mode), h->length, h->start, profile_store::payload(h)) ? RSP_OK : RSP_SET_FAILED;
+    }
+
+    //Fixed-size setting commands, the ones allowed in a batch
+    bool get_setting_size(uint8_t cmd, size_t& size)
+    {
+        switch (cmd)
+        {
+        case CMD_SET_HEATER_PARAMS:
+            size = sizeof(heater_params);
+            return true;
+        case CMD_SET_MEASURE_PARAMS:
+            size = sizeof(measure_params);
+            return true;
+        case CMD_SET_PID_PARAMS:
+            size = sizeof(my_pid_params_t);
+            return true;
+        case CMD_SET_ADC_CAL:
+            size = sizeof(uint8_t) + sizeof(my_adc_cal_t); // channel index, calibration
+            return true;
+        case CMD_SET_DAC_CAL:
+            size = sizeof(my_dac_cal_t);
+            return true;
+        case CMD_SET_PID_TRACE_PERIOD:
+            size = sizeof(uint16_t);
+            return true;
+        case CMD_SET_SESSION:
+            size = sizeof(uint8_t);
+            return true;
+        case CMD_SET_TRIP_LIMITS:
+            size = sizeof(heater_limits_t);
+            return true;
+        case CMD_SELECT_SENSOR:
+            size = sizeof(uint8_t);
+            return true;
+        case CMD_SET_FEATURES:
+            size = sizeof(feature_config_t);
+            return true;
+        case CMD_SET_AVERAGING:
+            size = sizeof(average_config_t);
+            return true;
+        case CMD_SET_BASELINE:
+            size = sizeof(baseline_config_t);
+            return true;
+        case CMD_SET_EVENTS:
+            size = sizeof(event_config_t);
+            return true;
+        case CMD_SET_TIMINGS:
+            size = sizeof(my_timings_t);
+            return true;
+        case CMD_SET_FILTERS:
+            size = sizeof(filter_config_t);
+            return true;
+        case CMD_SET_HEATER_MODEL:
+            size = sizeof(heater_model_t);
+            return true;
+        case CMD_SAVE_NVS:
+            size = 0;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static_assert(sizeof(my_pid_params_t) <= SETTING_MAX_SIZE && sizeof(heater_params) <= SETTING_MAX_SIZE &&
+        sizeof(heater_limits_t) <= SETTING_MAX_SIZE && sizeof(feature_config_t) <= SETTING_MAX_SIZE &&
+        sizeof(average_config_t) <= SETTING_MAX_SIZE && sizeof(baseline_config_t) <= SETTING_MAX_SIZE &&
+        sizeof(event_config_t) <= SETTING_MAX_SIZE && sizeof(my_timings_t) <= SETTING_MAX_SIZE &&
+        sizeof(filter_config_t) <= SETTING_MAX_SIZE && sizeof(heater_model_t) <= SETTING_MAX_SIZE,
+        "Settings must fit the argument buffer");
+
+    bool validate_setting(uint8_t cmd, const uint8_t* args)
+    {
+        switch (cmd)
+        {
+        case CMD_SET_ADC_CAL:
+            return args[0] < MY_ADC_CHANNEL_NUM;
+        case CMD_SELECT_SENSOR:
+            return args[0] < MY_SENSOR_NUM;
+        case CMD_SET_HEATER_PARAMS:
+        {
+            heater_params heater;
+            memcpy(&heater, args, sizeof(heater));
+            return my_params::validate_heater_params(heater.tempco, heater.rt_resistance, heater.rt_temp);
+        }
+        case CMD_SET_SESSION:
+            return (args[0] >> MY_SENSOR_NUM) == 0;
+        case CMD_SET_FEATURES:
+        {
+            feature_config_t config;
+            memcpy(&config, args, sizeof(config));
+            return cycle_features::validate(&config);
+        }
+        case CMD_SET_AVERAGING:
+        {
+            average_config_t config;
+            memcpy(&config, args, sizeof(config));
+            return cycle_average<CYCLE_LENGTH>::validate(&config);
+        }
+        case CMD_SET_BASELINE:
+        {
+            baseline_config_t config;
+            memcpy(&config, args, sizeof(config));
+            return baseline_tracker<CYCLE_LENGTH>::validate(&config);
+        }
+        case CMD_SET_EVENTS:
+        {
+            event_config_t config;
+            memcpy(&config, args, sizeof(config));
+            return event_detector::validate(&config);
+        }
+        case CMD_SET_TIMINGS:
+        {
+            my_timings_t t;
+            memcpy(&t, args, sizeof(t));
+            //A loop rate change would stretch the profiles being played
+            return my_params::validate_timings(&t) &&
+                (t.oversampling_rate == my_params::get_timings()->oversampling_rate || my_sensors::idle());
+        }
+        case CMD_SET_FILTERS:
+        {
+            filter_config_t config;
+            memcpy(&config, args, sizeof(config));
+            return my_params::validate_filter_config(&config);
+        }
+        case CMD_SET_HEATER_MODEL:
+        {
+            heater_model_t m;
+            memcpy(&m, args, sizeof(m));
+            return my_params::validate_heater_model(selected, &m);
+        }
+        default:
+            return true;
+        }
+    }
+
+    //Returns the response code. Applies to the selected sensor, except for the trace period and the NVS save.
+    uint8_t apply_setting(uint8_t cmd, const uint8_t* args)
+    {
+        switch (cmd)
+        {
+        case CMD_SET_HEATER_PARAMS:
+        {
+            heater_params heater;
+            memcpy(&heater, args, sizeof(heater));
+            my_params::set_heater_coef(selected, heater.tempco);
+            my_params::set_rt_resistance(selected, heater.rt_resistance, heater.rt_temp);
+            break;
+        }
+        case CMD_SET_MEASURE_PARAMS:
+        {
+            measure_params measure;
+            memcpy(&measure, args, sizeof(measure));
+            my_params::set_ref_resistance(selected, measure.ref_resistance);
+            break;
+        }
+        case CMD_SET_PID_PARAMS:
+        {
+            my_pid_params_t pid;
+            memcpy(&pid, args, sizeof(pid));
+            my_params::set_pid_params(selected, &pid);
+            break;
+        }
+        case CMD_SET_ADC_CAL:
+        {
+            my_adc_cal_t cal;
+            memcpy(&cal, args + 1, sizeof(cal));
+            my_params::set_adc_channel_cal(selected, args[0], &cal);
+            break;
+        }
+        case CMD_SET_DAC_CAL:
+        {
+            my_dac_cal_t cal;
+            memcpy(&cal, args, sizeof(cal));
+            my_params::set_dac_cal(selected, &cal);
+            break;
+        }
+        case CMD_SET_PID_TRACE_PERIOD:
+        {
+            uint16_t period;
+            memcpy(&period, args, sizeof(period));
+            my_pid_trace::set_period(period);
+            break;
+        }
+        case CMD_SET_SESSION:
+            my_session::set_sensors(args[0]);
+            break;
+        case CMD_SET_TRIP_LIMITS:
+        {
+            heater_limits_t limits;
+            memcpy(&limits, args, sizeof(limits));
+            my_params::set_trip_limits(selected, &limits);
+            break;
+        }
+        case CMD_SELECT_SENSOR:
+            selected = args[0]; //Sticky, also for the commands after the batch
+            break;
+        case CMD_SET_FEATURES:
+        {
+            feature_config_t config;
+            memcpy(&config, args, sizeof(config));
+            my_params::set_feature_config(selected, &config);
+            break;
+        }
+        case CMD_SET_AVERAGING:
+        {
+            average_config_t config;
+            memcpy(&config, args, sizeof(config));
+            my_params::set_average_config(selected, &config);
+            break;
+        }
+        case CMD_SET_BASELINE:
+        {
+            baseline_config_t config;
+            memcpy(&config, args, sizeof(config));
+            my_params::set_baseline_config(selected, &config);
+            break;
+        }
+        case CMD_SET_EVENTS:
+        {
+            event_config_t config;
+            memcpy(&config, args, sizeof(config));
+            my_params::set_event_config(selected, &config);
+            break;
+        }
+        case CMD_SET_TIMINGS:
+        {
+            my_timings_t t;
+            memcpy(&t, args, sizeof(t));
+            my_params::set_timings(selected, &t);
+            break;
+        }
+        case CMD_SET_FILTERS:
+        {
+            filter_config_t config;
+            memcpy(&config, args, sizeof(config));
+            my_params::set_filter_config(selected, &config);
+            break;
+        }
+        case CMD_SET_HEATER_MODEL:
+        {
+            heater_model_t m;
+            memcpy(&m, args, sizeof(m));
+            my_params::set_heater_model(selected, &m);
+            break;
+        }
+        case CMD_SAVE_NVS:
+            return (my_params::save() == ESP_OK) ? RSP_OK : RSP_SET_FAILED;
+        default:
+            return RSP_SET_FAILED;
+        }
+        return RSP_OK;
+    }
 
-    float get_next()
+    //All sub-commands are checked before the first one is applied
+    void process_batch()
     {
-        if (++cycle_counter >= CYCLE_LENGTH) cycle_end();
-        return *current_element++;
+        static const batch_entry_header* entries[BATCH_MAX_COMMANDS];
+        static uint8_t reply[sizeof(batch_response_header) + BATCH_MAX_COMMANDS];
+        batch_response_header* header = reinterpret_cast<batch_response_header*>(reply);
+        uint8_t* codes = reply + sizeof(batch_response_header);
+        header->request_id = batch.request_id;
+        header->result = RSP_OK;
+        int count = (batch.size <= sizeof(batch_body)) ? batch_split(batch_body, batch.size, entries, BATCH_MAX_COMMANDS) : -1;
+        if (count < 0)
+        {
+            ESP_LOGW(TAG, "Malformed batch #%u", batch.request_id);
+            header->result = RSP_SET_FAILED;
+            header->count = 0;
+            transmitter::send_buffer(CMD_BATCH, reply, sizeof(batch_response_header));
+            return;
+        }
+        header->count = count;
+        for (int i = 0; i < count; i++)
+        {
+            size_t size;
+            bool ok = get_setting_size(entries[i]->cmd, size) && (entries[i]->length == size) && 
+                validate_setting(entries[i]->cmd, batch_args(entries[i]));
+            codes[i] = ok ? NO_STD_RSP : RSP_SET_FAILED;
+            if (!ok) header->result = RSP_SET_FAILED;
+        }
+        if (header->result == RSP_OK)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                codes[i] = apply_setting(entries[i]->cmd, batch_args(entries[i]));
+                if (codes[i] != RSP_OK) header->result = codes[i];
+            }
+            my_params::publish(); //The control loop sees either none or all of the batch
+        }
+        ESP_LOGI(TAG, "Batch #%u: %d commands, result %u", batch.request_id, count, header->result);
+        transmitter::send_buffer(CMD_BATCH, reply, sizeof(batch_response_header) + count);
     }
 
-    void cycle_end()
+    //The frame's CRC checked out: the only place where a staged command changes anything. Returns the response code
+    uint8_t apply_staged(uint8_t cmd)
     {
-        cycle_counter = 0;
-        current_element = current_buffer;
+        player_t& p = players[selected];
+        switch (cmd)
+        {
+        case CMD_BATCH:
+            process_batch();
+            return NO_STD_RSP;
+        case CMD_STOP:
+            if (!p.operate) return RSP_ALREADY_IN_REQUESTED_STATE;
+            p.operate = false; //The control task publishes the partial cycle and rewinds (my_uart::idle)
+            ESP_LOGI(TAG, "Sensor %u cycle STOP.", selected);
+            return RSP_OK;
+        case CMD_START:
+            if (p.operate) return RSP_ALREADY_IN_REQUESTED_STATE;
+            p.operate = true;
+            my_sensors::wake();
+            ESP_LOGI(TAG, "Sensor %u cycle START.", selected);
+            return RSP_OK;
+        case CMD_CLEAR_TRIP:
+            return my_trip::clear(selected) ? RSP_OK : RSP_ALREADY_IN_REQUESTED_STATE;
+        case CMD_STORE_SAVE:
+            return store_save(p, store_args.slot, store_args.name);
+        case CMD_STORE_ACTIVATE:
+            return store_activate(p, store_args.slot);
+        case CMD_SET_TEMP_CYCLE:
+            ESP_LOGI(TAG, "DAC loading finished");
+            return (profile_accepted && commit_next(p, profile_table, CYCLE_LENGTH, 0, p.next_buffer)) ? RSP_OK : RSP_SET_FAILED;
+        case CMD_SET_SEGMENTS:
+            return (profile_accepted && commit_next(p, profile_segments, segments_args.count, segments_args.start, p.next_buffer)) ?
+                RSP_OK : RSP_SET_FAILED;
+        case CMD_PROFILE_BEGIN:
+            return begin_upload(p, upload_points);
+        case CMD_PROFILE_CHUNK:
+            return process_chunk(p, &chunk_header, chunk_data);
+        case CMD_PROFILE_COMMIT:
+            return commit_upload(p, commit_crc);
+        case CMD_SAVE_NVS:
+            return apply_setting(cmd, NULL);
+        case CMD_ENABLE_PID_DBG:
+            my_params::enable_pid_dbg = !my_params::enable_pid_dbg;
+            return my_params::enable_pid_dbg ? RSP_OK : RSP_NO_DATA;
+        default: //Single setting commands
+        {
+            uint8_t rsp = validate_setting(cmd, setting_args) ? apply_setting(cmd, setting_args) : RSP_SET_FAILED;
+            my_params::publish();
+            return rsp;
+        }
+        }
     }
 
-    void process_args(uint8_t cmd, size_t& argument_index, size_t& stream_index, parser_state& state, uint8_t& response)
+    void process_args(uint8_t cmd, size_t& argument_index, uint8_t b, parser_state& state, uint8_t& response)
     {
         size_t lim = 0; //Last byte index (count - 1)
         switch (cmd)
         {
         case CMD_SET_TEMP_CYCLE: // DAC
-            lim = sizeof(buffer1) - 1;
-            reinterpret_cast<uint8_t*>(next_buffer)[argument_index] = receive_raw[stream_index];
+        {
+            //Only the parser writes next_buffer while nothing is pending, a bad frame leaves the current profile alone.
+            //The buffer is shared with chunked uploads: one in progress is dropped
+            player_t& p = players[selected];
+            lim = sizeof(p.buffer1) - 1;
+            if (argument_index == 0)
+            {
+                profile_accepted = !p.next_pending.load(std::memory_order_acquire);
+                if (profile_accepted) p.upload_length = 0;
+            }
+            if (profile_accepted) reinterpret_cast<uint8_t*>(p.next_buffer)[argument_index] = b;
             if (argument_index == lim)
             {
-                auto temp = current_buffer;
-                current_buffer = next_buffer;
-                next_buffer = temp;
-                cycle_end();
-                transmitter::cycle_end();
-                ESP_LOGI(TAG, "DAC loading finished");
-                break;
+                state = parser_state::reading_counter;
+                staged = true; //Committed once the CRC checks out
+                return;
             }
             break;
-        case CMD_SET_HEATER_PARAMS:
+        }
+        case CMD_SET_SEGMENTS:
         {
-            static heater_params heater = {};
-            lim = sizeof(heater) - 1;
-            reinterpret_cast<uint8_t*>(&heater)[argument_index] = receive_raw[stream_index];
+            player_t& p = players[selected];
+            lim = sizeof(segments_args) - 1;
+            if (argument_index <= lim)
+            {
+                reinterpret_cast<uint8_t*>(&segments_args)[argument_index] = b;
+                if (argument_index < lim) break;
+                profile_accepted = !p.next_pending.load(std::memory_order_acquire) &&
+                    (segments_args.count > 0) && (segments_args.count <= PROFILE_MAX_SEGMENTS);
+                if (profile_accepted) p.upload_length = 0; //As with CMD_SET_TEMP_CYCLE
+                if (segments_args.count == 0)
+                {
+                    state = parser_state::reading_counter;
+                    response = RSP_SET_FAILED;
+                }
+                return;
+            }
+            lim += segments_args.count * sizeof(profile_segment_t);
+            if (profile_accepted) reinterpret_cast<uint8_t*>(p.next_buffer)[argument_index - sizeof(segments_args)] = b;
             if (argument_index == lim)
             {
-                my_params::set_heater_coef(heater.tempco);
-                my_params::set_rt_resistance(heater.rt_resistance, heater.rt_temp);
+                state = parser_state::reading_counter;
+                staged = true; //Validated and committed once the CRC checks out
+                return;
             }
             break;
         }
-        case CMD_SET_MEASURE_PARAMS:
+        case CMD_STORE_SAVE:
+        case CMD_STORE_ACTIVATE:
         {
-            static measure_params measure = {};
-            lim = sizeof(measure) - 1;
-            reinterpret_cast<uint8_t*>(&measure)[argument_index] = receive_raw[stream_index];
+            lim = ((cmd == CMD_STORE_SAVE) ? sizeof(store_args) : sizeof(store_args.slot)) - 1;
+            reinterpret_cast<uint8_t*>(&store_args)[argument_index] = b;
             if (argument_index == lim)
             {
-                my_params::set_ref_resistance(measure.ref_resistance);
+                state = parser_state::reading_counter;
+                staged = true; //Flash is erased and written, or the profile switched, once the CRC checks out
+                return;
             }
             break;
         }
-        case CMD_SET_PID_PARAMS:
+        case CMD_PROFILE_BEGIN:
+        {
+            lim = sizeof(upload_points) - 1;
+            reinterpret_cast<uint8_t*>(&upload_points)[argument_index] = b;
+            if (argument_index == lim)
+            {
+                state = parser_state::reading_counter;
+                staged = true; //A corrupted BEGIN must not discard the upload in progress
+                return;
+            }
+            break;
+        }
+        case CMD_PROFILE_CHUNK:
+        {
+            lim = sizeof(chunk_header) - 1;
+            if (argument_index <= lim)
+            {
+                reinterpret_cast<uint8_t*>(&chunk_header)[argument_index] = b;
+                if (argument_index < lim) break;
+                if (chunk_header.length == 0)
+                {
+                    state = parser_state::reading_counter;
+                    response = RSP_SET_FAILED;
+                }
+                return; // Header complete, data follows
+            }
+            lim += chunk_header.length; // Oversized chunks are consumed but not stored
+            if (argument_index - sizeof(chunk_header) < sizeof(chunk_data)) chunk_data[argument_index - sizeof(chunk_header)] = b;
+            if (argument_index == lim)
+            {
+                state = parser_state::reading_counter;
+                staged = true; //Copied into next_buffer once the frame's CRC checks out, the chunk's own CRC then
+                return;
+            }
+            break;
+        }
+        case CMD_PROFILE_COMMIT:
         {
-            static my_pid_params_t pid = {};
-            lim = sizeof(pid) - 1;
-            reinterpret_cast<uint8_t*>(&pid)[argument_index] = receive_raw[stream_index];
+            lim = sizeof(commit_crc) - 1;
+            reinterpret_cast<uint8_t*>(&commit_crc)[argument_index] = b;
             if (argument_index == lim)
             {
-                my_params::set_pid_params(&pid);
+                state = parser_state::reading_counter;
+                staged = true; //Checked against the upload and committed once the frame's CRC checks out
+                return;
             }
             break;
         }
+        case CMD_SET_HEATER_PARAMS:
+        case CMD_SET_MEASURE_PARAMS:
+        case CMD_SET_PID_PARAMS:
         case CMD_SET_ADC_CAL:
+        case CMD_SET_DAC_CAL:
+        case CMD_SET_PID_TRACE_PERIOD:
+        case CMD_SET_SESSION:
+        case CMD_SET_TRIP_LIMITS:
+        case CMD_SELECT_SENSOR:
+        case CMD_SET_FEATURES:
+        case CMD_SET_AVERAGING:
+        case CMD_SET_BASELINE:
+        case CMD_SET_EVENTS:
+        case CMD_SET_TIMINGS:
+        case CMD_SET_FILTERS:
+        case CMD_SET_HEATER_MODEL:
         {
-            static my_adc_cal_t cal = {};
-            static uint8_t index = 0;
-            lim = sizeof(cal); // plus 1 byte for index
-            if (argument_index == 0)
+            size_t size = 0;
+            get_setting_size(cmd, size);
+            lim = size - 1;
+            setting_args[argument_index] = b;
+            if (argument_index == lim)
             {
-                index = receive_raw[stream_index];
+                state = parser_state::reading_counter;
+                staged = true; //Validated and applied once the CRC checks out
+                return;
             }
-            else
+            break;
+        }
+        case CMD_BATCH:
+        {
+            lim = sizeof(batch) - 1;
+            if (argument_index <= lim)
             {
-                reinterpret_cast<uint8_t *>(&cal)[argument_index - 1] = receive_raw[stream_index];
-                if (argument_index == lim)
+                reinterpret_cast<uint8_t*>(&batch)[argument_index] = b;
+                if (argument_index < lim) break;
+                if (batch.size == 0)
                 {
-                    my_params::set_adc_channel_cal(index, &cal);
+                    state = parser_state::reading_counter;
+                    response = RSP_SET_FAILED;
                 }
+                return; // Header complete, sub-commands follow
+            }
+            lim += batch.size; // Oversized batches are consumed but not stored, process_batch() rejects them
+            if (argument_index - sizeof(batch) < sizeof(batch_body)) batch_body[argument_index - sizeof(batch)] = b;
+            if (argument_index == lim)
+            {
+                state = parser_state::reading_counter;
+                staged = true;
+                return;
             }
             break;
         }
-        case CMD_SET_DAC_CAL:
+        case CMD_GET_DATA_SEQ:
         {
-            static my_dac_cal_t cal = {};
-            lim = sizeof(cal) - 1;
-            reinterpret_cast<uint8_t *>(&cal)[argument_index] = receive_raw[stream_index];
+            static uint32_t seq = 0;
+            lim = sizeof(seq) - 1;
+            reinterpret_cast<uint8_t *>(&seq)[argument_index] = b;
             if (argument_index == lim)
             {
-                my_params::set_dac_cal(&cal);
+                state = parser_state::reading_counter;
+                response = transmitter::send_cycle_data(selected, seq) ? NO_STD_RSP : RSP_NO_DATA;
+                return;
             }
             break;
         }
         default:
-            my_uart::raise_error(my_error_codes::unknown_cmd);
+            my_uart::raise_error(my_error_codes::unknown_cmd, cmd, argument_index);
             state = parser_state::searching_for_preamble;
             return;
         }
@@ -265,7 +951,7 @@ namespace receiver
         }
     }
 
-    void process_cmd(uint8_t cmd, size_t& stream_index, parser_state& state, uint8_t& response)
+    void process_cmd(uint8_t cmd, parser_state& state, uint8_t& response)
     {
         switch (cmd)
         {
@@ -278,59 +964,109 @@ namespace receiver
         }
 #endif
         case CMD_STOP:
-            if (my_uart::operate)
-            {
-                my_uart::operate = false;
-                cycle_end();
-                transmitter::cycle_end();
-                response = RSP_OK;
-                ESP_LOGI(TAG, "Cycle STOP.");
-            }
-            else
-            {
-                response = RSP_ALREADY_IN_REQUESTED_STATE;
-            }
-            break;
-        case CMD_START: // START
-            if (my_uart::operate)
-            {
-                response = RSP_ALREADY_IN_REQUESTED_STATE;
-            }
-            else
-            {
-                my_uart::operate = true;
-                response = RSP_OK;
-                ESP_LOGI(TAG, "Cycle START.");
-            }
+        case CMD_START:
+        case CMD_CLEAR_TRIP:
+        case CMD_SAVE_NVS:
+        case CMD_ENABLE_PID_DBG:
+            staged = true; //Applied once the CRC checks out
             break;
         case CMD_GET_DATA:
-            transmitter::send_cycle_data();
+            transmitter::send_cycle_data(selected);
+            break;
+        case CMD_STORE_LIST:
+        {
+            static profile_store_list_entry_t entries[PROFILE_STORE_LIST_MAX];
+            size_t n = my_profile_store::list(entries, PROFILE_STORE_LIST_MAX);
+            transmitter::send_buffer(CMD_STORE_LIST, reinterpret_cast<uint8_t*>(entries), n * sizeof(entries[0]));
+            break;
+        }
+        case CMD_PROFILE_STATUS:
+        {
+            profile_upload_status status = get_upload_status(players[selected]);
+            transmitter::send_buffer(CMD_PROFILE_STATUS, reinterpret_cast<uint8_t*>(&status), sizeof(status));
+            break;
+        }
+        case CMD_GET_FEATURES:
+            transmitter::send_features(selected);
+            break;
+        case CMD_GET_AVERAGE:
+            transmitter::send_average(selected);
+            break;
+        case CMD_GET_BASELINE:
+        {
+            static my_baseline_t baseline;
+            my_params::read_baseline(selected, &baseline);
+            transmitter::send_buffer(CMD_GET_BASELINE, reinterpret_cast<uint8_t*>(&baseline), sizeof(baseline));
+            break;
+        }
+        case CMD_GET_RATES:
+        {
+            rates_t rates;
+            effective_rates(configTICK_RATE_HZ, my_params::get_timings()->oversampling_rate,
+                my_params::get_timings(selected)->sampling_rate, &rates);
+            rates.measured_loop_rate = my_params::get_loop_rate();
+            transmitter::send_buffer(CMD_GET_RATES, reinterpret_cast<uint8_t*>(&rates), sizeof(rates));
             break;
+        }
+        case CMD_GET_BOOT:
+        {
+            boot_report_t report;
+            my_boot::get_report(&report);
+            transmitter::send_buffer(CMD_GET_BOOT, reinterpret_cast<uint8_t*>(&report), sizeof(report));
+            break;
+        }
+        case CMD_GET_POWER:
+        {
+            power_report_t report;
+            my_power::get_report(&report);
+            transmitter::send_buffer(CMD_GET_POWER, reinterpret_cast<uint8_t*>(&report), sizeof(report));
+            break;
+        }
+        case CMD_GET_TREND:
+        {
+            static trend_report_t trend;
+            trend = *my_sensors::read_trend(selected);
+            transmitter::send_buffer(CMD_GET_TREND, reinterpret_cast<uint8_t*>(&trend), sizeof(trend));
+            break;
+        }
         case CMD_GET_HAVE_DATA:
-            response = transmitter::have_data ? RSP_OK : RSP_NO_DATA;
+            response = transmitter::telemetry[selected].ring.have_data() ? RSP_OK : RSP_NO_DATA;
             break;
+        case CMD_GET_TRIP:
+        {
+            uint8_t trip = my_trip::get_trip(selected);
+            transmitter::send_buffer(CMD_GET_TRIP, &trip, sizeof(trip));
+            break;
+        }
         case CMD_GET_ERROR:
-            ESP_LOGI(TAG, "Current error flags: %x", static_cast<uint32_t>(my_uart::error_codes));
-            transmitter::send_buffer(CMD_GET_ERROR,
-                                     reinterpret_cast<uint8_t *>(&my_uart::error_codes),
-                                     sizeof(my_uart::error_codes));
-            my_uart::error_codes = my_error_codes::none;
-            state = parser_state::reading_counter;
+        {
+            uint32_t codes = my_uart::error_codes.exchange(my_error_codes::none);
+            ESP_LOGI(TAG, "Current error flags: %x", codes);
+            transmitter::send_buffer(CMD_GET_ERROR, reinterpret_cast<uint8_t *>(&codes), sizeof(codes));
             break;
+        }
+        case CMD_GET_FAULTS:
+        {
+            static uint8_t report[sizeof(fault_report_header) + FAULT_CODE_COUNT * sizeof(uint32_t) + 
+                FAULT_LOG_DEPTH * sizeof(fault_event_t)];
+            fault_report_header* header = reinterpret_cast<fault_report_header*>(report);
+            uint32_t* counters = reinterpret_cast<uint32_t*>(report + sizeof(fault_report_header));
+            fault_event_t* events = reinterpret_cast<fault_event_t*>(counters + FAULT_CODE_COUNT);
+            header->timestamp_us = static_cast<uint32_t>(esp_timer_get_time());
+            header->code_count = FAULT_CODE_COUNT;
+            my_uart::faults.take_counters(counters);
+            header->event_count = my_uart::faults.take_events(events, FAULT_LOG_DEPTH, &header->lost);
+            transmitter::send_buffer(CMD_GET_FAULTS, report, 
+                reinterpret_cast<uint8_t*>(events + header->event_count) - report);
+            break;
+        }
         case CMD_GET_NVS:
         {
             size_t len;
-            uint8_t* buf = my_params::get_nvs_dump(&len);
+            uint8_t* buf = my_params::get_nvs_dump(selected, &len);
             transmitter::send_buffer(CMD_GET_NVS, buf, len);
             break;
         }
-        case CMD_SAVE_NVS:
-            response = (my_params::save() == ESP_OK) ? RSP_OK : RSP_SET_FAILED;
-            break;
-        case CMD_ENABLE_PID_DBG:
-            my_params::enable_pid_dbg = !my_params::enable_pid_dbg;
-            response = my_params::enable_pid_dbg ? RSP_OK : RSP_NO_DATA;
-            break;
         default:
             state = parser_state::reading_args;
             return;
@@ -338,7 +1074,7 @@ namespace receiver
         state = parser_state::reading_counter;
     }
 
-    void parse_input(size_t sz)
+    void parse_input(const uint8_t* data, size_t sz)
     {
         static parser_state state = parser_state::searching_for_preamble;
         static uint8_t cmd;
@@ -349,66 +1085,68 @@ namespace receiver
         static bool cmd_complete;
         for (size_t stream_index = 0; stream_index < sz; stream_index++)
         {
+            uint8_t b = data[stream_index];
             if (escape_state)
             {
                 escape_state = false;
             }
             else
             {
-                if (receive_raw[stream_index] == escape)
+                if (b == escape)
                 {
                     escape_state = true;
-                    ESP_LOGI(TAG, "Escape encountered: next byte %x", receive_raw[stream_index]);
+                    ESP_LOGD(TAG, "Escape encountered");
                     continue;
                 }
                 else
                 {
-                    if (receive_raw[stream_index] == postamble) state = parser_state::postamble_encountered;
-                    if (receive_raw[stream_index] == preamble) state = parser_state::searching_for_preamble;
+                    if (b == postamble) state = parser_state::postamble_encountered;
+                    if (b == preamble) state = parser_state::searching_for_preamble;
                 }
             }
 
             switch (state)
             {
             case parser_state::searching_for_preamble:
-                if (receive_raw[stream_index] == preamble && !escape_state)
+                if (b == preamble && !escape_state)
                 {
                     state = parser_state::reading_cmd;
                     receiver_crc = ~0;
                     response = NO_STD_RSP;
                     cmd_complete = false;
-                    ESP_LOGI(TAG, "Preamble encountered");
+                    ESP_LOGD(TAG, "Preamble encountered");
                 }
                 break;
             case parser_state::reading_cmd:
             {
-                cmd = receive_raw[stream_index];
+                cmd = b;
                 argument_index = 0;
                 crc_check = true;
+                staged = false;
                 receiver_crc = crc32_le(receiver_crc, &cmd, sizeof(cmd));
-                ESP_LOGI(TAG, "CMD ecnountered: %u", cmd);
-                process_cmd(cmd, stream_index, state, response);
+                ESP_LOGD(TAG, "CMD encountered: %u", cmd);
+                process_cmd(cmd, state, response);
                 break;
             }
             case parser_state::reading_args:
             {
-                receiver_crc = crc32_le(receiver_crc, &(receive_raw[stream_index]), sizeof(receive_raw[stream_index]));
-                process_args(cmd, argument_index, stream_index, state, response);
+                receiver_crc = crc32_le(receiver_crc, &b, sizeof(b));
+                process_args(cmd, argument_index, b, state, response);
                 argument_index++;
                 break;
             }
             case parser_state::reading_counter:
             {
-                uint8_t wdt = receive_raw[stream_index];
+                uint8_t wdt = b;
                 if (wdt != ++receiver_wdt)
                 {
                     receiver_wdt = wdt;
-                    my_uart::raise_error(my_error_codes::missed_packet);
+                    my_uart::raise_error(my_error_codes::missed_packet, cmd, argument_index);
                     ESP_LOGI(TAG, "WDT error detected");
                 }
                 receiver_crc = ~crc32_le(receiver_crc, &receiver_wdt, sizeof(receiver_wdt));
-                ESP_LOGI(TAG, "Calculated inbound CRC: %x", receiver_crc);
-                ESP_LOGI(TAG, "WDT: %u", receiver_wdt);
+                ESP_LOGD(TAG, "Calculated inbound CRC: %x", receiver_crc);
+                ESP_LOGD(TAG, "WDT: %u", receiver_wdt);
                 argument_index = 0;
                 state = parser_state::reading_crc;
                 break;
@@ -416,26 +1154,29 @@ namespace receiver
             case parser_state::reading_crc:
                 if (cmd_complete)
                 {
-                    my_uart::raise_error(my_error_codes::incorrect_command_format);
+                    my_uart::raise_error(my_error_codes::incorrect_command_format, cmd, argument_index);
                     state = parser_state::searching_for_preamble;
                 }
                 else
                 {
-                    //ESP_LOGI(TAG, "CRC check: %x, index: %i", receive_raw[stream_index], argument_index);
                     crc_check = crc_check && 
-                        (reinterpret_cast<uint8_t *>(&receiver_crc)[argument_index] == receive_raw[stream_index]);
+                        (reinterpret_cast<uint8_t *>(&receiver_crc)[argument_index] == b);
                     if (++argument_index == sizeof(receiver_crc))
                     {
                         if (crc_check)
                         {
-                            ESP_LOGI(TAG, "CRC OK");
+                            ESP_LOGD(TAG, "CRC OK");
                         }
                         else
                         {
                             response = RSP_BAD_CRC;
+                            my_uart::raise_error(my_error_codes::bad_crc, cmd);
                             ESP_LOGW(TAG, "CRC ERROR");
                         }
+                        if (crc_check && staged) response = apply_staged(cmd);
                         if (response != NO_STD_RSP) transmitter::send_cmd_response(cmd, response);
+                        session_command_t c = { static_cast<uint32_t>(esp_timer_get_time()), cmd, response, crc_check, 0 };
+                        my_session::push_command(selected, &c);
                         cmd_complete = true;
                         //Should encounter the postamble byte next and automatically switch the state
                     }
@@ -444,16 +1185,19 @@ namespace receiver
             case parser_state::postamble_encountered:
                 if (!cmd_complete)
                 {
-                    my_uart::raise_error(my_error_codes::incorrect_command_format);
+                    my_uart::raise_error(my_error_codes::incorrect_command_format, cmd, argument_index);
                 }
                 state = parser_state::searching_for_preamble;
                 cmd_complete = false;
-                ESP_LOGI(TAG, "Postamble encountered");
+                ESP_LOGD(TAG, "Postamble encountered");
                 break;
-            default:
-                my_uart::raise_error(my_error_codes::uart_parser_error);
+            default: //Corrupted state: drop the frame in progress and resync on the next preamble
+                ESP_LOGE(TAG, "Parser state %u is invalid, frame dropped", static_cast<unsigned>(state));
+                my_uart::raise_error(my_error_codes::uart_parser_error, cmd, argument_index);
                 state = parser_state::searching_for_preamble;
-                // TODO error handling
+                escape_state = false;
+                cmd_complete = false;
+                argument_index = 0;
                 break;
             }
         }
@@ -461,26 +1205,25 @@ namespace receiver
 
     void init()
     {
-        parser_semaphore = xSemaphoreCreateBinary();
-        assert(parser_semaphore);
-        xSemaphoreGive(parser_semaphore);
-        parser_queue_handle = xQueueCreate(10, sizeof(size_t));
-        assert(parser_queue_handle);
+        for (player_t& p : players)
+        {
+            p.current_profile = { profile_table, CYCLE_LENGTH, 0, p.buffer1 };
+            p.current_element = p.buffer1;
+            p.next_buffer = p.buffer2;
+        }
+        rx_stream = xStreamBufferCreate(RX_STREAM_SIZE, 1);
+        assert(rx_stream);
         xTaskCreatePinnedToCore(parser_task, "input_parser", 4096, NULL, 1, &parser_task_handle, 0);
         assert(parser_task_handle);
     }
 
     void parser_task(void *arg)
     {
+        static uint8_t chunk[RX_CHUNK_SIZE];
         while (1)
         {
-            size_t b;
-            auto r = xQueueReceive(parser_queue_handle, &b, portMAX_DELAY);
-            if (r == pdTRUE)
-            {
-                parse_input(b);
-                xSemaphoreGive(parser_semaphore);
-            }
+            size_t n = xStreamBufferReceive(rx_stream, chunk, sizeof(chunk), portMAX_DELAY);
+            if (n > 0) parse_input(chunk, n);
         }
     }
 }
@@ -492,115 +1235,263 @@ namespace receiver
 namespace transmitter
 {
     static uint32_t crc_dump_init_value;
+    static uint32_t crc_features_init_value;
+    static uint32_t crc_average_init_value;
 
-    void write_dbg(float val)
+    //Frames may be larger than the TX FIFO: queue what fits, flush and wait for the host to take it, until all is queued
+    bool write_all(const uint8_t* buf, size_t sz)
     {
-        write_immedeately(reinterpret_cast<uint8_t*>(&val), sizeof(val));
+        TickType_t start = xTaskGetTickCount();
+        size_t queued = tinyusb_cdcacm_write_queue(CDC_CHANNEL, buf, sz);
+        while (queued < sz)
+        {
+            if (xTaskGetTickCount() - start > pdMS_TO_TICKS(CDC_WRITE_TIMEOUT))
+            {
+                ESP_LOGW(TAG, "TX timeout, %u of %u bytes queued", queued, sz);
+                tinyusb_cdcacm_write_flush(CDC_CHANNEL, 0);
+                return false;
+            }
+            tinyusb_cdcacm_write_flush(CDC_CHANNEL, pdMS_TO_TICKS(CDC_FLUSH_WAIT));
+            queued += tinyusb_cdcacm_write_queue(CDC_CHANNEL, buf + queued, sz - queued);
+        }
+        tinyusb_cdcacm_write_flush(CDC_CHANNEL, 0);
+        return true;
     }
 
     void write_immedeately(const uint8_t* buf, size_t sz)
     {
-        tinyusb_cdcacm_write_queue(CDC_CHANNEL, buf, sz);
-        tinyusb_cdcacm_write_flush(CDC_CHANNEL, 0);
+        write_all(buf, sz);
     }
     
-    void send_buffer(uint8_t cmd, uint8_t* buffer, size_t sz)
+    bool send_buffer(uint8_t cmd, uint8_t* buffer, size_t sz)
     {
         uint32_t crc = crc32_le(~0, &cmd, sizeof(cmd));
         crc = crc32_le(crc, buffer, sz);
-        send_precalc_buffer(cmd, buffer, sz, crc);
+        return send_precalc_buffer(cmd, buffer, sz, crc);
+    }
+
+    bool send_precalc_buffer(uint8_t cmd, uint8_t* buffer, size_t sz, uint32_t crc)
+    {
+        xSemaphoreTake(transmit_mutex, portMAX_DELAY);
+        static uint8_t escape_buffer[FRAME_ENCODED_MAX(payload_max_size)];
+        crc = ~crc32_le(crc, &wdt_counter, sizeof(wdt_counter));
+        ESP_LOGD(TAG, "Outbound CRC: %x", crc);
+        size_t len = frame_encode(escape_buffer, cmd, buffer, sz, wdt_counter, crc);
+        bool sent = write_all(escape_buffer, len);
+        wdt_counter++;
+        xSemaphoreGive(transmit_mutex);
+        if (!sent)
+        {
+            my_uart::raise_error(my_error_codes::tx_incomplete, cmd);
+            return false;
+        }
+        ESP_LOGD(TAG, "Sent a data packet.");
+        return true;
     }
 
-    void escape_helper(uint8_t*& current, uint8_t value)
+    void send_cmd_response(uint8_t cmd, uint8_t rsp)
     {
-        switch (value)
+        send_buffer(cmd, &rsp, sizeof(rsp));
+    }
+
+    void send_slot(cycle_ring<cycle_data_t>& ring, slot_t* slot)
+    {
+        size_t len = offsetof(cycle_data_t, points) + slot->length * sizeof(float);
+        if (send_precalc_buffer(CMD_GET_DATA, reinterpret_cast<uint8_t*>(slot->data), len, slot->crc)) ring.release(slot);
+        else ring.requeue(slot); //The host gets it with its next CMD_GET_DATA
+    }
+
+    void send_cycle_data(size_t sensor)
+    {
+        cycle_ring<cycle_data_t>& ring = telemetry[sensor].ring;
+        slot_t* slot = ring.acquire();
+        if (slot == NULL)
         {
-        case preamble:
-        case postamble:
-        case escape:
-            *current++ = escape;
-            break;
-        default:
-            break;
+            send_cmd_response(CMD_GET_DATA, RSP_NO_DATA);
+            return;
         }
-        *current++ = value;
+        send_slot(ring, slot);
     }
 
-    void send_precalc_buffer(uint8_t cmd, uint8_t* buffer, size_t sz, uint32_t crc)
+    bool send_cycle_data(size_t sensor, uint32_t seq)
     {
-        static uint8_t escape_buffer[TRANSMIT_BUFFER_SIZE * sizeof(float) * 2];
-        crc = ~crc32_le(crc, &wdt_counter, sizeof(wdt_counter));
-        ESP_LOGI(TAG, "Outbound CRC: %x", crc);
-        uint8_t* current = escape_buffer;
-        *current++ = preamble;
-        escape_helper(current, cmd);
-        for (size_t i = 0; i < sz; i++)
+        cycle_ring<cycle_data_t>& ring = telemetry[sensor].ring;
+        slot_t* slot = ring.acquire(seq);
+        if (slot == NULL)
         {
-            escape_helper(current, buffer[i]);
+            ESP_LOGW(TAG, "Sensor %u cycle #%u is not available", sensor, seq);
+            return false;
         }
-        escape_helper(current, wdt_counter);
-        for (size_t i = 0; i < sizeof(crc); i++)
+        send_slot(ring, slot);
+        return true;
+    }
+
+    void send_features(size_t sensor)
+    {
+        cycle_ring<feature_data_t>& ring = telemetry[sensor].feature_ring;
+        feature_slot_t* slot = ring.acquire();
+        if (slot == NULL)
         {
-            escape_helper(current, reinterpret_cast<uint8_t*>(&crc)[i]);
+            send_cmd_response(CMD_GET_FEATURES, RSP_NO_DATA);
+            return;
         }
-        *current++ = postamble;
-        tinyusb_cdcacm_write_queue(CDC_CHANNEL, escape_buffer, current - escape_buffer);
-        tinyusb_cdcacm_write_flush(CDC_CHANNEL, 0);
-        wdt_counter++;
-        ESP_LOGI(TAG, "Sent a data packet.");
+        if (send_precalc_buffer(CMD_GET_FEATURES, slot->data->report, slot->length, slot->crc)) ring.release(slot);
+        else ring.requeue(slot);
     }
 
-    void send_cmd_response(uint8_t cmd, uint8_t rsp)
+    void send_average(size_t sensor)
     {
-        send_buffer(cmd, &rsp, sizeof(rsp));
+        cycle_ring<average_data_t>& ring = telemetry[sensor].average_ring;
+        average_slot_t* slot = ring.acquire();
+        if (slot == NULL)
+        {
+            send_cmd_response(CMD_GET_AVERAGE, RSP_NO_DATA);
+            return;
+        }
+        if (send_precalc_buffer(CMD_GET_AVERAGE, slot->data->report, slot->length, slot->crc)) ring.release(slot);
+        else ring.requeue(slot);
     }
 
-    void send_cycle_data()
+    //Sensor's control task
+    void publish_average(size_t sensor)
     {
-        xSemaphoreTake(transmit_mutex, portMAX_DELAY);
+        telemetry_t& t = telemetry[sensor];
+        if (t.average.cycle_end())
+        {
+            average_slot_t* slot = t.average_ring.producer_slot();
+            slot->length = t.average.finish(slot->seq, slot->data->report);
+            slot->crc = crc32_le(crc_average_init_value, slot->data->report, slot->length);
+            if (!t.average_ring.publish()) my_uart::raise_error(my_error_codes::data_overrun);
+        }
+        if (t.average_config != NULL) t.average.configure(t.average_config); //Takes effect with the next cycle
+    }
+
+    //Sensor's control task: hands the baseline to the params layer, which serves CMD_GET_BASELINE and saves it
+    void publish_baseline(size_t sensor)
+    {
+        telemetry_t& t = telemetry[sensor];
+        if (t.baseline.get_mode() != baseline_off)
+        {
+            uint16_t save_cycles = t.baseline_config->save_cycles;
+            bool save = (save_cycles > 0) && (t.baseline_cycles + 1u >= save_cycles);
+            if (my_params::update_baseline(sensor, t.baseline.get_state(), save))
+            {
+                t.baseline_cycles = save ? 0 : t.baseline_cycles + 1; //Retried next cycle if the params were busy
+            }
+        }
+        if (t.baseline_config != NULL) t.baseline.configure(t.baseline_config);
+    }
 
-        send_precalc_buffer(CMD_GET_DATA, reinterpret_cast<uint8_t*>(full_buffer->start), sizeof(data_buffer1), full_buffer->crc);
-        have_data = false;
+    //Sensor's control task
+    void publish_features(size_t sensor)
+    {
+        telemetry_t& t = telemetry[sensor];
+        if (!t.features_started) return; //No points since the last cycle end
+        t.features_started = false;
+        feature_slot_t* slot = t.feature_ring.producer_slot();
+        slot->length = t.features.finish(slot->seq, slot->data->report);
+        if (slot->length == 0) return; //Disabled
+        slot->crc = crc32_le(crc_features_init_value, slot->data->report, slot->length);
+        if (!t.feature_ring.publish()) my_uart::raise_error(my_error_codes::data_overrun);
+    }
 
-        xSemaphoreGive(transmit_mutex);
+    void start_slot(slot_t* slot)
+    {
+        slot->data->seq = slot->seq;
+        slot->length = 0;
+        slot->crc = crc32_le(crc_dump_init_value, reinterpret_cast<uint8_t*>(&slot->data->seq), sizeof(slot->data->seq));
     }
 
-    void enqueue_next(float res, float temp)
+    //Sensor's control task. Returns false on overrun.
+    bool publish(size_t sensor)
     {
-        if (++cycle_counter >= CYCLE_LENGTH) cycle_end();
-        *empty_buffer->current++ = temp;
-        *empty_buffer->current++ = res;
-        empty_buffer->crc = crc32_le(empty_buffer->crc,
-            reinterpret_cast<uint8_t*>(empty_buffer->current - FLOATS_PER_POINT), 
-            sizeof(float) * FLOATS_PER_POINT);
-        /*ESP_LOGI(TAG, "Incremental CRC: %x, float1: %x, float2: %x", ~empty_buffer->crc, 
-            *reinterpret_cast<uint32_t*>(&temp), *reinterpret_cast<uint32_t*>(&res));*/
+        cycle_ring<cycle_data_t>& ring = telemetry[sensor].ring;
+        if (ring.producer_slot()->length == 0) return true; //Nothing to publish
+        bool ok = ring.publish();
+        start_slot(ring.producer_slot());
+        return ok;
     }
 
-    void cycle_end()
+    //Sensor's control task
+    void enqueue_next(size_t sensor, float res, float temp, uint32_t timestamp_us, size_t index)
     {
-        xSemaphoreTake(transmit_mutex, portMAX_DELAY);
+        telemetry_t& t = telemetry[sensor];
+        float ratio = t.baseline.update(index, res);
+        if (t.baseline.get_mode() == baseline_normalize) res = ratio; //Everything downstream sees the normalized value
+        event_frame_t frame;
+        if (t.events.push(timestamp_us, index, ratio, &frame))
+        {
+            frame.sensor = static_cast<uint8_t>(sensor);
+            my_events::push(&frame);
+        }
+        t.average.push(index, temp, res);
+        if (!t.features_started && t.feature_config != NULL)
+        {
+            t.features.begin(t.feature_config);
+            t.features_started = true;
+        }
+        t.features.push(temp, res);
+        if (t.features.get_mode() == features_only || t.average.enabled()) return; //Only the reports go to the host
+        cycle_ring<cycle_data_t>& ring = t.ring;
+        bool ok = true;
+        if (ring.producer_slot()->length >= TRANSMIT_BUFFER_SIZE) ok = publish(sensor); //Long segment profiles span several slots
+        slot_t* slot = ring.producer_slot();
+        float* current = slot->data->points + slot->length;
+        *current++ = temp;
+        *current++ = res;
+        memcpy(current++, &timestamp_us, sizeof(timestamp_us));
+        slot->length += FLOATS_PER_POINT;
+        slot->crc = crc32_le(slot->crc,
+            reinterpret_cast<uint8_t*>(current - FLOATS_PER_POINT), 
+            sizeof(float) * FLOATS_PER_POINT);
+        if (!ok) my_uart::raise_error(my_error_codes::data_overrun);
+    }
 
-        cycle_counter = 0;
-        auto temp = full_buffer;
-        full_buffer = empty_buffer;
-        empty_buffer = temp;
-        empty_buffer->crc = crc_dump_init_value;
-        empty_buffer->current = empty_buffer->start;
-        have_data = true;
+    //Sensor's control task
+    void cycle_end(size_t sensor)
+    {
+        if (!publish(sensor)) my_uart::raise_error(my_error_codes::data_overrun);
+        publish_features(sensor);
+        publish_average(sensor);
+        publish_baseline(sensor);
+        telemetry_t& t = telemetry[sensor];
+        t.events.cycle_end();
+        if (t.event_config != NULL) t.events.configure(t.event_config);
+    }
 
-        xSemaphoreGive(transmit_mutex);
+    //Sensor's control task: points of the new profile don't line up with the averaged ones or the baseline
+    void profile_switched(size_t sensor, uint32_t profile)
+    {
+        telemetry[sensor].average.restart();
+        telemetry[sensor].baseline.set_profile(profile);
+        telemetry[sensor].events.reset(); //The baseline may be gone
     }
 
     void init()
     {
         static const uint8_t cmd_designator = CMD_GET_DATA;
+        static const uint8_t features_designator = CMD_GET_FEATURES;
+        static const uint8_t average_designator = CMD_GET_AVERAGE;
 
-        assert((sizeof(buffers) / sizeof(buffer_t*)) == buffers_count);
-        assert(sizeof(data_buffer1) == sizeof(data_buffer2));
+        crc_dump_init_value = crc32_le(~0, &cmd_designator, sizeof(cmd_designator));
+        crc_features_init_value = crc32_le(~0, &features_designator, sizeof(features_designator));
+        crc_average_init_value = crc32_le(~0, &average_designator, sizeof(average_designator));
         transmit_mutex = xSemaphoreCreateMutex();
         assert(transmit_mutex);
-        crc_dump_init_value = crc32_le(~0, &cmd_designator, sizeof(cmd_designator));
+        for (size_t i = 0; i < MY_SENSOR_NUM; i++)
+        {
+#if CYCLE_RING_IN_PSRAM
+            ring_storage[i] = static_cast<cycle_data_t*>(heap_caps_malloc(sizeof(cycle_data_t) * CYCLE_RING_DEPTH, MALLOC_CAP_SPIRAM));
+            assert(ring_storage[i]);
+#endif
+            telemetry[i].ring.init(ring_storage[i]);
+            start_slot(telemetry[i].ring.producer_slot());
+            telemetry[i].feature_ring.init(feature_storage[i]);
+            telemetry[i].average_ring.init(average_storage[i]);
+            telemetry[i].baseline.restore(my_params::get_baseline(i));
+            telemetry[i].baseline.set_profile(receiver::profile_id(receiver::players[i].current_profile));
+        }
+        ESP_LOGI(TAG, "Cycle rings: %u x %u slots of %u bytes", MY_SENSOR_NUM, CYCLE_RING_DEPTH, sizeof(cycle_data_t));
     }
 }
 
@@ -608,22 +1499,25 @@ namespace transmitter
  * Driver Callbacks
  */
 
+//TinyUSB task context: copy and return, never wait for the parser
 void tinyusb_cdc_rx_callback(int itf, cdcacm_event_t *event)
 {
-    static size_t rx_size = 0;
+    uint8_t buf[RX_CHUNK_SIZE];
+    size_t rx_size = 0;
 
-    xSemaphoreTake(receiver::parser_semaphore, portMAX_DELAY);
-    /* read */
-    esp_err_t ret = tinyusb_cdcacm_read((tinyusb_cdcacm_itf_t)itf, receiver::receive_raw, sizeof(receiver::receive_raw), &rx_size);
-    if (ret == ESP_OK)
+    do
     {
-        ESP_LOGI(TAG, "Data from channel %d: %i bytes.", itf, rx_size);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Read error");
-    }
-    xQueueSend(receiver::parser_queue_handle, &rx_size, portMAX_DELAY);
+        esp_err_t ret = tinyusb_cdcacm_read((tinyusb_cdcacm_itf_t)itf, buf, sizeof(buf), &rx_size);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Read error");
+            return;
+        }
+        if (xStreamBufferSend(receiver::rx_stream, buf, rx_size, 0) < rx_size)
+        {
+            my_uart::raise_error(my_error_codes::rx_overflow); //Parser has fallen behind, the frame will fail its CRC
+        }
+    } while (rx_size == sizeof(buf));
 }
 
 /***
@@ -632,35 +1526,105 @@ void tinyusb_cdc_rx_callback(int itf, cdcacm_event_t *event)
 
 namespace my_uart
 {
-    void fill_buffer_dbg(float start, float end) //linear interp
+    void fill_buffer_dbg(size_t sensor, float start, float end) //linear interp
     {
+        receiver::player_t& p = receiver::players[sensor];
+        if (p.next_pending.load(std::memory_order_acquire))
+        {
+            ESP_LOGW(TAG, "Previous profile hasn't been applied yet");
+            return;
+        }
         float inc = (end - start) / CYCLE_LENGTH;
         for (size_t i = 0; i < CYCLE_LENGTH; i++)
         {
-            receiver::current_buffer[i] = start;
+            p.next_buffer[i] = start;
             start += inc;
         }
+        receiver::commit_next(p, profile_table, CYCLE_LENGTH, 0, p.next_buffer);
     }
-    void raise_error(my_error_codes err)
+    void raise_error(my_error_codes err, uint8_t cmd, uint16_t offset)
     {
-        error_codes |= err;
-        ESP_LOGI(TAG, "Error raised: %x", static_cast<uint32_t>(error_codes));
+        error_codes.fetch_or(err, std::memory_order_relaxed);
+        fault_event_t context = {};
+        context.timestamp_us = static_cast<uint32_t>(esp_timer_get_time());
+        context.cmd = cmd;
+        context.offset = offset;
+        context.temp = last_temp.load(std::memory_order_relaxed);
+        for (uint32_t bits = err; bits; bits &= bits - 1)
+        {
+            faults.raise(__builtin_ctz(bits), context);
+        }
+        ESP_LOGD(TAG, "Error raised: %x", static_cast<uint32_t>(err));
     }
-    bool get_operate()
+    void note_temperature(float temp)
     {
-        return operate;
+        last_temp.store(temp, std::memory_order_relaxed);
     }
-    float first()
+    bool get_operate(size_t sensor)
     {
-        return receiver::get_next();
+        return receiver::players[sensor].operate;
     }
-    float next(float temp, float res)
+    float first(size_t sensor)
     {
-        transmitter::enqueue_next(res, temp);
-        float ret = receiver::get_next();
-        return ret;
+        return receiver::tick(sensor);
+    }
+    bool point_due(size_t sensor)
+    {
+        return receiver::players[sensor].point_rate.due();
+    }
+    void enqueue(size_t sensor, float temp, float res, uint32_t timestamp_us)
+    {
+        receiver::player_t& p = receiver::players[sensor];
+        if (p.cycle_ticks == 0) return;
+        //Measured at the previous setpoint: its position in the profile is the averaging bin
+        transmitter::enqueue_next(sensor, res, temp, timestamp_us, p.cycle_counter - 1);
+    }
+    float tick(size_t sensor)
+    {
+        return receiver::tick(sensor);
+    }
+    void set_feature_config(size_t sensor, const feature_config_t* config)
+    {
+        transmitter::telemetry[sensor].feature_config = config;
+    }
+    void set_average_config(size_t sensor, const average_config_t* config)
+    {
+        transmitter::telemetry[sensor].average_config = config;
+    }
+    void set_baseline_config(size_t sensor, const baseline_config_t* config)
+    {
+        transmitter::telemetry[sensor].baseline_config = config;
+    }
+    void set_event_config(size_t sensor, const event_config_t* config)
+    {
+        transmitter::telemetry[sensor].event_config = config;
+    }
+    void set_timings(size_t sensor, const my_timings_t* timings)
+    {
+        receiver::players[sensor].timings = timings;
+    }
+    bool cycle_started(size_t sensor)
+    {
+        return receiver::players[sensor].cycle_ticks == 1;
+    }
+    bool setpoint_is_continuous(size_t sensor)
+    {
+        return receiver::players[sensor].current_profile.mode == profile_segments;
+    }
+    void idle(size_t sensor)
+    {
+        receiver::player_t& p = receiver::players[sensor];
+        if (p.cycle_ticks > 0 || p.next_pending.load(std::memory_order_relaxed)) receiver::cycle_end(sensor);
     }
     void init()
+    {
+        receiver::init();
+        transmitter::init();
+        my_pid_trace::init();
+        my_events::init();
+        my_session::init();
+    }
+    void init_usb()
     {
         ESP_LOGI(TAG, "USB initialization");
         const tinyusb_config_t tusb_cfg = {}; // the configuration using default values
@@ -678,14 +1642,9 @@ namespace my_uart
 
         ESP_ERROR_CHECK(tusb_cdc_acm_init(&amc_cfg));
         ESP_LOGI(TAG, "USB initialization DONE");
-
-        receiver::init();
-        transmitter::init();
     }
-    void send_pid_dbg(float temp, float voltage)
+    bool send_frame(uint8_t cmd, uint8_t* buf, size_t sz)
     {
-        transmitter::write_dbg(debug_prefix);
-        transmitter::write_dbg(temp);
-        transmitter::write_dbg(voltage);
+        return transmitter::send_buffer(cmd, buf, sz);
     }
 }
\ No newline at end of file
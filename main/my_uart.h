@@ -1,6 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include "my_board.h"
+#include "cycle_features.h"
+#include "cycle_average.h"
+#include "baseline_tracker.h"
+#include "event_detector.h"
+#include "my_protocol.h"
 
 #define _BV(s) (1u << (s))
 
@@ -13,24 +20,42 @@ enum my_error_codes : uint32_t
     unknown_cmd = _BV(3),
     missed_packet = _BV(4),
     uart_parser_error = _BV(5),
-    incorrect_command_format = _BV(6)
+    incorrect_command_format = _BV(6),
+    data_overrun = _BV(7),
+    rx_overflow = _BV(8),
+    nvs_error = _BV(9),
+    bad_crc = _BV(10),
+    tx_incomplete = _BV(11) // A frame didn't fit into the CDC TX FIFO before CDC_WRITE_TIMEOUT, the host gets a CRC error
 };
 inline my_error_codes operator|(my_error_codes a, my_error_codes b)
 {
     return static_cast<my_error_codes>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
 }
-inline my_error_codes operator|=(my_error_codes a, my_error_codes b)
+inline my_error_codes& operator|=(my_error_codes& a, my_error_codes b)
 {
-    return a | b;
+    return a = a | b;
 }
 
 namespace my_uart
 {
-    void fill_buffer_dbg(float start, float end);
-    void init();
-    float next(float temp, float res);
-    float first();
-    bool get_operate();
-    void raise_error(my_error_codes err);
-    void send_pid_dbg(float temp, float voltage);
+    void fill_buffer_dbg(size_t sensor, float start, float end);
+    void init(); // Protocol state and tasks, after my_params::init()
+    void init_usb(); // TinyUSB and the CDC port, after init(). Any core
+    //Per sensor, from that sensor's control task only
+    float first(size_t sensor);
+    bool point_due(size_t sensor); // Whether the next tick() starts a telemetry point: enqueue the current one first
+    void enqueue(size_t sensor, float temp, float res, uint32_t timestamp_us); // Telemetry point, when point_due()
+    float tick(size_t sensor); // Advance the temperature profile by one control tick, returns the setpoint
+    void set_feature_config(size_t sensor, const feature_config_t* config); // Snapshot member, re-set on every parameter change
+    void set_average_config(size_t sensor, const average_config_t* config); // Likewise
+    void set_baseline_config(size_t sensor, const baseline_config_t* config); // Likewise
+    void set_event_config(size_t sensor, const event_config_t* config); // Likewise
+    void set_timings(size_t sensor, const my_timings_t* timings); // Likewise
+    bool cycle_started(size_t sensor); // The last tick() was the first of a cycle
+    bool setpoint_is_continuous(size_t sensor); // Setpoint changes every tick: bypass the PID dead band
+    void idle(size_t sensor); // Call from the control task while not operating
+    bool get_operate(size_t sensor);
+    void raise_error(my_error_codes err, uint8_t cmd = 0, uint16_t offset = 0); // Any task, lock-free; context for the fault log
+    void note_temperature(float temp); // Control loop, fault log context
+    bool send_frame(uint8_t cmd, uint8_t* buf, size_t sz); // Thread-safe, false if the USB stack didn't take the whole frame
 } // namespace my_uart
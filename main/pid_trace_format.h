@@ -0,0 +1,30 @@
+#pragma once
+
+#include <inttypes.h>
+
+/***
+ * CMD_PID_TRACE packet layout, shared with the host decoder
+ */
+
+struct pid_trace_header_t
+{
+    uint32_t seq; // packet counter
+    uint32_t dropped; // records lost so far because the queue was full (cumulative)
+    uint32_t tx_dropped; // packets the USB stack didn't accept (cumulative)
+    uint16_t count; // records following the header
+    uint16_t record_size;
+};
+
+struct pid_trace_record_t
+{
+    uint32_t timestamp_us; // monotonic, wraps every ~71.6 min
+    float setpoint; // K
+    float temp; // K
+    float p_term;
+    float i_term;
+    float ff_term; // proportional on dissipation (kPD)
+    float voltage; // commanded heater voltage
+    uint16_t dac_code;
+    uint8_t sensor; // index, see CMD_SELECT_SENSOR
+    uint8_t reserved;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+/***
+ * Parametric temperature profile: a list of segments evaluated incrementally at the control rate.
+ * All divisions and transcendental functions are done once per segment, each tick costs a few
+ * multiply-adds. Platform-independent (host-testable).
+ */
+
+enum profile_mode : uint8_t
+{
+    profile_table, // setpoint table, one point per telemetry period
+    profile_segments // profile_segment_t list, evaluated every control tick
+};
+
+enum profile_segment_type : uint8_t
+{
+    segment_hold, // keep the current value
+    segment_ramp, // linear to `target`
+    segment_exp,  // first-order approach to `target`, time constant `param` (s)
+    segment_sine, // around the current value, amplitude `target`, period `param` (s)
+    segment_step, // jump to `target`, then hold
+    segment_type_count
+};
+
+struct profile_segment_t // Wire and storage format
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t duration_ms;
+    float target;
+    float param;
+};
+
+class segment_profile
+{
+    private:
+        const profile_segment_t* _segments;
+        size_t _count;
+        float _start;
+        uint32_t _rate;                                       // ticks per second
+        float _tick_s;
+
+        size_t _index;                                        // segment being played
+        uint32_t _ticks_left;
+        float _value;
+        float _a, _b;                                         // per-segment state
+        float _rot_c, _rot_s;                                 // sine: rotation per tick
+        float _center;
+
+        void enter(const profile_segment_t* s);
+
+    public:
+        segment_profile();
+        void init(const profile_segment_t* segments, size_t count, float start, uint32_t rate_hz);
+        void rewind();
+        bool next(float &value);
+        float get_value();
+
+        static bool validate(const profile_segment_t* segments, size_t count, uint32_t rate_hz);
+};
+
+inline segment_profile::segment_profile() {
+    init(NULL, 0, 0, 1);
+}
+
+inline void segment_profile::init(const profile_segment_t* segments, size_t count, float start, uint32_t rate_hz) {
+    _segments = segments;
+    _count = count;
+    _start = start;
+    _rate = rate_hz;
+    _tick_s = 1.0f / rate_hz;
+    rewind();
+}
+
+inline void segment_profile::rewind() {
+    _index = 0;
+    _ticks_left = 0;
+    _value = _start;
+    _a = _b = 0;
+    _rot_c = 1;
+    _rot_s = 0;
+    _center = _start;
+}
+
+// Precompute everything the per-tick update needs
+inline void segment_profile::enter(const profile_segment_t* s) {
+    _ticks_left = static_cast<uint32_t>((static_cast<uint64_t>(s->duration_ms) * _rate) / 1000u);
+    switch (s->type) {
+        case segment_ramp:
+            if (_ticks_left == 0) {
+                _value = s->target;
+                break;
+            }
+            _a = (s->target - _value) / _ticks_left;            // increment
+            break;
+        case segment_exp:
+            _a = _value - s->target;                            // distance to target
+            _b = (s->param > 0) ? expf(-_tick_s / s->param) : 0;// decay per tick
+            break;
+        case segment_sine:
+        {
+            float w = (s->param > 0) ? (2 * (float)M_PI * _tick_s / s->param) : 0;
+            _rot_c = cosf(w);
+            _rot_s = sinf(w);
+            _a = 0;                                             // sin(phase)
+            _b = 1;                                             // cos(phase)
+            _center = _value;
+            break;
+        }
+        case segment_step:
+            _value = s->target;
+            break;
+        default:
+            break;
+    }
+}
+
+// Advances by one tick. Returns false (and leaves value untouched) once the last segment has finished.
+inline bool segment_profile::next(float &value) {
+    while (_ticks_left == 0) {
+        if (_index > 0) {
+            const profile_segment_t* prev = &_segments[_index - 1];
+            if (prev->type == segment_ramp) _value = prev->target;  // Land exactly, no accumulated error
+        }
+        if (_index >= _count) return false;
+        enter(&_segments[_index++]);
+    }
+    const profile_segment_t* s = &_segments[_index - 1];
+    switch (s->type) {
+        case segment_ramp:
+            _value += _a;
+            break;
+        case segment_exp:
+            _a *= _b;
+            _value = s->target + _a;
+            break;
+        case segment_sine:
+        {
+            float sn = _a * _rot_c + _b * _rot_s;
+            float cs = _b * _rot_c - _a * _rot_s;
+            float g = 1.5f - 0.5f * (sn * sn + cs * cs);        // Keep the phasor on the unit circle
+            _a = sn * g;
+            _b = cs * g;
+            _value = _center + s->target * _a;
+            break;
+        }
+        default:
+            break;
+    }
+    _ticks_left--;
+    value = _value;
+    return true;
+}
+
+inline float segment_profile::get_value() {
+    return _value;
+}
+
+// Every segment must last at least one tick at `rate_hz`: enter() truncates, so a shorter one would be skipped,
+// and a profile made of such segments would end before its first tick
+inline bool segment_profile::validate(const profile_segment_t* segments, size_t count, uint32_t rate_hz) {
+    if (count == 0) return false;
+    for (size_t i = 0; i < count; i++) {
+        if (segments[i].type >= segment_type_count) return false;
+        if (!isfinite(segments[i].target) || !isfinite(segments[i].param)) return false;
+        if (static_cast<uint64_t>(segments[i].duration_ms) * rate_hz < 1000u) return false;
+    }
+    return true;
+}
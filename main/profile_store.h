@@ -0,0 +1,108 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "profile_engine.h"
+
+/***
+ * On-flash format of the profile library: fixed-size slots (one erase sector each),
+ * a header followed by the payload (float[length] or profile_segment_t[length]).
+ * Entries are used in place through a memory mapping, so the payload must stay 4-byte aligned.
+ * Platform-independent (host-testable), the CRC routine is supplied by the caller.
+ */
+
+#define PROFILE_STORE_MAGIC 0x464F5250u // "PROF"
+#define PROFILE_STORE_VERSION 1
+#define PROFILE_STORE_SLOT_SIZE 4096
+#define PROFILE_STORE_NAME_LEN 16
+
+typedef uint32_t (*profile_store_crc_t)(uint32_t crc, uint8_t const* buf, uint32_t len);
+
+struct profile_store_header_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t mode; // profile_mode
+    uint8_t reserved;
+    uint16_t length; // points or segments
+    uint16_t payload_size; // bytes
+    float start; // segment mode initial setpoint
+    char name[PROFILE_STORE_NAME_LEN]; // not necessarily null-terminated
+    uint32_t crc; // header up to this field and payload
+};
+
+struct profile_store_list_entry_t // CMD_STORE_LIST response element
+{
+    uint8_t slot;
+    uint8_t mode;
+    uint16_t length;
+    char name[PROFILE_STORE_NAME_LEN];
+};
+
+static_assert(sizeof(profile_store_header_t) % sizeof(float) == 0, "Payload must stay aligned");
+
+namespace profile_store
+{
+    inline size_t payload_size(uint8_t mode, size_t length)
+    {
+        switch (mode)
+        {
+        case profile_table:
+            return length * sizeof(float);
+        case profile_segments:
+            return length * sizeof(profile_segment_t);
+        default:
+            return 0;
+        }
+    }
+
+    inline size_t max_length(uint8_t mode)
+    {
+        size_t s = payload_size(mode, 1);
+        return s ? (PROFILE_STORE_SLOT_SIZE - sizeof(profile_store_header_t)) / s : 0;
+    }
+
+    inline const void* payload(const profile_store_header_t* h)
+    {
+        return reinterpret_cast<const uint8_t*>(h) + sizeof(profile_store_header_t);
+    }
+
+    inline uint32_t calc_crc(const profile_store_header_t* h, const void* data, profile_store_crc_t crc_fn)
+    {
+        uint32_t crc = crc_fn(~0u, reinterpret_cast<const uint8_t*>(h), offsetof(profile_store_header_t, crc));
+        return ~crc_fn(crc, static_cast<const uint8_t*>(data), h->payload_size);
+    }
+
+    inline const profile_store_header_t* slot(const void* base, size_t index)
+    {
+        return reinterpret_cast<const profile_store_header_t*>(static_cast<const uint8_t*>(base) + index * PROFILE_STORE_SLOT_SIZE);
+    }
+
+    // Header for a new entry, the payload is written right after it
+    inline bool make_header(profile_store_header_t* h, uint8_t mode, size_t length, float start, const char* name,
+        const void* data, profile_store_crc_t crc_fn)
+    {
+        if (length == 0 || length > max_length(mode)) return false;
+        memset(h, 0, sizeof(*h));
+        h->magic = PROFILE_STORE_MAGIC;
+        h->version = PROFILE_STORE_VERSION;
+        h->mode = mode;
+        h->length = length;
+        h->payload_size = payload_size(mode, length);
+        h->start = start;
+        strncpy(h->name, name, sizeof(h->name));
+        h->crc = calc_crc(h, data, crc_fn);
+        return true;
+    }
+
+    // Erased (0xFF) and torn slots fail here
+    inline bool valid(const profile_store_header_t* h, profile_store_crc_t crc_fn)
+    {
+        if (h->magic != PROFILE_STORE_MAGIC || h->version != PROFILE_STORE_VERSION) return false;
+        if (h->length == 0 || h->length > max_length(h->mode)) return false;
+        if (h->payload_size != payload_size(h->mode, h->length)) return false;
+        return calc_crc(h, payload(h), crc_fn) == h->crc;
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/***
+ * Integer phase accumulators for running one periodic event off another at any rational ratio.
+ * The remainder is carried from event to event, so after n base ticks exactly floor(n * rate / base) events
+ * have fired: individual intervals differ by at most one base tick, the long-run rate never drifts.
+ * Platform-independent (host-testable).
+ */
+
+struct rates_t // Wire format (CMD_GET_RATES)
+{
+    uint32_t clock_rate; // Hz, the time base of the control loop (RTOS tick)
+    uint32_t loop_rate; // Hz, control ticks (oversampling). Profile segments are evaluated at this rate
+    uint32_t point_rate; // Hz, telemetry points of the selected sensor. Setpoint tables advance one point per telemetry point
+    uint16_t loop_period_min; // clock ticks between two control ticks
+    uint16_t loop_period_max;
+    float measured_loop_rate; // Hz, control ticks counted over the last second, 0 until measured
+};
+
+// Requested rates limited to what the clock can schedule: loop <= clock, points <= loop, neither 0
+inline void effective_rates(uint32_t clock_rate, uint32_t loop_rate, uint32_t point_rate, rates_t* out) {
+    out->clock_rate = clock_rate;
+    out->loop_rate = (loop_rate == 0) ? 1 : (loop_rate > clock_rate ? clock_rate : loop_rate);
+    out->point_rate = (point_rate == 0) ? 1 : (point_rate > out->loop_rate ? out->loop_rate : point_rate);
+    out->loop_period_min = static_cast<uint16_t>(clock_rate / out->loop_rate);
+    out->loop_period_max = static_cast<uint16_t>((clock_rate + out->loop_rate - 1) / out->loop_rate);
+    out->measured_loop_rate = 0;
+}
+
+// Fires `rate` times per `base` calls of tick()
+class rate_divider
+{
+    private:
+        uint32_t _rate, _base;
+        uint32_t _phase;                                      // 0.._base-1
+
+    public:
+        rate_divider();
+        void configure(uint32_t rate, uint32_t base);        // rate <= base; the phase is kept
+        void arm();                                          // The next tick() fires
+        bool due() const;                                    // Whether the next tick() fires
+        bool tick();
+};
+
+inline rate_divider::rate_divider() {
+    _phase = 0;
+    configure(1, 1);
+    arm();
+}
+
+inline void rate_divider::configure(uint32_t rate, uint32_t base) {
+    _base = (base == 0) ? 1 : base;
+    _rate = (rate == 0) ? 1 : (rate > _base ? _base : rate);
+    if (_phase >= _base) _phase = _base - 1;
+}
+
+inline void rate_divider::arm() {
+    _phase = _base - _rate;
+}
+
+inline bool rate_divider::due() const {
+    return _phase + _rate >= _base;
+}
+
+inline bool rate_divider::tick() {
+    _phase += _rate;
+    if (_phase < _base) return false;
+    _phase -= _base;
+    return true;
+}
+
+// Splits a `rate` Hz period into whole ticks of a `clock_rate` Hz clock, floor or ceil of clock_rate / rate
+class tick_period
+{
+    private:
+        uint32_t _rate, _clock_rate;
+        uint32_t _phase;                                      // 0.._rate-1
+
+    public:
+        tick_period();
+        void configure(uint32_t rate, uint32_t clock_rate);  // rate <= clock_rate
+        uint32_t next();                                     // Clock ticks until the next event, >= 1
+};
+
+inline tick_period::tick_period() {
+    _phase = 0;
+    configure(1, 1);
+}
+
+inline void tick_period::configure(uint32_t rate, uint32_t clock_rate) {
+    _clock_rate = (clock_rate == 0) ? 1 : clock_rate;
+    _rate = (rate == 0) ? 1 : (rate > _clock_rate ? _clock_rate : rate);
+    _phase = 0;
+}
+
+inline uint32_t tick_period::next() {
+    _phase += _clock_rate;
+    uint32_t n = _phase / _rate;
+    _phase -= n * _rate;
+    return n;
+}
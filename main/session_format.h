@@ -0,0 +1,96 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include "my_pid.h"
+#include "heater_guard.h"
+#include "heater_model.h"
+#include "filter_bank.h"
+#include "my_protocol.h"
+
+/***
+ * CMD_SESSION packet layout, shared with the host replay (host/session_replay.cpp):
+ * session_header_t, then records, each a session_record_header_t followed by `size` bytes.
+ * A sensor's ticks refer to the last session_params_t it sent (params_seq); the parameters go out when the
+ * recording starts and whenever the sensor takes a new parameter snapshot.
+ */
+
+#define SESSION_FORMAT_VERSION 1
+#define SESSION_CHANNELS 4 //MY_ADC_CHANNEL_NUM
+
+struct session_header_t
+{
+    uint32_t seq; // packet counter
+    uint32_t dropped; // records lost so far because a queue was full (cumulative)
+    uint32_t tx_dropped; // packets the USB stack didn't accept (cumulative)
+    uint16_t count; // records following the header
+    uint16_t version; // SESSION_FORMAT_VERSION
+};
+
+enum session_record_kind : uint8_t
+{
+    session_tick, // session_tick_t
+    session_params, // session_params_t
+    session_command // session_command_t
+};
+
+struct session_record_header_t
+{
+    uint8_t kind; // session_record_kind
+    uint8_t sensor;
+    uint16_t size; // bytes following
+};
+
+enum session_tick_flags : uint8_t
+{
+    session_operate = 0x01, // heater on, PID running
+    session_tripped = 0x02,
+    session_point = 0x04, // telemetry point taken this tick
+    session_continuous = 0x08, // PID tracks the setpoint (no dead band)
+    session_filters = 0x10 // filter windows (re)applied this tick: cycle start or idle
+};
+
+struct session_tick_t // One control tick: inputs, then outputs
+{
+    uint32_t timestamp_us; // of the scan
+    uint16_t raw[SESSION_CHANNELS]; // ADC codes, in my_adc_channels order
+    uint16_t mv[SESSION_CHANNELS]; // after the eFuse curve: what the filters were fed
+    float setpoint; // K, from the profile player, NaN while idle
+    float temp; // K, from the control outputs
+    float voltage; // commanded heater voltage
+    float point_temp; // K, telemetry outputs, NaN unless session_point
+    float point_res; // Ohm
+    uint16_t dac_code;
+    uint8_t flags; // session_tick_flags
+    uint8_t params_seq;
+};
+
+struct session_params_t // Everything the control path of one sensor depends on
+{
+    uint8_t seq; // per sensor, wraps
+    uint8_t reserved[3];
+    float rt_temp; // K
+    float adc_gain[SESSION_CHANNELS];
+    float adc_offset[SESSION_CHANNELS];
+    my_pid_params_t pid;
+    float pid_setpoint; // PID state when the snapshot was taken, before this tick's step
+    float pid_integral;
+    float heater_coef;
+    float rt_res;
+    float ref_res;
+    heater_model_t heater_model;
+    heater_guard_limits_t guard_limits;
+    my_timings_t timings;
+    filter_config_t filters;
+    uint32_t loop_rate; // Hz, effective (board-wide)
+    uint32_t point_rate; // Hz, effective
+};
+
+struct session_command_t // A frame the parser has finished
+{
+    uint32_t timestamp_us;
+    uint8_t cmd;
+    uint8_t response; // RSP_*, NO_STD_RSP if the reply isn't a status byte
+    uint8_t crc_ok;
+    uint8_t reserved;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <atomic>
+
+/***
+ * Latest-value hand-off between one writer and one reader.
+ * The writer fills a private slot and publishes it with a single atomic exchange, the reader swaps
+ * its slot for the newest published one. Neither side ever waits, and the reader always sees a complete set.
+ * Platform-independent (host-testable).
+ */
+
+template <class T> class triple_buffer
+{
+    private:
+        static const uint8_t index_mask = 0x03;
+        static const uint8_t fresh = 0x04;                    // middle slot published since the last read()
+
+        T _slots[3];
+        std::atomic<uint8_t> _middle;                         // index | fresh
+        uint8_t _back;                                        // owned by the writer
+        uint8_t _front;                                       // owned by the reader
+
+    public:
+        triple_buffer();
+        T* back();
+        void publish();
+        const T* read(bool* changed = NULL);
+};
+
+template <class T> triple_buffer<T>::triple_buffer() : _slots(), _middle(1), _back(2), _front(0) {
+}
+
+// Writer: fill the whole slot, then publish(). The pointer changes after every publish().
+template <class T> T* triple_buffer<T>::back() {
+    return &_slots[_back];
+}
+
+template <class T> void triple_buffer<T>::publish() {
+    _back = _middle.exchange(_back | fresh, std::memory_order_acq_rel) & index_mask;
+}
+
+// Reader: the returned set stays valid (and unchanged) until the next read()
+template <class T> const T* triple_buffer<T>::read(bool* changed) {
+    bool c = _middle.load(std::memory_order_relaxed) & fresh;
+    if (c) _front = _middle.exchange(_front, std::memory_order_acq_rel) & index_mask;
+    if (changed) *changed = c;
+    return &_slots[_front];
+}